@@ -0,0 +1,77 @@
+/******************************************************************************/
+/* bench-alloc.c  -- Counts allocations, only linked into moloch-bench
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Defining malloc in the executable overrides it for glib and the plugins too,
+ * the real work is still done by glibc.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+#define BENCH_ALLOC_SLOTS 64
+
+/* Threads pick a slot the first time they allocate, the counters are padded
+ * so the threads don't share cache lines.
+ */
+typedef struct {
+    uint64_t           count;
+    char               pad[56];
+} BenchAllocSlot_t;
+
+static BenchAllocSlot_t    slots[BENCH_ALLOC_SLOTS];
+static int                 nextSlot;
+static __thread int        mySlot = -1;
+
+/******************************************************************************/
+static inline void bench_alloc_count()
+{
+    if (mySlot == -1)
+        mySlot = __sync_fetch_and_add(&nextSlot, 1) % BENCH_ALLOC_SLOTS;
+    slots[mySlot].count++;
+}
+/******************************************************************************/
+void *malloc(size_t size)
+{
+    bench_alloc_count();
+    return __libc_malloc(size);
+}
+/******************************************************************************/
+void *calloc(size_t nmemb, size_t size)
+{
+    bench_alloc_count();
+    return __libc_calloc(nmemb, size);
+}
+/******************************************************************************/
+void *realloc(void *ptr, size_t size)
+{
+    bench_alloc_count();
+    return __libc_realloc(ptr, size);
+}
+/******************************************************************************/
+uint64_t moloch_bench_allocs()
+{
+    uint64_t total = 0;
+    int      i;
+
+    for (i = 0; i < BENCH_ALLOC_SLOTS; i++) {
+        total += slots[i].count;
+    }
+    return total;
+}
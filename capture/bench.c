@@ -0,0 +1,159 @@
+/******************************************************************************/
+/* bench.c  -- Per stage timing for the moloch-bench replay
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+#include <time.h>
+
+extern MolochConfig_t        config;
+
+/******************************************************************************/
+/* Each slot is only written by its own thread, padded so they don't share
+ * cache lines.
+ */
+typedef struct {
+    uint64_t           ns[MOLOCH_BENCH_NUM];
+    uint64_t           calls[MOLOCH_BENCH_NUM];
+    uint64_t           saves;
+    uint64_t           savedPackets;
+    uint64_t           extents;
+    char               pad[64 - (16*MOLOCH_BENCH_NUM + 24) % 64];
+} MolochBenchThread_t;
+
+LOCAL MolochBenchThread_t  benchThreads[MOLOCH_MAX_PACKET_THREADS + 1];
+
+LOCAL char                *stageNames[MOLOCH_BENCH_NUM] = {"decode", "lookup", "reassembly", "classify", "parse", "save", "write"};
+
+LOCAL uint64_t             replayStart;
+LOCAL uint64_t             replayEnd;
+LOCAL uint64_t             replayPackets;
+LOCAL uint64_t             replayBytes;
+LOCAL uint64_t             replayAllocs;
+LOCAL uint64_t             replayArenas;
+LOCAL uint64_t             replayArenaBytes;
+
+/******************************************************************************/
+uint64_t moloch_bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/******************************************************************************/
+void moloch_bench_add(int thread, int stage, int parent, uint64_t start)
+{
+    uint64_t ns = moloch_bench_now() - start;
+
+    benchThreads[thread].ns[stage] += ns;
+    benchThreads[thread].calls[stage]++;
+    if (parent >= 0)
+        benchThreads[thread].ns[parent] -= ns;
+}
+/******************************************************************************/
+/* An extent is a run of packets that follow each other in a pcap file, each
+ * one is at least one read for the viewer to load the session.
+ */
+void moloch_bench_session_saved(const MolochSession_t *session)
+{
+    MolochBenchThread_t *bt = &benchThreads[session->thread];
+    int64_t              end = -1;
+    guint                i;
+
+    bt->saves++;
+    for (i = 0; i < session->filePosArray->len; i++) {
+        int64_t pos = g_array_index(session->filePosArray, int64_t, i);
+        if (pos < 0) {
+            end = -1;
+            continue;
+        }
+        if (pos != end)
+            bt->extents++;
+        bt->savedPackets++;
+        end = pos + g_array_index(session->fileLenArray, uint16_t, i);
+    }
+}
+/******************************************************************************/
+void moloch_bench_replay_start()
+{
+    if (moloch_bench_allocs)
+        replayAllocs = moloch_bench_allocs();
+    moloch_field_arena_stats(&replayArenas, &replayArenaBytes);
+    replayStart = moloch_bench_now();
+}
+/******************************************************************************/
+void moloch_bench_replay_done(uint64_t packets, uint64_t bytes)
+{
+    replayEnd = moloch_bench_now();
+    replayPackets = packets;
+    replayBytes = bytes;
+}
+/******************************************************************************/
+/* Called after the main loop exits so the sessions saved at shutdown are in
+ * the save stage, the rates only cover the replay itself.  Allocations are
+ * only counted by the moloch-bench build, which wraps malloc.
+ */
+void moloch_bench_report()
+{
+    double secs = (replayEnd - replayStart)/1000000000.0;
+    int    t, s;
+
+    printf("{\"packets\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"seconds\": %.3f, \"packetsPerSec\": %.0f, \"bytesPerSec\": %.0f,\n",
+           replayPackets, replayBytes, secs,
+           secs > 0?replayPackets/secs:0, secs > 0?replayBytes/secs:0);
+
+    printf(" \"stages\": {");
+    for (s = 0; s < MOLOCH_BENCH_NUM; s++) {
+        uint64_t ns = 0, calls = 0;
+        for (t = 0; t <= MOLOCH_MAX_PACKET_THREADS; t++) {
+            ns += benchThreads[t].ns[s];
+            calls += benchThreads[t].calls[s];
+        }
+        printf("%s\n  \"%s\": {\"usecs\": %" PRIu64 ", \"calls\": %" PRIu64 ", \"nsPerPacket\": %.1f}",
+               s == 0?"":",", stageNames[s], ns/1000, calls,
+               replayPackets?(double)ns/replayPackets:0);
+    }
+    printf("\n },\n");
+
+    uint64_t arenas, arenaBytes;
+    moloch_field_arena_stats(&arenas, &arenaBytes);
+    arenas -= replayArenas;
+    arenaBytes -= replayArenaBytes;
+    printf(" \"fieldBytesPerSave\": %.0f,\n", arenas?(double)arenaBytes/arenas:0);
+
+    uint64_t internValues, internSaved;
+    moloch_field_intern_stats(&internValues, &internSaved);
+    printf(" \"internValues\": %" PRIu64 ", \"internBytesSaved\": %" PRIu64 ",\n", internValues, internSaved);
+
+    uint64_t saves = 0, savedPackets = 0, extents = 0;
+    for (t = 0; t <= MOLOCH_MAX_PACKET_THREADS; t++) {
+        saves += benchThreads[t].saves;
+        savedPackets += benchThreads[t].savedPackets;
+        extents += benchThreads[t].extents;
+    }
+    printf(" \"packetsPerSave\": %.1f, \"extentsPerSave\": %.2f,\n",
+           saves?(double)savedPackets/saves:0, saves?(double)extents/saves:0);
+
+    uint64_t runs, runBytes;
+    moloch_writer_ordered_stats(&runs, &runBytes);
+    printf(" \"sessionRuns\": %" PRIu64 ", \"bytesPerRun\": %.0f,\n", runs, runs?(double)runBytes/runs:0);
+
+    if (moloch_bench_allocs) {
+        printf(" \"allocsPerPacket\": %.2f}\n", replayPackets?(double)(moloch_bench_allocs() - replayAllocs)/replayPackets:0);
+    } else {
+        printf(" \"allocsPerPacket\": null}\n");
+    }
+    fflush(stdout);
+}
@@ -236,6 +236,76 @@ void moloch_config_load_includes(char **includes)
     }
 }
 /******************************************************************************/
+/* Parse a list of name[:bytes] entries, the bytes defaults to elephantKeepBytes */
+LOCAL int moloch_config_load_elephant_list(GKeyFile *keyfile, char *key, MolochStringHash_t *hash)
+{
+    int     i;
+    int     cnt = 0;
+    gchar **names = moloch_config_str_list(keyfile, key, NULL);
+
+    if (!names)
+        return 0;
+
+    for (i = 0; names[i]; i++) {
+        if (!(*names[i]))
+            continue;
+        long bytes = config.elephantKeepBytes;
+        char *colon = strchr(names[i], ':');
+        if (colon) {
+            *colon = 0;
+            bytes = atol(colon+1);
+            if (bytes < 0)
+                bytes = 0;
+            if (bytes > 0x7fffffff)
+                bytes = 0x7fffffff;
+        }
+
+        if (hash) {
+            moloch_string_add(hash, names[i], (gpointer)bytes, TRUE);
+        } else {
+            int port = atoi(names[i]);
+            if (port < 0 || port > 0xffff) {
+                LOG("WARNING - Ignoring bad %s port '%s'", key, names[i]);
+                continue;
+            }
+            if (!config.elephantPorts) {
+                config.elephantPorts = malloc(0x10000 * sizeof(int32_t));
+                memset(config.elephantPorts, 0xff, 0x10000 * sizeof(int32_t));
+            }
+            config.elephantPorts[port] = bytes;
+        }
+        cnt++;
+    }
+    g_strfreev(names);
+    return cnt;
+}
+/******************************************************************************/
+LOCAL void moloch_config_load_elephant(GKeyFile *keyfile)
+{
+    config.elephantKeepBytes  = moloch_config_int(keyfile, "elephantKeepBytes", 0, 0, 0x7fffffff);
+    config.elephantSnapLen    = moloch_config_int(keyfile, "elephantSnapLen", 0, 0, 0xffff);
+    config.elephantSampleRate = moloch_config_int(keyfile, "elephantSampleRate", 100, 1, 1000000);
+
+    char *mode = moloch_config_str(keyfile, "elephantMode", "truncate");
+    if (strcmp(mode, "truncate") == 0)
+        config.elephantSample = 0;
+    else if (strcmp(mode, "sample") == 0)
+        config.elephantSample = 1;
+    else {
+        printf("Unknown elephantMode '%s'\n", mode);
+        exit(1);
+    }
+    g_free(mode);
+
+    int cnt = 0;
+    cnt += moloch_config_load_elephant_list(keyfile, "elephantTags", (MolochStringHash_t *)(char*)&config.elephantTags);
+    cnt += moloch_config_load_elephant_list(keyfile, "elephantProtocols", (MolochStringHash_t *)(char*)&config.elephantProtocols);
+    cnt += moloch_config_load_elephant_list(keyfile, "elephantPorts", NULL);
+
+    config.elephant    = (cnt > 0 || config.elephantKeepBytes > 0);
+    config.elephantAll = (cnt == 0 && config.elephantKeepBytes > 0);
+}
+/******************************************************************************/
 void moloch_config_load()
 {
 
@@ -297,6 +367,35 @@ void moloch_config_load()
         g_strfreev(tags);
     }
 
+    char *compressESMethod = moloch_config_str(keyfile, "compressESMethod", "deflate");
+    if (strcmp(compressESMethod, "deflate") == 0)
+        config.compressESMethod = MOLOCH_COMPRESS_DEFLATE;
+    else if (strcmp(compressESMethod, "gzip") == 0)
+        config.compressESMethod = MOLOCH_COMPRESS_GZIP;
+    else if (strcmp(compressESMethod, "zstd") == 0) {
+        printf("compressESMethod zstd isn't supported, elasticsearch only accepts gzip or deflate\n");
+        exit(1);
+    } else {
+        printf("Unknown compressESMethod '%s'\n", compressESMethod);
+        exit(1);
+    }
+    g_free(compressESMethod);
+
+    char *magicMode = moloch_config_str(keyfile, "magicMode", "both");
+    if (strcmp(magicMode, "both") == 0)
+        config.magicMode = MOLOCH_MAGICMODE_BOTH;
+    else if (strcmp(magicMode, "basic") == 0)
+        config.magicMode = MOLOCH_MAGICMODE_BASIC;
+    else if (strcmp(magicMode, "libmagic") == 0)
+        config.magicMode = MOLOCH_MAGICMODE_LIBMAGIC;
+    else if (strcmp(magicMode, "none") == 0)
+        config.magicMode = MOLOCH_MAGICMODE_NONE;
+    else {
+        printf("Unknown magicMode '%s'\n", magicMode);
+        exit(1);
+    }
+    g_free(magicMode);
+
     char *bpfsStrs[MOLOCH_FILTER_MAX] = {"dontSaveBPFs", "minPacketsSaveBPFs"};
     int t;
     for (t = 0; t < MOLOCH_FILTER_MAX; t++) {
@@ -327,6 +426,7 @@ void moloch_config_load()
     config.plugins          = moloch_config_str_list(keyfile, "plugins", NULL);
     config.rootPlugins      = moloch_config_str_list(keyfile, "rootPlugins", NULL);
     config.smtpIpHeaders    = moloch_config_str_list(keyfile, "smtpIpHeaders", NULL);
+    config.memoryWatermarks = moloch_config_str_list(keyfile, "memoryWatermarks", NULL);
 
     if (config.smtpIpHeaders) {
         for (i = 0; config.smtpIpHeaders[i]; i++) {
@@ -358,6 +458,10 @@ void moloch_config_load()
     config.emailYara        = moloch_config_str(keyfile, "emailYara", NULL);
     config.geoipFile        = moloch_config_str(keyfile, "geoipFile", NULL);
     config.rirFile          = moloch_config_str(keyfile, "rirFile", NULL);
+    config.tagsSnapshot     = moloch_config_str(keyfile, "tagsSnapshot", NULL);
+    config.digestEngine     = moloch_config_str(keyfile, "digestEngine", "openssl");
+    config.metricsHost      = moloch_config_str(keyfile, "metricsHost", "127.0.0.1");
+    config.metricsSocket    = moloch_config_str(keyfile, "metricsSocket", NULL);
     config.geoipASNFile     = moloch_config_str(keyfile, "geoipASNFile", NULL);
     config.geoip6File       = moloch_config_str(keyfile, "geoip6File", NULL);
     config.geoipASN6File    = moloch_config_str(keyfile, "geoipASN6File", NULL);
@@ -402,6 +506,18 @@ void moloch_config_load()
     config.maxFrags              = moloch_config_int(keyfile, "maxFrags", 50000, 1000, 0xffffff);
 
     config.packetThreads         = moloch_config_int(keyfile, "packetThreads", 1, 1, MOLOCH_MAX_PACKET_THREADS);
+    config.compressESThreads     = moloch_config_int(keyfile, "compressESThreads", 2, 1, 16);
+    config.yaraWindow            = moloch_config_int(keyfile, "yaraWindow", 1024, 0, 0xffff);
+    config.yaraScanBytes         = moloch_config_int(keyfile, "yaraScanBytes", 16384, 1024, 0xffffff);
+    config.yaraMaxBytes          = moloch_config_int(keyfile, "yaraMaxBytes", 0, 0, 0x7fffffff);
+    config.memoryLimit           = moloch_config_int(keyfile, "memoryLimit", 0, 0, 0xffffff);
+    config.metricsPort           = moloch_config_int(keyfile, "metricsPort", 0, 0, 0xffff);
+    config.pcapReadThreads       = moloch_config_int(keyfile, "pcapReadThreads", 1, 1, 32);
+    config.fileNumBlockSize      = moloch_config_int(keyfile, "fileNumBlockSize", 100, 4, 10000);
+    config.compressESLevel       = moloch_config_int(keyfile, "compressESLevel", 6, 1, 9);
+    config.pcapSessionOrderRunSize = moloch_config_int(keyfile, "pcapSessionOrderRunSize", 128*1024, 16*1024, 16*1024*1024);
+    config.pcapSessionOrderMemory  = moloch_config_int(keyfile, "pcapSessionOrderMemory", 64, 1, 0xffff);
+    config.pcapSessionOrderDelay   = moloch_config_int(keyfile, "pcapSessionOrderDelay", 10, 1, 300);
 
 
     config.logUnknownProtocols   = moloch_config_boolean(keyfile, "logUnknownProtocols", config.debug);
@@ -411,9 +527,15 @@ void moloch_config_load()
     config.parseSMB              = moloch_config_boolean(keyfile, "parseSMB", TRUE);
     config.parseQSValue          = moloch_config_boolean(keyfile, "parseQSValue", FALSE);
     config.parseCookieValue      = moloch_config_boolean(keyfile, "parseCookieValue", FALSE);
+    config.supportSha256         = moloch_config_boolean(keyfile, "supportSha256", FALSE);
     config.compressES            = moloch_config_boolean(keyfile, "compressES", FALSE);
     config.antiSynDrop           = moloch_config_boolean(keyfile, "antiSynDrop", TRUE);
     config.readTruncatedPackets  = moloch_config_boolean(keyfile, "readTruncatedPackets", FALSE);
+    config.packetThreadRebalance = moloch_config_boolean(keyfile, "packetThreadRebalance", FALSE);
+    config.pcapIndex             = moloch_config_boolean(keyfile, "pcapIndex", FALSE);
+    config.pcapSessionOrder      = moloch_config_boolean(keyfile, "pcapSessionOrder", FALSE);
+
+    moloch_config_load_elephant(keyfile);
 
 }
 /******************************************************************************/
@@ -595,6 +717,8 @@ void moloch_config_load_header(char *section, char *group, char *helpBase, char
 void moloch_config_init()
 {
     HASH_INIT(s_, config.dontSaveTags, moloch_string_hash, moloch_string_cmp);
+    HASH_INIT(s_, config.elephantTags, moloch_string_hash, moloch_string_cmp);
+    HASH_INIT(s_, config.elephantProtocols, moloch_string_hash, moloch_string_cmp);
 
     moloch_config_load();
 
@@ -643,4 +767,16 @@ void moloch_config_exit()
         g_strfreev(config.rootPlugins);
     if (config.smtpIpHeaders)
         g_strfreev(config.smtpIpHeaders);
+    if (config.memoryWatermarks)
+        g_strfreev(config.memoryWatermarks);
+    if (config.elephantPorts)
+        free(config.elephantPorts);
+    if (config.tagsSnapshot)
+        g_free(config.tagsSnapshot);
+    if (config.digestEngine)
+        g_free(config.digestEngine);
+    if (config.metricsHost)
+        g_free(config.metricsHost);
+    if (config.metricsSocket)
+        g_free(config.metricsSocket);
 }
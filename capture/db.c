@@ -33,6 +33,7 @@ extern uint64_t         totalBytes;
 extern uint64_t         totalSessions;
 static uint16_t         myPid;
 extern uint32_t         pluginsCbs;
+extern volatile int     memoryLevel;
 
 LOCAL struct timeval    startTime;
 LOCAL GeoIP            *gi = 0;
@@ -53,6 +54,12 @@ LOCAL int               tagsField = -1;
 LOCAL int               tagsStringField = -1;
 
 LOCAL uint32_t          nextFileNum;
+LOCAL uint32_t          endFileNum;
+LOCAL uint32_t          spareFileNum;
+LOCAL uint32_t          spareEndFileNum;
+LOCAL uint32_t          reservedFileNum;
+LOCAL int               reservedFileNumKnown;
+LOCAL int               fileNumRefilling;
 LOCAL MOLOCH_LOCK_DEFINE(nextFileNum);
 
 /******************************************************************************/
@@ -240,34 +247,104 @@ void moloch_db_js0n_str(BSB *bsb, unsigned char *in, gboolean utf8)
 }
 
 /******************************************************************************/
+/* Each packet thread owns its dbInfo outright, full or aged buffers are handed
+ * to the main thread by pushing them on the lock free dbBufQ stack.
+ */
 LOCAL struct {
-    char   *json;
-    BSB     bsb;
-    time_t  lastSave;
-    char    prefix[100];
-    time_t  prefixTime;
-    MOLOCH_LOCK_EXTERN(lock);
+    char     *json;
+    BSB       bsb;
+    time_t    lastSave;
+    char      prefix[100];
+    time_t    prefixTime;
+    uint32_t  flushGen;
 } dbInfo[MOLOCH_MAX_PACKET_THREADS];
 
+typedef struct moloch_db_buf {
+    struct moloch_db_buf *next;
+    char                 *json;
+    uint32_t              len;
+} MolochDbBuf_t;
+
+LOCAL MolochDbBuf_t * volatile dbBufQ;
+LOCAL volatile uint32_t        dbFlushGen;
+
+/******************************************************************************/
+// Runs on packet thread
+LOCAL void moloch_db_publish(int thread, time_t now)
+{
+    MolochDbBuf_t *buf = MOLOCH_TYPE_ALLOC(MolochDbBuf_t);
+    buf->json = dbInfo[thread].json;
+    buf->len  = BSB_LENGTH(dbInfo[thread].bsb);
+
+    do {
+        buf->next = dbBufQ;
+    } while (!__sync_bool_compare_and_swap(&dbBufQ, buf->next, buf));
+
+    dbInfo[thread].json = 0;
+    dbInfo[thread].lastSave = now;
+}
+/******************************************************************************/
+// Runs on packet thread, called when idle and every so often when busy
+void moloch_db_flush_thread(int thread)
+{
+    uint32_t flushGen = dbFlushGen;
+
+    if (!dbInfo[thread].json || BSB_LENGTH(dbInfo[thread].bsb) == 0) {
+        dbInfo[thread].flushGen = flushGen;
+        return;
+    }
+
+    struct timeval currentTime;
+    gettimeofday(&currentTime, NULL);
+
+    if (dbInfo[thread].flushGen != flushGen ||
+        (currentTime.tv_sec - dbInfo[thread].lastSave) >= config.dbFlushTimeout) {
+        dbInfo[thread].flushGen = flushGen;
+        moloch_db_publish(thread, currentTime.tv_sec);
+    }
+}
+/******************************************************************************/
+// Runs on main thread, ask every packet thread to publish what it has
+LOCAL void moloch_db_flush_threads()
+{
+    int thread;
+
+    MOLOCH_THREAD_INCR(dbFlushGen);
+    for (thread = 0; thread < config.packetThreads; thread++) {
+        moloch_packet_thread_wake(thread);
+    }
+}
+/******************************************************************************/
+LOCAL int moloch_db_threads_pending()
+{
+    int thread;
+
+    for (thread = 0; thread < config.packetThreads; thread++) {
+        if (dbInfo[thread].json && BSB_LENGTH(dbInfo[thread].bsb) > 0)
+            return thread + 1;
+    }
+    return 0;
+}
+
 void moloch_db_save_session(MolochSession_t *session, int final)
 {
     uint32_t               i;
     char                   id[100];
-    char                   key[100];
-    int                    key_len;
     uuid_t                 uuid;
     MolochString_t        *hstring;
     MolochInt_t           *hint;
     MolochStringHashStd_t *shash;
     MolochIntHashStd_t    *ihash;
-    GHashTable            *ghash;
-    GHashTableIter         iter;
+    MolochFieldIntsIter_t  iter;
     unsigned char         *startPtr;
     unsigned char         *dataPtr;
     uint32_t               jsonSize;
     int                    pos;
     gpointer               ikey;
 
+    MOLOCH_BENCH_START(saveStart);
+    MOLOCH_METRICS_START(saveMetricsStart);
+
     /* Let the plugins finish */
     if (pluginsCbs & MOLOCH_PLUGIN_SAVE)
         moloch_plugins_cb_save(session, final);
@@ -288,10 +365,19 @@ void moloch_db_save_session(MolochSession_t *session, int final)
         return;
     }
 
-    totalSessions++;
+    /* Sampled out */
+    if (session->noSPI)
+        return;
+
+    if (config.bench)
+        moloch_bench_session_saved(session);
+
+    __sync_add_and_fetch(&totalSessions, 1);
     session->segments++;
 
     const int thread = session->thread;
+    if (config.metrics)
+        moloch_metrics_count(thread, MOLOCH_METRICS_SESSIONS_SAVED, 1);
 
     if (dbInfo[thread].prefixTime != session->lastPacket.tv_sec) {
         dbInfo[thread].prefixTime = session->lastPacket.tv_sec;
@@ -328,21 +414,18 @@ void moloch_db_save_session(MolochSession_t *session, int final)
         else if (id[i] == '/') id[i] = '_';
     }
 
-    key_len = snprintf(key, sizeof(key), "/_bulk");
-
-    MOLOCH_LOCK(dbInfo[thread].lock);
-    /* If no room left to add, send the buffer */
+    /* If no room left to add, hand the buffer off to the main thread */
     if (dbInfo[thread].json && (uint32_t)BSB_REMAINING(dbInfo[thread].bsb) < jsonSize) {
+        struct timeval currentTime;
+        gettimeofday(&currentTime, NULL);
+
         if (BSB_LENGTH(dbInfo[thread].bsb) > 0) {
-            moloch_http_set(esServer, key, key_len, dbInfo[thread].json, BSB_LENGTH(dbInfo[thread].bsb), NULL, NULL);
+            moloch_db_publish(thread, currentTime.tv_sec);
         } else {
             moloch_http_free_buffer(dbInfo[thread].json);
+            dbInfo[thread].json = 0;
+            dbInfo[thread].lastSave = currentTime.tv_sec;
         }
-        dbInfo[thread].json = 0;
-
-        struct timeval currentTime;
-        gettimeofday(&currentTime, NULL);
-        dbInfo[thread].lastSave = currentTime.tv_sec;
     }
 
     /* Allocate a new buffer using the max of the bulk size or estimated size. */
@@ -530,6 +613,13 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                       session->segments,
                       config.nodeName);
 
+    if (session->truncatedPackets)
+        BSB_EXPORT_sprintf(jbsb, "\"ptr\":%u,", session->truncatedPackets);
+    if (session->skippedPackets)
+        BSB_EXPORT_sprintf(jbsb, "\"psk\":%u,", session->skippedPackets);
+    if (session->unsavedBytes)
+        BSB_EXPORT_sprintf(jbsb, "\"bun\":%" PRIu64 ",", session->unsavedBytes);
+
     if (session->rootId) {
         if (session->rootId[0] == 'R')
             session->rootId = g_strdup(id);
@@ -566,8 +656,6 @@ void moloch_db_save_session(MolochSession_t *session, int final)
         if (!session->fields[pos] || flags & MOLOCH_FIELD_FLAG_DISABLED)
             continue;
 
-        const int freeField = final || ((flags & MOLOCH_FIELD_FLAG_LINKED_SESSIONS) == 0);
-
         if (inGroupNum != config.fields[pos]->dbGroupNum) {
             if (inGroupNum != 0) {
                 BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
@@ -591,9 +679,6 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                                (unsigned char *)session->fields[pos]->str,
                                flags & MOLOCH_FIELD_FLAG_FORCE_UTF8);
             BSB_EXPORT_u08(jbsb, ',');
-            if (freeField) {
-                g_free(session->fields[pos]->str);
-            }
             break;
         case MOLOCH_FIELD_TYPE_STR_ARRAY:
             if (flags & MOLOCH_FIELD_FLAG_CNT) {
@@ -610,9 +695,6 @@ void moloch_db_save_session(MolochSession_t *session, int final)
             }
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
             BSB_EXPORT_cstr(jbsb, "],");
-            if (freeField) {
-                g_ptr_array_free(session->fields[pos]->sarray, TRUE);
-            }
             break;
         case MOLOCH_FIELD_TYPE_STR_HASH:
             shash = session->fields[pos]->shash;
@@ -623,16 +705,14 @@ void moloch_db_save_session(MolochSession_t *session, int final)
             }
             BSB_EXPORT_sprintf(jbsb, "\"%s\":[", config.fields[pos]->dbField);
             HASH_FORALL(s_, *shash, hstring,
-                moloch_db_js0n_str(&jbsb, (unsigned char *)hstring->str, hstring->utf8 || flags & MOLOCH_FIELD_FLAG_FORCE_UTF8);
+                if (hstring->uw) {
+                    const MolochFieldInternValue_t *value = hstring->uw;
+                    BSB_EXPORT_ptr(jbsb, value->json, value->jsonLen);
+                } else {
+                    moloch_db_js0n_str(&jbsb, (unsigned char *)hstring->str, hstring->utf8 || flags & MOLOCH_FIELD_FLAG_FORCE_UTF8);
+                }
                 BSB_EXPORT_u08(jbsb, ',');
             );
-            if (freeField) {
-                HASH_FORALL_POP_HEAD(s_, *shash, hstring,
-                    g_free(hstring->str);
-                    MOLOCH_TYPE_FREE(MolochString_t, hstring);
-                );
-                MOLOCH_TYPE_FREE(MolochStringHashStd_t, shash);
-            }
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
             BSB_EXPORT_cstr(jbsb, "],");
             break;
@@ -648,32 +728,22 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                 BSB_EXPORT_sprintf(jbsb, "%u", hint->i_hash);
                 BSB_EXPORT_u08(jbsb, ',');
             );
-            if (freeField) {
-                HASH_FORALL_POP_HEAD(i_, *ihash, hint,
-                    MOLOCH_TYPE_FREE(MolochInt_t, hint);
-                );
-                MOLOCH_TYPE_FREE(MolochIntHashStd_t, ihash);
-            }
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
             BSB_EXPORT_cstr(jbsb, "],");
             break;
         case MOLOCH_FIELD_TYPE_INT_GHASH:
-            ghash = session->fields[pos]->ghash;
             if (flags & MOLOCH_FIELD_FLAG_CNT) {
-                BSB_EXPORT_sprintf(jbsb, "\"%scnt\": %d,", config.fields[pos]->dbField, g_hash_table_size(ghash));
+                BSB_EXPORT_sprintf(jbsb, "\"%scnt\": %d,", config.fields[pos]->dbField, moloch_field_count(pos, session));
             } else if (flags & MOLOCH_FIELD_FLAG_COUNT) {
-                BSB_EXPORT_sprintf(jbsb, "\"%s-cnt\": %d,", config.fields[pos]->dbField, g_hash_table_size(ghash));
+                BSB_EXPORT_sprintf(jbsb, "\"%s-cnt\": %d,", config.fields[pos]->dbField, moloch_field_count(pos, session));
             }
             BSB_EXPORT_sprintf(jbsb, "\"%s\":[", config.fields[pos]->dbField);
-            g_hash_table_iter_init (&iter, ghash);
-            while (g_hash_table_iter_next (&iter, &ikey, NULL)) {
+            moloch_field_ints_iter_init(&iter, session->fields[pos]);
+            while (moloch_field_ints_iter_next(&iter, &ikey)) {
                 BSB_EXPORT_sprintf(jbsb, "%u", (int)(long)ikey);
                 BSB_EXPORT_u08(jbsb, ',');
             }
 
-            if (freeField) {
-                g_hash_table_destroy(ghash);
-            }
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
             BSB_EXPORT_cstr(jbsb, "],");
             break;
@@ -844,12 +914,6 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                 BSB_EXPORT_sprintf(jbsb, "%u", htonl(hint->i_hash));
                 BSB_EXPORT_u08(jbsb, ',');
             );
-            if (freeField) {
-                HASH_FORALL_POP_HEAD(i_, *ihash, hint,
-                    MOLOCH_TYPE_FREE(MolochInt_t, hint);
-                );
-                MOLOCH_TYPE_FREE(MolochIntHashStd_t, ihash);
-            }
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
 
             BSB_EXPORT_cstr(jbsb, "],");
@@ -857,13 +921,12 @@ void moloch_db_save_session(MolochSession_t *session, int final)
         }
         case MOLOCH_FIELD_TYPE_IP_GHASH: {
             const int post = (flags & MOLOCH_FIELD_FLAG_IPPRE) == 0;
-            ghash = session->fields[pos]->ghash;
             if (flags & MOLOCH_FIELD_FLAG_CNT) {
-                BSB_EXPORT_sprintf(jbsb, "\"%scnt\":%d,", config.fields[pos]->dbField, g_hash_table_size(ghash));
+                BSB_EXPORT_sprintf(jbsb, "\"%scnt\":%d,", config.fields[pos]->dbField, moloch_field_count(pos, session));
             } else if (flags & MOLOCH_FIELD_FLAG_COUNT) {
-                BSB_EXPORT_sprintf(jbsb, "\"%s-cnt\":%d,", config.fields[pos]->dbField, g_hash_table_size(ghash));
+                BSB_EXPORT_sprintf(jbsb, "\"%s-cnt\":%d,", config.fields[pos]->dbField, moloch_field_count(pos, session));
             } else if (flags & MOLOCH_FIELD_FLAG_SCNT) {
-                BSB_EXPORT_sprintf(jbsb, "\"%sscnt\":%d,", config.fields[pos]->dbField, g_hash_table_size(ghash));
+                BSB_EXPORT_sprintf(jbsb, "\"%sscnt\":%d,", config.fields[pos]->dbField, moloch_field_count(pos, session));
             }
 
             if (gi || ipTree) {
@@ -874,8 +937,8 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                 else
                     BSB_EXPORT_sprintf(jbsb, "\"g%s\":[", config.fields[pos]->dbField);
 
-                g_hash_table_iter_init (&iter, ghash);
-                while (g_hash_table_iter_next (&iter, &ikey, NULL)) {
+                moloch_field_ints_iter_init(&iter, session->fields[pos]);
+                while (moloch_field_ints_iter_next(&iter, &ikey)) {
                     const char *g = NULL;
                     if (ipTree && (ii = moloch_db_get_local_ip4(session, (int)(long)ikey))) {
                         g = ii->country;
@@ -903,9 +966,9 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                     BSB_EXPORT_sprintf(jbsb, "\"%s-asn\":[", config.fields[pos]->dbField);
                 else
                     BSB_EXPORT_sprintf(jbsb, "\"as%s\":[", config.fields[pos]->dbField);
-                g_hash_table_iter_init (&iter, ghash);
+                moloch_field_ints_iter_init(&iter, session->fields[pos]);
 
-                while (g_hash_table_iter_next (&iter, &ikey, NULL)) {
+                while (moloch_field_ints_iter_next(&iter, &ikey)) {
                     char *as = NULL;
 
                     if (ipTree && (ii = moloch_db_get_local_ip4(session, (int)(long)ikey))) {
@@ -938,8 +1001,8 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                 else
                     BSB_EXPORT_sprintf(jbsb, "\"rir%s\":[", config.fields[pos]->dbField);
 
-                g_hash_table_iter_init (&iter, ghash);
-                while (g_hash_table_iter_next (&iter, &ikey, NULL)) {
+                moloch_field_ints_iter_init(&iter, session->fields[pos]);
+                while (moloch_field_ints_iter_next(&iter, &ikey)) {
                     char *rir = NULL;
 
                     if (ipTree && (ii = moloch_db_get_local_ip4(session, (int)(long)ikey))) {
@@ -962,14 +1025,11 @@ void moloch_db_save_session(MolochSession_t *session, int final)
 
 
             BSB_EXPORT_sprintf(jbsb, "\"%s\":[", config.fields[pos]->dbField);
-            g_hash_table_iter_init (&iter, ghash);
-            while (g_hash_table_iter_next (&iter, &ikey, NULL)) {
+            moloch_field_ints_iter_init(&iter, session->fields[pos]);
+            while (moloch_field_ints_iter_next(&iter, &ikey)) {
                 BSB_EXPORT_sprintf(jbsb, "%u", htonl((int)(long)ikey));
                 BSB_EXPORT_u08(jbsb, ',');
             }
-            if (freeField) {
-                g_hash_table_destroy(ghash);
-            }
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
 
             BSB_EXPORT_cstr(jbsb, "],");
@@ -981,20 +1041,20 @@ void moloch_db_save_session(MolochSession_t *session, int final)
             BSB_EXPORT_sprintf(jbsb, "\"tlscnt\":%d,", HASH_COUNT(t_, *cihash));
             BSB_EXPORT_cstr(jbsb, "\"tls\":[");
 
+            MolochCertsInfoRef_t *hci;
             MolochCertsInfo_t *certs;
             MolochString_t *string;
 
-            HASH_FORALL_POP_HEAD(t_, *cihash, certs,
+            /* The certs may be shared with other sessions, so only read them */
+            HASH_FORALL(t_, *cihash, hci,
+                certs = hci->certs;
                 BSB_EXPORT_u08(jbsb, '{');
 
                 if (certs->issuer.commonName.s_count > 0) {
                     BSB_EXPORT_cstr(jbsb, "\"iCn\":[");
-                    while (certs->issuer.commonName.s_count > 0) {
-                        DLL_POP_HEAD(s_, &certs->issuer.commonName, string);
+                    DLL_FOREACH(s_, &certs->issuer.commonName, string) {
                         moloch_db_js0n_str(&jbsb, (unsigned char *)string->str, string->utf8);
                         BSB_EXPORT_u08(jbsb, ',');
-                        g_free(string->str);
-                        MOLOCH_TYPE_FREE(MolochString_t, string);
                     }
                     BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
                     BSB_EXPORT_u08(jbsb, ']');
@@ -1011,12 +1071,9 @@ void moloch_db_save_session(MolochSession_t *session, int final)
 
                 if (certs->subject.commonName.s_count) {
                     BSB_EXPORT_cstr(jbsb, "\"sCn\":[");
-                    while (certs->subject.commonName.s_count > 0) {
-                        DLL_POP_HEAD(s_, &certs->subject.commonName, string);
+                    DLL_FOREACH(s_, &certs->subject.commonName, string) {
                         moloch_db_js0n_str(&jbsb, (unsigned char *)string->str, string->utf8);
                         BSB_EXPORT_u08(jbsb, ',');
-                        g_free(string->str);
-                        MOLOCH_TYPE_FREE(MolochString_t, string);
                     }
                     BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
                     BSB_EXPORT_u08(jbsb, ']');
@@ -1042,12 +1099,9 @@ void moloch_db_save_session(MolochSession_t *session, int final)
                 if (certs->alt.s_count) {
                     BSB_EXPORT_sprintf(jbsb, "\"altcnt\":%d,", certs->alt.s_count);
                     BSB_EXPORT_cstr(jbsb, "\"alt\":[");
-                    while (certs->alt.s_count > 0) {
-                        DLL_POP_HEAD(s_, &certs->alt, string);
+                    DLL_FOREACH(s_, &certs->alt, string) {
                         moloch_db_js0n_str(&jbsb, (unsigned char *)string->str, TRUE);
                         BSB_EXPORT_u08(jbsb, ',');
-                        g_free(string->str);
-                        MOLOCH_TYPE_FREE(MolochString_t, string);
                     }
                     BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
                     BSB_EXPORT_u08(jbsb, ']');
@@ -1060,24 +1114,21 @@ void moloch_db_save_session(MolochSession_t *session, int final)
 
                 BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
 
-                moloch_field_certsinfo_free(certs);
                 i++;
 
                 BSB_EXPORT_u08(jbsb, '}');
                 BSB_EXPORT_u08(jbsb, ',');
             );
-            MOLOCH_TYPE_FREE(MolochCertsInfoHashStd_t, cihash);
 
             BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
             BSB_EXPORT_cstr(jbsb, "],");
         }
         } /* switch */
-        if (freeField) {
-            MOLOCH_TYPE_FREE(MolochField_t, session->fields[pos]);
-            session->fields[pos] = 0;
-        }
     }
 
+    /* Everything but the linked session fields goes at once with the arena */
+    moloch_field_saved(session, final);
+
     if (inGroupNum) {
         BSB_EXPORT_rewind(jbsb, 1); // Remove last comma
         BSB_EXPORT_cstr(jbsb, "},");
@@ -1091,7 +1142,8 @@ void moloch_db_save_session(MolochSession_t *session, int final)
         goto cleanup;
     }
 
-    if (config.dryRun) {
+    // moloch-bench keeps going so the bulk path into the null http sink is timed too
+    if (config.dryRun && !config.bench) {
         if (config.tests) {
             static int outputed;
             outputed++;
@@ -1116,7 +1168,8 @@ void moloch_db_save_session(MolochSession_t *session, int final)
     }
 cleanup:
     dbInfo[thread].bsb = jbsb;
-    MOLOCH_UNLOCK(dbInfo[thread].lock);
+    MOLOCH_METRICS_OBSERVE(thread, MOLOCH_METRICS_SESSION_SAVE, saveMetricsStart);
+    MOLOCH_BENCH_STOP(thread, MOLOCH_BENCH_SAVE, saveStart);
 }
 /******************************************************************************/
 long long zero_atoll(char *v) {
@@ -1252,6 +1305,10 @@ void moloch_db_update_stats(int n)
     dbTotalDropped[n] += (totalDropped - lastDropped[n]);
     dbTotalK[n] += (totalBytes - lastBytes[n])/1024;
 
+    uint64_t compressIn, compressOut, compressUsecs;
+    uint32_t compressSkipped;
+    moloch_http_compress_stats(esServer, &compressIn, &compressOut, &compressUsecs, &compressSkipped);
+
     uint64_t mem = moloch_db_memory_size();
     double   memMax = moloch_db_memory_max();
     float    memUse = mem/memMax*100.0;
@@ -1289,8 +1346,13 @@ void moloch_db_update_stats(int n)
         "\"deltaDropped\": %" PRIu64 ", "
         "\"deltaFragsDropped\": %" PRIu64 ", "
         "\"deltaOverloadDropped\": %" PRIu64 ", "
-        "\"deltaMS\": %" PRIu64
-        "}",
+        "\"deltaMS\": %" PRIu64 ", "
+        "\"rebalanceMoves\": %u, "
+        "\"esCompressIn\": %" PRIu64 ", "
+        "\"esCompressOut\": %" PRIu64 ", "
+        "\"esCompressRatio\": %.3f, "
+        "\"esCompressMS\": %" PRIu64 ", "
+        "\"esCompressSkipped\": %u",
         VERSION,
         config.nodeName,
         config.hostName,
@@ -1322,7 +1384,46 @@ void moloch_db_update_stats(int n)
         (totalDropped - lastDropped[n]),
         (fragsDropped - lastFragsDropped[n]),
         (overloadDropped - lastOverloadDropped[n]),
-        diffms);
+        diffms,
+        moloch_packet_rebalance_moves(),
+        compressIn,
+        compressOut,
+        compressIn?(double)compressOut/compressIn:1.0,
+        compressUsecs/1000,
+        compressSkipped);
+
+    // Per packet thread counters, shows how evenly the flow hash spreads the load
+    json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, ", \"threadPackets\": [");
+    for (i = 0; i < config.packetThreads; i++) {
+        json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "%s%" PRIu64, i?",":"", moloch_packet_thread_packets(i));
+    }
+    json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "], \"threadBytes\": [");
+    for (i = 0; i < config.packetThreads; i++) {
+        json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "%s%" PRIu64, i?",":"", moloch_packet_thread_bytes(i));
+    }
+    if (config.yara) {
+        uint64_t yaraBytes[MOLOCH_MAX_PACKET_THREADS], yaraUsecs[MOLOCH_MAX_PACKET_THREADS];
+        for (i = 0; i < config.packetThreads; i++) {
+            moloch_yara_thread_stats(i, &yaraBytes[i], &yaraUsecs[i]);
+        }
+        json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "], \"threadYaraBytes\": [");
+        for (i = 0; i < config.packetThreads; i++) {
+            json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "%s%" PRIu64, i?",":"", yaraBytes[i]);
+        }
+        json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "], \"threadYaraMS\": [");
+        for (i = 0; i < config.packetThreads; i++) {
+            json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "%s%" PRIu64, i?",":"", yaraUsecs[i]/1000);
+        }
+    }
+    if (config.memoryLimit) {
+        json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len,
+                             "], \"memoryLevel\": %d, \"memoryUsed\": %" PRIu64 ", \"memoryTransitions\": %u, \"memoryShed\": [",
+                             memoryLevel, moloch_memory_used(), moloch_memory_transitions());
+        for (i = MOLOCH_MEMORY_STOP_SPI; i < MOLOCH_MEMORY_LEVEL_NUM; i++) {
+            json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "%s%" PRIu64, i > MOLOCH_MEMORY_STOP_SPI?",":"", moloch_memory_shed_count(i));
+        }
+    }
+    json_len += snprintf(json+json_len, MOLOCH_HTTP_BUFFER_SIZE-json_len, "]}");
 
     lastTime[n]            = currentTime;
     lastBytes[n]           = totalBytes;
@@ -1348,30 +1449,28 @@ gboolean moloch_db_update_stats_gfunc (gpointer user_data)
     return TRUE;
 }
 /******************************************************************************/
-// Runs on main thread
-gboolean moloch_db_flush_gfunc (gpointer user_data )
+// Runs on main thread, sends everything the packet threads have published
+gboolean moloch_db_flush_gfunc (gpointer UNUSED(user_data) )
 {
-    int             thread;
-    struct timeval  currentTime;
-
-    gettimeofday(&currentTime, NULL);
+    if (!dbBufQ)
+        return TRUE;
 
-    for (thread = 0; thread < config.packetThreads; thread++) {
-        MOLOCH_LOCK(dbInfo[thread].lock);
-        if (dbInfo[thread].json && BSB_LENGTH(dbInfo[thread].bsb) > 0 &&
-            ((currentTime.tv_sec - dbInfo[thread].lastSave) >= config.dbFlushTimeout || user_data == (gpointer)1)) {
+    MolochDbBuf_t *buf = __sync_lock_test_and_set(&dbBufQ, NULL);
+    MolochDbBuf_t *prev = 0;
 
-            char   *json = dbInfo[thread].json;
-            int     len = BSB_LENGTH(dbInfo[thread].bsb);
+    // Stack is newest first, reverse so ES gets them in order
+    while (buf) {
+        MolochDbBuf_t *next = buf->next;
+        buf->next = prev;
+        prev = buf;
+        buf = next;
+    }
 
-            dbInfo[thread].json = 0;
-            dbInfo[thread].lastSave = currentTime.tv_sec;
-            MOLOCH_UNLOCK(dbInfo[thread].lock);
-            // Unlock and then send buffer
-            moloch_http_set(esServer, "/_bulk", 6, json, len, NULL, NULL);
-        } else {
-            MOLOCH_UNLOCK(dbInfo[thread].lock);
-        }
+    while (prev) {
+        buf = prev;
+        prev = buf->next;
+        moloch_http_set(esServer, "/_bulk", 6, buf->json, buf->len, NULL, NULL);
+        MOLOCH_TYPE_FREE(MolochDbBuf_t, buf);
     }
 
     return TRUE;
@@ -1439,13 +1538,139 @@ uint32_t moloch_db_get_sequence_number_sync(char *name)
     }
 }
 /******************************************************************************/
-void moloch_db_fn_seq_cb(uint32_t newSeq, gpointer UNUSED(uw))
+/* File numbers are reserved from the fn-<node> sequence fileNumBlockSize at a
+ * time by moving its version forward with version_type=external.  The current
+ * block is [nextFileNum, endFileNum), once it gets low the next block is
+ * fetched in the background into [spareFileNum, spareEndFileNum).
+ * All of these are protected by the nextFileNum lock.
+ */
+LOCAL void moloch_db_fn_refill();
+LOCAL gboolean moloch_db_fn_refill_gfunc(gpointer UNUSED(user_data))
+{
+    MOLOCH_LOCK(nextFileNum);
+    moloch_db_fn_refill();
+    MOLOCH_UNLOCK(nextFileNum);
+    return FALSE;
+}
+/******************************************************************************/
+LOCAL void moloch_db_fn_reserve_cb(int code, unsigned char *data, int data_len, gpointer uw)
+{
+    uint32_t            version_len;
+    unsigned char      *version = moloch_js0n_get(data, data_len, "_version", &version_len);
+
+    MOLOCH_LOCK(nextFileNum);
+    fileNumRefilling = 0;
+    if (code >= 200 && code < 300 && version_len && version) {
+        reservedFileNum = atoi((char*)version);
+        spareFileNum    = (long)uw + 1;
+        spareEndFileNum = reservedFileNum + 1;
+        MOLOCH_UNLOCK(nextFileNum);
+        return;
+    }
+
+    /* Either someone else moved the sequence or ES isn't answering, learn the current value and try again */
+    LOG("ERROR - Couldn't reserve file numbers: %d %.*s", code, data_len, data);
+    reservedFileNumKnown = 0;
+    MOLOCH_UNLOCK(nextFileNum);
+    g_timeout_add_seconds(1, moloch_db_fn_refill_gfunc, 0);
+}
+/******************************************************************************/
+LOCAL void moloch_db_fn_current_cb(int code, unsigned char *data, int data_len, gpointer UNUSED(uw))
 {
+    uint32_t            version_len;
+    unsigned char      *version = moloch_js0n_get(data, data_len, "_version", &version_len);
+
     MOLOCH_LOCK(nextFileNum);
-    nextFileNum = newSeq;
+    fileNumRefilling = 0;
+    if (version_len && version) {
+        reservedFileNum = atoi((char*)version);
+        reservedFileNumKnown = 1;
+        moloch_db_fn_refill();
+    } else if (code == 404) {
+        reservedFileNum = 0;
+        reservedFileNumKnown = 1;
+        moloch_db_fn_refill();
+    } else {
+        LOG("ERROR - Couldn't fetch file number sequence: %d %.*s", code, data_len, data);
+        g_timeout_add_seconds(1, moloch_db_fn_refill_gfunc, 0);
+    }
     MOLOCH_UNLOCK(nextFileNum);
 }
 /******************************************************************************/
+/* Must hold the nextFileNum lock */
+LOCAL void moloch_db_fn_refill()
+{
+    char                key[200];
+    int                 key_len;
+
+    if (fileNumRefilling || spareEndFileNum)
+        return;
+
+    fileNumRefilling = 1;
+
+    if (!reservedFileNumKnown) {
+        key_len = snprintf(key, sizeof(key), "/%ssequence/sequence/fn-%s", config.prefix, config.nodeName);
+        moloch_http_send(esServer, "GET", key, key_len, NULL, 0, NULL, FALSE, moloch_db_fn_current_cb, 0);
+        return;
+    }
+
+    char *json = moloch_http_get_buffer(MOLOCH_HTTP_BUFFER_SIZE);
+    int json_len = snprintf(json, MOLOCH_HTTP_BUFFER_SIZE, "{}");
+    key_len = snprintf(key, sizeof(key), "/%ssequence/sequence/fn-%s?version_type=external&version=%u", config.prefix, config.nodeName, reservedFileNum + config.fileNumBlockSize);
+    moloch_http_send(esServer, "POST", key, key_len, json, json_len, NULL, FALSE, moloch_db_fn_reserve_cb, (gpointer)(long)reservedFileNum);
+}
+/******************************************************************************/
+/* Must NOT hold the nextFileNum lock since this waits on elasticsearch, only
+ * used when we have no file numbers at all.  The block is installed as the
+ * current one if that is still empty once the lock is taken again, otherwise
+ * as the spare.
+ */
+LOCAL void moloch_db_fn_reserve_sync()
+{
+    char                key[200];
+    int                 key_len;
+    unsigned char      *data;
+    size_t              data_len;
+    unsigned char      *version;
+    uint32_t            version_len;
+
+    while (1) {
+        key_len = snprintf(key, sizeof(key), "/%ssequence/sequence/fn-%s", config.prefix, config.nodeName);
+        data = moloch_http_get(esServer, key, key_len, &data_len);
+        version = moloch_js0n_get(data, data_len, "_version", &version_len);
+        uint32_t current = (version_len && version)?atoi((char*)version):0;
+        if (data)
+            free(data);
+
+        key_len = snprintf(key, sizeof(key), "/%ssequence/sequence/fn-%s?version_type=external&version=%u", config.prefix, config.nodeName, current + config.fileNumBlockSize);
+        data = moloch_http_send_sync(esServer, "POST", key, key_len, "{}", 2, NULL, &data_len);
+        version = moloch_js0n_get(data, data_len, "_version", &version_len);
+
+        if (version_len && version) {
+            uint32_t reserved = atoi((char*)version);
+            free(data);
+
+            MOLOCH_LOCK(nextFileNum);
+            reservedFileNum      = MAX(reservedFileNum, reserved);
+            reservedFileNumKnown = 1;
+            if (nextFileNum == endFileNum) {
+                nextFileNum = current + 1;
+                endFileNum  = reserved + 1;
+            } else if (!spareEndFileNum) {
+                spareFileNum    = current + 1;
+                spareEndFileNum = reserved + 1;
+            }
+            MOLOCH_UNLOCK(nextFileNum);
+            return;
+        }
+
+        LOG("ERROR - Couldn't reserve file numbers: %d %.*s", (int)data_len, (int)data_len, data);
+        if (data)
+            free(data);
+        sleep(1);
+    }
+}
+/******************************************************************************/
 void moloch_db_load_file_num()
 {
     char               key[200];
@@ -1506,9 +1731,8 @@ void moloch_db_load_file_num()
 
 fetch_file_num:
     if (!config.pcapReadOffline) {
-        /* If doing a live file create a file number now */
-        snprintf(key, sizeof(key), "fn-%s", config.nodeName);
-        nextFileNum = moloch_db_get_sequence_number_sync(key);
+        /* If doing a live file reserve the first block of file numbers now */
+        moloch_db_fn_reserve_sync();
     }
 }
 /******************************************************************************/
@@ -1545,6 +1769,76 @@ void moloch_db_mkpath(char *path)
     }
 }
 /******************************************************************************/
+/* File documents are written in the background so a slow ES never holds up
+ * the writer that rotated the file.  Connection failures and 5xx errors are
+ * retried with a growing delay up to MOLOCH_FILE_DOC_MAX_TRIES times, anything
+ * else ES rejects won't get better and is dropped.
+ */
+#define MOLOCH_FILE_DOC_MAX_TRIES 30
+
+typedef struct moloch_file_doc {
+    struct moloch_file_doc *d_next, *d_prev;
+    char                   *key;
+    char                   *json;
+    int                     key_len;
+    int                     json_len;
+    int                     tries;
+} MolochFileDoc_t;
+
+typedef struct {
+    struct moloch_file_doc *d_next, *d_prev;
+    int                     d_count;
+} MolochFileDocHead_t;
+
+LOCAL MolochFileDocHead_t   fileDocs;
+LOCAL guint                 fileDocsTimer;
+
+LOCAL void moloch_db_file_doc_send(MolochFileDoc_t *doc);
+/******************************************************************************/
+LOCAL gboolean moloch_db_file_doc_gfunc(gpointer UNUSED(user_data))
+{
+    MolochFileDoc_t *doc;
+
+    fileDocsTimer = 0;
+    while (DLL_POP_HEAD(d_, &fileDocs, doc)) {
+        moloch_db_file_doc_send(doc);
+    }
+    return FALSE;
+}
+/******************************************************************************/
+LOCAL void moloch_db_file_doc_cb(int code, unsigned char *data, int data_len, gpointer uw)
+{
+    MolochFileDoc_t *doc = uw;
+
+    if (code >= 200 && code < 300)
+        goto cleanup;
+
+    doc->tries++;
+    if ((code != 0 && code < 500) || doc->tries >= MOLOCH_FILE_DOC_MAX_TRIES) {
+        LOG("ERROR - Dropping file %.*s after try %d: %d %.*s %.*s", doc->key_len, doc->key, doc->tries, code, data_len, data, doc->json_len, doc->json);
+        goto cleanup;
+    }
+
+    LOG("ERROR - Couldn't save file %.*s try %d: %d %.*s", doc->key_len, doc->key, doc->tries, code, data_len, data);
+
+    DLL_PUSH_TAIL(d_, &fileDocs, doc);
+    if (!fileDocsTimer)
+        fileDocsTimer = g_timeout_add_seconds(MIN(doc->tries, 30), moloch_db_file_doc_gfunc, 0);
+    return;
+
+cleanup:
+    g_free(doc->key);
+    g_free(doc->json);
+    MOLOCH_TYPE_FREE(MolochFileDoc_t, doc);
+}
+/******************************************************************************/
+LOCAL void moloch_db_file_doc_send(MolochFileDoc_t *doc)
+{
+    char *json = moloch_http_get_buffer(doc->json_len + 1);
+    memcpy(json, doc->json, doc->json_len);
+    moloch_http_send(esServer, "POST", doc->key, doc->key_len, json, doc->json_len, NULL, FALSE, moloch_db_file_doc_cb, doc);
+}
+/******************************************************************************/
 char *moloch_db_create_file(time_t firstPacket, char *name, uint64_t size, int locked, uint32_t *id)
 {
     char               key[100];
@@ -1552,23 +1846,38 @@ char *moloch_db_create_file(time_t firstPacket, char *name, uint64_t size, int l
     uint32_t           num;
     char               filename[1024];
     struct tm         *tmp;
-    char              *json = moloch_http_get_buffer(MOLOCH_HTTP_BUFFER_SIZE);
+    char               json[MOLOCH_HTTP_BUFFER_SIZE];
     int                json_len;
     const uint64_t     fp = firstPacket;
 
 
     MOLOCH_LOCK(nextFileNum);
-    snprintf(key, sizeof(key), "fn-%s", config.nodeName);
-    if (nextFileNum == 0) {
-        /* If doing an offline file OR the last async call hasn't returned, just get a sync filenum */
-        num = moloch_db_get_sequence_number_sync(key);
-    } else {
-        /* If doing a live file, use current file num and schedule the next one */
-        num = nextFileNum;
-        nextFileNum = 0; /* Don't reuse number */
-        moloch_db_get_sequence_number(key, moloch_db_fn_seq_cb, 0);
+    while (1) {
+        if (nextFileNum == endFileNum && spareEndFileNum) {
+            nextFileNum     = spareFileNum;
+            endFileNum      = spareEndFileNum;
+            spareFileNum    = 0;
+            spareEndFileNum = 0;
+        }
+
+        if (nextFileNum != endFileNum)
+            break;
+
+        /* Offline with nothing reserved yet OR the background refill never came back,
+         * don't hold the lock while waiting and check again after */
+        if (!config.pcapReadOffline)
+            LOG("WARNING - Ran out of reserved file numbers, waiting on elasticsearch");
+        MOLOCH_UNLOCK(nextFileNum);
+        moloch_db_fn_reserve_sync();
+        MOLOCH_LOCK(nextFileNum);
     }
 
+    num = nextFileNum++;
+
+    /* Fetch the next block while we still have some left */
+    if (endFileNum - nextFileNum <= config.fileNumBlockSize/4)
+        moloch_db_fn_refill();
+
 
     if (name) {
         static GRegex     *numRegex;
@@ -1631,13 +1940,18 @@ char *moloch_db_create_file(time_t firstPacket, char *name, uint64_t size, int l
         key_len = snprintf(key, sizeof(key), "/%sfiles/file/%s-%d?refresh=true", config.prefix, config.nodeName,num);
     }
 
-    moloch_http_set(esServer, key, key_len, json, json_len, NULL, NULL);
-
     MOLOCH_UNLOCK(nextFileNum);
 
     if (config.logFileCreation)
         LOG("Creating file %d with key >%s< using >%s<", num, key, json);
 
+    MolochFileDoc_t *doc = MOLOCH_TYPE_ALLOC0(MolochFileDoc_t);
+    doc->key      = g_strndup(key, key_len);
+    doc->key_len  = key_len;
+    doc->json     = g_strndup(json, json_len);
+    doc->json_len = json_len;
+    moloch_db_file_doc_send(doc);
+
     *id = num;
 
     if (name)
@@ -1681,6 +1995,92 @@ void moloch_db_check()
     }
 }
 
+/******************************************************************************/
+/* Tag name -> tag number dictionary.  The tags table is only changed under the
+ * tags lock, after adding the writer publishes a read only copy that lookups
+ * use without any locking.  The old copy is freed once no packet thread can
+ * still be using it, the names belong to the tags table and live until exit.
+ */
+typedef struct {
+    const char        *tagName;
+    uint32_t           hash;
+    int                tagValue;
+} MolochTagSlot_t;
+
+typedef struct {
+    uint32_t           mask;
+    MolochTagSlot_t    slots[];
+} MolochTagTable_t;
+
+LOCAL MOLOCH_LOCK_DEFINE(tags);
+LOCAL MolochTagTable_t *volatile tagTable;
+
+LOCAL int moloch_db_tag_find(const char *tagname)
+{
+    const MolochTagTable_t *table = tagTable;
+
+    if (!table)
+        return 0;
+
+    const uint32_t h = moloch_db_tag_hash(tagname);
+    uint32_t       i;
+
+    for (i = h & table->mask; table->slots[i].tagName; i = (i + 1) & table->mask) {
+        if (table->slots[i].hash == h && strcmp(table->slots[i].tagName, tagname) == 0)
+            return table->slots[i].tagValue;
+    }
+    return 0;
+}
+/******************************************************************************/
+/* Returns the value in the dictionary, which might be from an earlier add.
+ * Lookups don't see it until moloch_db_tag_publish is called.
+ */
+LOCAL int moloch_db_tag_add(const char *tagname, int tagValue)
+{
+    MolochTag_t *tag;
+
+    MOLOCH_LOCK(tags);
+    HASH_FIND(tag_, tags, tagname, tag);
+    if (!tag) {
+        tag = MOLOCH_TYPE_ALLOC(MolochTag_t);
+        tag->tagName = g_strdup(tagname);
+        tag->tagValue = tagValue;
+        HASH_ADD(tag_, tags, tag->tagName, tag);
+    }
+    tagValue = tag->tagValue;
+    MOLOCH_UNLOCK(tags);
+
+    return tagValue;
+}
+/******************************************************************************/
+/* Build a new lookup copy, call once after a group of adds */
+LOCAL void moloch_db_tag_publish()
+{
+    MolochTag_t *tag;
+    uint32_t     size = 1024;
+
+    MOLOCH_LOCK(tags);
+    while (size < (uint32_t)HASH_COUNT(tag_, tags) * 2)
+        size *= 2;
+
+    MolochTagTable_t *table = g_malloc0(sizeof(MolochTagTable_t) + size * sizeof(MolochTagSlot_t));
+    table->mask = size - 1;
+    HASH_FORALL(tag_, tags, tag,
+        uint32_t i = tag->tag_hash & table->mask;
+        while (table->slots[i].tagName)
+            i = (i + 1) & table->mask;
+        table->slots[i].tagName  = tag->tagName;
+        table->slots[i].hash     = tag->tag_hash;
+        table->slots[i].tagValue = tag->tagValue;
+    );
+
+    // Swap while still locked so copies are published in the order they were built
+    MolochTagTable_t *old = __sync_lock_test_and_set(&tagTable, table);
+    MOLOCH_UNLOCK(tags);
+
+    if (old)
+        moloch_packet_defer_free(g_free, old);
+}
 /******************************************************************************/
 void moloch_db_load_tags()
 {
@@ -1731,203 +2131,459 @@ void moloch_db_load_tags()
 
 
         if (id && n) {
-            MolochTag_t *tag = MOLOCH_TYPE_ALLOC(MolochTag_t);
-            tag->tagName = g_strndup((char*)id, (int)id_len);
+            char *tagName = g_strndup((char*)id, (int)id_len);
             if (*n == '[')
-                tag->tagValue = atol((char*)n+1);
+                moloch_db_tag_add(tagName, atol((char*)n+1));
             else
-                tag->tagValue = atol((char*)n);
-            HASH_ADD(tag_, tags, tag->tagName, tag);
+                moloch_db_tag_add(tagName, atol((char*)n));
+            g_free(tagName);
         } else {
             LOG ("ERROR - Could not load %.*s", out[i+1], ahits+out[i]);
         }
     }
+    moloch_db_tag_publish();
 }
+/******************************************************************************/
+/* The tags sequence version is the last tag number handed out, 0 if unknown */
+LOCAL uint32_t moloch_db_tags_sequence()
+{
+    char               key[200];
+    int                key_len;
+    size_t             data_len;
+    unsigned char     *data;
+    uint32_t           version_len;
+    unsigned char     *version;
+
+    key_len = snprintf(key, sizeof(key), "/%ssequence/sequence/tags", config.prefix);
+    data = moloch_http_get(esServer, key, key_len, &data_len);
+    version = moloch_js0n_get(data, data_len, "_version", &version_len);
+    uint32_t current = (version_len && version)?atoi((char*)version):0;
+    if (data)
+        free(data);
+    return current;
+}
+/******************************************************************************/
+/* The tags snapshot lets a restart skip fetching tags from ES one at a time.
+ * It is only trusted if it was written for the same ES and prefix, no tags
+ * have been created since, so the tags sequence still matches, and none of its
+ * entries disagree with what was just loaded from ES.  A recreated or restored
+ * tags index always moves or resets the sequence.
+ */
+LOCAL void moloch_db_load_tags_snapshot()
+{
+    FILE *fp;
+    char  line[2000];
+
+    if (!(fp = fopen(config.tagsSnapshot, "r")))
+        return;
+
+    char header[2000];
+    snprintf(header, sizeof(header), "#moloch tags %s %s %u\n", config.elasticsearch, config.prefix, moloch_db_tags_sequence());
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, header) != 0) {
+        LOG("WARNING - Ignoring tags snapshot %s, not for this cluster or tags have changed", config.tagsSnapshot);
+        fclose(fp);
+        return;
+    }
+
+    GPtrArray *names  = g_ptr_array_new_with_free_func(g_free);
+    GArray    *values = g_array_new(FALSE, FALSE, sizeof(int));
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *tab = strchr(line, '\t');
+        int   len = strlen(line);
+        if (!tab || len < 3 || line[len-1] != '\n')
+            continue;
+        line[len-1] = 0;
+
+        int tagValue = atoi(line);
+        int existing = moloch_db_tag_find(tab+1);
+        if (tagValue <= 0 || (existing && existing != tagValue)) {
+            LOG("WARNING - Ignoring tags snapshot %s, %s doesn't match ES", config.tagsSnapshot, tab+1);
+            g_ptr_array_free(names, TRUE);
+            g_array_free(values, TRUE);
+            fclose(fp);
+            return;
+        }
+        g_ptr_array_add(names, g_strdup(tab+1));
+        g_array_append_val(values, tagValue);
+    }
+    fclose(fp);
+
+    uint32_t i;
+    for (i = 0; i < names->len; i++) {
+        moloch_db_tag_add(g_ptr_array_index(names, i), g_array_index(values, int, i));
+    }
+    moloch_db_tag_publish();
+
+    if (config.debug)
+        LOG("Loaded %u tags from snapshot %s", names->len, config.tagsSnapshot);
+
+    g_ptr_array_free(names, TRUE);
+    g_array_free(values, TRUE);
+}
+/******************************************************************************/
+LOCAL void moloch_db_save_tags_snapshot()
+{
+    FILE        *fp;
+    char         tmpname[PATH_MAX];
+    MolochTag_t *tag;
+
+    uint32_t sequence = moloch_db_tags_sequence();
+    if (!sequence) {
+        LOG("ERROR - Not writing tags snapshot %s, couldn't fetch tags sequence", config.tagsSnapshot);
+        return;
+    }
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", config.tagsSnapshot);
+    if (!(fp = fopen(tmpname, "w"))) {
+        LOG("ERROR - Couldn't write tags snapshot %s: %s", tmpname, strerror(errno));
+        return;
+    }
+
+    fprintf(fp, "#moloch tags %s %s %u\n", config.elasticsearch, config.prefix, sequence);
+    MOLOCH_LOCK(tags);
+    HASH_FORALL(tag_, tags, tag,
+        if (!strchr(tag->tagName, '\n'))
+            fprintf(fp, "%d\t%s\n", tag->tagValue, tag->tagName);
+    );
+    MOLOCH_UNLOCK(tags);
+    fclose(fp);
+
+    if (rename(tmpname, config.tagsSnapshot) != 0)
+        LOG("ERROR - Couldn't rename %s to %s: %s", tmpname, config.tagsSnapshot, strerror(errno));
+}
+/******************************************************************************/
+/* Unknown tags are queued from any thread and resolved on the main thread in
+ * batches: one _mget for the batch, then for the missing ones a _bulk to get
+ * new sequence numbers and a _bulk to create them.  Several batches can be in
+ * flight at once.
+ */
+#define MOLOCH_TAG_BATCH        100
+#define MOLOCH_TAG_MAX_BATCHES  4
+
 typedef struct moloch_tag_request {
     struct moloch_tag_request *t_next, *t_prev;
     int                        t_count;
+    struct moloch_tag_request *same;    // other requests in the batch for the same tag
     void                      *uw;
     MolochTag_cb               func;
     int                        tagtype;
     char                      *tag;
-    char                      *escaped;
     uint32_t                   newSeq;
 } MolochTagRequest_t;
 
+typedef struct {
+    MolochTagRequest_t        *r[MOLOCH_TAG_BATCH];
+    int                        num;
+} MolochTagBatch_t;
+
 LOCAL int                     outstandingTagRequests = 0;
 LOCAL MolochTagRequest_t      tagRequests;
 LOCAL MOLOCH_LOCK_DEFINE(tagRequests);
+LOCAL guint                   tagRequestsTimer;
 
-void moloch_db_tag_cb(int code, unsigned char *data, int data_len, gpointer uw);
+LOCAL gboolean moloch_db_tag_batch_gfunc(gpointer UNUSED(user_data));
 
 /******************************************************************************/
 int moloch_db_tags_loading() {
     return outstandingTagRequests + tagRequests.t_count;
 }
 /******************************************************************************/
-void moloch_db_free_tag_request(MolochTagRequest_t *r)
+LOCAL void moloch_db_tag_finish(MolochTagRequest_t *r, uint32_t tagValue)
+{
+    while (r) {
+        MolochTagRequest_t *same = r->same;
+        if (r->func)
+            r->func(r->uw, r->tagtype, r->tag, tagValue, TRUE);
+        free(r->tag);
+        MOLOCH_TYPE_FREE(MolochTagRequest_t, r);
+        r = same;
+    }
+}
+/******************************************************************************/
+// Put requests back on the queue to go through _mget again
+LOCAL void moloch_db_tag_requeue(MolochTagRequest_t *r)
 {
-    g_free(r->escaped);
-    free(r->tag);
-    MOLOCH_TYPE_FREE(MolochTagRequest_t, r);
+    MOLOCH_LOCK(tagRequests);
+    while (r) {
+        MolochTagRequest_t *same = r->same;
+        r->same = 0;
+        DLL_PUSH_TAIL(t_, &tagRequests, r);
+        r = same;
+    }
+    if (!tagRequestsTimer)
+        tagRequestsTimer = g_timeout_add(0, moloch_db_tag_batch_gfunc, 0);
+    MOLOCH_UNLOCK(tagRequests);
+}
+/******************************************************************************/
+LOCAL void moloch_db_tag_batch_done(MolochTagBatch_t *batch)
+{
+    MOLOCH_TYPE_FREE(MolochTagBatch_t, batch);
     outstandingTagRequests--;
+    moloch_db_tag_batch_gfunc(0);
+}
+/******************************************************************************/
+LOCAL void moloch_db_tag_create_cb(int UNUSED(code), unsigned char *data, int data_len, gpointer uw)
+{
+    MolochTagBatch_t *batch = uw;
+    uint32_t          out[2*MOLOCH_TAG_BATCH+2];
+    uint32_t          items_len = 0;
+    unsigned char    *items = 0;
+    int               i;
 
-    while (tagRequests.t_count > 0) {
-        char               key[500];
-        int                key_len;
-
-        MOLOCH_LOCK(tagRequests);
-        DLL_POP_HEAD(t_, &tagRequests, r);
-        MOLOCH_UNLOCK(tagRequests);
-
-        MolochTag_t *tag;
-        HASH_FIND(tag_, tags, r->tag, tag);
-
-        if (tag) {
-            if (r->func)
-                r->func(r->uw, r->tagtype, r->tag, tag->tagValue, TRUE);
-            g_free(r->escaped);
-            free(r->tag);
-            MOLOCH_TYPE_FREE(MolochTagRequest_t, r);
-            continue;
+    memset(out, 0, sizeof(out));
+    if (data)
+        items = moloch_js0n_get(data, data_len, "items", &items_len);
+    if (items)
+        js0n(items, items_len, out);
+
+    for (i = 0; i < batch->num; i++) {
+        uint32_t       create_len = 0;
+        unsigned char *create = 0;
+        uint32_t       status_len = 0;
+        unsigned char *status = 0;
+
+        if (out[i*2+1])
+            create = moloch_js0n_get(items+out[i*2], out[i*2+1], "create", &create_len);
+        if (create)
+            status = moloch_js0n_get(create, create_len, "status", &status_len);
+
+        if (status && atoi((char*)status) == 201) {
+            uint32_t tagValue = moloch_db_tag_add(batch->r[i]->tag, batch->r[i]->newSeq);
+            moloch_db_tag_finish(batch->r[i], tagValue);
+        } else {
+            // Someone else probably created it first, look it up again
+            moloch_db_tag_requeue(batch->r[i]);
         }
-
-        key_len = snprintf(key, sizeof(key), "/%stags/tag/%s?fields=n", config.prefix, r->escaped);
-        moloch_http_send(esServer, "GET", key, key_len, NULL, 0, NULL, FALSE, moloch_db_tag_cb, r);
-        outstandingTagRequests++;
-        break;
     }
+    moloch_db_tag_publish();
+    moloch_db_tag_batch_done(batch);
 }
 /******************************************************************************/
-
-void moloch_db_tag_create_cb(int UNUSED(code), unsigned char *data, int UNUSED(data_len), gpointer uw)
+LOCAL void moloch_db_tag_seq_cb(int UNUSED(code), unsigned char *data, int data_len, gpointer uw)
 {
-    MolochTagRequest_t *r = uw;
-    char                key[500];
-    int                 key_len;
+    MolochTagBatch_t *batch = uw;
+    uint32_t          out[2*MOLOCH_TAG_BATCH+2];
+    uint32_t          items_len = 0;
+    unsigned char    *items = 0;
+    int               i;
 
-    if (strstr((char *)data, "{\"error\":") != 0) {
-        key_len = snprintf(key, sizeof(key), "/%stags/tag/%s?fields=n", config.prefix, r->escaped);
-        moloch_http_send(esServer, "GET", key, key_len, NULL, 0, NULL, FALSE, moloch_db_tag_cb, r);
-        return;
+    memset(out, 0, sizeof(out));
+    if (data)
+        items = moloch_js0n_get(data, data_len, "items", &items_len);
+    if (items)
+        js0n(items, items_len, out);
+
+    int size = 200;
+    for (i = 0; i < batch->num; i++) {
+        uint32_t       index_len = 0;
+        unsigned char *index = 0;
+        uint32_t       version_len = 0;
+        unsigned char *version = 0;
+
+        if (out[i*2+1])
+            index = moloch_js0n_get(items+out[i*2], out[i*2+1], "index", &index_len);
+        if (index)
+            version = moloch_js0n_get(index, index_len, "_version", &version_len);
+
+        if (!version) {
+            LOG("ERROR - Couldn't fetch tags sequence: %.*s", data_len, data);
+            for (i = 0; i < batch->num; i++) {
+                moloch_db_tag_requeue(batch->r[i]);
+            }
+            moloch_db_tag_batch_done(batch);
+            return;
+        }
+        batch->r[i]->newSeq = atoi((char*)version);
+        size += 100 + 6*strlen(batch->r[i]->tag);
     }
 
-    MolochTag_t *tag = MOLOCH_TYPE_ALLOC(MolochTag_t);
-    tag->tagName = g_strdup(r->tag);
-    tag->tagValue = r->newSeq;
-    HASH_ADD(tag_, tags, tag->tagName, tag);
+    char *json = moloch_http_get_buffer(size);
+    BSB   bsb;
+    BSB_INIT(bsb, json, size);
 
-    if (r->func)
-        r->func(r->uw, r->tagtype, r->tag, r->newSeq, TRUE);
-    moloch_db_free_tag_request(r);
+    for (i = 0; i < batch->num; i++) {
+        BSB_EXPORT_sprintf(bsb, "{\"create\":{\"_index\":\"%stags\",\"_type\":\"tag\",\"_id\":", config.prefix);
+        moloch_db_js0n_str(&bsb, (unsigned char *)batch->r[i]->tag, TRUE);
+        BSB_EXPORT_sprintf(bsb, "}}\n{\"n\":%u}\n", batch->r[i]->newSeq);
+    }
+
+    moloch_http_send(esServer, "POST", "/_bulk", 6, json, BSB_LENGTH(bsb), NULL, FALSE, moloch_db_tag_create_cb, batch);
 }
 /******************************************************************************/
-void moloch_db_tag_seq_cb(uint32_t newSeq, gpointer uw)
+LOCAL void moloch_db_tag_mget_cb(int UNUSED(code), unsigned char *data, int data_len, gpointer uw)
 {
-    MolochTagRequest_t *r = uw;
-    char                key[500];
-    int                 key_len;
-    char               *json = moloch_http_get_buffer(MOLOCH_HTTP_BUFFER_SIZE);
+    MolochTagBatch_t *batch = uw;
+    uint32_t          out[2*MOLOCH_TAG_BATCH+2];
+    uint32_t          docs_len = 0;
+    unsigned char    *docs = 0;
+    int               i;
 
-    r->newSeq = newSeq;
+    memset(out, 0, sizeof(out));
+    if (data)
+        docs = moloch_js0n_get(data, data_len, "docs", &docs_len);
 
-    key_len = snprintf(key, sizeof(key), "/%stags/tag/%s?op_type=create", config.prefix, r->escaped);
-    int json_len = snprintf(json, MOLOCH_HTTP_BUFFER_SIZE, "{\"n\":%u}", newSeq);
+    if (!docs) {
+        for (i = 0; i < batch->num; i++) {
+            moloch_db_tag_finish(batch->r[i], 0);
+        }
+        moloch_db_tag_batch_done(batch);
+        return;
+    }
+
+    js0n(docs, docs_len, out);
 
-    moloch_http_set(esServer, key, key_len, json, json_len, moloch_db_tag_create_cb, r);
+    int missing = 0;
+    for (i = 0; i < batch->num; i++) {
+        uint32_t       fields_len = 0;
+        unsigned char *fields = 0;
+        uint32_t       n_len = 0;
+        unsigned char *n = 0;
+
+        if (out[i*2+1])
+            fields = moloch_js0n_get(docs+out[i*2], out[i*2+1], "fields", &fields_len);
+        if (fields)
+            n = moloch_js0n_get(fields, fields_len, "n", &n_len);
+
+        if (n) {
+            uint32_t tagValue = moloch_db_tag_add(batch->r[i]->tag, atol((char*)n + (*n == '['?1:0)));
+            moloch_db_tag_finish(batch->r[i], tagValue);
+        } else {
+            batch->r[missing++] = batch->r[i];
+        }
+    }
+    if (missing < batch->num)
+        moloch_db_tag_publish();
+    batch->num = missing;
+
+    if (missing == 0) {
+        moloch_db_tag_batch_done(batch);
+        return;
+    }
+
+    // Get a new sequence number for each missing tag in one bulk request
+    char *json = moloch_http_get_buffer(missing*100);
+    BSB   bsb;
+    BSB_INIT(bsb, json, missing*100);
+    for (i = 0; i < missing; i++) {
+        BSB_EXPORT_sprintf(bsb, "{\"index\":{\"_index\":\"%ssequence\",\"_type\":\"sequence\",\"_id\":\"tags\"}}\n{}\n", config.prefix);
+    }
+    moloch_http_send(esServer, "POST", "/_bulk", 6, json, BSB_LENGTH(bsb), NULL, FALSE, moloch_db_tag_seq_cb, batch);
 }
 /******************************************************************************/
-void moloch_db_tag_cb(int UNUSED(code), unsigned char *data, int data_len, gpointer uw)
+// Runs on main thread
+LOCAL gboolean moloch_db_tag_batch_gfunc(gpointer UNUSED(user_data))
 {
-    MolochTagRequest_t *r = uw;
+    char key[200];
+    int  key_len;
 
-    if (!data) {
-        if (r->func)
-            r->func(r->uw, r->tagtype, r->tag, 0, TRUE);
-        moloch_db_free_tag_request(r);
-        return;
-    }
+    while (outstandingTagRequests < MOLOCH_TAG_MAX_BATCHES) {
+        MolochTagBatch_t   *batch = MOLOCH_TYPE_ALLOC0(MolochTagBatch_t);
+        MolochTagRequest_t *r;
+        MolochTagRequest_t *resolved = 0;
+        int                 size = 100;
+        int                 i;
 
-    uint32_t           fields_len;
-    unsigned char     *fields = 0;
-    fields = moloch_js0n_get(data, data_len, "fields", &fields_len);
+        MOLOCH_LOCK(tagRequests);
+        while (batch->num < MOLOCH_TAG_BATCH && tagRequests.t_count > 0) {
+            DLL_POP_HEAD(t_, &tagRequests, r);
+            r->same = 0;
+
+            // Might have been resolved while it was waiting, finish after unlocking
+            r->newSeq = moloch_db_tag_find(r->tag);
+            if (r->newSeq) {
+                r->same = resolved;
+                resolved = r;
+                continue;
+            }
 
-    if (fields) {
-        uint32_t           n_len;
-        unsigned char     *n = 0;
-        n = moloch_js0n_get(fields, fields_len, "n", &n_len);
+            for (i = 0; i < batch->num; i++) {
+                if (strcmp(batch->r[i]->tag, r->tag) == 0) {
+                    r->same = batch->r[i]->same;
+                    batch->r[i]->same = r;
+                    break;
+                }
+            }
+            if (i == batch->num) {
+                batch->r[batch->num++] = r;
+                size += 6*strlen(r->tag) + 3;
+            }
+        }
+        if (batch->num == 0)
+            tagRequestsTimer = 0;
+        MOLOCH_UNLOCK(tagRequests);
 
-        MolochTag_t *tag = MOLOCH_TYPE_ALLOC(MolochTag_t);
-        tag->tagName = g_strdup(r->tag);
-        if (*n == '[')
-            tag->tagValue = atol((char*)n+1);
-        else
-            tag->tagValue = atol((char*)n);
-        HASH_ADD(tag_, tags, tag->tagName, tag);
+        while (resolved) {
+            r = resolved;
+            resolved = r->same;
+            r->same = 0;
+            moloch_db_tag_finish(r, r->newSeq);
+        }
 
-        if (r->func)
-            r->func(r->uw, r->tagtype, r->tag, tag->tagValue, TRUE);
-        moloch_db_free_tag_request(r);
-        return;
+        if (batch->num == 0) {
+            MOLOCH_TYPE_FREE(MolochTagBatch_t, batch);
+            return FALSE;
+        }
+
+        char *json = moloch_http_get_buffer(size);
+        BSB   bsb;
+        BSB_INIT(bsb, json, size);
+        BSB_EXPORT_cstr(bsb, "{\"ids\":[");
+        for (i = 0; i < batch->num; i++) {
+            if (i > 0)
+                BSB_EXPORT_u08(bsb, ',');
+            moloch_db_js0n_str(&bsb, (unsigned char *)batch->r[i]->tag, TRUE);
+        }
+        BSB_EXPORT_cstr(bsb, "]}");
+
+        key_len = snprintf(key, sizeof(key), "/%stags/tag/_mget?fields=n", config.prefix);
+        moloch_http_send(esServer, "POST", key, key_len, json, BSB_LENGTH(bsb), NULL, FALSE, moloch_db_tag_mget_cb, batch);
+        outstandingTagRequests++;
     }
 
-    moloch_db_get_sequence_number("tags", moloch_db_tag_seq_cb, r) ;
+    // Too many batches outstanding, one finishing will call us again
+    MOLOCH_LOCK(tagRequests);
+    tagRequestsTimer = 0;
+    MOLOCH_UNLOCK(tagRequests);
+    return FALSE;
 }
 /******************************************************************************/
 uint32_t moloch_db_peek_tag(const char *tagname)
 {
-    MolochTag_t *tag;
-    HASH_FIND(tag_, tags, tagname, tag);
-
-    if (!tag)
-        return 0;
-    return tag->tagValue;
+    return moloch_db_tag_find(tagname);
 }
 /******************************************************************************/
 void moloch_db_get_tag(void *uw, int tagtype, const char *tagname, MolochTag_cb func)
 {
-    MolochTag_t *tag;
-    HASH_FIND(tag_, tags, tagname, tag);
+    uint32_t tagValue = moloch_db_tag_find(tagname);
 
-    if (tag) {
+    if (tagValue) {
         if (func)
-            func(uw, tagtype, tagname, tag->tagValue, FALSE);
+            func(uw, tagtype, tagname, tagValue, FALSE);
         return;
     }
 
     if (config.dryRun) {
-        static int tagNum = 1;
-        MolochTag_t *tag = MOLOCH_TYPE_ALLOC(MolochTag_t);
-        tag->tagName = g_strdup(tagname);
-        tag->tagValue = tagNum++;
-        HASH_ADD(tag_, tags, tag->tagName, tag);
+        static int tagNum = 0;
+        tagValue = moloch_db_tag_add(tagname, MOLOCH_THREAD_INCR(tagNum));
+        moloch_db_tag_publish();
 
         if (func)
-            func(uw, tagtype, tagname, tag->tagValue, FALSE);
+            func(uw, tagtype, tagname, tagValue, FALSE);
         return;
     }
 
-    MolochTagRequest_t *r = MOLOCH_TYPE_ALLOC(MolochTagRequest_t);
-    r->uw = uw;
+    MolochTagRequest_t *r = MOLOCH_TYPE_ALLOC0(MolochTagRequest_t);
+    r->uw      = uw;
     r->func    = func;
     r->tag     = strdup(tagname);
     r->tagtype = tagtype;
-    r->escaped = g_uri_escape_string (tagname, G_URI_RESERVED_CHARS_ALLOWED_IN_PATH_ELEMENT, 0);
-
-
 
-    if (outstandingTagRequests == 0) {
-        char               key[500];
-        int                key_len;
-
-        key_len = snprintf(key, sizeof(key), "/%stags/tag/%s?fields=n", config.prefix, r->escaped);
-        moloch_http_send(esServer, "GET", key, key_len, NULL, 0, NULL, FALSE, moloch_db_tag_cb, r);
-        outstandingTagRequests++;
-    } else {
-        MOLOCH_LOCK(tagRequests);
-        DLL_PUSH_TAIL(t_, &tagRequests, r);
-        MOLOCH_UNLOCK(tagRequests);
-    }
+    MOLOCH_LOCK(tagRequests);
+    DLL_PUSH_TAIL(t_, &tagRequests, r);
+    if (!tagRequestsTimer)
+        tagRequestsTimer = g_timeout_add(0, moloch_db_tag_batch_gfunc, 0);
+    MOLOCH_UNLOCK(tagRequests);
 }
 /******************************************************************************/
 void moloch_db_load_rir()
@@ -2139,14 +2795,25 @@ int moloch_db_can_quit()
         return 1;
     }
 
-    int thread;
-    for (thread = 0; thread < config.packetThreads; thread++) {
-        if (dbInfo[thread].json && BSB_LENGTH(dbInfo[thread].bsb) > 0) {
-            moloch_db_flush_gfunc((gpointer)1);
-            if (config.debug)
-                LOG ("Can't quit, sJson[%d] %ld", thread, BSB_LENGTH(dbInfo[thread].bsb));
-            return 1;
-        }
+    if (fileDocs.d_count > 0) {
+        if (config.debug)
+            LOG ("Can't quit, fileDocs %d", fileDocs.d_count);
+        return 1;
+    }
+
+    int thread = moloch_db_threads_pending();
+    if (thread) {
+        moloch_db_flush_threads();
+        if (config.debug)
+            LOG ("Can't quit, sJson[%d] %ld", thread-1, BSB_LENGTH(dbInfo[thread-1].bsb));
+        return 1;
+    }
+
+    if (dbBufQ) {
+        moloch_db_flush_gfunc(0);
+        if (config.debug)
+            LOG ("Can't quit, published bulk buffers");
+        return 1;
     }
 
     if (moloch_http_queue_length(esServer) > 0) {
@@ -2166,8 +2833,11 @@ void moloch_db_init()
     }
     if (!config.dryRun) {
         esServer = moloch_http_create_server(config.elasticsearch, 9200, config.maxESConns, config.maxESRequests, config.compressES);
+    } else if (config.bench) {
+        esServer = moloch_http_create_null_server(config.compressES);
     }
     DLL_INIT(t_, &tagRequests);
+    DLL_INIT(d_, &fileDocs);
     HASH_INIT(tag_, tags, moloch_db_tag_hash, moloch_db_tag_cmp);
     myPid = getpid();
     gettimeofday(&startTime, NULL);
@@ -2176,6 +2846,8 @@ void moloch_db_init()
         moloch_db_load_file_num();
         if (!config.noLoadTags)
             moloch_db_load_tags();
+        if (config.tagsSnapshot)
+            moloch_db_load_tags_snapshot();
         moloch_db_load_stats();
         moloch_db_load_fields();
     }
@@ -2224,11 +2896,9 @@ void moloch_db_init()
         timers[0] = g_timeout_add_seconds( 2, moloch_db_update_stats_gfunc, 0);
         timers[1] = g_timeout_add_seconds( 5, moloch_db_update_stats_gfunc, (gpointer)1);
         timers[2] = g_timeout_add_seconds(60, moloch_db_update_stats_gfunc, (gpointer)2);
-        timers[3] = g_timeout_add_seconds( 1, moloch_db_flush_gfunc, 0);
-    }
-    int thread;
-    for (thread = 0; thread < config.packetThreads; thread++) {
-        MOLOCH_LOCK_INIT(dbInfo[thread].lock);
+        timers[3] = g_timeout_add(100, moloch_db_flush_gfunc, 0);
+    } else if (config.bench) {
+        timers[3] = g_timeout_add(100, moloch_db_flush_gfunc, 0);
     }
 }
 /******************************************************************************/
@@ -2241,8 +2911,25 @@ void moloch_db_exit()
             g_source_remove(timers[i]);
         }
 
-        moloch_db_flush_gfunc((gpointer)1);
+        /* Packet threads are still running, have them publish anything left */
+        moloch_db_flush_threads();
+        for (i = 0; i < 500 && moloch_db_threads_pending(); i++) {
+            usleep(10000);
+        }
+        if (moloch_db_threads_pending())
+            LOG("WARNING - Packet threads didn't publish all session buffers");
+        moloch_db_flush_gfunc(0);
         moloch_db_update_stats(TRUE);
+        if (config.tagsSnapshot)
+            moloch_db_save_tags_snapshot();
+        moloch_http_free_server(esServer);
+    } else if (config.bench) {
+        g_source_remove(timers[3]);
+        moloch_db_flush_threads();
+        for (i = 0; i < 500 && moloch_db_threads_pending(); i++) {
+            usleep(10000);
+        }
+        moloch_db_flush_gfunc(0);
         moloch_http_free_server(esServer);
     }
 
@@ -2267,6 +2954,9 @@ void moloch_db_exit()
         ipTree = 0;
     }
 
+    g_free(tagTable);
+    tagTable = NULL;
+
     MolochTag_t *tag;
     HASH_FORALL_POP_HEAD(tag_, tags, tag,
         g_free(tag->tagName);
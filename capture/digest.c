@@ -0,0 +1,229 @@
+/******************************************************************************/
+/* digest.c  -- Body digests used by the parsers
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+#include <openssl/evp.h>
+
+extern MolochConfig_t        config;
+extern unsigned char         moloch_char_to_hexstr[256][3];
+
+/******************************************************************************/
+/* An engine knows how to run one kind of digest.  openssl picks the fastest
+ * code for the cpu at runtime (SHA-NI, AVX2), glib is the old GChecksum code.
+ */
+typedef struct {
+    char   *name;
+    void *(*create)(int type);
+    void  (*reset)(void *ctx, int type);
+    void  (*update)(void *ctx, const unsigned char *data, int len);
+    int   (*finish)(void *ctx, int type, unsigned char *out);
+    void  (*destroy)(void *ctx);
+} MolochDigestEngine_t;
+
+struct moloch_digest {
+    void              *ctx[MOLOCH_DIGEST_NUM];
+    char               str[MOLOCH_DIGEST_NUM][65];
+    uint8_t            types;
+    uint8_t            finished;
+};
+
+LOCAL MolochDigestEngine_t *engine;
+
+/******************************************************************************/
+LOCAL const EVP_MD *moloch_digest_openssl_md(int type)
+{
+    return type == 0?EVP_md5():EVP_sha256();
+}
+/******************************************************************************/
+LOCAL void *moloch_digest_openssl_create(int type)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(ctx, moloch_digest_openssl_md(type), NULL);
+    return ctx;
+}
+/******************************************************************************/
+LOCAL void moloch_digest_openssl_reset(void *ctx, int type)
+{
+    EVP_DigestInit_ex(ctx, moloch_digest_openssl_md(type), NULL);
+}
+/******************************************************************************/
+LOCAL void moloch_digest_openssl_update(void *ctx, const unsigned char *data, int len)
+{
+    EVP_DigestUpdate(ctx, data, len);
+}
+/******************************************************************************/
+LOCAL int moloch_digest_openssl_finish(void *ctx, int UNUSED(type), unsigned char *out)
+{
+    unsigned int len = 0;
+    EVP_DigestFinal_ex(ctx, out, &len);
+    return len;
+}
+/******************************************************************************/
+LOCAL void moloch_digest_openssl_destroy(void *ctx)
+{
+    EVP_MD_CTX_destroy(ctx);
+}
+/******************************************************************************/
+LOCAL void *moloch_digest_glib_create(int type)
+{
+    return g_checksum_new(type == 0?G_CHECKSUM_MD5:G_CHECKSUM_SHA256);
+}
+/******************************************************************************/
+LOCAL void moloch_digest_glib_reset(void *ctx, int UNUSED(type))
+{
+    g_checksum_reset(ctx);
+}
+/******************************************************************************/
+LOCAL void moloch_digest_glib_update(void *ctx, const unsigned char *data, int len)
+{
+    g_checksum_update(ctx, data, len);
+}
+/******************************************************************************/
+LOCAL int moloch_digest_glib_finish(void *ctx, int UNUSED(type), unsigned char *out)
+{
+    gsize len = 32;
+    g_checksum_get_digest(ctx, out, &len);
+    return len;
+}
+/******************************************************************************/
+LOCAL void moloch_digest_glib_destroy(void *ctx)
+{
+    g_checksum_free(ctx);
+}
+/******************************************************************************/
+LOCAL MolochDigestEngine_t engines[] = {
+    {"openssl", moloch_digest_openssl_create, moloch_digest_openssl_reset, moloch_digest_openssl_update, moloch_digest_openssl_finish, moloch_digest_openssl_destroy},
+    {"glib",    moloch_digest_glib_create,    moloch_digest_glib_reset,    moloch_digest_glib_update,    moloch_digest_glib_finish,    moloch_digest_glib_destroy},
+    {NULL,      NULL, NULL, NULL, NULL, NULL}
+};
+/******************************************************************************/
+MolochDigest_t *moloch_digest_new(int types)
+{
+    MolochDigest_t *digest = MOLOCH_TYPE_ALLOC0(MolochDigest_t);
+    int t;
+
+    digest->types = types;
+    for (t = 0; t < MOLOCH_DIGEST_NUM; t++) {
+        if (types & (1 << t))
+            digest->ctx[t] = engine->create(t);
+    }
+    return digest;
+}
+/******************************************************************************/
+void moloch_digest_reset(MolochDigest_t *digest)
+{
+    int t;
+
+    for (t = 0; t < MOLOCH_DIGEST_NUM; t++) {
+        if (digest->ctx[t])
+            engine->reset(digest->ctx[t], t);
+    }
+    digest->finished = 0;
+}
+/******************************************************************************/
+void moloch_digest_update(MolochDigest_t *digest, const unsigned char *data, int len)
+{
+    int t;
+
+    for (t = 0; t < MOLOCH_DIGEST_NUM; t++) {
+        if (digest->ctx[t])
+            engine->update(digest->ctx[t], data, len);
+    }
+}
+/******************************************************************************/
+/* Returns the hex string for one of the digests, no more updates are allowed
+ * until moloch_digest_reset is called.
+ */
+const char *moloch_digest_get_string(MolochDigest_t *digest, int type)
+{
+    unsigned char out[32];
+    int           len, i;
+
+    if (!digest->ctx[type])
+        return NULL;
+
+    if ((digest->finished & (1 << type)) == 0) {
+        len = engine->finish(digest->ctx[type], type, out);
+        for (i = 0; i < len; i++) {
+            digest->str[type][i*2]   = moloch_char_to_hexstr[out[i]][0];
+            digest->str[type][i*2+1] = moloch_char_to_hexstr[out[i]][1];
+        }
+        digest->str[type][len*2] = 0;
+        digest->finished |= (1 << type);
+    }
+    return digest->str[type];
+}
+/******************************************************************************/
+void moloch_digest_free(MolochDigest_t *digest)
+{
+    int t;
+
+    for (t = 0; t < MOLOCH_DIGEST_NUM; t++) {
+        if (digest->ctx[t])
+            engine->destroy(digest->ctx[t]);
+    }
+    MOLOCH_TYPE_FREE(MolochDigest_t, digest);
+}
+/******************************************************************************/
+/* Compare each engine on the same buffer, used by --digestbench */
+void moloch_digest_bench()
+{
+    MolochDigestEngine_t *saved = engine;
+    unsigned char        *buf = malloc(1024*1024);
+    int                   e, t, i;
+
+    for (i = 0; i < 1024*1024; i++) {
+        buf[i] = i * 31;
+    }
+
+    for (t = 0; t < MOLOCH_DIGEST_NUM; t++) {
+        for (e = 0; engines[e].name; e++) {
+            engine = &engines[e];
+            MolochDigest_t *digest = moloch_digest_new(1 << t);
+
+            struct timeval startTime, endTime;
+            gettimeofday(&startTime, NULL);
+            for (i = 0; i < 256; i++) {
+                moloch_digest_update(digest, buf, 1024*1024);
+            }
+            const char *str = moloch_digest_get_string(digest, t);
+            gettimeofday(&endTime, NULL);
+
+            double secs = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec)/1000000.0;
+            printf("%-7s %-6s %8.1f MB/s %s\n", engines[e].name, t == 0?"md5":"sha256", 256/secs, str);
+            moloch_digest_free(digest);
+        }
+    }
+
+    free(buf);
+    engine = saved;
+}
+/******************************************************************************/
+void moloch_digest_init()
+{
+    int e;
+
+    for (e = 0; engines[e].name; e++) {
+        if (strcmp(engines[e].name, config.digestEngine) == 0) {
+            engine = &engines[e];
+            return;
+        }
+    }
+
+    LOG("Unknown digestEngine %s", config.digestEngine);
+    exit(1);
+}
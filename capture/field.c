@@ -24,6 +24,25 @@ extern MolochConfig_t        config;
 HASH_VAR(d_, fieldsByDb, MolochFieldInfo_t, 13);
 HASH_VAR(e_, fieldsByExp, MolochFieldInfo_t, 13);
 
+/* Fields flagged MOLOCH_FIELD_FLAG_INTERN have a table of the values seen so
+ * far that the sessions point into instead of each keeping a copy.  Readers
+ * never lock, values are only ever added and are filled in before they are
+ * published.  Once a table is full new values are copied into the session
+ * like any other field, so a field that turns out not to be low cardinality
+ * costs at most MOLOCH_FIELD_INTERN_MAX values.
+ */
+#define MOLOCH_FIELD_INTERN_SLOTS 1024
+#define MOLOCH_FIELD_INTERN_MAX   512
+#define MOLOCH_FIELD_INTERN_LEN   1024
+
+typedef struct moloch_field_intern {
+    MolochFieldInternValue_t * volatile slots[MOLOCH_FIELD_INTERN_SLOTS];
+    int                        num;
+    MOLOCH_LOCK_EXTERN(lock);
+} MolochFieldIntern_t;
+
+LOCAL uint64_t internSaved[MOLOCH_MAX_PACKET_THREADS];
+
 /******************************************************************************/
 int moloch_field_exp_cmp(const void *keyv, const void *elementv)
 {
@@ -249,6 +268,16 @@ int moloch_field_define(char *group, char *kind, char *expression, char *friendl
     minfo->type     = type;
     minfo->flags    = flags;
 
+    if ((flags & MOLOCH_FIELD_FLAG_INTERN) && !minfo->intern) {
+        if (type == MOLOCH_FIELD_TYPE_STR_HASH) {
+            minfo->intern = MOLOCH_TYPE_ALLOC0(MolochFieldIntern_t);
+            MOLOCH_LOCK_INIT(minfo->intern->lock);
+        } else {
+            LOG("WARNING - Only string hash fields can be interned, not %s", expression);
+            minfo->flags &= ~MOLOCH_FIELD_FLAG_INTERN;
+        }
+    }
+
     if ((flags & MOLOCH_FIELD_FLAG_FAKE) == 0) {
         if (minfo->pos == -1) {
             minfo->pos = config.maxField++;
@@ -417,8 +446,20 @@ void moloch_field_init()
 void moloch_field_exit()
 {
     MolochFieldInfo_t *info = 0;
+    int                i;
 
     HASH_FORALL_POP_HEAD(d_, fieldsByDb, info,
+        if (info->intern) {
+            if (config.debug)
+                LOG("%s interned %d values", info->expression, info->intern->num);
+            for (i = 0; i < MOLOCH_FIELD_INTERN_SLOTS; i++) {
+                if (info->intern->slots[i]) {
+                    free(info->intern->slots[i]->json);
+                    free(info->intern->slots[i]);
+                }
+            }
+            MOLOCH_TYPE_FREE(MolochFieldIntern_t, info->intern);
+        }
         if (info->dbFieldFull)
             g_free(info->dbFieldFull);
         if (info->expression)
@@ -433,6 +474,172 @@ void moloch_field_exit()
     );
 }
 /******************************************************************************/
+/* Fields hold a handful of values each and are all thrown away together when
+ * the session is saved, so everything is bump allocated from chunks hung off
+ * the session instead of one malloc per value.  Chunks start small and double
+ * since most sessions only have a few fields, big values get their own chunk.
+ */
+#define MOLOCH_FIELD_CHUNK_MIN   512
+#define MOLOCH_FIELD_CHUNK_MAX   8192
+
+LOCAL uint64_t fieldArenas;
+LOCAL uint64_t fieldArenaBytes;
+
+LOCAL void *moloch_field_alloc(MolochSession_t *session, uint32_t size)
+{
+    MolochFieldChunk_t *chunk = session->fieldChunks;
+
+    size = (size + 7) & ~7;
+    if (chunk && chunk->used + size <= chunk->size) {
+        void *mem = chunk->data + chunk->used;
+        chunk->used += size;
+        return mem;
+    }
+
+    if (size > MOLOCH_FIELD_CHUNK_MAX/4) {
+        MolochFieldChunk_t *big = MOLOCH_SIZE_ALLOC(fieldChunk, sizeof(MolochFieldChunk_t) + size);
+        big->size = big->used = size;
+        if (chunk) {
+            big->next = chunk->next;
+            chunk->next = big;
+        } else {
+            big->next = NULL;
+            session->fieldChunks = big;
+        }
+        return big->data;
+    }
+
+    uint32_t csize = chunk?MIN(chunk->size*2, MOLOCH_FIELD_CHUNK_MAX):MOLOCH_FIELD_CHUNK_MIN;
+    chunk = MOLOCH_SIZE_ALLOC(fieldChunk, sizeof(MolochFieldChunk_t) + csize);
+    chunk->size = csize;
+    chunk->used = size;
+    chunk->next = session->fieldChunks;
+    session->fieldChunks = chunk;
+    return chunk->data;
+}
+/******************************************************************************/
+/* The session owns strings that weren't copied, they are moved into the arena */
+LOCAL char *moloch_field_strndup(MolochSession_t *session, const char *string, int len, gboolean copy)
+{
+    char *str = moloch_field_alloc(session, len + 1);
+    memcpy(str, string, len);
+    str[len] = 0;
+    if (!copy)
+        g_free((char *)string);
+    return str;
+}
+/******************************************************************************/
+LOCAL void moloch_field_arena_free(MolochFieldChunk_t *chunk)
+{
+    MolochFieldChunk_t *next;
+    uint64_t            bytes = 0;
+
+    if (!chunk)
+        return;
+
+    for (; chunk; chunk = next) {
+        next = chunk->next;
+        bytes += chunk->size;
+        MOLOCH_SIZE_FREE(fieldChunk, chunk);
+    }
+    __sync_add_and_fetch(&fieldArenas, 1);
+    __sync_add_and_fetch(&fieldArenaBytes, bytes);
+}
+/******************************************************************************/
+void moloch_field_arena_stats(uint64_t *arenas, uint64_t *bytes)
+{
+    *arenas = fieldArenas;
+    *bytes = fieldArenaBytes;
+}
+/******************************************************************************/
+LOCAL MolochFieldInternValue_t *moloch_field_intern(int pos, const char *string, int len)
+{
+    MolochFieldIntern_t      *intern = config.fields[pos]->intern;
+    MolochFieldInternValue_t *value;
+    uint32_t                  hash = moloch_string_hash_len(string, len);
+    uint32_t                  i = hash & (MOLOCH_FIELD_INTERN_SLOTS - 1);
+
+    while ((value = intern->slots[i])) {
+        if (value->hash == hash && value->len == len && memcmp(value->str, string, len) == 0)
+            return value;
+        i = (i + 1) & (MOLOCH_FIELD_INTERN_SLOTS - 1);
+    }
+
+    if (intern->num >= MOLOCH_FIELD_INTERN_MAX)
+        return NULL;
+
+    MOLOCH_LOCK(intern->lock);
+    // Values may have been added since we looked, they can only be from i on
+    while ((value = intern->slots[i])) {
+        if (value->hash == hash && value->len == len && memcmp(value->str, string, len) == 0) {
+            MOLOCH_UNLOCK(intern->lock);
+            return value;
+        }
+        i = (i + 1) & (MOLOCH_FIELD_INTERN_SLOTS - 1);
+    }
+
+    if (intern->num >= MOLOCH_FIELD_INTERN_MAX) {
+        MOLOCH_UNLOCK(intern->lock);
+        return NULL;
+    }
+
+    value = malloc(sizeof(MolochFieldInternValue_t) + len + 1);
+    value->hash = hash;
+    value->len = len;
+    memcpy(value->str, string, len);
+    value->str[len] = 0;
+
+    BSB   bsb;
+    char *json = malloc(len*6 + 3);
+    BSB_INIT(bsb, json, len*6 + 3);
+    moloch_db_js0n_str(&bsb, (unsigned char *)value->str, config.fields[pos]->flags & MOLOCH_FIELD_FLAG_FORCE_UTF8);
+    value->jsonLen = BSB_LENGTH(bsb);
+    value->json = realloc(json, value->jsonLen);
+
+    __sync_synchronize();
+    intern->slots[i] = value;
+    intern->num++;
+    MOLOCH_UNLOCK(intern->lock);
+
+    return value;
+}
+/******************************************************************************/
+void moloch_field_intern_stats(uint64_t *values, uint64_t *savedBytes)
+{
+    int i;
+
+    *values = 0;
+    *savedBytes = 0;
+    for (i = 0; i < config.maxField; i++) {
+        if (config.fields[i]->intern)
+            *values += config.fields[i]->intern->num;
+    }
+    for (i = 0; i < MOLOCH_MAX_PACKET_THREADS; i++) {
+        *savedBytes += internSaved[i];
+    }
+}
+/******************************************************************************/
+LOCAL void moloch_field_hstring_set(MolochSession_t *session, int pos, MolochString_t *hstring, const char *string, int len, gboolean copy)
+{
+    MolochFieldInternValue_t *value = NULL;
+
+    if (config.fields[pos]->intern && len <= MOLOCH_FIELD_INTERN_LEN)
+        value = moloch_field_intern(pos, string, len);
+
+    if (value) {
+        hstring->str = value->str;
+        hstring->uw = value;
+        internSaved[session->thread] += len + 1;
+        if (!copy)
+            g_free((char *)string);
+    } else {
+        hstring->str = moloch_field_strndup(session, string, len, copy);
+        hstring->uw = NULL;
+    }
+    hstring->len = len;
+    hstring->utf8 = 0;
+}
+/******************************************************************************/
 gboolean moloch_field_string_add(int pos, MolochSession_t *session, const char *string, int len, gboolean copy)
 {
     MolochField_t         *field;
@@ -443,29 +650,26 @@ gboolean moloch_field_string_add(int pos, MolochSession_t *session, const char *
         return FALSE;
 
     if (!session->fields[pos]) {
-        field = MOLOCH_TYPE_ALLOC(MolochField_t);
+        field = moloch_field_alloc(session, sizeof(MolochField_t));
         session->fields[pos] = field;
         if (len == -1)
             len = strlen(string);
         field->jsonSize = 6 + config.fields[pos]->dbFieldLen + 2*len;
-        if (copy)
-            string = g_strndup(string, len);
+        MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, field->jsonSize);
         switch (config.fields[pos]->type) {
         case MOLOCH_FIELD_TYPE_STR:
-            field->str = (char*)string;
+            field->str = moloch_field_strndup(session, string, len, copy);
             return TRUE;
         case MOLOCH_FIELD_TYPE_STR_ARRAY:
-            field->sarray = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(field->sarray, (char*)string);
+            field->sarray = g_ptr_array_new();
+            g_ptr_array_add(field->sarray, moloch_field_strndup(session, string, len, copy));
             return TRUE;
         case MOLOCH_FIELD_TYPE_STR_HASH:
-            hash = MOLOCH_TYPE_ALLOC(MolochStringHashStd_t);
+            hash = moloch_field_alloc(session, sizeof(MolochStringHashStd_t));
             HASH_INIT(s_, *hash, moloch_string_hash, moloch_string_ncmp);
             field->shash = hash;
-            hstring = MOLOCH_TYPE_ALLOC(MolochString_t);
-            hstring->str = (char*)string;
-            hstring->len = len;
-            hstring->utf8 = 0;
+            hstring = moloch_field_alloc(session, sizeof(MolochString_t));
+            moloch_field_hstring_set(session, pos, hstring, string, len, copy);
             HASH_ADD(s_, *hash, hstring->str, hstring);
             return TRUE;
         default:
@@ -479,39 +683,28 @@ gboolean moloch_field_string_add(int pos, MolochSession_t *session, const char *
 
     field = session->fields[pos];
     field->jsonSize += (6 + 2*len);
+    MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, 6 + 2*len);
 
     if (field->jsonSize > 20000)
         session->midSave = 1;
 
     switch (config.fields[pos]->type) {
     case MOLOCH_FIELD_TYPE_STR:
-        if (copy)
-            string = g_strndup(string, len);
-        g_free(field->str);
-        field->str = (char*)string;
+        field->str = moloch_field_strndup(session, string, len, copy);
         return TRUE;
     case MOLOCH_FIELD_TYPE_STR_ARRAY:
-        if (copy)
-            string = g_strndup(string, len);
-        g_ptr_array_add(field->sarray, (char*)string);
+        g_ptr_array_add(field->sarray, moloch_field_strndup(session, string, len, copy));
         return TRUE;
     case MOLOCH_FIELD_TYPE_STR_HASH:
         HASH_FIND_HASH(s_, *(field->shash), moloch_string_hash_len(string, len), string, hstring);
 
         if (hstring) {
             field->jsonSize -= (6 + 2*len);
+            MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, -(6 + 2*len));
             return FALSE;
         }
-        hstring = MOLOCH_TYPE_ALLOC(MolochString_t);
-        if (copy) {
-            hstring->str = g_strndup(string, len);
-            hstring->len = len;
-            hstring->utf8 = 0;
-        } else {
-            hstring->str = (char*)string;
-            hstring->len = len;
-            hstring->utf8 = 0;
-        }
+        hstring = moloch_field_alloc(session, sizeof(MolochString_t));
+        moloch_field_hstring_set(session, pos, hstring, string, len, copy);
         HASH_ADD(s_, *(field->shash), hstring->str, hstring);
         return TRUE;
     default:
@@ -520,6 +713,58 @@ gboolean moloch_field_string_add(int pos, MolochSession_t *session, const char *
     }
 }
 /******************************************************************************/
+/* INT_GHASH and IP_GHASH values are kept in a small array, searched in order,
+ * until there are more than MOLOCH_FIELD_INTS_MAX of them.  Only the fields
+ * that really get big pay for a GHashTable.
+ */
+#define MOLOCH_FIELD_INTS_MAX 8
+
+LOCAL gboolean moloch_field_ints_add(MolochField_t *field, int i)
+{
+    int n;
+
+    if (!field->intsNum)
+        return g_hash_table_insert(field->ghash, (void *)(long)i, NULL);
+
+    for (n = 0; n < field->intsNum; n++) {
+        if (field->ints[n] == i)
+            return FALSE;
+    }
+
+    if (field->intsNum < MOLOCH_FIELD_INTS_MAX) {
+        field->ints[field->intsNum++] = i;
+        return TRUE;
+    }
+
+    GHashTable *ghash = g_hash_table_new(NULL, NULL);
+    for (n = 0; n < field->intsNum; n++) {
+        g_hash_table_insert(ghash, (void *)(long)field->ints[n], NULL);
+    }
+    g_hash_table_insert(ghash, (void *)(long)i, NULL);
+    field->intsNum = 0;
+    field->ghash = ghash;
+    return TRUE;
+}
+/******************************************************************************/
+void moloch_field_ints_iter_init(MolochFieldIntsIter_t *iter, MolochField_t *field)
+{
+    iter->field = field;
+    iter->pos = 0;
+    if (!field->intsNum)
+        g_hash_table_iter_init(&iter->iter, field->ghash);
+}
+/******************************************************************************/
+gboolean moloch_field_ints_iter_next(MolochFieldIntsIter_t *iter, gpointer *ikey)
+{
+    if (!iter->field->intsNum)
+        return g_hash_table_iter_next(&iter->iter, ikey, NULL);
+
+    if (iter->pos >= iter->field->intsNum)
+        return FALSE;
+    *ikey = (void *)(long)iter->field->ints[iter->pos++];
+    return TRUE;
+}
+/******************************************************************************/
 gboolean moloch_field_int_add(int pos, MolochSession_t *session, int i)
 {
     MolochField_t        *field;
@@ -530,7 +775,7 @@ gboolean moloch_field_int_add(int pos, MolochSession_t *session, int i)
         return FALSE;
 
     if (!session->fields[pos]) {
-        field = MOLOCH_TYPE_ALLOC(MolochField_t);
+        field = moloch_field_alloc(session, sizeof(MolochField_t));
         session->fields[pos] = field;
         field->jsonSize = 3 + config.fields[pos]->dbFieldLen + 10;
         switch (config.fields[pos]->type) {
@@ -546,17 +791,18 @@ gboolean moloch_field_int_add(int pos, MolochSession_t *session, int i)
         case MOLOCH_FIELD_TYPE_IP_HASH:
             field->jsonSize += 100;
         case MOLOCH_FIELD_TYPE_INT_HASH:
-            hash = MOLOCH_TYPE_ALLOC(MolochIntHashStd_t);
+            hash = moloch_field_alloc(session, sizeof(MolochIntHashStd_t));
             HASH_INIT(i_, *hash, moloch_int_hash, moloch_int_cmp);
             field->ihash = hash;
-            hint = MOLOCH_TYPE_ALLOC(MolochInt_t);
+            hint = moloch_field_alloc(session, sizeof(MolochInt_t));
             HASH_ADD(i_, *hash, (void *)(long)i, hint);
             return TRUE;
         case MOLOCH_FIELD_TYPE_IP_GHASH:
             field->jsonSize += 100;
         case MOLOCH_FIELD_TYPE_INT_GHASH:
-            field->ghash = g_hash_table_new(NULL, NULL);
-            g_hash_table_insert(field->ghash, (void *)(long)i, NULL);
+            field->ints = moloch_field_alloc(session, sizeof(int) * MOLOCH_FIELD_INTS_MAX);
+            field->ints[0] = i;
+            field->intsNum = 1;
             return TRUE;
         default:
             LOG("Not a int %s", config.fields[pos]->dbField);
@@ -583,11 +829,11 @@ gboolean moloch_field_int_add(int pos, MolochSession_t *session, int i)
             field->jsonSize -= (3 + 10);
             return FALSE;
         }
-        hint = MOLOCH_TYPE_ALLOC(MolochInt_t);
+        hint = moloch_field_alloc(session, sizeof(MolochInt_t));
         HASH_ADD(i_, *(field->ihash), (void *)(long)i, hint);
         return TRUE;
     case MOLOCH_FIELD_TYPE_IP_GHASH:
-        if (!g_hash_table_insert(field->ghash, (void *)(long)i, NULL)) {
+        if (!moloch_field_ints_add(field, i)) {
             field->jsonSize -= 13;
             return FALSE;
         } else {
@@ -595,7 +841,7 @@ gboolean moloch_field_int_add(int pos, MolochSession_t *session, int i)
             return TRUE;
         }
     case MOLOCH_FIELD_TYPE_INT_GHASH:
-        if (!g_hash_table_insert(field->ghash, (void *)(long)i, NULL)) {
+        if (!moloch_field_ints_add(field, i)) {
             field->jsonSize -= 13;
             return FALSE;
         }
@@ -622,7 +868,10 @@ uint32_t moloch_field_certsinfo_hash(const void *key)
 int moloch_field_certsinfo_cmp(const void *keyv, const void *elementv)
 {
     MolochCertsInfo_t *key = (MolochCertsInfo_t *)keyv;
-    MolochCertsInfo_t *element = (MolochCertsInfo_t *)elementv;
+    MolochCertsInfo_t *element = ((MolochCertsInfoRef_t *)elementv)->certs;
+
+    if (key == element)
+        return 1;
 
     if ( !((key->serialNumberLen == element->serialNumberLen) &&
            (memcmp(key->serialNumber, element->serialNumber, element->serialNumberLen) == 0) &&
@@ -656,22 +905,26 @@ int moloch_field_certsinfo_cmp(const void *keyv, const void *elementv)
     return 1;
 }
 /******************************************************************************/
+/* On success the session takes over the caller's reference to certs */
 gboolean moloch_field_certsinfo_add(int pos, MolochSession_t *session, MolochCertsInfo_t *certs, int len)
 {
     MolochField_t             *field;
     MolochCertsInfoHashStd_t   *hash;
-    MolochCertsInfo_t          *hci;
+    MolochCertsInfoRef_t       *hci;
 
     if (!session->fields[pos]) {
-        field = MOLOCH_TYPE_ALLOC(MolochField_t);
+        field = moloch_field_alloc(session, sizeof(MolochField_t));
         session->fields[pos] = field;
         field->jsonSize = 3 + config.fields[pos]->dbFieldLen + len;
+        MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, field->jsonSize);
         switch (config.fields[pos]->type) {
         case MOLOCH_FIELD_TYPE_CERTSINFO:
-            hash = MOLOCH_TYPE_ALLOC(MolochCertsInfoHashStd_t);
+            hash = moloch_field_alloc(session, sizeof(MolochCertsInfoHashStd_t));
             HASH_INIT(t_, *hash, moloch_field_certsinfo_hash, moloch_field_certsinfo_cmp);
             field->cihash = hash;
-            HASH_ADD(t_, *hash, certs, certs);
+            hci = moloch_field_alloc(session, sizeof(MolochCertsInfoRef_t));
+            hci->certs = certs;
+            HASH_ADD(t_, *hash, certs, hci);
             return TRUE;
         default:
             LOG("Not a certsinfo %s", config.fields[pos]->dbField);
@@ -686,7 +939,10 @@ gboolean moloch_field_certsinfo_add(int pos, MolochSession_t *session, MolochCer
         if (hci)
             return FALSE;
         field->jsonSize += 3 + len;
-        HASH_ADD(t_, *(field->cihash), certs, certs);
+        MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, 3 + len);
+        hci = moloch_field_alloc(session, sizeof(MolochCertsInfoRef_t));
+        hci->certs = certs;
+        HASH_ADD(t_, *(field->cihash), certs, hci);
         return TRUE;
     default:
         LOG("Not a certsinfo %s", config.fields[pos]->dbField);
@@ -694,71 +950,150 @@ gboolean moloch_field_certsinfo_add(int pos, MolochSession_t *session, MolochCer
     }
 }
 /******************************************************************************/
-void moloch_field_free(MolochSession_t *session)
+/* Frees what a field has outside the arena */
+LOCAL void moloch_field_release(MolochSession_t *session, int pos, MolochField_t *field, gboolean moved)
 {
-    int                       pos;
-    MolochField_t            *field;
-    MolochString_t           *hstring;
-    MolochStringHashStd_t    *shash;
+    MolochCertsInfoRef_t     *hci;
+
+    if (MOLOCH_MEMORY_FIELD_TYPE(config.fields[pos]->type))
+        MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, -(int64_t)field->jsonSize);
+
+    switch (config.fields[pos]->type) {
+    case MOLOCH_FIELD_TYPE_STR_ARRAY:
+        g_ptr_array_free(field->sarray, TRUE);
+        break;
+    case MOLOCH_FIELD_TYPE_INT_ARRAY:
+        g_array_free(field->iarray, TRUE);
+        break;
+    case MOLOCH_FIELD_TYPE_IP_GHASH:
+    case MOLOCH_FIELD_TYPE_INT_GHASH:
+        if (!field->intsNum)
+            g_hash_table_destroy(field->ghash);
+        break;
+    case MOLOCH_FIELD_TYPE_CERTSINFO:
+        if (!moved) {
+            HASH_FORALL(t_, *(field->cihash), hci,
+                moloch_field_certsinfo_free(hci->certs);
+            );
+        }
+        break;
+    } // switch
+}
+/******************************************************************************/
+/* Adds a field's values again so they end up in the session's current arena,
+ * the cert references are handed over instead of copied.
+ */
+LOCAL void moloch_field_move(MolochSession_t *session, int pos, MolochField_t *field)
+{
+    MolochString_t           *hstring, *moved;
     MolochInt_t              *hint;
-    MolochIntHashStd_t       *ihash;
-    MolochCertsInfo_t        *hci;
-    MolochCertsInfoHashStd_t *cihash;
+    MolochCertsInfoRef_t     *hci;
+    MolochFieldIntsIter_t     iter;
+    gpointer                  ikey;
+    guint                     i;
+
+    switch (config.fields[pos]->type) {
+    case MOLOCH_FIELD_TYPE_STR:
+        moloch_field_string_add(pos, session, field->str, -1, TRUE);
+        break;
+    case MOLOCH_FIELD_TYPE_STR_ARRAY:
+        for (i = 0; i < field->sarray->len; i++) {
+            moloch_field_string_add(pos, session, g_ptr_array_index(field->sarray, i), -1, TRUE);
+        }
+        break;
+    case MOLOCH_FIELD_TYPE_STR_HASH:
+        HASH_FORALL(s_, *(field->shash), hstring,
+            if (moloch_field_string_add(pos, session, hstring->str, hstring->len, TRUE) && hstring->utf8) {
+                HASH_FIND_HASH(s_, *(session->fields[pos]->shash), moloch_string_hash_len(hstring->str, hstring->len), hstring->str, moved);
+                moved->utf8 = 1;
+            }
+        );
+        break;
+    case MOLOCH_FIELD_TYPE_INT:
+    case MOLOCH_FIELD_TYPE_IP:
+        moloch_field_int_add(pos, session, field->i);
+        break;
+    case MOLOCH_FIELD_TYPE_INT_ARRAY:
+        for (i = 0; i < field->iarray->len; i++) {
+            moloch_field_int_add(pos, session, g_array_index(field->iarray, int, i));
+        }
+        break;
+    case MOLOCH_FIELD_TYPE_IP_HASH:
+    case MOLOCH_FIELD_TYPE_INT_HASH:
+        HASH_FORALL(i_, *(field->ihash), hint,
+            moloch_field_int_add(pos, session, hint->i_hash);
+        );
+        break;
+    case MOLOCH_FIELD_TYPE_IP_GHASH:
+    case MOLOCH_FIELD_TYPE_INT_GHASH:
+        moloch_field_ints_iter_init(&iter, field);
+        while (moloch_field_ints_iter_next(&iter, &ikey)) {
+            moloch_field_int_add(pos, session, (int)(long)ikey);
+        }
+        break;
+    case MOLOCH_FIELD_TYPE_CERTSINFO:
+        HASH_FORALL(t_, *(field->cihash), hci,
+            moloch_field_certsinfo_add(pos, session, hci->certs, 0);
+        );
+        break;
+    } // switch
+
+    // Keep the size estimate the field already had
+    MolochField_t *nfield = session->fields[pos];
+    if (nfield) {
+        if (MOLOCH_MEMORY_FIELD_TYPE(config.fields[pos]->type))
+            MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_FIELDS, (int64_t)field->jsonSize - (int64_t)nfield->jsonSize);
+        nfield->jsonSize = field->jsonSize;
+    }
+}
+/******************************************************************************/
+/* Called once a session has been written out.  All the fields are dropped
+ * and the arena freed in one go, on a mid save the linked session fields are
+ * kept by moving them to a fresh arena first.
+ */
+void moloch_field_saved(MolochSession_t *session, int final)
+{
+    MolochFieldChunk_t *chunks = session->fieldChunks;
+    MolochField_t      *field;
+    int                 pos;
 
+    session->fieldChunks = NULL;
     for (pos = 0; pos < session->maxFields; pos++) {
         if (!(field = session->fields[pos]))
             continue;
 
-        switch (config.fields[pos]->type) {
-        case MOLOCH_FIELD_TYPE_STR:
-            g_free(field->str);
-            break;
-        case MOLOCH_FIELD_TYPE_STR_ARRAY:
-            g_ptr_array_free(field->sarray, TRUE);
-            break;
-        case MOLOCH_FIELD_TYPE_STR_HASH:
-            shash = session->fields[pos]->shash;
-            HASH_FORALL_POP_HEAD(s_, *shash, hstring,
-                g_free(hstring->str);
-                MOLOCH_TYPE_FREE(MolochString_t, hstring);
-            );
-            MOLOCH_TYPE_FREE(MolochStringHashStd_t, shash);
-            break;
-        case MOLOCH_FIELD_TYPE_INT:
-            break;
-        case MOLOCH_FIELD_TYPE_INT_ARRAY:
-            g_array_free(field->iarray, TRUE);
-            break;
-        case MOLOCH_FIELD_TYPE_IP_HASH:
-        case MOLOCH_FIELD_TYPE_INT_HASH:
-            ihash = session->fields[pos]->ihash;
-            HASH_FORALL_POP_HEAD(i_, *ihash, hint,
-                MOLOCH_TYPE_FREE(MolochInt_t, hint);
-            );
-            MOLOCH_TYPE_FREE(MolochIntHashStd_t, ihash);
-            break;
-        case MOLOCH_FIELD_TYPE_IP_GHASH:
-        case MOLOCH_FIELD_TYPE_INT_GHASH:
-            g_hash_table_destroy(session->fields[pos]->ghash);
-            break;
-        case MOLOCH_FIELD_TYPE_CERTSINFO:
-            cihash = session->fields[pos]->cihash;
-            HASH_FORALL_POP_HEAD(t_, *cihash, hci,
-                moloch_field_certsinfo_free(hci);
-            );
-            MOLOCH_TYPE_FREE(MolochCertsInfoHashStd_t, cihash);
-            break;
-        } // switch
-        MOLOCH_TYPE_FREE(MolochField_t, session->fields[pos]);
+        session->fields[pos] = NULL;
+        const gboolean moved = !final && (config.fields[pos]->flags & MOLOCH_FIELD_FLAG_LINKED_SESSIONS);
+        if (moved)
+            moloch_field_move(session, pos, field);
+        moloch_field_release(session, pos, field, moved);
+    }
+    moloch_field_arena_free(chunks);
+}
+/******************************************************************************/
+void moloch_field_free(MolochSession_t *session)
+{
+    int                       pos;
+    MolochField_t            *field;
+
+    for (pos = 0; pos < session->maxFields; pos++) {
+        if ((field = session->fields[pos]))
+            moloch_field_release(session, pos, field, FALSE);
     }
+    moloch_field_arena_free(session->fieldChunks);
+    session->fieldChunks = NULL;
     MOLOCH_SIZE_FREE(fields, session->fields);
     session->fields = 0;
 }
 /******************************************************************************/
+/* Drops a reference, the cert is only freed when the last one goes */
 void moloch_field_certsinfo_free (MolochCertsInfo_t *certs)
 {
     MolochString_t *string;
 
+    if (__sync_sub_and_fetch(&certs->refs, 1) > 0)
+        return;
+
     while (DLL_POP_HEAD(s_, &certs->alt, string)) {
         g_free(string->str);
         MOLOCH_TYPE_FREE(MolochString_t, string);
@@ -809,7 +1144,7 @@ int moloch_field_count(int pos, MolochSession_t *session)
         return HASH_COUNT(s_, *(field->ihash));
     case MOLOCH_FIELD_TYPE_INT_GHASH:
     case MOLOCH_FIELD_TYPE_IP_GHASH:
-        return g_hash_table_size(field->ghash);
+        return field->intsNum?field->intsNum:g_hash_table_size(field->ghash);
     case MOLOCH_FIELD_TYPE_CERTSINFO:
         return HASH_COUNT(s_, *(field->cihash));
     default:
@@ -60,13 +60,17 @@ typedef int (* HASH_CMP_FUNC)(const void *key, const void *element);
    } varname
 
 #define HASHP_INIT(name, varname, sz, hashfunc, cmpfunc) \
+    HASHP_INIT_MEM(name, varname, sz, hashfunc, cmpfunc, malloc(sz * sizeof((varname).buckets[0])))
+
+// Buckets in caller supplied memory, must hold sz buckets
+#define HASHP_INIT_MEM(name, varname, sz, hashfunc, cmpfunc, mem) \
   do { \
        int i; \
        (varname).size = sz; \
        (varname).hash = hashfunc; \
        (varname).cmp = cmpfunc; \
        (varname).count = 0; \
-       (varname).buckets = malloc(sz * sizeof((varname).buckets[0])); \
+       (varname).buckets = mem; \
        for (i = 0; i < (varname).size; i++) { \
            DLL_INIT(name, &((varname).buckets[i])); \
        } \
@@ -38,6 +38,7 @@ typedef struct molochhttpserver_t MolochHttpServer_t;
 
 typedef struct molochhttprequest_t {
     struct molochhttprequest_t *rqt_next, *rqt_prev;
+    struct molochhttprequest_t *rqo_next, *rqo_prev;
 
     MolochHttpResponse_cb func;
     gpointer              uw;
@@ -53,6 +54,7 @@ typedef struct molochhttprequest_t {
     struct curl_slist    *headerList;
     char                 *dataOut;
     uint32_t              dataOutLen;
+    char                  compressDone;
 
 } MolochHttpRequest_t;
 
@@ -61,6 +63,11 @@ typedef struct {
     int                         rqt_count;
 } MolochHttpRequestHead_t;
 
+typedef struct {
+    struct molochhttprequest_t *rqo_next, *rqo_prev;
+    int                         rqo_count;
+} MolochHttpOrderHead_t;
+
 typedef struct molochhttpconn_t {
     struct molochhttpconn_t *h_next, *h_prev;
     uint32_t                 h_hash;
@@ -93,6 +100,7 @@ struct molochhttpserver_t {
     int                   namesPos;
     char                  compress;
     char                  https;
+    char                  null;            // moloch-bench sink, nothing is sent
     int                   defaultPort;
     uint16_t              maxConns;
     uint16_t              maxOutstandingRequests;
@@ -105,9 +113,28 @@ struct molochhttpserver_t {
     int                   multiRunning;
 
     MolochHttpHeader_cb   headerCb;
+
+    uint32_t              compressMin;     // adaptive, smaller bodies usually aren't worth it
+    uint32_t              compressProbe;
+    uint32_t              compressSkipped;
+    uint64_t              compressIn;
+    uint64_t              compressOut;
+    uint64_t              compressUsecs;
 };
 
-static z_stream z_strm;
+#define MOLOCH_HTTP_COMPRESS_MIN   1000
+#define MOLOCH_HTTP_COMPRESS_MAX   0x100000
+
+/* Bodies to compress are handed to a pool of workers, each with its own
+ * z_stream.  Every request with a body to a compressing server is also put on
+ * orderQ, in send order, and only queued to curl once it and everything before
+ * it are done, so workers finishing out of order don't reorder bulk requests.
+ */
+static MolochHttpRequestHead_t compressQ;
+static MolochHttpOrderHead_t   orderQ;
+static MOLOCH_LOCK_DEFINE(compressQ);
+static MOLOCH_COND_DEFINE(compressQ);
+static int                     compressThreadsStarted;
 
 /******************************************************************************/
 int moloch_http_conn_cmp(const void *keyv, const void *elementv)
@@ -239,6 +266,12 @@ static void moloch_http_curlm_check_multi_info(MolochHttpServer_t *server)
             long   responseCode;
             curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &responseCode);
 
+            if (config.metrics && strstr(request->url, "/_bulk")) {
+                double totalTime;
+                curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME, &totalTime);
+                moloch_metrics_observe(MOLOCH_METRICS_OTHER_THREAD, MOLOCH_METRICS_ES_BULK, totalTime*1000000);
+            }
+
             if (config.logESRequests) {
                 double totalTime;
                 double connectTime;
@@ -481,6 +514,28 @@ int moloch_http_curl_close_callback(void *serverV, curl_socket_t fd)
     return 0;
 }
 /******************************************************************************/
+/* The null sink answers each request as soon as it would have gone to curl */
+static void moloch_http_null_done(MolochHttpRequest_t *request)
+{
+    MolochHttpServer_t *server = request->server;
+
+    if (request->func)
+        request->func(200, (unsigned char *)"", 0, request->uw);
+
+    if (request->dataOut) {
+        MOLOCH_SIZE_FREE(buffer, request->dataOut);
+    }
+    if (request->headerList) {
+        curl_slist_free_all(request->headerList);
+    }
+    curl_easy_cleanup(request->easy);
+    MOLOCH_TYPE_FREE(MolochHttpRequest_t, request);
+
+    MOLOCH_LOCK(requests);
+    server->outstanding--;
+    MOLOCH_UNLOCK(requests);
+}
+/******************************************************************************/
 static gboolean moloch_http_send_timer_callback(gpointer UNUSED(unused))
 {
     MolochHttpRequest_t       *request;
@@ -498,12 +553,142 @@ static gboolean moloch_http_send_timer_callback(gpointer UNUSED(unused))
 #ifdef MOLOCH_HTTP_DEBUG
         LOG("HTTPDEBUG DO %s %p %d %s", request->server->names[0], request, request->server->outstanding, request->url);
 #endif
+        if (request->server->null) {
+            moloch_http_null_done(request);
+            continue;
+        }
         curl_multi_add_handle(request->server->multi, request->easy);
     }
 
     return G_SOURCE_REMOVE;
 }
 /******************************************************************************/
+static void moloch_http_send_queue(MolochHttpRequest_t *request)
+{
+    if (request->headerList) {
+        curl_easy_setopt(request->easy, CURLOPT_HTTPHEADER, request->headerList);
+    }
+
+    MOLOCH_LOCK(requests);
+    DLL_PUSH_TAIL(rqt_, &requests, request);
+
+    if (!requestsTimer)
+        requestsTimer = g_timeout_add(0, moloch_http_send_timer_callback, NULL);
+    MOLOCH_UNLOCK(requests);
+}
+/******************************************************************************/
+static void moloch_http_compress(z_stream *z_strm, MolochHttpRequest_t *request)
+{
+    MolochHttpServer_t *server = request->server;
+    uint32_t            data_len = request->dataOutLen;
+    char               *buf = moloch_http_get_buffer(data_len);
+    struct timeval      startTime;
+    struct timeval      endTime;
+    int                 ret;
+
+    gettimeofday(&startTime, NULL);
+
+    z_strm->avail_in   = data_len;
+    z_strm->next_in    = (unsigned char *)request->dataOut;
+    z_strm->avail_out  = data_len;
+    z_strm->next_out   = (unsigned char *)buf;
+    ret = deflate(z_strm, Z_FINISH);
+
+    uint32_t out_len = data_len - z_strm->avail_out;
+    deflateReset(z_strm);
+
+    gettimeofday(&endTime, NULL);
+    MOLOCH_THREAD_INCR_NUM(server->compressUsecs, (endTime.tv_sec - startTime.tv_sec)*1000000 + (endTime.tv_usec - startTime.tv_usec));
+    MOLOCH_THREAD_INCR_NUM(server->compressIn, data_len);
+
+    if (ret == Z_STREAM_END) {
+        MOLOCH_THREAD_INCR_NUM(server->compressOut, out_len);
+        if (config.compressESMethod == MOLOCH_COMPRESS_GZIP)
+            request->headerList = curl_slist_append(request->headerList, "Content-Encoding: gzip");
+        else
+            request->headerList = curl_slist_append(request->headerList, "Content-Encoding: deflate");
+        MOLOCH_SIZE_FREE(buffer, request->dataOut);
+        request->dataOut    = buf;
+        request->dataOutLen = out_len;
+
+        curl_easy_setopt(request->easy, CURLOPT_INFILESIZE, out_len);
+        curl_easy_setopt(request->easy, CURLOPT_POSTFIELDSIZE, out_len);
+        curl_easy_setopt(request->easy, CURLOPT_POSTFIELDS, buf);
+    } else {
+        MOLOCH_THREAD_INCR_NUM(server->compressOut, data_len);
+        MOLOCH_SIZE_FREE(buffer, buf);
+    }
+
+    /* Move the size below which we don't bother compressing an eighth of the
+     * way at a time so one odd body can't swing it.  A bad ratio pulls it up
+     * toward twice the body size, a good one decays it back toward the
+     * minimum and anything in between leaves it alone.  The workers share it,
+     * losing an update to another worker is fine.
+     */
+    uint32_t compressMin = __sync_fetch_and_add(&server->compressMin, 0);
+    uint32_t newMin = compressMin;
+    if (ret != Z_STREAM_END || out_len > data_len - data_len/10) {
+        uint32_t target = MIN(data_len*2, MOLOCH_HTTP_COMPRESS_MAX);
+        if (target > compressMin)
+            newMin = compressMin + (target - compressMin + 7)/8;
+    } else if (out_len < data_len/2) {
+        newMin = compressMin - (compressMin - MOLOCH_HTTP_COMPRESS_MIN)/8;
+    }
+    if (newMin != compressMin)
+        __sync_bool_compare_and_swap(&server->compressMin, compressMin, newMin);
+}
+/******************************************************************************/
+/* Called with compressQ locked, queue to curl the done requests at the front */
+static void moloch_http_compress_release()
+{
+    MolochHttpRequest_t *request;
+
+    while (DLL_COUNT(rqo_, &orderQ) > 0 && orderQ.rqo_next->compressDone) {
+        DLL_POP_HEAD(rqo_, &orderQ, request);
+        moloch_http_send_queue(request);
+    }
+}
+/******************************************************************************/
+static void *moloch_http_compress_thread(void *UNUSED(arg))
+{
+    MolochHttpRequest_t *request;
+    z_stream             z_strm;
+
+    z_strm.zalloc = Z_NULL;
+    z_strm.zfree  = Z_NULL;
+    z_strm.opaque = Z_NULL;
+    deflateInit2(&z_strm, config.compressESLevel, Z_DEFLATED,
+                 (config.compressESMethod == MOLOCH_COMPRESS_GZIP?16:0) + 15, 8, Z_DEFAULT_STRATEGY);
+
+    while (1) {
+        MOLOCH_LOCK(compressQ);
+        while (DLL_COUNT(rqt_, &compressQ) == 0) {
+            MOLOCH_COND_WAIT(compressQ);
+        }
+        DLL_POP_HEAD(rqt_, &compressQ, request);
+        MOLOCH_UNLOCK(compressQ);
+
+        moloch_http_compress(&z_strm, request);
+
+        MOLOCH_LOCK(compressQ);
+        request->compressDone = 1;
+        moloch_http_compress_release();
+        MOLOCH_UNLOCK(compressQ);
+    }
+
+    return NULL;
+}
+/******************************************************************************/
+void moloch_http_compress_stats(void *serverV, uint64_t *in, uint64_t *out, uint64_t *usecs, uint32_t *skipped)
+{
+    MolochHttpServer_t *server = serverV;
+
+    *in      = server?server->compressIn:0;
+    *out     = server?server->compressOut:0;
+    *usecs   = server?server->compressUsecs:0;
+    *skipped = server?server->compressSkipped:0;
+}
+/******************************************************************************/
 gboolean moloch_http_send(void *serverV, const char *method, const char *key, uint32_t key_len, char *data, uint32_t data_len, char **headers, gboolean dropable, MolochHttpResponse_cb func, gpointer uw)
 {
     MolochHttpServer_t        *server = serverV;
@@ -527,28 +712,6 @@ gboolean moloch_http_send(void *serverV, const char *method, const char *key, ui
         }
     }
 
-    // Do we need to compress item
-    if (server->compress && data && data_len > 1000) {
-        char            *buf = moloch_http_get_buffer(data_len);
-        int              ret;
-
-        z_strm.avail_in   = data_len;
-        z_strm.next_in    = (unsigned char *)data;
-        z_strm.avail_out  = data_len;
-        z_strm.next_out   = (unsigned char *)buf;
-        ret = deflate(&z_strm, Z_FINISH);
-        if (ret == Z_STREAM_END) {
-            request->headerList = curl_slist_append(request->headerList, "Content-Encoding: deflate");
-            MOLOCH_SIZE_FREE(buffer, data);
-            data_len = data_len - z_strm.avail_out;
-            data     = buf;
-        } else {
-            MOLOCH_SIZE_FREE(buffer, buf);
-        }
-
-        deflateReset(&z_strm);
-    }
-
     request->server     = server;
     request->func       = func;
     request->uw         = uw;
@@ -568,10 +731,6 @@ gboolean moloch_http_send(void *serverV, const char *method, const char *key, ui
     curl_easy_setopt(request->easy, CURLOPT_CLOSESOCKETFUNCTION, moloch_http_curl_close_callback);
     curl_easy_setopt(request->easy, CURLOPT_CLOSESOCKETDATA, server);
 
-    if (request->headerList) {
-        curl_easy_setopt(request->easy, CURLOPT_HTTPHEADER, request->headerList);
-    }
-
     if (method[0] != 'G') {
         curl_easy_setopt(request->easy, CURLOPT_CUSTOMREQUEST, method);
         curl_easy_setopt(request->easy, CURLOPT_INFILESIZE, data_len);
@@ -606,13 +765,29 @@ gboolean moloch_http_send(void *serverV, const char *method, const char *key, ui
     LOG("HTTPDEBUG INCR %s %p %d %s", server->names[0], request, server->outstanding, request->url);
 #endif
     server->outstanding++;
-
-    DLL_PUSH_TAIL(rqt_, &requests, request);
-
-    if (!requestsTimer)
-        requestsTimer = g_timeout_add(0, moloch_http_send_timer_callback, NULL);
     MOLOCH_UNLOCK(requests);
 
+    // Do we need to compress item, bodies that aren't still wait their turn behind ones that are
+    if (server->compress && data) {
+        MOLOCH_LOCK(compressQ);
+        DLL_PUSH_TAIL(rqo_, &orderQ, request);
+        if (data_len <= MOLOCH_HTTP_COMPRESS_MIN) {
+            request->compressDone = 1;
+            moloch_http_compress_release();
+        } else if (data_len < __sync_fetch_and_add(&server->compressMin, 0) && (MOLOCH_THREAD_INCR(server->compressProbe) & 0x3f) != 0) {
+            // Small bodies that haven't been compressing well are skipped, but still probe now and then
+            MOLOCH_THREAD_INCR(server->compressSkipped);
+            request->compressDone = 1;
+            moloch_http_compress_release();
+        } else {
+            DLL_PUSH_TAIL(rqt_, &compressQ, request);
+            MOLOCH_COND_SIGNAL(compressQ);
+        }
+        MOLOCH_UNLOCK(compressQ);
+        return 0;
+    }
+
+    moloch_http_send_queue(request);
     return 0;
 }
 
@@ -648,6 +823,22 @@ void moloch_http_free_server(void *serverV)
 
     g_source_remove(server->multiTimer);
 
+    // Wait for the compression workers, including ones in the middle of a
+    // request, then hand curl anything they queued
+    while (1) {
+        MOLOCH_LOCK(compressQ);
+        int count = DLL_COUNT(rqo_, &orderQ);
+        MOLOCH_UNLOCK(compressQ);
+        MOLOCH_LOCK(requests);
+        count += DLL_COUNT(rqt_, &requests);
+        MOLOCH_UNLOCK(requests);
+        if (count == 0)
+            break;
+        moloch_http_send_timer_callback(NULL);
+        usleep(1000);
+    }
+    curl_multi_perform(server->multi, &server->multiRunning);
+
     // Finish any still running requests
     while (server->multiRunning) {
         curl_multi_perform(server->multi, &server->multiRunning);
@@ -705,6 +896,16 @@ void *moloch_http_create_server(const char *hostnames, int defaultPort, int maxC
     server->maxConns = maxConns;
     server->maxOutstandingRequests = maxOutstandingRequests;
     server->compress = compress;
+    server->compressMin = MOLOCH_HTTP_COMPRESS_MIN;
+
+    if (compress && !compressThreadsStarted) {
+        compressThreadsStarted = 1;
+        for (i = 0; i < config.compressESThreads; i++) {
+            char name[100];
+            snprintf(name, sizeof(name), "moloch-comp%d", i);
+            moloch_threads_new(MOLOCH_THREAD_ES, i, name, &moloch_http_compress_thread, NULL);
+        }
+    }
 
     server->multi = curl_multi_init();
     curl_multi_setopt(server->multi, CURLMOPT_SOCKETFUNCTION, moloch_http_curlm_socket_callback);
@@ -719,18 +920,26 @@ void *moloch_http_create_server(const char *hostnames, int defaultPort, int maxC
     return server;
 }
 /******************************************************************************/
-void moloch_http_init()
+/* For moloch-bench, requests go through the same queues and compression but
+ * are never sent
+ */
+void *moloch_http_create_null_server(int compress)
 {
-    z_strm.zalloc = Z_NULL;
-    z_strm.zfree  = Z_NULL;
-    z_strm.opaque = Z_NULL;
-    deflateInit(&z_strm, Z_DEFAULT_COMPRESSION);
+    MolochHttpServer_t *server = moloch_http_create_server("null", 9200, 1, 0xffff, compress);
 
+    server->null = 1;
+    return server;
+}
+/******************************************************************************/
+void moloch_http_init()
+{
     curl_global_init(CURL_GLOBAL_SSL);
 
     HASH_INIT(h_, connections, moloch_session_hash, moloch_http_conn_cmp);
     memset(&connectionsSet, 0, sizeof(connectionsSet));
     DLL_INIT(rqt_, &requests);
+    DLL_INIT(rqt_, &compressQ);
+    DLL_INIT(rqo_, &orderQ);
 }
 /******************************************************************************/
 void moloch_http_exit()
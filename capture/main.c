@@ -43,6 +43,7 @@ MOLOCH_LOCK_DEFINE(LOG);
 
 /******************************************************************************/
 static gboolean showVersion    = FALSE;
+static gboolean digestBench    = FALSE;
 
 /******************************************************************************/
 gboolean moloch_debug_flag()
@@ -72,6 +73,10 @@ static GOptionEntry entries[] =
     { "nospi",       0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,           &config.noSPI,         "no SPI data written to ES", NULL },
     { "tests",       0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,           &config.tests,         "Output test suite information", NULL },
     { "noLoadTags",  0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,           &config.noLoadTags,    "Don't load tags at startup", NULL },
+    { "digestbench", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,           &digestBench,          "Compare the body digest engines and exit", NULL },
+    { "bench",       0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,           &config.bench,         "Replay the -r files from memory and report timing as JSON", NULL },
+    { "benchloops",  0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT,            &config.benchLoops,    "With --bench number of times to replay the files, default 1", NULL },
+    { "benchpps",    0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT,            &config.benchPps,      "With --bench target packets per second, default as fast as possible", NULL },
     { NULL,          0, 0,                                    0,           NULL, NULL, NULL }
 };
 
@@ -151,6 +156,23 @@ void parse_args(int argc, char **argv)
         config.dryRun = 1;
     }
 
+    // moloch-bench is the only build with the allocation counter
+    if (moloch_bench_allocs)
+        config.bench = 1;
+
+    if (config.bench) {
+        if (!config.pcapReadFiles) {
+            printf("--bench requires -r\n");
+            exit(1);
+        }
+        config.dryRun = 1;
+        // Keep stdout for the JSON report
+        if (!config.debug)
+            config.quiet = 1;
+        if (config.benchLoops <= 0)
+            config.benchLoops = 1;
+    }
+
     if (config.pcapSkip && config.copyPcap)  {
         printf("Can't skip and copy pcap files\n");
         exit(1);
@@ -197,9 +219,26 @@ void controlc(int UNUSED(sig))
     moloch_quit();
 }
 /******************************************************************************/
+/* Only set a flag in the signal handler, the real reload happens on the
+ * main thread in moloch_reload_gfunc
+ */
+static volatile sig_atomic_t reloadNeeded;
+
 void reload(int UNUSED(sig))
 {
+    reloadNeeded = 1;
+}
+/******************************************************************************/
+static gboolean moloch_reload_gfunc (gpointer UNUSED(user_data))
+{
+    if (!reloadNeeded)
+        return TRUE;
+
+    reloadNeeded = 0;
+    LOG("Reloading");
+    moloch_yara_reload();
     moloch_plugins_reload();
+    return TRUE;
 }
 /******************************************************************************/
 unsigned char *moloch_js0n_get(unsigned char *data, uint32_t len, char *key, uint32_t *olen)
@@ -488,7 +527,9 @@ gboolean moloch_ready_gfunc (gpointer UNUSED(user_data))
     if (config.debug)
         LOG("maxField = %d", config.maxField);
 
-    if (config.pcapReadOffline) {
+    if (config.bench) {
+        moloch_writers_start("null");
+    } else if (config.pcapReadOffline) {
         if (config.dryRun || !config.copyPcap) {
             moloch_writers_start("inplace");
         } else {
@@ -580,11 +621,19 @@ int main(int argc, char **argv)
     parse_args(argc, argv);
     moloch_hex_init();
     moloch_config_init();
+    moloch_digest_init();
+    if (digestBench) {
+        moloch_digest_bench();
+        exit(0);
+    }
+    moloch_threads_init();
     moloch_writers_init();
     moloch_readers_init();
     moloch_plugins_init();
     moloch_plugins_load(config.rootPlugins);
-    if (config.pcapReadOffline)
+    if (config.bench)
+        moloch_readers_set("bench");
+    else if (config.pcapReadOffline)
         moloch_readers_set("libpcap-file");
     else
         moloch_readers_set(NULL);
@@ -601,14 +650,19 @@ int main(int argc, char **argv)
     moloch_yara_init();
     moloch_parsers_init();
     moloch_session_init();
+    moloch_memory_init();
+    moloch_metrics_init();
     moloch_plugins_load(config.plugins);
     g_timeout_add(1, moloch_ready_gfunc, 0);
+    g_timeout_add_seconds(1, moloch_reload_gfunc, 0);
 
     g_main_loop_run(mainLoop);
 
     LOG("Final cleanup");
+    moloch_metrics_exit();
     moloch_plugins_exit();
     moloch_parsers_exit();
+    moloch_packet_exit();
     moloch_yara_exit();
     moloch_db_exit();
     moloch_http_exit();
@@ -617,6 +671,9 @@ int main(int argc, char **argv)
 
     g_main_loop_unref(mainLoop);
 
+    if (config.bench)
+        moloch_bench_report();
+
     if (!config.dryRun && config.copyPcap) {
         moloch_writer_exit();
     }
@@ -0,0 +1,145 @@
+/******************************************************************************/
+/* memory.c  -- Global memory governor, sheds load before the OOM killer does
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+
+extern MolochConfig_t        config;
+extern void                 *esServer;
+
+/******************************************************************************/
+/* Counters are per packet thread and padded so the threads don't share cache
+ * lines, the main thread sums them up when it recomputes the level.
+ */
+typedef struct {
+    volatile int64_t   bytes[MOLOCH_MEMORY_NUM];
+    char               pad[64 - 8*MOLOCH_MEMORY_NUM];
+} MolochMemoryThread_t;
+
+LOCAL MolochMemoryThread_t memoryThreads[MOLOCH_MAX_PACKET_THREADS];
+
+LOCAL uint64_t             watermarks[MOLOCH_MEMORY_LEVEL_NUM];
+LOCAL uint64_t             memoryUsed;
+LOCAL uint32_t             memoryTransitions;
+LOCAL uint64_t             memoryShed[MOLOCH_MEMORY_LEVEL_NUM];
+LOCAL uint32_t             sessionSize;
+
+volatile int               memoryLevel;
+
+LOCAL char                *levelNames[MOLOCH_MEMORY_LEVEL_NUM] = {"ok", "stop-spi", "truncate-tcp", "mid-save", "drop"};
+
+/******************************************************************************/
+void moloch_memory_add(int thread, int type, int64_t bytes)
+{
+    __sync_add_and_fetch(&memoryThreads[thread].bytes[type], bytes);
+}
+/******************************************************************************/
+void moloch_memory_shed(int level)
+{
+    __sync_add_and_fetch(&memoryShed[level], 1);
+}
+/******************************************************************************/
+uint64_t moloch_memory_used()
+{
+    return memoryUsed;
+}
+/******************************************************************************/
+uint32_t moloch_memory_transitions()
+{
+    return memoryTransitions;
+}
+/******************************************************************************/
+uint64_t moloch_memory_shed_count(int level)
+{
+    return memoryShed[level];
+}
+/******************************************************************************/
+/* Sessions are estimated from the count since most of their memory is fixed,
+ * writer and ES buffers from their queue lengths, everything else is counted
+ * as it is allocated and freed.
+ */
+LOCAL uint64_t moloch_memory_total()
+{
+    int64_t total = 0;
+    int     t, type;
+
+    for (t = 0; t < config.packetThreads; t++) {
+        for (type = 0; type < MOLOCH_MEMORY_NUM; type++) {
+            total += memoryThreads[t].bytes[type];
+        }
+    }
+
+    total += (int64_t)moloch_session_monitoring() * sessionSize;
+    if (moloch_writer_queue_length)
+        total += (int64_t)moloch_writer_queue_length() * config.pcapWriteSize;
+    total += (int64_t)moloch_http_queue_length(esServer) * config.dbBulkSize;
+
+    return total < 0?0:total;
+}
+/******************************************************************************/
+/* Going up a level happens as soon as a watermark is crossed, coming back down
+ * waits until usage is 10% under it so we don't flap around the line.
+ */
+LOCAL gboolean moloch_memory_gfunc (gpointer UNUSED(user_data))
+{
+    int level = memoryLevel;
+
+    memoryUsed = moloch_memory_total();
+
+    while (level + 1 < MOLOCH_MEMORY_LEVEL_NUM && memoryUsed >= watermarks[level + 1])
+        level++;
+
+    while (level > MOLOCH_MEMORY_OK && memoryUsed < watermarks[level] / 10 * 9)
+        level--;
+
+    if (level != memoryLevel) {
+        LOG("%s memory level %s -> %s, using %" PRIu64 "MB of %uMB",
+            level > memoryLevel?"WARNING -":"INFO -",
+            levelNames[memoryLevel], levelNames[level],
+            memoryUsed/(1024*1024), config.memoryLimit);
+        memoryLevel = level;
+        memoryTransitions++;
+    }
+
+    return TRUE;
+}
+/******************************************************************************/
+void moloch_memory_init()
+{
+    int i;
+
+    if (!config.memoryLimit)
+        return;
+
+    uint32_t percents[MOLOCH_MEMORY_LEVEL_NUM] = {0, 70, 80, 90, 100};
+    if (config.memoryWatermarks) {
+        for (i = 0; config.memoryWatermarks[i] && i + 1 < MOLOCH_MEMORY_LEVEL_NUM; i++) {
+            percents[i + 1] = atoi(config.memoryWatermarks[i]);
+        }
+    }
+
+    for (i = 1; i < MOLOCH_MEMORY_LEVEL_NUM; i++) {
+        if (percents[i] < percents[i - 1] || percents[i] > 100) {
+            LOG("memoryWatermarks must be increasing percents of memoryLimit, not more then 100");
+            exit(1);
+        }
+        watermarks[i] = config.memoryLimit * 1024ULL * 1024ULL * percents[i] / 100;
+    }
+
+    sessionSize = sizeof(MolochSession_t) + config.maxField * sizeof(MolochField_t *) + 1000;
+
+    g_timeout_add(250, moloch_memory_gfunc, 0);
+}
@@ -0,0 +1,303 @@
+/******************************************************************************/
+/* metrics.c  -- Per thread counters and latency histograms, served in the
+ *               Prometheus text format
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+extern MolochConfig_t        config;
+extern void                 *esServer;
+extern uint64_t              totalPackets;
+extern uint64_t              totalBytes;
+extern uint64_t              totalSessions;
+
+extern MolochWriterQueueLength moloch_writer_queue_length;
+
+/******************************************************************************/
+/* Histograms have a bucket per power of two microseconds, bucket b holds
+ * values less than 2^b, the last one is everything bigger.
+ */
+#define MOLOCH_METRICS_BUCKETS 40
+
+/* Each packet thread only writes its own slot, the other threads share the
+ * last slot and use atomics.  Slots are aligned so they don't share lines.
+ */
+typedef struct {
+    uint64_t           counters[MOLOCH_METRICS_COUNTER_NUM];
+    uint64_t           histos[MOLOCH_METRICS_HISTO_NUM][MOLOCH_METRICS_BUCKETS];
+    uint64_t           sums[MOLOCH_METRICS_HISTO_NUM];
+} __attribute__((aligned(64))) MolochMetricsThread_t;
+
+LOCAL MolochMetricsThread_t metricsThreads[MOLOCH_MAX_PACKET_THREADS + 1];
+
+LOCAL struct {
+    char *name;
+    char *help;
+} counterInfo[MOLOCH_METRICS_COUNTER_NUM] = {
+    {"moloch_packet_thread_sessions_saved_total", "Session records saved by each packet thread"}
+};
+
+LOCAL struct {
+    char *name;
+    char *help;
+} histoInfo[MOLOCH_METRICS_HISTO_NUM] = {
+    {"moloch_packet_age_seconds",    "Time from packet capture timestamp to packet thread processing, live capture only"},
+    {"moloch_session_save_seconds",  "Time to build a session record"},
+    {"moloch_es_bulk_seconds",       "Elasticsearch bulk request round trip"},
+    {"moloch_disk_write_seconds",    "Time for each pcap write call"},
+    {"moloch_parser_seconds",        "Time spent in the parsers for each packet"}
+};
+
+LOCAL int                  listenFds[2] = {-1, -1};
+
+/******************************************************************************/
+uint64_t moloch_metrics_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/******************************************************************************/
+void moloch_metrics_count(int thread, int counter, uint64_t n)
+{
+    if (thread == MOLOCH_METRICS_OTHER_THREAD)
+        __sync_add_and_fetch(&metricsThreads[thread].counters[counter], n);
+    else
+        metricsThreads[thread].counters[counter] += n;
+}
+/******************************************************************************/
+void moloch_metrics_observe(int thread, int histo, uint64_t usecs)
+{
+    int bucket = usecs?64 - __builtin_clzll(usecs):0;
+    if (bucket >= MOLOCH_METRICS_BUCKETS)
+        bucket = MOLOCH_METRICS_BUCKETS - 1;
+
+    if (thread == MOLOCH_METRICS_OTHER_THREAD) {
+        __sync_add_and_fetch(&metricsThreads[thread].histos[histo][bucket], 1);
+        __sync_add_and_fetch(&metricsThreads[thread].sums[histo], usecs);
+    } else {
+        metricsThreads[thread].histos[histo][bucket]++;
+        metricsThreads[thread].sums[histo] += usecs;
+    }
+}
+/******************************************************************************/
+LOCAL void moloch_metrics_gauge(GString *out, char *name, char *help, int64_t value)
+{
+    g_string_append_printf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %" PRId64 "\n", name, help, name, name, value);
+}
+/******************************************************************************/
+LOCAL void moloch_metrics_counter(GString *out, char *name, char *help, uint64_t value)
+{
+    g_string_append_printf(out, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, value);
+}
+/******************************************************************************/
+/* The packet thread slots are read without locking, a scrape can be a few
+ * updates behind which doesn't matter for counters.
+ */
+LOCAL GString *moloch_metrics_build()
+{
+    GString *out = g_string_sized_new(16000);
+    int      t, c, h, b;
+
+    moloch_metrics_counter(out, "moloch_packets_total", "Packets read by capture", totalPackets);
+    moloch_metrics_counter(out, "moloch_bytes_total", "Bytes read by capture", totalBytes);
+    moloch_metrics_counter(out, "moloch_sessions_total", "Session records saved", totalSessions);
+
+    MolochReaderStats_t stats;
+    if (moloch_reader_stats && moloch_reader_stats(&stats) == 0) {
+        moloch_metrics_counter(out, "moloch_reader_dropped_total", "Packets dropped by the reader", stats.dropped);
+    }
+
+    moloch_metrics_gauge(out, "moloch_sessions_active", "Sessions in memory", moloch_session_monitoring());
+    moloch_metrics_gauge(out, "moloch_es_queue_depth", "Outstanding elasticsearch requests", moloch_http_queue_length(esServer));
+    if (moloch_writer_queue_length)
+        moloch_metrics_gauge(out, "moloch_writer_queue_depth", "Pcap buffers waiting to be written", moloch_writer_queue_length());
+    if (config.memoryLimit)
+        moloch_metrics_gauge(out, "moloch_memory_used_bytes", "Memory governor estimate of memory used", moloch_memory_used());
+
+    // Per packet thread stats are kept by packet.c
+    GString *lines[4];
+    for (c = 0; c < 4; c++) {
+        lines[c] = g_string_sized_new(1000);
+    }
+    g_string_append(lines[0], "# HELP moloch_packet_thread_packets_total Packets processed by each packet thread\n# TYPE moloch_packet_thread_packets_total counter\n");
+    g_string_append(lines[1], "# HELP moloch_packet_thread_bytes_total Bytes processed by each packet thread\n# TYPE moloch_packet_thread_bytes_total counter\n");
+    g_string_append(lines[2], "# HELP moloch_packet_thread_overload_drops_total Packets dropped because the packet thread queue was full\n# TYPE moloch_packet_thread_overload_drops_total counter\n");
+    g_string_append(lines[3], "# HELP moloch_packet_queue_depth Packets waiting for each packet thread\n# TYPE moloch_packet_queue_depth gauge\n");
+    for (t = 0; t < config.packetThreads; t++) {
+        uint64_t packets, bytes;
+        uint32_t drops;
+        int      queued;
+
+        moloch_packet_thread_stats(t, &packets, &bytes, &drops, &queued);
+        g_string_append_printf(lines[0], "moloch_packet_thread_packets_total{thread=\"%d\"} %" PRIu64 "\n", t, packets);
+        g_string_append_printf(lines[1], "moloch_packet_thread_bytes_total{thread=\"%d\"} %" PRIu64 "\n", t, bytes);
+        g_string_append_printf(lines[2], "moloch_packet_thread_overload_drops_total{thread=\"%d\"} %u\n", t, drops);
+        g_string_append_printf(lines[3], "moloch_packet_queue_depth{thread=\"%d\"} %d\n", t, queued);
+    }
+    for (c = 0; c < 4; c++) {
+        g_string_append_len(out, lines[c]->str, lines[c]->len);
+        g_string_free(lines[c], TRUE);
+    }
+
+    for (c = 0; c < MOLOCH_METRICS_COUNTER_NUM; c++) {
+        g_string_append_printf(out, "# HELP %s %s\n# TYPE %s counter\n", counterInfo[c].name, counterInfo[c].help, counterInfo[c].name);
+        for (t = 0; t < config.packetThreads; t++) {
+            g_string_append_printf(out, "%s{thread=\"%d\"} %" PRIu64 "\n", counterInfo[c].name, t, metricsThreads[t].counters[c]);
+        }
+    }
+
+    // Histograms from all the threads are merged, output is cumulative
+    for (h = 0; h < MOLOCH_METRICS_HISTO_NUM; h++) {
+        uint64_t buckets[MOLOCH_METRICS_BUCKETS];
+        uint64_t sum = 0;
+
+        memset(buckets, 0, sizeof(buckets));
+        for (t = 0; t <= MOLOCH_MAX_PACKET_THREADS; t++) {
+            for (b = 0; b < MOLOCH_METRICS_BUCKETS; b++) {
+                buckets[b] += metricsThreads[t].histos[h][b];
+            }
+            sum += metricsThreads[t].sums[h];
+        }
+
+        g_string_append_printf(out, "# HELP %s %s\n# TYPE %s histogram\n", histoInfo[h].name, histoInfo[h].help, histoInfo[h].name);
+        uint64_t count = 0;
+        for (b = 0; b < MOLOCH_METRICS_BUCKETS - 1; b++) {
+            count += buckets[b];
+            g_string_append_printf(out, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", histoInfo[h].name, ((1ULL << b) - 1)/1000000.0, count);
+        }
+        count += buckets[MOLOCH_METRICS_BUCKETS - 1];
+        g_string_append_printf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", histoInfo[h].name, count);
+        g_string_append_printf(out, "%s_sum %.6f\n", histoInfo[h].name, sum/1000000.0);
+        g_string_append_printf(out, "%s_count %" PRIu64 "\n", histoInfo[h].name, count);
+    }
+
+    return out;
+}
+/******************************************************************************/
+/* Every request gets the metrics no matter the path, the response is small
+ * enough to write before going back to the main loop.
+ */
+LOCAL gboolean moloch_metrics_request_cb(gint fd, GIOCondition UNUSED(cond), gpointer UNUSED(data))
+{
+    char buf[4096];
+
+    if (read(fd, buf, sizeof(buf)) <= 0) {
+        close(fd);
+        return FALSE;
+    }
+
+    GString *body = moloch_metrics_build();
+    char     header[200];
+    int      hlen = snprintf(header, sizeof(header),
+                             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                             body->len);
+
+    struct timeval tv = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (write(fd, header, hlen) == hlen) {
+        size_t pos = 0;
+        while (pos < body->len) {
+            ssize_t len = write(fd, body->str + pos, body->len - pos);
+            if (len <= 0)
+                break;
+            pos += len;
+        }
+    }
+
+    g_string_free(body, TRUE);
+    close(fd);
+    return FALSE;
+}
+/******************************************************************************/
+LOCAL gboolean moloch_metrics_accept_cb(gint fd, GIOCondition UNUSED(cond), gpointer UNUSED(data))
+{
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            LOG("ERROR - metrics accept failed %s", strerror(errno));
+        return TRUE;
+    }
+
+    moloch_watch_fd(client, MOLOCH_GIO_READ_COND, moloch_metrics_request_cb, NULL);
+    return TRUE;
+}
+/******************************************************************************/
+LOCAL int moloch_metrics_listen(int fd, struct sockaddr *addr, socklen_t len, char *name)
+{
+    if (fd < 0 || bind(fd, addr, len) < 0 || listen(fd, 16) < 0) {
+        LOG("ERROR - Couldn't listen for metrics on %s - %s", name, strerror(errno));
+        exit(1);
+    }
+
+    moloch_watch_fd(fd, MOLOCH_GIO_READ_COND, moloch_metrics_accept_cb, NULL);
+    if (config.debug)
+        LOG("Metrics listening on %s", name);
+    return fd;
+}
+/******************************************************************************/
+void moloch_metrics_init()
+{
+    if (config.metricsPort) {
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(config.metricsPort);
+        if (inet_pton(AF_INET, config.metricsHost, &sin.sin_addr) != 1) {
+            LOG("ERROR - metricsHost %s must be an ip address", config.metricsHost);
+            exit(1);
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (fd >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        listenFds[0] = moloch_metrics_listen(fd, (struct sockaddr *)&sin, sizeof(sin), config.metricsHost);
+    }
+
+    if (config.metricsSocket) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(config.metricsSocket) >= sizeof(sun.sun_path)) {
+            LOG("ERROR - metricsSocket %s is too long", config.metricsSocket);
+            exit(1);
+        }
+        strcpy(sun.sun_path, config.metricsSocket);
+        unlink(config.metricsSocket);
+
+        listenFds[1] = moloch_metrics_listen(socket(AF_UNIX, SOCK_STREAM, 0), (struct sockaddr *)&sun, sizeof(sun), config.metricsSocket);
+    }
+
+    config.metrics = (listenFds[0] != -1 || listenFds[1] != -1);
+}
+/******************************************************************************/
+void moloch_metrics_exit()
+{
+    if (listenFds[0] != -1)
+        close(listenFds[0]);
+    if (listenFds[1] != -1) {
+        close(listenFds[1]);
+        unlink(config.metricsSocket);
+    }
+}
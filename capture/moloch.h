@@ -107,9 +107,10 @@ typedef struct {
     char                orgUtf8;
 } MolochCertInfo_t;
 
-typedef struct moloch_tlsinfo {
-    struct moloch_tlsinfo *t_next, *t_prev;
-    uint32_t               t_hash;
+/* Parsed certs are refcounted and never changed once built, so the same one
+ * can be shared by every session that sees it
+ */
+typedef struct {
     uint64_t               notBefore;
     uint64_t               notAfter;
     MolochCertInfo_t       issuer;
@@ -117,12 +118,20 @@ typedef struct moloch_tlsinfo {
     MolochStringHead_t     alt;
     unsigned char         *serialNumber;
     short                  serialNumberLen;
-    short                  t_bucket;
+    volatile int           refs;
     unsigned char          hash[60];
 } MolochCertsInfo_t;
 
+/* A session's reference to a cert */
+typedef struct moloch_tlsref {
+    struct moloch_tlsref  *t_next, *t_prev;
+    MolochCertsInfo_t     *certs;
+    uint32_t               t_hash;
+    short                  t_bucket;
+} MolochCertsInfoRef_t;
+
 typedef struct {
-    struct moloch_tlsinfo *t_next, *t_prev;
+    struct moloch_tlsref  *t_next, *t_prev;
     int                    t_count;
 } MolochCertsInfoHead_t;
 
@@ -160,6 +169,8 @@ typedef HASH_VAR(s_, MolochCertsInfoHashStd_t, MolochCertsInfoHead_t, 5);
 #define MOLOCH_FIELD_FLAG_FAKE               0x0010
 /* Don't create in capture list */ 
 #define MOLOCH_FIELD_FLAG_DISABLED           0x0020
+/* Few distinct values, sessions share one copy of each (STR_HASH only) */
+#define MOLOCH_FIELD_FLAG_INTERN             0x0040
 
 /* These are ones you shouldn't set, for old cruf before we were smarter */
 /* XXXcnt - dont use */
@@ -194,8 +205,20 @@ typedef struct moloch_field_info {
     int                       pos;
     uint16_t                  type;
     uint16_t                  flags;
+    struct moloch_field_intern *intern;
 } MolochFieldInfo_t;
 
+/* An interned value, a STR_HASH entry points to it from uw.  The json is
+ * already quoted and escaped so saving just copies it.
+ */
+typedef struct {
+    char                     *json;
+    uint32_t                  hash;
+    uint16_t                  len;
+    uint16_t                  jsonLen;
+    char                      str[];
+} MolochFieldInternValue_t;
+
 typedef struct {
     union {
         char                     *str;
@@ -206,10 +229,27 @@ typedef struct {
         MolochIntHashStd_t       *ihash;
         MolochCertsInfoHashStd_t *cihash;
         GHashTable               *ghash;
+        int                      *ints;
     };
     uint32_t                   jsonSize;
+    uint16_t                   intsNum;   // INT_GHASH/IP_GHASH values still in ints, 0 once moved to ghash
 } MolochField_t;
 
+/* Walks an INT_GHASH or IP_GHASH field the same way as a GHashTableIter */
+typedef struct {
+    MolochField_t             *field;
+    int                        pos;
+    GHashTableIter             iter;
+} MolochFieldIntsIter_t;
+
+/* Per session arena that the field values are allocated from */
+typedef struct moloch_field_chunk {
+    struct moloch_field_chunk *next;
+    uint32_t                   size;
+    uint32_t                   used;
+    char                       data[];
+} MolochFieldChunk_t;
+
 #define MOLOCH_LOCK_DEFINE(var)         pthread_mutex_t var##_mutex = PTHREAD_MUTEX_INITIALIZER
 #define MOLOCH_LOCK_EXTERN(var)         pthread_mutex_t var##_mutex
 #define MOLOCH_LOCK_INIT(var)           pthread_mutex_init(&var##_mutex, NULL)
@@ -224,6 +264,10 @@ typedef struct {
 #define MOLOCH_COND_BROADCAST(var)      pthread_cond_broadcast(&var##_cond)
 #define MOLOCH_COND_SIGNAL(var)         pthread_cond_signal(&var##_cond)
 
+#define MOLOCH_THREAD_INCR(var)         __sync_add_and_fetch(&var, 1)
+#define MOLOCH_THREAD_DECR(var)         __sync_sub_and_fetch(&var, 1)
+#define MOLOCH_THREAD_INCR_NUM(var, num) __sync_add_and_fetch(&var, num)
+
 #define MOLOCH_MAX_PACKET_THREADS 24
 
 #ifndef LOCAL
@@ -243,6 +287,8 @@ typedef struct {
  */
 enum MolochRotate { MOLOCH_ROTATE_HOURLY, MOLOCH_ROTATE_DAILY, MOLOCH_ROTATE_WEEKLY, MOLOCH_ROTATE_MONTHLY };
 enum MolochFilterType { MOLOCH_FILTER_DONT_SAVE, MOLOCH_FILTER_MIN_SAVE, MOLOCH_FILTER_MAX};
+enum MolochCompress { MOLOCH_COMPRESS_DEFLATE, MOLOCH_COMPRESS_GZIP };
+enum MolochMagicMode { MOLOCH_MAGICMODE_BOTH, MOLOCH_MAGICMODE_BASIC, MOLOCH_MAGICMODE_LIBMAGIC, MOLOCH_MAGICMODE_NONE };
 
 typedef struct moloch_config {
     gboolean  quitting;
@@ -265,12 +311,21 @@ typedef struct moloch_config {
     gboolean  pcapSkip;
     gboolean  flushBetween;
     gboolean  noLoadTags;
+    gboolean  bench;
+    gboolean  metrics;
+    int       benchLoops;
+    int       benchPps;
 
     enum MolochRotate rotate;
+    enum MolochCompress compressESMethod;
+    enum MolochMagicMode magicMode;
 
     int       writeMethod;
 
     HASH_VAR(s_, dontSaveTags, MolochStringHead_t, 11);
+    HASH_VAR(s_, elephantTags, MolochStringHead_t, 11);
+    HASH_VAR(s_, elephantProtocols, MolochStringHead_t, 11);
+    int32_t           *elephantPorts;
     MolochFieldInfo_t *fields[200];
     int                maxField;
 
@@ -292,6 +347,10 @@ typedef struct moloch_config {
     char     *geoip6File;
     char     *geoipASN6File;
     char     *rirFile;
+    char     *tagsSnapshot;
+    char     *digestEngine;
+    char     *metricsHost;
+    char     *metricsSocket;
     char     *dropUser;
     char     *dropGroup;
     char    **pluginsDir;
@@ -303,6 +362,7 @@ typedef struct moloch_config {
     char    **rootPlugins;
     char    **plugins;
     char    **smtpIpHeaders;
+    char    **memoryWatermarks;
 
     double    maxFileSizeG;
     uint64_t  maxFileSizeB;
@@ -323,6 +383,21 @@ typedef struct moloch_config {
     uint32_t  maxFreeOutputBuffers;
     uint32_t  fragsTimeout;
     uint32_t  maxFrags;
+    uint32_t  elephantKeepBytes;
+    uint32_t  elephantSnapLen;
+    uint32_t  elephantSampleRate;
+    uint32_t  compressESThreads;
+    uint32_t  yaraWindow;
+    uint32_t  yaraScanBytes;
+    uint32_t  yaraMaxBytes;
+    uint32_t  memoryLimit;
+    uint32_t  metricsPort;
+    uint32_t  pcapReadThreads;
+    uint32_t  pcapSessionOrderRunSize;
+    uint32_t  pcapSessionOrderMemory;
+    uint32_t  pcapSessionOrderDelay;
+    uint32_t  fileNumBlockSize;
+    int       compressESLevel;
 
     int       packetThreads;
 
@@ -333,9 +408,16 @@ typedef struct moloch_config {
     char      parseSMB;
     char      parseQSValue;
     char      parseCookieValue;
+    char      supportSha256;
     char      compressES;
     char      antiSynDrop;
     char      readTruncatedPackets;
+    char      packetThreadRebalance;
+    char      pcapIndex;
+    char      pcapSessionOrder;
+    char      elephant;
+    char      elephantAll;
+    char      elephantSample;
 } MolochConfig_t;
 
 typedef struct {
@@ -377,7 +459,9 @@ typedef struct molochpacket_t
     uint64_t       readerFilePos;  // where in input file
     char          *readerName;     // file name reader used
     uint32_t       writerFileNum;  // file number in db
+    uint32_t       hash;           // symmetric flow hash, same as moloch_session_hash
     uint16_t       pktlen;         // length of packet
+    uint16_t       writerCapLen;   // bytes writer should save, 0 for all of pktlen
     uint16_t       payloadLen;     // length of ip payload
     uint16_t       payloadOffset;  // offset to ip payload from start
     uint8_t        ipOffset;       // offset to ip header from start
@@ -430,11 +514,15 @@ typedef struct moloch_session {
     char                   sessionId[MOLOCH_SESSIONID_LEN];
 
     MolochField_t        **fields;
+    MolochFieldChunk_t    *fieldChunks;
+    struct moloch_writer_run *writerRun;
 
     void                  **pluginData;
 
     MolochParserInfo_t    *parserInfo;
 
+    struct moloch_yara_session *yara;
+
     MolochTcpDataHead_t   tcpData;
     uint32_t              tcpSeq[2];
     char                  tcpState[2];
@@ -451,6 +539,7 @@ typedef struct moloch_session {
     uint64_t               bytes[2];
     uint64_t               databytes[2];
     uint64_t               totalDatabytes[2];
+    uint64_t               unsavedBytes;
 
 
     uint32_t               lastFileNum;
@@ -458,6 +547,10 @@ typedef struct moloch_session {
     struct in6_addr        addr1;
     struct in6_addr        addr2;
     uint32_t               packets[2];
+    uint32_t               elephantBytes;
+    uint32_t               elephantSeen[2];
+    uint32_t               truncatedPackets;
+    uint32_t               skippedPackets;
 
     uint16_t               port1;
     uint16_t               port2;
@@ -484,6 +577,9 @@ typedef struct moloch_session {
     uint16_t               stopTCP:1;
     uint16_t               ses:3;
     uint16_t               midSave:1;
+    uint16_t               elephant:1;
+    uint16_t               noSPI:1;
+    uint16_t               sampleKept:1;
 } MolochSession_t;
 
 typedef struct moloch_session_head {
@@ -628,6 +724,8 @@ void     moloch_db_init();
 int      moloch_db_tags_loading();
 char    *moloch_db_create_file(time_t firstPacket, char *name, uint64_t size, int locked, uint32_t *id);
 void     moloch_db_save_session(MolochSession_t *session, int final);
+void     moloch_db_js0n_str(BSB *bsb, unsigned char *in, gboolean utf8);
+void     moloch_db_flush_thread(int thread);
 void     moloch_db_get_tag(void *uw, int tagtype, const char *tag, MolochTag_cb func);
 uint32_t moloch_db_peek_tag(const char *tagname);
 void     moloch_db_add_local_ip(char *str, MolochIpInfo_t *ii);
@@ -636,6 +734,109 @@ void     moloch_db_update_field(char *expression, char *name, char *value);
 gboolean moloch_db_file_exists(char *filename);
 void     moloch_db_exit();
 
+/******************************************************************************/
+/*
+ * digest.c
+ */
+#define MOLOCH_DIGEST_MD5     0
+#define MOLOCH_DIGEST_SHA256  1
+#define MOLOCH_DIGEST_NUM     2
+
+typedef struct moloch_digest MolochDigest_t;
+
+void            moloch_digest_init();
+MolochDigest_t *moloch_digest_new(int types);
+void            moloch_digest_reset(MolochDigest_t *digest);
+void            moloch_digest_update(MolochDigest_t *digest, const unsigned char *data, int len);
+const char     *moloch_digest_get_string(MolochDigest_t *digest, int type);
+void            moloch_digest_free(MolochDigest_t *digest);
+void            moloch_digest_bench();
+
+/******************************************************************************/
+/*
+ * memory.c
+ */
+#define MOLOCH_MEMORY_FIELDS          0
+#define MOLOCH_MEMORY_TCP             1
+#define MOLOCH_MEMORY_PACKETS         2
+#define MOLOCH_MEMORY_YARA            3
+#define MOLOCH_MEMORY_NUM             4
+
+/* Shedding levels, each one also does everything below it */
+#define MOLOCH_MEMORY_OK              0
+#define MOLOCH_MEMORY_STOP_SPI        1
+#define MOLOCH_MEMORY_TRUNCATE        2
+#define MOLOCH_MEMORY_MID_SAVE        3
+#define MOLOCH_MEMORY_DROP            4
+#define MOLOCH_MEMORY_LEVEL_NUM       5
+
+/* Only the string and cert fields are counted, they are the ones that grow */
+#define MOLOCH_MEMORY_FIELD_TYPE(type) ((type) == MOLOCH_FIELD_TYPE_STR || (type) == MOLOCH_FIELD_TYPE_STR_ARRAY || (type) == MOLOCH_FIELD_TYPE_STR_HASH || (type) == MOLOCH_FIELD_TYPE_CERTSINFO)
+#define MOLOCH_MEMORY_ADD(thread, type, bytes) do { if (config.memoryLimit) moloch_memory_add(thread, type, bytes); } while (0)
+
+void     moloch_memory_init();
+void     moloch_memory_add(int thread, int type, int64_t bytes);
+void     moloch_memory_shed(int level);
+uint64_t moloch_memory_used();
+uint32_t moloch_memory_transitions();
+uint64_t moloch_memory_shed_count(int level);
+
+/******************************************************************************/
+/*
+ * bench.c
+ */
+enum MolochBenchStage { MOLOCH_BENCH_DECODE, MOLOCH_BENCH_LOOKUP, MOLOCH_BENCH_REASSEMBLY, MOLOCH_BENCH_CLASSIFY,
+                        MOLOCH_BENCH_PARSE, MOLOCH_BENCH_SAVE, MOLOCH_BENCH_WRITE, MOLOCH_BENCH_NUM };
+
+/* The reader thread gets its own slot after the packet threads */
+#define MOLOCH_BENCH_READER_THREAD    MOLOCH_MAX_PACKET_THREADS
+
+/* Stages are only timed with --bench, STOP_NESTED also takes the time back
+ * out of the enclosing stage so each stage is reported exclusive */
+#define MOLOCH_BENCH_START(var) uint64_t var = config.bench?moloch_bench_now():0
+#define MOLOCH_BENCH_STOP(thread, stage, var) do { if (config.bench) moloch_bench_add(thread, stage, -1, var); } while (0)
+#define MOLOCH_BENCH_STOP_NESTED(thread, stage, parent, var) do { if (config.bench) moloch_bench_add(thread, stage, parent, var); } while (0)
+
+uint64_t moloch_bench_now();
+void     moloch_bench_add(int thread, int stage, int parent, uint64_t start);
+void     moloch_bench_replay_start();
+void     moloch_bench_replay_done(uint64_t packets, uint64_t bytes);
+void     moloch_bench_session_saved(const MolochSession_t *session);
+void     moloch_bench_report();
+uint64_t moloch_bench_allocs() __attribute__((weak));
+
+/******************************************************************************/
+/*
+ * threads.c
+ */
+enum MolochThreadRole { MOLOCH_THREAD_PACKET, MOLOCH_THREAD_READER, MOLOCH_THREAD_WRITER, MOLOCH_THREAD_ES, MOLOCH_THREAD_OTHER, MOLOCH_THREAD_ROLE_NUM };
+
+void     moloch_threads_init();
+GThread *moloch_threads_new(int role, int index, const char *name, GThreadFunc func, gpointer data);
+int      moloch_threads_node(int role, int index);
+void    *moloch_threads_alloc(int role, int index, size_t size);
+
+/******************************************************************************/
+/*
+ * metrics.c
+ */
+enum MolochMetricsCounter { MOLOCH_METRICS_SESSIONS_SAVED, MOLOCH_METRICS_COUNTER_NUM };
+enum MolochMetricsHisto { MOLOCH_METRICS_PACKET_AGE, MOLOCH_METRICS_SESSION_SAVE, MOLOCH_METRICS_ES_BULK,
+                          MOLOCH_METRICS_DISK_WRITE, MOLOCH_METRICS_PARSER, MOLOCH_METRICS_HISTO_NUM };
+
+/* Packet threads have their own slot, everyone else shares the last one */
+#define MOLOCH_METRICS_OTHER_THREAD   MOLOCH_MAX_PACKET_THREADS
+
+/* Latencies are only timed when the metrics endpoint is on */
+#define MOLOCH_METRICS_START(var) uint64_t var = config.metrics?moloch_metrics_now():0
+#define MOLOCH_METRICS_OBSERVE(thread, histo, var) do { if (config.metrics) moloch_metrics_observe(thread, histo, (moloch_metrics_now() - var)/1000); } while (0)
+
+void     moloch_metrics_init();
+uint64_t moloch_metrics_now();
+void     moloch_metrics_count(int thread, int counter, uint64_t n);
+void     moloch_metrics_observe(int thread, int histo, uint64_t usecs);
+void     moloch_metrics_exit();
+
 /******************************************************************************/
 /*
  * parsers.c
@@ -656,6 +857,7 @@ void moloch_parsers_classify_udp(MolochSession_t *session, const unsigned char *
 void moloch_parsers_exit();
 
 void moloch_parsers_magic(MolochSession_t *session, int field, const char *data, int len);
+int  moloch_parsers_line_append(GString *line, const unsigned char *data, int len, int maxLine);
 
 typedef void (* MolochClassifyFunc) (MolochSession_t *session, const unsigned char *data, int remaining, int which, void *uw);
 
@@ -696,8 +898,10 @@ void moloch_http_exit();
 int moloch_http_queue_length(void *server);
 
 void *moloch_http_create_server(const char *hostnames, int defaultPort, int maxConns, int maxOutstandingRequests, int compress);
+void *moloch_http_create_null_server(int compress);
 void moloch_http_set_header_cb(void *server, MolochHttpHeader_cb cb);
 void moloch_http_free_server(void *server);
+void moloch_http_compress_stats(void *server, uint64_t *in, uint64_t *out, uint64_t *usecs, uint32_t *skipped);
 
 gboolean moloch_http_is_moloch(uint32_t hash, char *key);
 
@@ -712,10 +916,12 @@ void     moloch_session_id6 (char *buf, uint8_t *addr1, uint16_t port1, uint8_t
 char    *moloch_session_id_string (char *sessionId, char *buf);
 
 uint32_t moloch_session_hash(const void *key);
+uint32_t moloch_session_flow_hash(uint32_t addr1, uint16_t port1, uint32_t addr2, uint16_t port2);
+uint32_t moloch_session_flow_hash6(uint8_t *addr1, uint16_t port1, uint8_t *addr2, uint16_t port2);
 int      moloch_session_cmp(const void *keyv, const void *elementv);
 
 MolochSession_t *moloch_session_find(int ses, char *sessionId);
-MolochSession_t *moloch_session_find_or_create(int ses, char *sessionId, int *isNew);
+MolochSession_t *moloch_session_find_or_create(int ses, uint32_t hash, char *sessionId, int *isNew);
 
 void     moloch_session_init();
 void     moloch_session_exit();
@@ -724,6 +930,7 @@ gboolean moloch_session_has_protocol(MolochSession_t *session, const char *proto
 void     moloch_session_add_tag(MolochSession_t *session, const char *tag);
 void     moloch_session_add_tag_type(MolochSession_t *session, int field, const char *tag);
 gboolean moloch_session_has_tag(MolochSession_t *session, const char *tag);
+void     moloch_session_elephant_ports(MolochSession_t *session);
 
 #define  moloch_session_incr_outstanding(session) (session)->outstandingQueries++
 gboolean moloch_session_decr_outstanding(MolochSession_t *session);
@@ -763,13 +970,23 @@ uint64_t moloch_packet_dropped_packets();
 void     moloch_packet_exit();
 void     moloch_packet_tcp_free(MolochSession_t *session);
 int      moloch_packet_outstanding();
+void     moloch_packet_thread_stats(int thread, uint64_t *packets, uint64_t *bytes, uint32_t *drops, int *queued);
 int      moloch_packet_frags_outstanding();
 int      moloch_packet_frags_size();
 uint64_t moloch_packet_dropped_frags();
 uint64_t moloch_packet_dropped_overload();
+int      moloch_packet_hash_thread(uint32_t hash);
+void     moloch_packet_hash_ref(uint32_t hash);
+void     moloch_packet_hash_unref(uint32_t hash);
+uint64_t moloch_packet_thread_packets(int thread);
+uint64_t moloch_packet_thread_bytes(int thread);
+uint32_t moloch_packet_rebalance_moves();
 void     moloch_packet_thread_wake(int thread);
 void     moloch_packet_flush();
+typedef void (*MolochPacketDeferFunc)(gpointer data);
+void     moloch_packet_defer_free(MolochPacketDeferFunc func, gpointer data);
 void     moloch_packet(MolochPacket_t * const packet);
+void     moloch_packet_add_file_pos(MolochSession_t *session, const MolochPacket_t *packet);
 void     moloch_packet_process_data(MolochSession_t *session, const uint8_t *data, int len, int which);
 
 /******************************************************************************/
@@ -874,6 +1091,11 @@ void moloch_plugins_exit();
 void moloch_yara_init();
 void moloch_yara_execute(MolochSession_t *session, const uint8_t *data, int len, int first);
 void moloch_yara_email_execute(MolochSession_t *session, const uint8_t *data, int len, int first);
+void moloch_yara_session_add(MolochSession_t *session, const uint8_t *data, int len, int which);
+void moloch_yara_session_finish(MolochSession_t *session);
+void moloch_yara_session_free(MolochSession_t *session);
+void moloch_yara_thread_stats(int thread, uint64_t *bytes, uint64_t *usecs);
+void moloch_yara_reload();
 void moloch_yara_exit();
 
 /******************************************************************************/
@@ -891,8 +1113,13 @@ gboolean moloch_field_string_add(int pos, MolochSession_t *session, const char *
 gboolean moloch_field_int_add(int pos, MolochSession_t *session, int i);
 gboolean moloch_field_certsinfo_add(int pos, MolochSession_t *session, MolochCertsInfo_t *info, int len);
 int  moloch_field_count(int pos, MolochSession_t *session);
+void moloch_field_ints_iter_init(MolochFieldIntsIter_t *iter, MolochField_t *field);
+gboolean moloch_field_ints_iter_next(MolochFieldIntsIter_t *iter, gpointer *ikey);
 void moloch_field_certsinfo_free (MolochCertsInfo_t *certs);
+void moloch_field_saved(MolochSession_t *session, int final);
 void moloch_field_free(MolochSession_t *session);
+void moloch_field_arena_stats(uint64_t *arenas, uint64_t *bytes);
+void moloch_field_intern_stats(uint64_t *values, uint64_t *savedBytes);
 void moloch_field_exit();
 
 /******************************************************************************/
@@ -904,15 +1131,38 @@ typedef void (*MolochWriterInit)(char *name);
 typedef uint32_t (*MolochWriterQueueLength)();
 typedef void (*MolochWriterWrite)(const MolochSession_t * const session, MolochPacket_t * const packet);
 typedef void (*MolochWriterExit)();
+typedef void (*MolochWriterWriteRun)(const MolochSession_t * const session, MolochPacket_t * const packets, int num);
 
 extern MolochWriterQueueLength moloch_writer_queue_length;
 extern MolochWriterWrite moloch_writer_write;
 extern MolochWriterExit moloch_writer_exit;
+extern MolochWriterWriteRun moloch_writer_write_run;
 
 
 void moloch_writers_init();
 void moloch_writers_start(char *name);
 void moloch_writers_add(char *name, MolochWriterInit func);
+void moloch_writer_write_run_each(const MolochSession_t * const session, MolochPacket_t * const packets, int num);
+
+/******************************************************************************/
+/*
+ * writer-index.c
+ */
+typedef struct moloch_writer_index MolochWriterIndex_t;
+
+MolochWriterIndex_t *moloch_writer_index_new();
+void moloch_writer_index_add(MolochWriterIndex_t *index, const MolochSession_t *session, uint64_t pos, uint32_t len);
+void moloch_writer_index_write(MolochWriterIndex_t *index, const char *pcapName);
+
+/******************************************************************************/
+/*
+ * writer-ordered.c
+ */
+void moloch_writer_ordered_init();
+void moloch_writer_ordered_add(MolochSession_t *session, MolochPacket_t *packet);
+void moloch_writer_ordered_flush(MolochSession_t *session);
+void moloch_writer_ordered_check(int thread);
+void moloch_writer_ordered_stats(uint64_t *written, uint64_t *writtenBytes);
 
 /******************************************************************************/
 /*
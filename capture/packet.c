@@ -35,6 +35,7 @@ struct timeval               initialPacket;
 
 extern void                 *esServer;
 extern uint32_t              pluginsCbs;
+extern volatile int          memoryLevel;
 
 LOCAL int                    mac1Field;
 LOCAL int                    mac2Field;
@@ -53,6 +54,50 @@ LOCAL  uint32_t              overloadDrops[MOLOCH_MAX_PACKET_THREADS];
 
 LOCAL  MolochPacketHead_t    fragsQ;
 
+/* Flow hash indirection table, each bucket of the symmetric flow hash is
+ * owned by one packet thread.  With packetThreadRebalance buckets that have
+ * no queued packets and no sessions can be moved to a less busy thread.
+ * Readers take a ref and then load the owner without the lock, the rebalance
+ * pass sets MOLOCH_FLOW_MOVING on an idle bucket while it changes the owner.
+ */
+#define MOLOCH_FLOW_TABLE_SIZE 4096
+#define MOLOCH_FLOW_TABLE_MASK (MOLOCH_FLOW_TABLE_SIZE - 1)
+#define MOLOCH_FLOW_MOVING     0x80000000
+
+LOCAL  volatile uint8_t      flowTable[MOLOCH_FLOW_TABLE_SIZE];
+LOCAL  uint32_t              flowRefs[MOLOCH_FLOW_TABLE_SIZE];
+LOCAL  MOLOCH_LOCK_DEFINE(flowTable);
+LOCAL  uint32_t              rebalanceMoves;
+
+typedef struct {
+    uint64_t                 packets;
+    uint64_t                 bytes;
+    volatile uint64_t        epoch;
+    char                     pad[40]; // Keep each thread on its own cache line
+} MolochPacketThreadStats_t;
+
+LOCAL  MolochPacketThreadStats_t threadStats[MOLOCH_MAX_PACKET_THREADS];
+
+/* Deferred frees for data the packet threads read without locks, see
+ * moloch_packet_defer_free.
+ */
+typedef struct moloch_packet_defer {
+    struct moloch_packet_defer *d_next, *d_prev;
+    MolochPacketDeferFunc       func;
+    gpointer                    data;
+    uint64_t                    epoch;
+} MolochPacketDefer_t;
+
+typedef struct {
+    struct moloch_packet_defer *d_next, *d_prev;
+    int                         d_count;
+} MolochPacketDeferHead_t;
+
+LOCAL  volatile uint64_t     deferEpoch;
+// Set up statically so frees can be deferred before moloch_packet_init
+LOCAL  MolochPacketDeferHead_t deferQ = {(MolochPacketDefer_t *)&deferQ, (MolochPacketDefer_t *)&deferQ, 0};
+LOCAL  MOLOCH_LOCK_DEFINE(deferQ);
+
 LOCAL  gboolean              callFilters;
 
 
@@ -96,6 +141,7 @@ void moloch_packet_tcp_free(MolochSession_t *session)
 {
     MolochTcpData_t *td;
     while (DLL_POP_HEAD(td_, &session->tcpData, td)) {
+        MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_TCP, -td->packet->pktlen);
         moloch_packet_free(td->packet);
         MOLOCH_TYPE_FREE(MolochTcpData_t, td);
     }
@@ -163,19 +209,26 @@ void moloch_packet_tcp_finish(MolochSession_t *session)
             }
 
             if (session->totalDatabytes[which] == session->consumed[which])  {
+                MOLOCH_BENCH_START(classifyStart);
                 moloch_parsers_classify_tcp(session, data, len, which);
+                MOLOCH_BENCH_STOP_NESTED(session->thread, MOLOCH_BENCH_CLASSIFY, MOLOCH_BENCH_REASSEMBLY, classifyStart);
             }
 
+            MOLOCH_BENCH_START(parseStart);
+            MOLOCH_METRICS_START(parseMetricsStart);
             moloch_packet_process_data(session, data, len, which);
+            MOLOCH_METRICS_OBSERVE(session->thread, MOLOCH_METRICS_PARSER, parseMetricsStart);
+            MOLOCH_BENCH_STOP_NESTED(session->thread, MOLOCH_BENCH_PARSE, MOLOCH_BENCH_REASSEMBLY, parseStart);
             session->tcpSeq[which] += len;
             session->databytes[which] += len;
             session->totalDatabytes[which] += len;
 
             if (config.yara) {
-                moloch_yara_execute(session, data, len, 0);
+                moloch_yara_session_add(session, data, len, which);
             }
 
             DLL_REMOVE(td_, tcpData, ftd);
+            MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_TCP, -ftd->packet->pktlen);
             moloch_packet_free(ftd->packet);
             MOLOCH_TYPE_FREE(MolochTcpData_t, ftd);
         } else {
@@ -201,16 +254,23 @@ void moloch_packet_process_udp(MolochSession_t * const session, MolochPacket_t *
         session->firstBytesLen[packet->direction] = MIN(8, len);
         memcpy(session->firstBytes[packet->direction], data, session->firstBytesLen[packet->direction]);
 
-        if (!session->stopSPI)
+        if (!session->stopSPI) {
+            MOLOCH_BENCH_START(classifyStart);
             moloch_parsers_classify_udp(session, data, len, packet->direction);
+            MOLOCH_BENCH_STOP(session->thread, MOLOCH_BENCH_CLASSIFY, classifyStart);
+        }
     }
 
+    MOLOCH_BENCH_START(parseStart);
+    MOLOCH_METRICS_START(parseMetricsStart);
     int i;
     for (i = 0; i < session->parserNum; i++) {
         if (session->parserInfo[i].parserFunc) {
             session->parserInfo[i].parserFunc(session, session->parserInfo[i].uw, data, len, packet->direction);
         }
     }
+    MOLOCH_METRICS_OBSERVE(session->thread, MOLOCH_METRICS_PARSER, parseMetricsStart);
+    MOLOCH_BENCH_STOP(session->thread, MOLOCH_BENCH_PARSE, parseStart);
 }
 /******************************************************************************/
 int moloch_packet_process_tcp(MolochSession_t * const session, MolochPacket_t * const packet)
@@ -255,7 +315,10 @@ int moloch_packet_process_tcp(MolochSession_t * const session, MolochPacket_t *
 
     MolochTcpDataHead_t * const tcpData = &session->tcpData;
 
-    if (DLL_COUNT(td_, tcpData) > 256) {
+    /* Under memory pressure only allow a short out of order queue */
+    if (DLL_COUNT(td_, tcpData) > (memoryLevel >= MOLOCH_MEMORY_TRUNCATE?16:256)) {
+        if (DLL_COUNT(td_, tcpData) <= 256)
+            moloch_memory_shed(MOLOCH_MEMORY_TRUNCATE);
         moloch_packet_tcp_free(session);
         moloch_session_add_tag(session, "incomplete-tcp");
         session->stopTCP = 1;
@@ -314,6 +377,7 @@ int moloch_packet_process_tcp(MolochSession_t * const session, MolochPacket_t *
                         DLL_ADD_AFTER(td_, tcpData, ftd, td);
 
                         DLL_REMOVE(td_, tcpData, ftd);
+                        MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_TCP, -ftd->packet->pktlen);
                         moloch_packet_free(ftd->packet);
                         MOLOCH_TYPE_FREE(MolochTcpData_t, ftd);
                         ftd = td;
@@ -336,6 +400,7 @@ int moloch_packet_process_tcp(MolochSession_t * const session, MolochPacket_t *
         }
     }
 
+    MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_TCP, packet->pktlen);
     return 0;
 }
 
@@ -347,6 +412,57 @@ void moloch_packet_thread_wake(int thread)
     MOLOCH_UNLOCK(packetQ[thread].lock);
 }
 /******************************************************************************/
+/* RCU style reclaim.  Readers on the packet threads use a published pointer
+ * without any locking, the writer swaps in the new version and hands the old
+ * one to this function.  Each packet thread records the current epoch every
+ * time around its loop, and once all of them have passed the epoch of an
+ * entry nothing can still be using it and func is called on the main thread.
+ * Safe to call from any thread.
+ */
+void moloch_packet_defer_free(MolochPacketDeferFunc func, gpointer data)
+{
+    MolochPacketDefer_t *defer = MOLOCH_TYPE_ALLOC(MolochPacketDefer_t);
+    defer->func = func;
+    defer->data = data;
+
+    MOLOCH_LOCK(deferQ);
+    defer->epoch = __sync_add_and_fetch(&deferEpoch, 1);
+    DLL_PUSH_TAIL(d_, &deferQ, defer);
+    MOLOCH_UNLOCK(deferQ);
+}
+/******************************************************************************/
+LOCAL gboolean moloch_packet_defer_gfunc (gpointer UNUSED(user_data))
+{
+    MolochPacketDefer_t *defer;
+    uint64_t             epoch = deferEpoch;
+    int                  t;
+
+    if (DLL_COUNT(d_, &deferQ) == 0)
+        return TRUE;
+
+    for (t = 0; t < config.packetThreads; t++) {
+        if (threadStats[t].epoch < epoch)
+            epoch = threadStats[t].epoch;
+    }
+
+    while (1) {
+        MOLOCH_LOCK(deferQ);
+        defer = DLL_PEEK_HEAD(d_, &deferQ);
+        if (defer && defer->epoch <= epoch)
+            DLL_REMOVE(d_, &deferQ, defer);
+        else
+            defer = NULL;
+        MOLOCH_UNLOCK(deferQ);
+
+        if (!defer)
+            break;
+
+        defer->func(defer->data);
+        MOLOCH_TYPE_FREE(MolochPacketDefer_t, defer);
+    }
+    return TRUE;
+}
+/******************************************************************************/
 /* Only called on main thread, we busy block until all packet threads are empty.
  * Should only be used by tests and at end
  */
@@ -368,14 +484,91 @@ void moloch_packet_flush()
     }
 }
 /******************************************************************************/
+/* Apply the elephant flow policy, the first elephantBytes of payload in each
+ * direction are always saved, after that packets are either truncated to
+ * their headers (or elephantSnapLen) or sampled.  Returns FALSE if the packet
+ * shouldn't be written at all.  Everything is still counted for SPI.
+ */
+LOCAL int moloch_packet_elephant_save(MolochSession_t *session, MolochPacket_t *packet)
+{
+    struct tcphdr *tcphdr = 0;
+    int            hdrlen = 0;
+
+    switch (packet->protocol) {
+    case IPPROTO_TCP:
+        tcphdr = (struct tcphdr *)(packet->pkt + packet->payloadOffset);
+        hdrlen = 4 * tcphdr->th_off;
+        break;
+    case IPPROTO_UDP:
+        hdrlen = 8;
+        break;
+    }
+
+    int payload = packet->payloadLen - hdrlen;
+    if (payload <= 0)
+        return TRUE;
+
+    uint32_t *seen = &session->elephantSeen[packet->direction];
+    if (*seen < session->elephantBytes) {
+        *seen += payload;
+        return TRUE;
+    }
+
+    if (config.elephantSample) {
+        if ((tcphdr && (tcphdr->th_flags & (TH_SYN|TH_FIN|TH_RST))) ||
+            (session->packets[packet->direction] % config.elephantSampleRate) == 0) {
+            return TRUE;
+        }
+        session->skippedPackets++;
+        session->unsavedBytes += packet->pktlen;
+        return FALSE;
+    }
+
+    int caplen = packet->payloadOffset + hdrlen;
+    if ((int)config.elephantSnapLen > caplen)
+        caplen = config.elephantSnapLen;
+
+    if (caplen >= packet->pktlen)
+        return TRUE;
+
+    packet->writerCapLen = caplen;
+    session->truncatedPackets++;
+    session->unsavedBytes += packet->pktlen - caplen;
+    return TRUE;
+}
+/******************************************************************************/
+/* Record where the writer put the packet, a file change is marked with the
+ * negative file number.
+ */
+void moloch_packet_add_file_pos(MolochSession_t *session, const MolochPacket_t *packet)
+{
+    int16_t len;
+
+    if (session->lastFileNum != packet->writerFileNum) {
+        session->lastFileNum = packet->writerFileNum;
+        g_array_append_val(session->fileNumArray, packet->writerFileNum);
+        int64_t pos = -1LL * packet->writerFileNum;
+        g_array_append_val(session->filePosArray, pos);
+        len = 0;
+        g_array_append_val(session->fileLenArray, len);
+    }
+
+    g_array_append_val(session->filePosArray, packet->writerFilePos);
+    len = 16 + (packet->writerCapLen?packet->writerCapLen:packet->pktlen);
+    g_array_append_val(session->fileLenArray, len);
+}
+/******************************************************************************/
 LOCAL void *moloch_packet_thread(void *threadp)
 {
     MolochPacket_t  *packet;
     int thread = (long)threadp;
 
     while (1) {
+        int idle = 0;
+
         MOLOCH_LOCK(packetQ[thread].lock);
         if (DLL_COUNT(packet_, &packetQ[thread]) == 0) {
+            idle = 1;
             struct timeval tv;
             struct timespec ts;
             gettimeofday(&tv, NULL);
@@ -386,13 +579,40 @@ LOCAL void *moloch_packet_thread(void *threadp)
         DLL_POP_HEAD(packet_, &packetQ[thread], packet);
         MOLOCH_UNLOCK(packetQ[thread].lock);
 
+        /* Quiescent point, nothing from before here is still being used */
+        if (threadStats[thread].epoch != deferEpoch) {
+            __sync_synchronize();
+            threadStats[thread].epoch = deferEpoch;
+        }
+
         moloch_session_process_commands(thread);
 
+        /* Per thread timer for handing off aged db buffers and session runs */
+        if (idle || (threadStats[thread].packets & 0xfff) == 0) {
+            moloch_db_flush_thread(thread);
+            if (config.pcapSessionOrder)
+                moloch_writer_ordered_check(thread);
+        }
+
         if (!packet)
             continue;
 
-        lastPacketSecs[thread] = packet->ts.tv_sec;
+        MOLOCH_MEMORY_ADD(thread, MOLOCH_MEMORY_PACKETS, -packet->pktlen);
+        // Readers merging several files can hand off a packet a little late, never go backwards
+        if (config.pcapReadThreads == 1 || packet->ts.tv_sec > lastPacketSecs[thread])
+            lastPacketSecs[thread] = packet->ts.tv_sec;
+        threadStats[thread].packets++;
+        threadStats[thread].bytes += packet->pktlen;
+
+        // Only meaningful when the timestamps are from now
+        if (config.metrics && !config.pcapReadOffline) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            int64_t age = (now.tv_sec - packet->ts.tv_sec) * 1000000LL + (now.tv_usec - packet->ts.tv_usec);
+            moloch_metrics_observe(thread, MOLOCH_METRICS_PACKET_AGE, age > 0?age:0);
+        }
 
+        const uint32_t       hash = packet->hash;
         MolochSession_t     *session;
         struct ip           *ip4 = (struct ip*)(packet->pkt + packet->ipOffset);
         struct ip6_hdr      *ip6 = (struct ip6_hdr*)(packet->pkt + packet->ipOffset);
@@ -439,7 +659,9 @@ LOCAL void *moloch_packet_thread(void *threadp)
         }
 
         int isNew;
-        session = moloch_session_find_or_create(packet->ses,sessionId, &isNew); // Returns locked session
+        MOLOCH_BENCH_START(lookupStart);
+        session = moloch_session_find_or_create(packet->ses, hash, sessionId, &isNew); // Returns locked session
+        MOLOCH_BENCH_STOP(thread, MOLOCH_BENCH_LOOKUP, lookupStart);
 
         if (isNew) {
             session->saveTime = packet->ts.tv_sec + config.tcpSaveTimeout;
@@ -493,6 +715,14 @@ LOCAL void *moloch_packet_thread(void *threadp)
                 break;
             }
 
+            if (config.elephant)
+                moloch_session_elephant_ports(session);
+
+            if (memoryLevel >= MOLOCH_MEMORY_STOP_SPI && !session->stopSPI) {
+                session->stopSPI = 1;
+                moloch_memory_shed(MOLOCH_MEMORY_STOP_SPI);
+            }
+
             if (pluginsCbs & MOLOCH_PLUGIN_NEW)
                 moloch_plugins_cb_new(session);
         }
@@ -547,25 +777,22 @@ LOCAL void *moloch_packet_thread(void *threadp)
 
         uint32_t packets = session->packets[0] + session->packets[1];
 
-        if (session->stopSaving == 0 || packets < session->stopSaving) {
-            moloch_writer_write(session, packet);
-
-            int16_t len;
-            if (session->lastFileNum != packet->writerFileNum) {
-                session->lastFileNum = packet->writerFileNum;
-                g_array_append_val(session->fileNumArray, packet->writerFileNum);
-                int64_t pos = -1LL * packet->writerFileNum;
-                g_array_append_val(session->filePosArray, pos);
-                len = 0;
-                g_array_append_val(session->fileLenArray, len);
+        if ((session->stopSaving == 0 || packets < session->stopSaving) &&
+            (!session->elephant || moloch_packet_elephant_save(session, packet))) {
+            MOLOCH_BENCH_START(writeStart);
+            if (config.pcapSessionOrder) {
+                moloch_writer_ordered_add(session, packet);
+            } else {
+                moloch_writer_write(session, packet);
+                moloch_packet_add_file_pos(session, packet);
             }
-
-            g_array_append_val(session->filePosArray, packet->writerFilePos);
-            len = 16 + packet->pktlen;
-            g_array_append_val(session->fileLenArray, len);
+            MOLOCH_BENCH_STOP(thread, MOLOCH_BENCH_WRITE, writeStart);
 
             if (packets >= config.maxPackets || session->midSave) {
                 moloch_session_mid_save(session, packet->ts.tv_sec);
+            } else if (memoryLevel >= MOLOCH_MEMORY_MID_SAVE && packets >= config.maxPackets/10) {
+                moloch_memory_shed(MOLOCH_MEMORY_MID_SAVE);
+                moloch_session_mid_save(session, packet->ts.tv_sec);
             }
         }
 
@@ -622,15 +849,19 @@ LOCAL void *moloch_packet_thread(void *threadp)
         case SESSION_UDP:
             moloch_packet_process_udp(session, packet);
             break;
-        case SESSION_TCP:
+        case SESSION_TCP: {
+            MOLOCH_BENCH_START(tcpStart);
             freePacket = moloch_packet_process_tcp(session, packet);
             moloch_packet_tcp_finish(session);
+            MOLOCH_BENCH_STOP(thread, MOLOCH_BENCH_REASSEMBLY, tcpStart);
             break;
         }
+        }
 
         if (freePacket) {
             moloch_packet_free(packet);
         }
+        moloch_packet_hash_unref(hash);
     }
 
     return NULL;
@@ -874,21 +1105,81 @@ int moloch_packet_frags_outstanding()
     return DLL_COUNT(packet_, &fragsQ);
 }
 /******************************************************************************/
-int moloch_packet_ip(MolochPacket_t * const packet, const char * const sessionId)
+int moloch_packet_hash_thread(uint32_t hash)
+{
+    return flowTable[hash & MOLOCH_FLOW_TABLE_MASK];
+}
+/******************************************************************************/
+void moloch_packet_hash_ref(uint32_t hash)
 {
-    totalBytes += packet->pktlen;
+    if (config.packetThreadRebalance)
+        MOLOCH_THREAD_INCR(flowRefs[hash & MOLOCH_FLOW_TABLE_MASK]);
+}
+/******************************************************************************/
+void moloch_packet_hash_unref(uint32_t hash)
+{
+    if (config.packetThreadRebalance)
+        MOLOCH_THREAD_DECR(flowRefs[hash & MOLOCH_FLOW_TABLE_MASK]);
+}
+/******************************************************************************/
+/* Called with flowTable locked.  Moves idle buckets from the busiest packet
+ * thread to the least busy one, a bucket is idle when it has no queued packets
+ * and no sessions so nothing can be split across threads.
+ */
+LOCAL void moloch_packet_rebalance()
+{
+    static uint64_t lastPackets[MOLOCH_MAX_PACKET_THREADS];
+    static uint32_t nextBucket;
+    uint64_t        load[MOLOCH_MAX_PACKET_THREADS];
+    int             t, min = 0, max = 0;
+
+    for (t = 0; t < config.packetThreads; t++) {
+        uint64_t packets = threadStats[t].packets;
+        load[t] = packets - lastPackets[t] + DLL_COUNT(packet_, &packetQ[t]);
+        lastPackets[t] = packets;
+        if (load[t] < load[min])
+            min = t;
+        if (load[t] > load[max])
+            max = t;
+    }
+
+    // Only bother if the busiest thread has 25% more work than the quietest
+    if (max == min || load[max] <= load[min] + load[min]/4)
+        return;
 
-    if (totalPackets == 0) {
+    int i, moved = 0;
+    for (i = 0; i < MOLOCH_FLOW_TABLE_SIZE && moved < 32; i++) {
+        uint32_t b = (nextBucket + i) & MOLOCH_FLOW_TABLE_MASK;
+        if (flowTable[b] == max && __sync_bool_compare_and_swap(&flowRefs[b], 0, MOLOCH_FLOW_MOVING)) {
+            flowTable[b] = min;
+            __sync_fetch_and_and(&flowRefs[b], ~MOLOCH_FLOW_MOVING);
+            moved++;
+        }
+    }
+    nextBucket += i;
+    rebalanceMoves += moved;
+
+    if (config.debug && moved)
+        LOG("Rebalance moved %d buckets from thread %d (%" PRIu64 ") to %d (%" PRIu64 ")", moved, max, load[max], min, load[min]);
+}
+/******************************************************************************/
+int moloch_packet_ip(MolochPacket_t * const packet)
+{
+    // With pcapReadThreads there can be several readers
+    __sync_add_and_fetch(&totalBytes, packet->pktlen);
+    const uint64_t packetNum = __sync_fetch_and_add(&totalPackets, 1);
+
+    if (packetNum == 0) {
         MolochReaderStats_t stats;
         if (!moloch_reader_stats(&stats)) {
             initialDropped = stats.dropped;
         }
         initialPacket = packet->ts;
         LOG("Initial Packet = %ld", initialPacket.tv_sec);
-        LOG("%" PRIu64 " Initial Dropped = %d", totalPackets, initialDropped);
+        LOG("%" PRIu64 " Initial Dropped = %d", packetNum, initialDropped);
     }
 
-    if ((++totalPackets) % config.logEveryXPackets == 0) {
+    if ((packetNum + 1) % config.logEveryXPackets == 0) {
         MolochReaderStats_t stats;
         if (moloch_reader_stats(&stats)) {
             stats.dropped = 0;
@@ -911,11 +1202,45 @@ int moloch_packet_ip(MolochPacket_t * const packet, const char * const sessionId
           moloch_packet_frags_outstanding(),
           moloch_packet_frags_size()
           );
+
+        if (config.debug && config.packetThreads > 1) {
+            char buf[MOLOCH_MAX_PACKET_THREADS*22];
+            int  t, len = 0;
+            for (t = 0; t < config.packetThreads; t++) {
+                len += snprintf(buf+len, sizeof(buf)-len, " %" PRIu64, threadStats[t].packets);
+            }
+            LOG("thread packets:%s moves: %u", buf, rebalanceMoves);
+        }
+    }
+
+    uint32_t thread;
+
+    if (config.packetThreadRebalance) {
+        if (((packetNum + 1) & 0xffff) == 0) {
+            MOLOCH_LOCK(flowTable);
+            moloch_packet_rebalance();
+            MOLOCH_UNLOCK(flowTable);
+        }
+
+        // The ref keeps the bucket from moving, wait out a move already started
+        const uint32_t bucket = packet->hash & MOLOCH_FLOW_TABLE_MASK;
+        uint32_t refs = MOLOCH_THREAD_INCR(flowRefs[bucket]);
+        while (refs & MOLOCH_FLOW_MOVING)
+            refs = __sync_fetch_and_add(&flowRefs[bucket], 0);
+        thread = flowTable[bucket];
+    } else {
+        thread = flowTable[packet->hash & MOLOCH_FLOW_TABLE_MASK];
     }
 
-    uint32_t thread = moloch_session_hash(sessionId) % config.packetThreads;
+    if (memoryLevel >= MOLOCH_MEMORY_DROP) {
+        moloch_packet_hash_unref(packet->hash);
+        moloch_memory_shed(MOLOCH_MEMORY_DROP);
+        packet->pkt = 0;
+        return 1;
+    }
 
     if (DLL_COUNT(packet_, &packetQ[thread]) >= config.maxPacketsInQueue) {
+        moloch_packet_hash_unref(packet->hash);
         MOLOCH_LOCK(packetQ[thread].lock);
         overloadDrops[thread]++;
         if ((overloadDrops[thread] % 1000) == 1) {
@@ -934,6 +1259,7 @@ int moloch_packet_ip(MolochPacket_t * const packet, const char * const sessionId
         packet->copied = 1;
     }
 
+    MOLOCH_MEMORY_ADD(thread, MOLOCH_MEMORY_PACKETS, packet->pktlen);
     MOLOCH_LOCK(packetQ[thread].lock);
     DLL_PUSH_TAIL(packet_, &packetQ[thread], packet);
     MOLOCH_COND_SIGNAL(packetQ[thread].lock);
@@ -946,7 +1272,6 @@ int moloch_packet_ip4(MolochPacket_t * const packet, const uint8_t *data, int le
     struct ip           *ip4 = (struct ip*)data;
     struct tcphdr       *tcphdr = 0;
     struct udphdr       *udphdr = 0;
-    char                 sessionId[MOLOCH_SESSIONID_LEN];
 
     if (len < (int)sizeof(struct ip))
         return 1;
@@ -979,8 +1304,8 @@ int moloch_packet_ip4(MolochPacket_t * const packet, const uint8_t *data, int le
         }
 
         tcphdr = (struct tcphdr *)((char*)ip4 + ip_hdr_len);
-        moloch_session_id(sessionId, ip4->ip_src.s_addr, tcphdr->th_sport,
-                          ip4->ip_dst.s_addr, tcphdr->th_dport);
+        packet->hash = moloch_session_flow_hash(ip4->ip_src.s_addr, tcphdr->th_sport,
+                                                ip4->ip_dst.s_addr, tcphdr->th_dport);
         packet->ses = SESSION_TCP;
         break;
     case IPPROTO_UDP:
@@ -990,13 +1315,13 @@ int moloch_packet_ip4(MolochPacket_t * const packet, const uint8_t *data, int le
 
         udphdr = (struct udphdr *)((char*)ip4 + ip_hdr_len);
 
-        moloch_session_id(sessionId, ip4->ip_src.s_addr, udphdr->uh_sport,
-                          ip4->ip_dst.s_addr, udphdr->uh_dport);
+        packet->hash = moloch_session_flow_hash(ip4->ip_src.s_addr, udphdr->uh_sport,
+                                                ip4->ip_dst.s_addr, udphdr->uh_dport);
         packet->ses = SESSION_UDP;
         break;
     case IPPROTO_ICMP:
-        moloch_session_id(sessionId, ip4->ip_src.s_addr, 0,
-                          ip4->ip_dst.s_addr, 0);
+        packet->hash = moloch_session_flow_hash(ip4->ip_src.s_addr, 0,
+                                                ip4->ip_dst.s_addr, 0);
         packet->ses = SESSION_ICMP;
         break;
     case IPPROTO_GRE:
@@ -1009,7 +1334,7 @@ int moloch_packet_ip4(MolochPacket_t * const packet, const uint8_t *data, int le
     }
     packet->protocol = ip4->ip_p;
 
-    return moloch_packet_ip(packet, sessionId);
+    return moloch_packet_ip(packet);
 }
 /******************************************************************************/
 int moloch_packet_ip6(MolochPacket_t * const UNUSED(packet), const uint8_t *data, int len)
@@ -1017,7 +1342,6 @@ int moloch_packet_ip6(MolochPacket_t * const UNUSED(packet), const uint8_t *data
     struct ip6_hdr      *ip6 = (struct ip6_hdr *)data;
     struct tcphdr       *tcphdr = 0;
     struct udphdr       *udphdr = 0;
-    char                 sessionId[MOLOCH_SESSIONID_LEN];
 
     if (len < (int)sizeof(struct ip6_hdr)) {
         return 1;
@@ -1054,8 +1378,8 @@ int moloch_packet_ip6(MolochPacket_t * const UNUSED(packet), const uint8_t *data
 
             tcphdr = (struct tcphdr *)(data + ip_hdr_len);
 
-            moloch_session_id6(sessionId, ip6->ip6_src.s6_addr, tcphdr->th_sport,
-                               ip6->ip6_dst.s6_addr, tcphdr->th_dport);
+            packet->hash = moloch_session_flow_hash6(ip6->ip6_src.s6_addr, tcphdr->th_sport,
+                                                     ip6->ip6_dst.s6_addr, tcphdr->th_dport);
             packet->ses = SESSION_TCP;
             done = 1;
             break;
@@ -1066,21 +1390,21 @@ int moloch_packet_ip6(MolochPacket_t * const UNUSED(packet), const uint8_t *data
 
             udphdr = (struct udphdr *)(data + ip_hdr_len);
 
-            moloch_session_id6(sessionId, ip6->ip6_src.s6_addr, udphdr->uh_sport,
-                               ip6->ip6_dst.s6_addr, udphdr->uh_dport);
+            packet->hash = moloch_session_flow_hash6(ip6->ip6_src.s6_addr, udphdr->uh_sport,
+                                                     ip6->ip6_dst.s6_addr, udphdr->uh_dport);
 
             packet->ses = SESSION_UDP;
             done = 1;
             break;
         case IPPROTO_ICMP:
-            moloch_session_id6(sessionId, ip6->ip6_src.s6_addr, 0,
-                               ip6->ip6_dst.s6_addr, 0);
+            packet->hash = moloch_session_flow_hash6(ip6->ip6_src.s6_addr, 0,
+                                                     ip6->ip6_dst.s6_addr, 0);
             packet->ses = SESSION_ICMP;
             done = 1;
             break;
         case IPPROTO_ICMPV6:
-            moloch_session_id6(sessionId, ip6->ip6_src.s6_addr, 0,
-                               ip6->ip6_dst.s6_addr, 0);
+            packet->hash = moloch_session_flow_hash6(ip6->ip6_src.s6_addr, 0,
+                                                     ip6->ip6_dst.s6_addr, 0);
             packet->ses = SESSION_ICMP;
             done = 1;
             break;
@@ -1097,7 +1421,7 @@ int moloch_packet_ip6(MolochPacket_t * const UNUSED(packet), const uint8_t *data
     packet->protocol = nxt;
     packet->payloadOffset = packet->ipOffset + ip_hdr_len;
     packet->payloadLen = ip_len - ip_hdr_len + sizeof(struct ip6_hdr);
-    return moloch_packet_ip(packet, sessionId);
+    return moloch_packet_ip(packet);
 }
 /******************************************************************************/
 int moloch_packet_ether(MolochPacket_t * const packet, const uint8_t *data, int len)
@@ -1164,6 +1488,14 @@ int moloch_packet_outstanding()
     return count;
 }
 /******************************************************************************/
+void moloch_packet_thread_stats(int thread, uint64_t *packets, uint64_t *bytes, uint32_t *drops, int *queued)
+{
+    *packets = threadStats[thread].packets;
+    *bytes   = threadStats[thread].bytes;
+    *drops   = overloadDrops[thread];
+    *queued  = DLL_COUNT(packet_, &packetQ[thread]);
+}
+/******************************************************************************/
 uint32_t moloch_packet_frag_hash(const void *key)
 {
     int i;
@@ -1223,6 +1555,24 @@ void moloch_packet_init()
         MOLOCH_FIELD_TYPE_IP_GHASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_LINKED_SESSIONS,
         NULL);
 
+    moloch_field_define("general", "integer",
+        "packets.truncated", "Truncated Packets", "ptr",
+        "Packets saved truncated by the elephant flow policy",
+        0,  MOLOCH_FIELD_FLAG_FAKE,
+        NULL);
+
+    moloch_field_define("general", "integer",
+        "packets.skipped", "Skipped Packets", "psk",
+        "Packets not saved by the elephant flow policy",
+        0,  MOLOCH_FIELD_FLAG_FAKE,
+        NULL);
+
+    moloch_field_define("general", "integer",
+        "bytes.unsaved", "Unsaved Bytes", "bun",
+        "Bytes not saved by the elephant flow policy",
+        0,  MOLOCH_FIELD_FLAG_FAKE,
+        NULL);
+
     moloch_field_define("general", "lotermfield",
         "tipv6.src", "IPv6 Src", "tipv61-term",
         "Temporary IPv6 Source",
@@ -1240,13 +1590,17 @@ void moloch_packet_init()
         NULL);
 
     int t;
+    for (t = 0; t < MOLOCH_FLOW_TABLE_SIZE; t++) {
+        flowTable[t] = t % config.packetThreads;
+    }
+
     for (t = 0; t < config.packetThreads; t++) {
         char name[100];
         DLL_INIT(packet_, &packetQ[t]);
         MOLOCH_LOCK_INIT(packetQ[t].lock);
         MOLOCH_COND_INIT(packetQ[t].lock);
         snprintf(name, sizeof(name), "moloch-pkt%d", t);
-        g_thread_new(name, &moloch_packet_thread, (gpointer)(long)t);
+        moloch_threads_new(MOLOCH_THREAD_PACKET, t, name, &moloch_packet_thread, (gpointer)(long)t);
     }
 
     DLL_INIT(packet_, &fragsQ);
@@ -1256,7 +1610,9 @@ void moloch_packet_init()
     HASH_INIT(fragh_, fragsHash, moloch_packet_frag_hash, moloch_packet_frag_cmp);
     DLL_INIT(fragl_, &fragsList);
 
-    g_thread_new("moloch-frags4", &moloch_packet_frags_thread, NULL);
+    moloch_threads_new(MOLOCH_THREAD_OTHER, 0, "moloch-frags4", &moloch_packet_frags_thread, NULL);
+
+    g_timeout_add_seconds(1, moloch_packet_defer_gfunc, 0);
 
     moloch_add_can_quit(moloch_packet_outstanding, "packet outstanding");
     moloch_add_can_quit(moloch_packet_frags_outstanding, "packet frags outstanding");
@@ -1288,6 +1644,27 @@ uint64_t moloch_packet_dropped_overload()
     return count;
 }
 /******************************************************************************/
+uint64_t moloch_packet_thread_packets(int thread)
+{
+    return threadStats[thread].packets;
+}
+/******************************************************************************/
+uint64_t moloch_packet_thread_bytes(int thread)
+{
+    return threadStats[thread].bytes;
+}
+/******************************************************************************/
+uint32_t moloch_packet_rebalance_moves()
+{
+    return rebalanceMoves;
+}
+/******************************************************************************/
 void moloch_packet_exit()
 {
+    MolochPacketDefer_t *defer;
+
+    while (DLL_POP_HEAD(d_, &deferQ, defer)) {
+        defer->func(defer->data);
+        MOLOCH_TYPE_FREE(MolochPacketDefer_t, defer);
+    }
 }
@@ -33,13 +33,181 @@ extern unsigned char         moloch_char_to_hexstr[256][3];
 
 int    userField;
 
+/******************************************************************************/
+/* Built in signatures for the content types we care about, checked before (or
+ * instead of) libmagic depending on magicMode.  Names match what libmagic
+ * returns for the same data so the field values don't change.  Ambiguous
+ * entries cover formats libmagic splits further, like the zip based office
+ * documents or elf shared libraries, so they are only used for magicMode=basic.
+ */
+typedef struct {
+    const char          *match;
+    uint8_t              offset;
+    uint8_t              len;
+    const char          *mime;
+    uint8_t              ambiguous;   // libmagic tells these apart more finely
+} MolochMagic_t;
+
+static MolochMagic_t magicTable[] = {
+    /* Archives and compression */
+    {"\x1f\x8b",                         0, 2, "application/x-gzip", 0},
+    {"PK\x03\x04",                       0, 4, "application/zip", 1},
+    {"PK\x05\x06",                       0, 4, "application/zip", 0},
+    {"BZh",                              0, 3, "application/x-bzip2", 0},
+    {"\xfd" "7zXZ\x00",                  0, 6, "application/x-xz", 0},
+    {"7z\xbc\xaf\x27\x1c",               0, 6, "application/x-7z-compressed", 0},
+    {"Rar!\x1a\x07",                     0, 6, "application/x-rar", 0},
+    {"MSCF\x00\x00\x00\x00",             0, 8, "application/vnd.ms-cab-compressed", 0},
+    {"\x28\xb5\x2f\xfd",                 0, 4, "application/x-zstd", 0},
+    {"\x04\x22\x4d\x18",                 0, 4, "application/x-lz4", 0},
+    {"\x1f\x9d",                         0, 2, "application/x-compress", 0},
+    {"\xed\xab\xee\xdb",                 0, 4, "application/x-rpm", 0},
+    {"!<arch>\ndebian",                  0, 14, "application/vnd.debian.binary-package", 0},
+    {"!<arch>\n",                        0, 8, "application/x-archive", 0},
+
+    /* Executables */
+    {"MZ",                               0, 2, "application/x-dosexec", 0},
+    {"\x7f" "ELF",                       0, 4, "application/x-executable", 1},
+    {"\xca\xfe\xba\xbe",                 0, 4, "application/x-java-applet", 1},
+    {"\xfe\xed\xfa\xce",                 0, 4, "application/x-mach-binary", 0},
+    {"\xfe\xed\xfa\xcf",                 0, 4, "application/x-mach-binary", 0},
+    {"\xce\xfa\xed\xfe",                 0, 4, "application/x-mach-binary", 0},
+    {"\xcf\xfa\xed\xfe",                 0, 4, "application/x-mach-binary", 0},
+    {"dex\n",                            0, 4, "application/x-dex", 0},
+    {"\x00" "asm",                       0, 4, "application/wasm", 0},
+
+    /* Documents */
+    {"%PDF-",                            0, 5, "application/pdf", 0},
+    {"%!PS",                             0, 4, "application/postscript", 0},
+    {"{\\rtf",                           0, 5, "text/rtf", 0},
+    {"\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", 0, 8, "application/vnd.ms-office", 1},
+    {"SQLite format 3\x00",              0, 16, "application/x-sqlite3", 0},
+    {"<?xml",                            0, 5, "application/xml", 1},
+    {"wOFF",                             0, 4, "application/font-woff", 0},
+    {"wOF2",                             0, 4, "font/woff2", 0},
+    {"FWS",                              0, 3, "application/x-shockwave-flash", 0},
+    {"CWS",                              0, 3, "application/x-shockwave-flash", 0},
+    {"ZWS",                              0, 3, "application/x-shockwave-flash", 0},
+
+    /* Images */
+    {"GIF87a",                           0, 6, "image/gif", 0},
+    {"GIF89a",                           0, 6, "image/gif", 0},
+    {"\x89PNG\r\n\x1a\n",                0, 8, "image/png", 0},
+    {"\xff\xd8\xff",                     0, 3, "image/jpeg", 0},
+    {"II*\x00",                          0, 4, "image/tiff", 0},
+    {"MM\x00*",                          0, 4, "image/tiff", 0},
+    {"8BPS",                             0, 4, "image/vnd.adobe.photoshop", 0},
+    {"WEBP",                             8, 4, "image/webp", 0},
+
+    /* Audio and video */
+    {"ID3",                              0, 3, "audio/mpeg", 0},
+    {"OggS",                             0, 4, "application/ogg", 0},
+    {"fLaC",                             0, 4, "audio/x-flac", 0},
+    {"WAVE",                             8, 4, "audio/x-wav", 0},
+    {"AVI ",                             8, 4, "video/x-msvideo", 0},
+    {"\x1a\x45\xdf\xa3",                 0, 4, "video/x-matroska", 0},
+    {"\x00\x00\x01\xba",                 0, 4, "video/mpeg", 0},
+    {"FLV\x01",                          0, 4, "video/x-flv", 0},
+    {"ftyp",                             4, 4, "video/mp4", 1},
+    {"\x30\x26\xb2\x75\x8e\x66\xcf\x11", 0, 8, "video/x-ms-asf", 0},
+
+    {NULL, 0, 0, NULL, 0}
+};
+
+/* Signatures at offset 0 chained by their first byte, the rest are always checked */
+static short                 magicFirst[256];
+static short                 magicNext[sizeof(magicTable)/sizeof(magicTable[0])];
+static short                 magicOffset;
+
+static const char           *magicHtml[] = {"<!doctype html", "<html", "<head", "<title", "<body", "<script", "<iframe", "<style", "<table", NULL};
+
+/******************************************************************************/
+static void moloch_parsers_magic_init()
+{
+    int i;
+
+    memset(magicFirst, 0xff, sizeof(magicFirst));
+    magicOffset = -1;
+
+    /* Walk backwards so each chain stays in table order */
+    for (i = sizeof(magicTable)/sizeof(magicTable[0]) - 2; i >= 0; i--) {
+        if (magicTable[i].offset == 0) {
+            uint8_t first = magicTable[i].match[0];
+            magicNext[i] = magicFirst[first];
+            magicFirst[first] = i;
+        } else {
+            magicNext[i] = magicOffset;
+            magicOffset = i;
+        }
+    }
+}
+/******************************************************************************/
+/* Returns the content type or NULL if we don't know, only looks at 64 bytes.
+ * Unless ambiguous is set NULL is also returned for ambiguous matches so
+ * libmagic gets to decide.
+ */
+static const char *moloch_parsers_magic_basic(const char *data, int len, int ambiguous)
+{
+    const uint8_t *udata = (const uint8_t *)data;
+    int            i;
+
+    if (len > 64)
+        len = 64;
+
+    for (i = magicFirst[udata[0]]; i >= 0; i = magicNext[i]) {
+        if (magicTable[i].len <= len && memcmp(data, magicTable[i].match, magicTable[i].len) == 0)
+            return (ambiguous || !magicTable[i].ambiguous)?magicTable[i].mime:NULL;
+    }
+
+    for (i = magicOffset; i >= 0; i = magicNext[i]) {
+        if (magicTable[i].offset + magicTable[i].len <= len && memcmp(data + magicTable[i].offset, magicTable[i].match, magicTable[i].len) == 0)
+            return (ambiguous || !magicTable[i].ambiguous)?magicTable[i].mime:NULL;
+    }
+
+    /* Html, possibly after some white space */
+    for (i = 0; i < len && isspace(udata[i]); i++);
+    if (i < len && data[i] == '<') {
+        int h;
+        for (h = 0; magicHtml[h]; h++) {
+            int hlen = strlen(magicHtml[h]);
+            if (i + hlen <= len && strncasecmp(data + i, magicHtml[h], hlen) == 0)
+                return "text/html";
+        }
+    }
+
+    return NULL;
+}
 /******************************************************************************/
 void moloch_parsers_magic(MolochSession_t *session, int field, const char *data, int len)
 {
-    if (len < 3)
+    if (len < 3 || config.magicMode == MOLOCH_MAGICMODE_NONE)
+        return;
+
+    const char *m = NULL;
+
+    if (config.magicMode != MOLOCH_MAGICMODE_LIBMAGIC) {
+        m = moloch_parsers_magic_basic(data, len, config.magicMode == MOLOCH_MAGICMODE_BASIC);
+        if (m) {
+            moloch_field_string_add(field, session, m, -1, TRUE);
+            return;
+        }
+    }
+
+    if (config.magicMode == MOLOCH_MAGICMODE_BASIC) {
+        int i;
+        for (i = 0; i < MIN(len, 64); i++) {
+            uint8_t c = data[i];
+            if (c < 32 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1b)
+                break;
+            if (c == 0x7f)
+                break;
+        }
+        m = (i == MIN(len, 64))?"text/plain":"application/octet-stream";
+        moloch_field_string_add(field, session, m, -1, TRUE);
         return;
+    }
 
-    const char *m = magic_buffer(cookie[session->thread], data, MIN(len,50));
+    m = magic_buffer(cookie[session->thread], data, MIN(len,50));
     if (m) {
         int len;
         char *semi = strchr(m, ';');
@@ -52,6 +220,26 @@ void moloch_parsers_magic(MolochSession_t *session, int field, const char *data,
     }
 }
 /******************************************************************************/
+/* Line tokenizer for the text protocols.  Appends everything before the next
+ * \r to line and returns how many bytes that was, if it equals len there was no
+ * \r and the line continues in the next packet.  memchr uses the vectorized
+ * libc code so long lines cost a copy instead of a loop per byte.  When
+ * maxLine is set line is never grown past it, the rest is still consumed.
+ */
+int moloch_parsers_line_append(GString *line, const unsigned char *data, int len, int maxLine)
+{
+    const unsigned char *cr = memchr(data, '\r', len);
+    int                  n = cr?cr - data:len;
+    int                  add = n;
+
+    if (maxLine && (int)line->len + add > maxLine)
+        add = MAX(0, maxLine - (int)line->len);
+
+    if (add)
+        g_string_append_len(line, (const char *)data, add);
+    return n;
+}
+/******************************************************************************/
 void moloch_parsers_initial_tag(MolochSession_t *session)
 {
     int i;
@@ -250,8 +438,10 @@ void moloch_parsers_init()
     flags |= MAGIC_NO_CHECK_CDF;
 #endif
 
+    moloch_parsers_magic_init();
+
     int t;
-    for (t = 0; t < config.packetThreads; t++) {
+    for (t = 0; (config.magicMode == MOLOCH_MAGICMODE_BOTH || config.magicMode == MOLOCH_MAGICMODE_LIBMAGIC) && t < config.packetThreads; t++) {
         cookie[t] = magic_open(flags);
         if (!cookie[t]) {
             LOG("Error with libmagic %s", magic_error(cookie[t]));
@@ -366,7 +556,8 @@ void moloch_parsers_init()
 void moloch_parsers_exit() {
     int t;
     for (t = 0; t < config.packetThreads; t++) {
-        magic_close(cookie[t]);
+        if (cookie[t])
+            magic_close(cookie[t]);
     }
 }
 /******************************************************************************/
@@ -26,6 +26,12 @@ static int                   queryClassField;
 static int                   statusField;
 static int                   opCodeField;
 
+/* Keep 1 of every N udp transactions by query type or response status */
+static uint16_t              qtypeSample[256];
+static uint16_t              statusSample[16];
+static int                   statusSampling;
+static char                  dnsFastSave;
+
 typedef struct {
     unsigned char      *data[2];
     uint16_t            size[2];
@@ -142,6 +148,9 @@ void dns_parser(MolochSession_t *session, const unsigned char *data, int len)
     if (qdcount > 10 || qdcount <= 0)
         return;
 
+    uint16_t id   = (data[0] << 8) | data[1];
+    int      rate = 0;
+
     BSB bsb;
     BSB_INIT(bsb, data + 12, len - 12);
 
@@ -164,6 +173,9 @@ void dns_parser(MolochSession_t *session, const unsigned char *data, int len)
         BSB_IMPORT_u16(bsb, qtype);
         BSB_IMPORT_u16(bsb, qclass);
 
+        if (qtype <= 255)
+            rate = MAX(rate, qtypeSample[qtype]);
+
         if (opcode == 5)
             continue;
 
@@ -184,6 +196,23 @@ void dns_parser(MolochSession_t *session, const unsigned char *data, int len)
     moloch_field_string_add(opCodeField, session, opcodes[opcode], -1, TRUE);
     moloch_session_add_protocol(session, "dns");
 
+    if (qr != 0)
+        rate = MAX(rate, statusSample[data[3] & 0xf]);
+
+    /* The id is random so both halves of a transaction make the same choice.
+     * A flow is only dropped if every transaction in it is sampled out, so
+     * once one is kept the flow stays kept.  With status sampling only the
+     * response knows the status, so a query doesn't decide its transaction.
+     */
+    if (session->protocol == IPPROTO_UDP && !session->sampleKept) {
+        if (rate > 1 && (id % rate) != 0) {
+            session->noSPI = 1;
+        } else if (qr != 0 || !statusSampling) {
+            session->noSPI = 0;
+            session->sampleKept = 1;
+        }
+    }
+
     if (qr == 0 && opcode != 5)
         return;
 
@@ -338,6 +367,12 @@ void dns_tcp_classify(MolochSession_t *session, const unsigned char *UNUSED(data
 int dns_udp_parser(MolochSession_t *session, void *UNUSED(uw), const unsigned char *data, int len, int UNUSED(which))
 {
     dns_parser(session, data, len);
+
+    /* Save the transaction a few seconds after the first packet instead of
+     * waiting out udpTimeout, the response almost always shows up by then
+     */
+    if (dnsFastSave && !session->closingQ)
+        moloch_session_mark_for_close(session, SESSION_UDP);
     return 0;
 }
 /******************************************************************************/
@@ -380,13 +415,13 @@ void moloch_parser_init()
     queryTypeField = moloch_field_define("dns", "uptermfield",
         "dns.query.type", "Query Type", "dns.qt-term",
         "DNS lookup query type",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_INTERN,
         NULL);
 
     queryClassField = moloch_field_define("dns", "uptermfield",
         "dns.query.class", "Query Class", "dns.qc-term",
         "DNS lookup query class",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_INTERN,
         NULL);
 
 
@@ -492,5 +527,43 @@ void moloch_parser_init()
     DNS_CLASSIFY("\xa4\x00"); // NOTIFY response
     DNS_CLASSIFY("\xa8\x00"); // UPDATE response
     DNS_CLASSIFY("\xa8\x05"); // UPDATE response
+
+    dnsFastSave = moloch_config_boolean(NULL, "dnsFastSave", FALSE);
+
+    gchar **samples = moloch_config_str_list(NULL, "dnsSample", NULL);
+    int i, t;
+    for (i = 0; samples && samples[i]; i++) {
+        char *colon = strchr(samples[i], ':');
+        if (!colon) {
+            LOG("dnsSample %s should be type:rate", samples[i]);
+            exit(1);
+        }
+        *colon = 0;
+        int rate = atoi(colon+1);
+
+        for (t = 0; t < 256; t++) {
+            if (qtypes[t] && strcasecmp(qtypes[t], samples[i]) == 0) {
+                qtypeSample[t] = rate;
+                break;
+            }
+        }
+        if (t < 256)
+            continue;
+
+        for (t = 0; t < 16; t++) {
+            if (strcasecmp(statuses[t], samples[i]) == 0) {
+                statusSample[t] = rate;
+                if (rate > 1)
+                    statusSampling = 1;
+                break;
+            }
+        }
+        if (t == 16) {
+            LOG("dnsSample unknown query type or status %s", samples[i]);
+            exit(1);
+        }
+    }
+    if (samples)
+        g_strfreev(samples);
 }
 
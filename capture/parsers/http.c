@@ -20,6 +20,11 @@
 
 #define MAX_URL_LENGTH 4096
 
+/* What we do with body bytes, decided when the session is classified */
+#define HTTP_BODY_DIGEST 0x01
+#define HTTP_BODY_MAGIC  0x02
+#define HTTP_BODY_PLUGIN 0x04
+
 typedef struct {
     MolochSession_t *session;
     GString         *urlString;
@@ -31,9 +36,10 @@ typedef struct {
 
     char             header[2][40];
     short            pos[2];
+    char             special[2];
     http_parser      parsers[2];
 
-    GChecksum       *checksum[2];
+    MolochDigest_t  *digest[2];
 
     uint16_t         wParsers:2;
     uint16_t         inHeader:2;
@@ -41,6 +47,7 @@ typedef struct {
     uint16_t         inBody:2;
     uint16_t         urlWhich:1;
     uint16_t         which:1;
+    uint16_t         bodyInterest:3;
 } HTTPInfo_t;
 
 extern MolochConfig_t        config;
@@ -49,6 +56,24 @@ extern uint32_t              pluginsCbs;
 static MolochStringHashStd_t httpReqHeaders;
 static MolochStringHashStd_t httpResHeaders;
 
+/* Everything we need to know about a header name, built the first time a
+ * packet thread sees the name and reused after that.
+ */
+#define HTTP_HEADER_HOST          1
+#define HTTP_HEADER_COOKIE        2
+#define HTTP_HEADER_AUTHORIZATION 3
+
+#define HTTP_MAX_HEADER_CACHE 1000
+
+typedef struct {
+    char            *tag;
+    uint32_t         tagValue;
+    int              pos[2];
+    char             special;
+} HTTPHeader_t;
+
+static MolochStringHashStd_t httpHeaderCache[MOLOCH_MAX_PACKET_THREADS];
+
 static int cookieKeyField;
 static int cookieValueField;
 static int hostField;
@@ -60,6 +85,7 @@ static int uaField;
 static int tagsReqField;
 static int tagsResField;
 static int md5Field;
+static int sha256Field;
 static int verReqField;
 static int verResField;
 static int pathField;
@@ -83,7 +109,8 @@ moloch_hp_cb_on_message_begin (http_parser *parser)
     http->inHeader &= ~(1 << http->which);
     http->inValue  &= ~(1 << http->which);
     http->inBody   &= ~(1 << http->which);
-    g_checksum_reset(http->checksum[http->which]);
+    if (http->bodyInterest & HTTP_BODY_DIGEST)
+        moloch_digest_reset(http->digest[http->which]);
 
     if (pluginsCbs & MOLOCH_PLUGIN_HP_OMB)
         moloch_plugins_cb_hp_omb(session, parser);
@@ -125,13 +152,15 @@ moloch_hp_cb_on_body (http_parser *parser, const char *at, size_t length)
             moloch_session_add_tag(session, "http:password");
         }
 
-        moloch_parsers_magic(session, magicField, at, length);
+        if (http->bodyInterest & HTTP_BODY_MAGIC)
+            moloch_parsers_magic(session, magicField, at, length);
         http->inBody |= (1 << http->which);
     }
 
-    g_checksum_update(http->checksum[http->which], (guchar *)at, length);
+    if (http->bodyInterest & HTTP_BODY_DIGEST)
+        moloch_digest_update(http->digest[http->which], (const unsigned char *)at, length);
 
-    if (pluginsCbs & MOLOCH_PLUGIN_HP_OB)
+    if (http->bodyInterest & HTTP_BODY_PLUGIN)
         moloch_plugins_cb_hp_ob(session, parser, at, length);
 
     return 0;
@@ -205,9 +234,14 @@ moloch_hp_cb_on_message_complete (http_parser *parser)
     if (pluginsCbs & MOLOCH_PLUGIN_HP_OMC)
         moloch_plugins_cb_hp_omc(session, parser);
 
-    if (http->inBody & (1 << http->which)) {
-        const char *md5 = g_checksum_get_string(http->checksum[http->which]);
-        moloch_field_string_add(md5Field, session, (char*)md5, 32, TRUE);
+    if ((http->bodyInterest & HTTP_BODY_DIGEST) && (http->inBody & (1 << http->which))) {
+        const char *md5 = moloch_digest_get_string(http->digest[http->which], MOLOCH_DIGEST_MD5);
+        if (md5)
+            moloch_field_string_add(md5Field, session, (char*)md5, 32, TRUE);
+
+        const char *sha256 = moloch_digest_get_string(http->digest[http->which], MOLOCH_DIGEST_SHA256);
+        if (sha256)
+            moloch_field_string_add(sha256Field, session, (char*)sha256, 64, TRUE);
     }
 
     return 0;
@@ -300,22 +334,78 @@ moloch_hp_cb_on_header_field (http_parser *parser, const char *at, size_t length
     int len = strlen(http->header[http->which]);
     size_t remaining = sizeof(http->header[http->which]) - len;
     if (remaining > 1) {
+        int i;
         int copy = MIN(length, remaining - 1);
-        memcpy(http->header[http->which] + len, at, copy);
-        http->header[http->which][len + copy] = 0;
+        char *header = http->header[http->which] + len;
+        for (i = 0; i < copy; i++) {
+            header[i] = g_ascii_tolower(at[i]);
+        }
+        header[copy] = 0;
     }
 
     return 0;
 }
 
+/******************************************************************************/
+LOCAL void
+http_header_fill(HTTPHeader_t *hdr, const char *lower)
+{
+    MolochString_t        *hstring;
+    char                   tag[200];
+
+    HASH_FIND(s_, httpReqHeaders, lower, hstring);
+    hdr->pos[0] = (long)(hstring?hstring->uw:0);
+    HASH_FIND(s_, httpResHeaders, lower, hstring);
+    hdr->pos[1] = (long)(hstring?hstring->uw:0);
+
+    if (strcmp(lower, "host") == 0)
+        hdr->special = HTTP_HEADER_HOST;
+    else if (strcmp(lower, "cookie") == 0)
+        hdr->special = HTTP_HEADER_COOKIE;
+    else if (strcmp(lower, "authorization") == 0)
+        hdr->special = HTTP_HEADER_AUTHORIZATION;
+    else
+        hdr->special = 0;
+
+    snprintf(tag, sizeof(tag), "http:header:%s", lower);
+    hdr->tag = g_strdup(tag);
+    hdr->tagValue = 0;
+}
+/******************************************************************************/
+/* Headers names are already lower case, each packet thread keeps its own cache
+ * so no locking, once full new names are just looked up every time.
+ */
+LOCAL HTTPHeader_t *
+http_header_lookup(MolochSession_t *session, const char *lower, HTTPHeader_t *tmp)
+{
+    MolochStringHashStd_t *cache = &httpHeaderCache[session->thread];
+    MolochString_t        *hstring;
+
+    HASH_FIND(s_, *cache, lower, hstring);
+    if (hstring)
+        return hstring->uw;
+
+    if (HASH_COUNT(s_, *cache) >= HTTP_MAX_HEADER_CACHE) {
+        http_header_fill(tmp, lower);
+        return tmp;
+    }
+
+    HTTPHeader_t *hdr = MOLOCH_TYPE_ALLOC0(HTTPHeader_t);
+    http_header_fill(hdr, lower);
+
+    hstring = MOLOCH_TYPE_ALLOC0(MolochString_t);
+    hstring->str = g_strdup(lower);
+    hstring->len = strlen(lower);
+    hstring->uw = hdr;
+    HASH_ADD(s_, *cache, hstring->str, hstring);
+    return hdr;
+}
 /******************************************************************************/
 int
 moloch_hp_cb_on_header_value (http_parser *parser, const char *at, size_t length)
 {
     HTTPInfo_t            *http = parser->data;
     MolochSession_t       *session = http->session;
-    char                   header[200];
-    MolochString_t        *hstring = 0;
 
 #ifdef HTTPDEBUG
     LOG("HTTPDEBUG: which: %d value: %.*s", http->which, (int)length, at);
@@ -324,42 +414,52 @@ moloch_hp_cb_on_header_value (http_parser *parser, const char *at, size_t length
     if ((http->inValue & (1 << http->which)) == 0) {
         http->inValue |= (1 << http->which);
 
-        char *lower = g_ascii_strdown(http->header[http->which], -1);
+        char *lower = http->header[http->which];
         moloch_plugins_cb_hp_ohf(session, parser, lower, strlen(lower));
 
-        if (http->which == http->urlWhich)
-            HASH_FIND(s_, httpReqHeaders, lower, hstring);
-        else
-            HASH_FIND(s_, httpResHeaders, lower, hstring);
+        HTTPHeader_t  tmp;
+        HTTPHeader_t *hdr = http_header_lookup(session, lower, &tmp);
+        int           req = (http->which == http->urlWhich);
+        int           tagsField = req?tagsReqField:tagsResField;
 
-        http->pos[http->which] = (long)(hstring?hstring->uw:0);
+        http->pos[http->which] = hdr->pos[req?0:1];
+        http->special[http->which] = hdr->special;
 
-        snprintf(header, sizeof(header), "http:header:%s", lower);
-        g_free(lower);
-        if (http->which == http->urlWhich)
-            moloch_session_add_tag_type(session, tagsReqField, header);
-        else
-            moloch_session_add_tag_type(session, tagsResField, header);
+        /* Once the tag number is known skip the tag lookup, unless some tags have side effects */
+        if (hdr->tagValue && HASH_COUNT(s_, config.dontSaveTags) == 0 && HASH_COUNT(s_, config.elephantTags) == 0) {
+            moloch_field_int_add(tagsField, session, hdr->tagValue);
+        } else {
+            moloch_session_add_tag_type(session, tagsField, hdr->tag);
+            if (hdr != &tmp)
+                hdr->tagValue = moloch_db_peek_tag(hdr->tag);
+        }
+
+        if (hdr == &tmp)
+            g_free(tmp.tag);
     }
 
     moloch_plugins_cb_hp_ohv(session, parser, at, length);
 
     // Request side
     if (parser->method) {
-        if (strcasecmp("host", http->header[http->which]) == 0) {
+        switch (http->special[http->which]) {
+        case HTTP_HEADER_HOST:
             if (!http->hostString)
                 http->hostString = g_string_new_len("//", 2);
             g_string_append_len(http->hostString, at, length);
-        } else if (strcasecmp("cookie", http->header[http->which]) == 0) {
+            break;
+        case HTTP_HEADER_COOKIE:
             if (!http->cookieString)
                 http->cookieString = g_string_new_len(at, length);
             else
                 g_string_append_len(http->cookieString, at, length);
-        } else if (strcasecmp("authorization", http->header[http->which]) == 0) {
+            break;
+        case HTTP_HEADER_AUTHORIZATION:
             if (!http->authString)
                 http->authString = g_string_new_len(at, length);
             else
                 g_string_append_len(http->authString, at, length);
+            break;
         }
     }
 
@@ -626,8 +726,10 @@ void http_free(MolochSession_t UNUSED(*session), void *uw)
     if (http->valueString[1])
         g_string_free(http->valueString[1], TRUE);
 
-    g_checksum_free(http->checksum[0]);
-    g_checksum_free(http->checksum[1]);
+    if (http->bodyInterest & HTTP_BODY_DIGEST) {
+        moloch_digest_free(http->digest[0]);
+        moloch_digest_free(http->digest[1]);
+    }
 
     MOLOCH_TYPE_FREE(HTTPInfo_t, http);
 }
@@ -641,8 +743,20 @@ void http_classify(MolochSession_t *session, const unsigned char *UNUSED(data),
 
     HTTPInfo_t            *http          = MOLOCH_TYPE_ALLOC0(HTTPInfo_t);
 
-    http->checksum[0] = g_checksum_new(G_CHECKSUM_MD5);
-    http->checksum[1] = g_checksum_new(G_CHECKSUM_MD5);
+    int digests = 0;
+    if (!(config.fields[md5Field]->flags & MOLOCH_FIELD_FLAG_DISABLED))
+        digests |= (1 << MOLOCH_DIGEST_MD5);
+    if (config.supportSha256 && !(config.fields[sha256Field]->flags & MOLOCH_FIELD_FLAG_DISABLED))
+        digests |= (1 << MOLOCH_DIGEST_SHA256);
+    if (digests) {
+        http->bodyInterest |= HTTP_BODY_DIGEST;
+        http->digest[0] = moloch_digest_new(digests);
+        http->digest[1] = moloch_digest_new(digests);
+    }
+    if (config.magicMode != MOLOCH_MAGICMODE_NONE && !(config.fields[magicField]->flags & MOLOCH_FIELD_FLAG_DISABLED))
+        http->bodyInterest |= HTTP_BODY_MAGIC;
+    if (pluginsCbs & MOLOCH_PLUGIN_HP_OB)
+        http->bodyInterest |= HTTP_BODY_PLUGIN;
 
     http_parser_init(&http->parsers[0], HTTP_BOTH);
     http_parser_init(&http->parsers[1], HTTP_BOTH);
@@ -655,6 +769,22 @@ void http_classify(MolochSession_t *session, const unsigned char *UNUSED(data),
     moloch_parsers_register2(session, http_parse, http, http_free, http_save);
 }
 /******************************************************************************/
+LOCAL void http_exit()
+{
+    MolochString_t *hstring;
+    int             t;
+
+    for (t = 0; t < MOLOCH_MAX_PACKET_THREADS; t++) {
+        HASH_FORALL_POP_HEAD(s_, httpHeaderCache[t], hstring,
+            HTTPHeader_t *hdr = hstring->uw;
+            g_free(hdr->tag);
+            MOLOCH_TYPE_FREE(HTTPHeader_t, hdr);
+            g_free(hstring->str);
+            MOLOCH_TYPE_FREE(MolochString_t, hstring);
+        );
+    }
+}
+/******************************************************************************/
 void moloch_parser_init()
 {
 static const char *method_strings[] =
@@ -691,7 +821,7 @@ static const char *method_strings[] =
     uaField = moloch_field_define("http", "textfield",
         "http.user-agent", "Useragent", "ua",
         "User-Agent Header",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT | MOLOCH_FIELD_FLAG_INTERN,
         "rawField", "rawua",
         NULL);
 
@@ -721,6 +851,12 @@ static const char *method_strings[] =
         "category", "md5",
         NULL);
 
+    sha256Field = moloch_field_define("http", "lotermfield",
+        "http.sha256", "Body SHA256", "hsha256",
+        "SHA256 of http body response, requires supportSha256",
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT,
+        NULL);
+
     moloch_field_define("http", "termfield",
         "http.version", "Version", "httpversion",
         "HTTP version number",
@@ -773,13 +909,13 @@ static const char *method_strings[] =
     methodField = moloch_field_define("http", "termfield",
         "http.method", "Request Method", "http.method-term",
         "HTTP Request Method",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_INTERN,
         NULL);
 
     magicField = moloch_field_define("http", "termfield",
         "http.bodymagic", "Body Magic", "http.bodymagic-term",
         "The content type of body determined by libfile/magic",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_INTERN,
         NULL);
 
     userField = moloch_field_define("http", "termfield",
@@ -804,6 +940,24 @@ static const char *method_strings[] =
     HASH_INIT(s_, httpReqHeaders, moloch_string_hash, moloch_string_cmp);
     HASH_INIT(s_, httpResHeaders, moloch_string_hash, moloch_string_cmp);
 
+    int t;
+    for (t = 0; t < MOLOCH_MAX_PACKET_THREADS; t++) {
+        HASH_INIT(s_, httpHeaderCache[t], moloch_string_hash, moloch_string_cmp);
+    }
+
+    // Registered only for the exit callback that frees the header caches
+    moloch_plugins_register("http", FALSE);
+    moloch_plugins_set_cb("http",
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      http_exit,
+      NULL
+    );
+
     moloch_config_add_header(&httpReqHeaders, "x-forwarded-for", xffField);
     moloch_config_add_header(&httpReqHeaders, "user-agent", uaField);
     moloch_config_add_header(&httpReqHeaders, "host", hostField);
@@ -37,6 +37,7 @@ static int hhField;
 static int subField;
 static int ctField;
 static int md5Field;
+static int sha256Field;
 static int fnField;
 static int uaField;
 static int mvField;
@@ -50,10 +51,11 @@ typedef struct {
     GString           *line[2];
     gint               state64[2];
     guint              save64[2];
-    GChecksum         *checksum[2];
+    MolochDigest_t    *digest[2];
 
     uint16_t           base64Decode:2;
     uint16_t           firstInContent:2;
+    uint16_t           decodeAttachments:1;
 } SMTPInfo_t;
 
 /******************************************************************************/
@@ -411,11 +413,12 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
         case EMAIL_AUTHPLAIN:
         case EMAIL_AUTHLOGIN:
         case EMAIL_CMD: {
-            if (*data == '\r') {
-                (*state)++;
-                break;
-            }
-            g_string_append_c(line, *data);
+            int n = moloch_parsers_line_append(line, data, remaining, 0);
+            if (n == remaining)
+                return 0;
+            data += n;
+            remaining -= n;
+            (*state)++;
             break;
         }
         case EMAIL_CMD_RETURN: {
@@ -510,11 +513,12 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
             break;
         }
         case EMAIL_DATA_HEADER: {
-            if (*data == '\r') {
-                *state = EMAIL_DATA_HEADER_RETURN;
-                break;
-            }
-            g_string_append_c(line, *data);
+            int n = moloch_parsers_line_append(line, data, remaining, 0);
+            if (n == remaining)
+                return 0;
+            data += n;
+            remaining -= n;
+            *state = EMAIL_DATA_HEADER_RETURN;
             break;
         }
         case EMAIL_DATA_HEADER_RETURN: {
@@ -619,11 +623,15 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
         }
         case EMAIL_MIME_DATA:
         case EMAIL_DATA: {
-            if (*data == '\r') {
-                (*state)++;
-                break;
-            }
-            g_string_append_c(line, *data);
+            /* Body lines are only kept whole when base64 decoding, otherwise the
+             * start is enough to find the boundaries and the ending .
+             */
+            int n = moloch_parsers_line_append(line, data, remaining, (email->base64Decode & (1 << which))?20000:1000);
+            if (n == remaining)
+                return 0;
+            data += n;
+            remaining -= n;
+            (*state)++;
             break;
         }
         case EMAIL_MIME_DATA_RETURN:
@@ -649,14 +657,19 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
 
                 if (found) {
                     if (email->base64Decode & (1 << which)) {
-                        const char *md5 = g_checksum_get_string(email->checksum[which]);
-                        moloch_field_string_add(md5Field, session, (char*)md5, 32, TRUE);
+                        const char *md5 = moloch_digest_get_string(email->digest[which], MOLOCH_DIGEST_MD5);
+                        if (md5)
+                            moloch_field_string_add(md5Field, session, (char*)md5, 32, TRUE);
+
+                        const char *sha256 = moloch_digest_get_string(email->digest[which], MOLOCH_DIGEST_SHA256);
+                        if (sha256)
+                            moloch_field_string_add(sha256Field, session, (char*)sha256, 64, TRUE);
                     }
                     email->firstInContent |= (1 << which);
                     email->base64Decode &= ~(1 << which);
                     email->state64[which] = 0;
                     email->save64[which] = 0;
-                    g_checksum_reset(email->checksum[which]);
+                    moloch_digest_reset(email->digest[which]);
                     *state = EMAIL_MIME;
                 } else if (*state == EMAIL_MIME_DATA_RETURN) {
                     if (email->base64Decode & (1 << which)) {
@@ -665,7 +678,7 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
                             gsize  b = g_base64_decode_step (line->str, line->len, buf, 
                                                             &(email->state64[which]),
                                                             &(email->save64[which]));
-                            g_checksum_update(email->checksum[which], buf, b);
+                            moloch_digest_update(email->digest[which], buf, b);
 
                             if (email->firstInContent & (1 << which)) {
                                 email->firstInContent &= ~(1 << which);
@@ -689,11 +702,12 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
             return 0;
         }
         case EMAIL_TLS_OK: {
-            if (*data == '\r') {
-                *state = EMAIL_TLS_OK_RETURN;
-                break;
-            }
-            g_string_append_c(line, *data);
+            int n = moloch_parsers_line_append(line, data, remaining, 0);
+            if (n == remaining)
+                return 0;
+            data += n;
+            remaining -= n;
+            *state = EMAIL_TLS_OK_RETURN;
             break;
         }
         case EMAIL_TLS_OK_RETURN: {
@@ -712,12 +726,12 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
             return 0;
         }
         case EMAIL_MIME: {
-
-            if (*data == '\r') {
-                *state = EMAIL_MIME_RETURN;
-                break;
-            }
-            g_string_append_c(line, *data);
+            int n = moloch_parsers_line_append(line, data, remaining, 0);
+            if (n == remaining)
+                return 0;
+            data += n;
+            remaining -= n;
+            *state = EMAIL_MIME_RETURN;
             break;
         }
         case EMAIL_MIME_RETURN: {
@@ -767,7 +781,8 @@ int smtp_parser(MolochSession_t *session, void *uw, const unsigned char *data, i
                     smtp_email_add_encoded(session, fnField, matching, strlen(matching));
                 }
             } else if (strncasecmp(line->str, "content-transfer-encoding:", 26) == 0) {
-                if(moloch_memcasestr(line->str+26, line->len - 26, "base64", 6)) {
+                /* Only decode attachments if something wants the decoded bytes */
+                if (email->decodeAttachments && moloch_memcasestr(line->str+26, line->len - 26, "base64", 6)) {
                     email->base64Decode |= (1 << which);
                 }
             }
@@ -794,8 +809,8 @@ void smtp_free(MolochSession_t UNUSED(*session), void *uw)
     g_string_free(email->line[0], TRUE);
     g_string_free(email->line[1], TRUE);
 
-    g_checksum_free(email->checksum[0]);
-    g_checksum_free(email->checksum[1]);
+    moloch_digest_free(email->digest[0]);
+    moloch_digest_free(email->digest[1]);
 
     while (DLL_POP_HEAD(s_, &email->boundaries, string)) {
         g_free(string->str);
@@ -825,8 +840,17 @@ void smtp_classify(MolochSession_t *session, const unsigned char *data, int len,
         email->line[0] = g_string_sized_new(100);
         email->line[1] = g_string_sized_new(100);
 
-        email->checksum[0] = g_checksum_new(G_CHECKSUM_MD5);
-        email->checksum[1] = g_checksum_new(G_CHECKSUM_MD5);
+        int digests = 0;
+        if (!(config.fields[md5Field]->flags & MOLOCH_FIELD_FLAG_DISABLED))
+            digests |= (1 << MOLOCH_DIGEST_MD5);
+        if (config.supportSha256 && !(config.fields[sha256Field]->flags & MOLOCH_FIELD_FLAG_DISABLED))
+            digests |= (1 << MOLOCH_DIGEST_SHA256);
+
+        email->digest[0] = moloch_digest_new(digests);
+        email->digest[1] = moloch_digest_new(digests);
+
+        email->decodeAttachments = digests ||
+                                   (config.magicMode != MOLOCH_MAGICMODE_NONE && !(config.fields[magicField]->flags & MOLOCH_FIELD_FLAG_DISABLED));
 
         DLL_INIT(s_, &(email->boundaries));
 
@@ -913,6 +937,13 @@ void moloch_parser_init()
         "category", "md5",
         NULL);
 
+    sha256Field = moloch_field_define("email", "termfield",
+        "email.sha256", "Attach SHA256s", "esha256",
+        "Email attachment SHA256s, requires supportSha256",
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT,
+        "requiredRight", "emailSearch",
+        NULL);
+
     fctField = moloch_field_define("email", "termfield",
         "email.file-content-type", "Attach Content-Type", "efct",
         "Email attachment content types",
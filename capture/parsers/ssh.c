@@ -124,7 +124,7 @@ void moloch_parser_init()
     verField = moloch_field_define("ssh", "lotermfield",
         "ssh.ver", "Version", "sshver",
         "SSH Software Version",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT | MOLOCH_FIELD_FLAG_INTERN,
         NULL);
 
     keyField = moloch_field_define("ssh", "termfield",
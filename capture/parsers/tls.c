@@ -33,6 +33,25 @@ extern unsigned char    moloch_char_to_hexstr[256][3];
 
 LOCAL GChecksum *checksums[MOLOCH_MAX_PACKET_THREADS];
 
+/* Per thread direct mapped cache of parsed certs keyed by their SHA1, busy
+ * sites send the same few chains over and over.  Each entry holds its own
+ * reference so it stays valid after the sessions using it are gone.
+ */
+typedef struct {
+    guchar              digest[20];
+    MolochCertsInfo_t  *certs;
+} TLSCertCacheEntry_t;
+
+typedef struct {
+    TLSCertCacheEntry_t *entries;
+    uint64_t             lookups;
+    uint64_t             hits;
+    uint64_t             bytesSaved;
+} TLSCertCache_t;
+
+LOCAL TLSCertCache_t  certCache[MOLOCH_MAX_PACKET_THREADS];
+LOCAL uint32_t        certCacheSize;
+
 /******************************************************************************/
 void
 tls_certinfo_process(MolochCertInfo_t *ci, BSB *bsb)
@@ -265,17 +284,46 @@ void tls_process_server_certificate(MolochSession_t *session, const unsigned cha
     BSB_IMPORT_skip(cbsb, 3); // Length again
 
     GChecksum * const checksum = checksums[session->thread];
+    TLSCertCache_t * const cache = &certCache[session->thread];
 
     while(BSB_REMAINING(cbsb) > 3) {
         int            badreason = 0;
         unsigned char *cdata = BSB_WORK_PTR(cbsb);
         int            clen = MIN(BSB_REMAINING(cbsb) - 3, (cdata[0] << 16 | cdata[1] << 8 | cdata[2]));
 
+        guchar digest[20];
+        gsize  len = sizeof(digest);
+
+        g_checksum_update(checksum, cdata+3, clen);
+        g_checksum_get_digest(checksum, digest, &len);
+        g_checksum_reset(checksum);
+
+        TLSCertCacheEntry_t *entry = NULL;
+        if (certCacheSize) {
+            cache->lookups++;
+            if ((cache->lookups % 100000) == 0) {
+                LOG("tls cert cache thread %d lookups: %" PRIu64 " hits: %" PRIu64 " (%.1f%%) saved: %" PRIu64 "KB",
+                    session->thread, cache->lookups, cache->hits, cache->hits*100.0/cache->lookups, cache->bytesSaved/1024);
+            }
+
+            entry = &cache->entries[(digest[0] << 24 | digest[1] << 16 | digest[2] << 8 | digest[3]) % certCacheSize];
+            if (entry->certs && memcmp(entry->digest, digest, 20) == 0) {
+                cache->hits++;
+                cache->bytesSaved += clen;
+                __sync_add_and_fetch(&entry->certs->refs, 1);
+                if (!moloch_field_certsinfo_add(certsField, session, entry->certs, clen*2)) {
+                    moloch_field_certsinfo_free(entry->certs);
+                }
+                BSB_IMPORT_skip(cbsb, clen + 3);
+                continue;
+            }
+        }
 
         MolochCertsInfo_t *certs = MOLOCH_TYPE_ALLOC0(MolochCertsInfo_t);
         DLL_INIT(s_, &certs->alt);
         DLL_INIT(s_, &certs->subject.commonName);
         DLL_INIT(s_, &certs->issuer.commonName);
+        certs->refs = 1;
 
         uint32_t       atag, alen, apc;
         unsigned char *value;
@@ -283,11 +331,6 @@ void tls_process_server_certificate(MolochSession_t *session, const unsigned cha
         BSB            bsb;
         BSB_INIT(bsb, cdata + 3, clen);
 
-        guchar digest[20];
-        gsize  len = sizeof(digest);
-
-        g_checksum_update(checksum, cdata+3, clen);
-        g_checksum_get_digest(checksum, digest, &len);
         if (len > 0) {
             int i;
             for(i = 0; i < 20; i++) {
@@ -297,7 +340,6 @@ void tls_process_server_certificate(MolochSession_t *session, const unsigned cha
             }
         }
         certs->hash[59] = 0;
-        g_checksum_reset(checksum);
 
         /* Certificate */
         if (!(value = moloch_parsers_asn_get_tlv(&bsb, &apc, &atag, &alen)))
@@ -366,6 +408,14 @@ void tls_process_server_certificate(MolochSession_t *session, const unsigned cha
             tls_alt_names(certs, &tbsb, lastOid);
         }
 
+        if (entry) {
+            if (entry->certs)
+                moloch_field_certsinfo_free(entry->certs);
+            memcpy(entry->digest, digest, 20);
+            entry->certs = certs;
+            __sync_add_and_fetch(&certs->refs, 1);
+        }
+
         if (!moloch_field_certsinfo_add(certsField, session, certs, clen*2)) {
             moloch_field_certsinfo_free(certs);
         }
@@ -685,13 +735,13 @@ void moloch_parser_init()
     verField = moloch_field_define("tls", "termfield",
         "tls.version", "Version", "tlsver-term", 
         "SSL/TLS version field", 
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT, 
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT | MOLOCH_FIELD_FLAG_INTERN, 
         NULL);
 
     cipherField = moloch_field_define("tls", "uptermfield",
         "tls.cipher", "Cipher", "tlscipher-term", 
         "SSL/TLS cipher field", 
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT, 
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_CNT | MOLOCH_FIELD_FLAG_INTERN, 
         NULL);
 
     dstIdField = moloch_field_define("tls", "lotermfield",
@@ -715,9 +765,13 @@ void moloch_parser_init()
 
     moloch_parsers_classifier_register_tcp("tls", NULL, 0, (unsigned char*)"\x16\x03", 2, tls_classify);
 
+    certCacheSize = moloch_config_int(NULL, "tlsCertCacheSize", 1024, 0, 0xfffff);
+
     int t;
     for (t = 0; t < config.packetThreads; t++) {
         checksums[t] = g_checksum_new(G_CHECKSUM_SHA1);
+        if (certCacheSize)
+            certCache[t].entries = calloc(certCacheSize, sizeof(TLSCertCacheEntry_t));
     }
 }
 
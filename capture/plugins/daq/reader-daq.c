@@ -152,7 +152,7 @@ void reader_daq_start() {
 
         char name[100];
         snprintf(name, sizeof(name), "moloch-daq%d", i);
-        g_thread_new(name, &reader_daq_thread, NULL);
+        moloch_threads_new(MOLOCH_THREAD_READER, i, name, &reader_daq_thread, NULL);
     }
 }
 /******************************************************************************/
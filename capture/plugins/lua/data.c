@@ -61,7 +61,7 @@ int MD_memmem(lua_State *L)
     MD_t *md = checkMolochData(L, 1);
     size_t len;
     const char *needle = luaL_checklstring(L, 2, &len);
-    const char *match = moloch_memstr(md->str, md->len, needle, len);
+    const char *match = memmem(md->str, md->len, needle, len);
     if (match) {
         lua_pushinteger(L, match - md->str);
     } else {
@@ -26,6 +26,10 @@ MolochSession_t moluaFakeSessions[MOLOCH_MAX_PACKET_THREADS];
 
 int molua_pluginIndex;
 
+#define MOLUA_MAX_CALLBACKS 100
+static MoluaCallback_t *callbacks[MOLUA_MAX_CALLBACKS];
+static int              callbacksCnt;
+
 /******************************************************************************/
 void molua_stackDump (lua_State *L)
 {
@@ -71,6 +75,90 @@ void lua_http_on_body_cb (MolochSession_t *session, http_parser *UNUSED(hp), con
     }
 }
 /******************************************************************************/
+/* Called on Ls[0] while the lua files are loading, the function itself is
+ * looked up in each state by molua_callback_resolve once all files are loaded
+ */
+MoluaCallback_t *molua_callback_register(const char *name)
+{
+    int i;
+
+    for (i = 0; i < callbacksCnt; i++) {
+        if (strcmp(callbacks[i]->name, name) == 0)
+            return callbacks[i];
+    }
+
+    if (callbacksCnt >= MOLUA_MAX_CALLBACKS) {
+        LOG("ERROR - Can't have more then %d lua callbacks", MOLUA_MAX_CALLBACKS);
+        exit(0);
+    }
+
+    MoluaCallback_t *cb = MOLOCH_TYPE_ALLOC0(MoluaCallback_t);
+    cb->name = g_strdup(name);
+    callbacks[callbacksCnt++] = cb;
+    return cb;
+}
+/******************************************************************************/
+void molua_callback_resolve(lua_State *L, int thread)
+{
+    int i;
+
+    for (i = 0; i < callbacksCnt; i++) {
+        MoluaCallback_t *cb = callbacks[i];
+
+        lua_getglobal(L, cb->name);
+        if (!lua_isfunction(L, -1)) {
+            LOG("ERROR - lua function %s not found", cb->name);
+            exit(0);
+        }
+
+        if (!cb->source) {
+            lua_Debug ar;
+            lua_pushvalue(L, -1);
+            lua_getinfo(L, ">S", &ar);
+            cb->source = g_strdup_printf("%s:%d", ar.short_src, ar.linedefined);
+        }
+
+        cb->ref[thread] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+}
+/******************************************************************************/
+/* The function and nargs arguments must already be pushed */
+int molua_callback_pcall(lua_State *L, MoluaCallback_t *cb, int thread, int nargs, int nresults)
+{
+    struct timeval startTime, endTime;
+
+    gettimeofday(&startTime, NULL);
+    int rc = lua_pcall(L, nargs, nresults, 0);
+    gettimeofday(&endTime, NULL);
+
+    cb->calls[thread]++;
+    cb->usecs[thread] += (endTime.tv_sec - startTime.tv_sec)*1000000 + (endTime.tv_usec - startTime.tv_usec);
+    return rc;
+}
+/******************************************************************************/
+static void molua_callback_stats()
+{
+    int i, t;
+
+    for (i = 0; i < callbacksCnt; i++) {
+        MoluaCallback_t *cb = callbacks[i];
+        uint64_t calls = 0, usecs = 0;
+
+        for (t = 0; t < config.packetThreads; t++) {
+            calls += cb->calls[t];
+            usecs += cb->usecs[t];
+        }
+        LOG("lua %s (%s) calls: %" PRIu64 " ms: %" PRIu64 " avg usecs: %.1f",
+            cb->name, cb->source, calls, usecs/1000, calls?(double)usecs/calls:0.0);
+    }
+}
+/******************************************************************************/
+static gboolean molua_callback_stats_gfunc(gpointer UNUSED(user_data))
+{
+    molua_callback_stats();
+    return TRUE;
+}
+/******************************************************************************/
 static int M_expression_to_fieldId(lua_State *L)
 {
     if (lua_gettop(L) != 1 || !lua_isstring(L, 1)) {
@@ -110,11 +198,159 @@ void molua_session_save(MolochSession_t *session, int final)
         if (mp->table) {
             luaL_unref(Ls[session->thread], LUA_REGISTRYINDEX, mp->table);
         }
+        if (mp->session) {
+            // Scripts that kept the session around will now get an error
+            lua_State *L = Ls[session->thread];
+            lua_rawgeti(L, LUA_REGISTRYINDEX, mp->session);
+            *(void **)lua_touserdata(L, -1) = NULL;
+            lua_pop(L, 1);
+            luaL_unref(L, LUA_REGISTRYINDEX, mp->session);
+        }
         MOLOCH_TYPE_FREE(MoluaPlugin_t, mp);
         session->pluginData[molua_pluginIndex] = 0;
     }
 }
 /******************************************************************************/
+void molua_plugin_exit()
+{
+    molua_callback_stats();
+}
+#ifdef MOLUA_LUAJIT
+/******************************************************************************/
+/* FFI accessors, handed to the prelude as a table of function pointers so
+ * they don't need to be exported.  They return views into capture memory,
+ * nothing is copied unless the script asks for a lua string.
+ */
+typedef struct {
+    uint64_t  databytes[2];
+    uint32_t  packets[2];
+    uint16_t  port1;
+    uint16_t  port2;
+    uint8_t   protocol;
+} MoluaSessionInfo_t;
+
+typedef struct {
+    int  (*field_str)(const MolochSession_t *session, int pos, int n, const char **str);
+    int  (*field_int)(const MolochSession_t *session, int pos, int n, int *value);
+    void (*info)(const MolochSession_t *session, MoluaSessionInfo_t *info);
+} MoluaFFI_t;
+
+/******************************************************************************/
+static int molua_ffi_field_str(const MolochSession_t *session, int pos, int n, const char **str)
+{
+    MolochString_t *hstring;
+
+    if (pos < 0 || pos >= session->maxFields || !session->fields[pos])
+        return -1;
+
+    MolochField_t *field = session->fields[pos];
+    switch (config.fields[pos]->type) {
+    case MOLOCH_FIELD_TYPE_STR:
+        if (n != 0)
+            return -1;
+        *str = field->str;
+        return strlen(field->str);
+    case MOLOCH_FIELD_TYPE_STR_ARRAY:
+        if (n < 0 || n >= (int)field->sarray->len)
+            return -1;
+        *str = g_ptr_array_index(field->sarray, n);
+        return strlen(*str);
+    case MOLOCH_FIELD_TYPE_STR_HASH:
+        HASH_FORALL(s_, *(field->shash), hstring,
+            if (n-- == 0) {
+                *str = hstring->str;
+                return hstring->len;
+            }
+        );
+        return -1;
+    }
+    return -1;
+}
+/******************************************************************************/
+static int molua_ffi_field_int(const MolochSession_t *session, int pos, int n, int *value)
+{
+    MolochInt_t *hint;
+
+    if (pos < 0 || pos >= session->maxFields || !session->fields[pos])
+        return 0;
+
+    MolochField_t *field = session->fields[pos];
+    switch (config.fields[pos]->type) {
+    case MOLOCH_FIELD_TYPE_INT:
+    case MOLOCH_FIELD_TYPE_IP:
+        if (n != 0)
+            return 0;
+        *value = field->i;
+        return 1;
+    case MOLOCH_FIELD_TYPE_INT_ARRAY:
+        if (n < 0 || n >= (int)field->iarray->len)
+            return 0;
+        *value = g_array_index(field->iarray, int, n);
+        return 1;
+    case MOLOCH_FIELD_TYPE_INT_HASH:
+    case MOLOCH_FIELD_TYPE_IP_HASH:
+        HASH_FORALL(i_, *(field->ihash), hint,
+            if (n-- == 0) {
+                *value = hint->i_hash;
+                return 1;
+            }
+        );
+        return 0;
+    }
+    return 0;
+}
+/******************************************************************************/
+static void molua_ffi_info(const MolochSession_t *session, MoluaSessionInfo_t *info)
+{
+    info->databytes[0] = session->databytes[0];
+    info->databytes[1] = session->databytes[1];
+    info->packets[0]   = session->packets[0];
+    info->packets[1]   = session->packets[1];
+    info->port1        = session->port1;
+    info->port2        = session->port2;
+    info->protocol     = session->protocol;
+}
+/******************************************************************************/
+static MoluaFFI_t moluaFFI = {molua_ffi_field_str, molua_ffi_field_int, molua_ffi_info};
+
+static const char *moluaFFIPrelude =
+"local ffi = require('ffi')\n"
+"ffi.cdef[[\n"
+"typedef struct { const uint8_t *str; int len; uint8_t needFree; } MD_t;\n"
+"typedef struct { uint64_t databytes[2]; uint32_t packets[2]; uint16_t port1; uint16_t port2; uint8_t protocol; } MoluaSessionInfo_t;\n"
+"typedef struct {\n"
+"    int  (*field_str)(void *session, int pos, int n, const char **str);\n"
+"    int  (*field_int)(void *session, int pos, int n, int *value);\n"
+"    void (*info)(void *session, MoluaSessionInfo_t *info);\n"
+"} MoluaFFI_t;\n"
+"]]\n"
+"local api = ffi.cast('MoluaFFI_t *', ...)\n"
+"local strp = ffi.new('const char *[1]')\n"
+"local intp = ffi.new('int[1]')\n"
+"MolochFFI = {}\n"
+"function MolochFFI.session(session) return ffi.cast('void **', session)[0] end\n"
+"function MolochFFI.data(data) local md = ffi.cast('MD_t *', data) return md.str, md.len end\n"
+"function MolochFFI.field_ptr(s, pos, n) local len = api.field_str(s, pos, n or 0, strp) if len < 0 then return nil end return strp[0], len end\n"
+"function MolochFFI.field_str(s, pos, n) local len = api.field_str(s, pos, n or 0, strp) if len < 0 then return nil end return ffi.string(strp[0], len) end\n"
+"function MolochFFI.field_int(s, pos, n) if api.field_int(s, pos, n or 0, intp) == 0 then return nil end return intp[0] end\n"
+"function MolochFFI.info(s, info) info = info or ffi.new('MoluaSessionInfo_t') api.info(s, info) return info end\n";
+
+/******************************************************************************/
+static void molua_ffi_init(lua_State *L)
+{
+    if (luaL_loadstring(L, moluaFFIPrelude)) {
+        LOG("Error loading ffi prelude: %s", lua_tostring(L, -1));
+        exit(0);
+    }
+
+    lua_pushlightuserdata(L, &moluaFFI);
+    if (lua_pcall(L, 1, 0, 0)) {
+        LOG("Error initing ffi prelude: %s", lua_tostring(L, -1));
+        exit(0);
+    }
+}
+#endif
+/******************************************************************************/
 void moloch_plugin_init()
 {
     int thread;
@@ -123,12 +359,15 @@ void moloch_plugin_init()
 
     molua_pluginIndex = moloch_plugins_register("lua", TRUE);
 
-    moloch_plugins_set_cb("lua", NULL, NULL, NULL, NULL, molua_session_save, NULL, NULL, NULL);
+    moloch_plugins_set_cb("lua", NULL, NULL, NULL, NULL, molua_session_save, NULL, molua_plugin_exit, NULL);
 
 
     for (thread = 0; thread < config.packetThreads; thread++) {
         L = Ls[thread] = luaL_newstate();
         luaL_openlibs(L);
+#ifdef MOLUA_LUAJIT
+        molua_ffi_init(L);
+#endif
         moluaFakeSessions[thread].thread = thread;
 
         int i;
@@ -149,5 +388,10 @@ void moloch_plugin_init()
                 exit(0);
             }
         }
+
+        molua_callback_resolve(L, thread);
     }
+
+    if (config.debug)
+        g_timeout_add_seconds(60, molua_callback_stats_gfunc, 0);
 }
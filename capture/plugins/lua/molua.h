@@ -4,6 +4,20 @@
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
+#ifdef MOLUA_LUAJIT
+#include "luajit.h"
+#endif
+
+/* LuaJIT is Lua 5.1 with some 5.2 extensions, map the few newer calls we use */
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen(L, i)         lua_objlen(L, i)
+#endif
+#if LUA_VERSION_NUM < 503
+#define lua_isinteger(L, i)      (lua_type(L, i) == LUA_TNUMBER)
+#endif
+#ifndef luaL_newlib
+#define luaL_newlib(L, l)        (lua_newtable(L), luaL_setfuncs(L, l, 0))
+#endif
 
 extern MolochConfig_t        config;
 
@@ -28,8 +42,24 @@ typedef struct {
 typedef struct {
     uint32_t callbackOff[MOLUA_REF_SIZE];
     long     table;
+    long     session;
 } MoluaPlugin_t;
 
+/* A named lua function resolved to a registry ref in each packet thread's
+ * state, with the time spent in it per thread
+ */
+typedef struct {
+    char     *name;
+    char     *source;
+    long      ref[MOLOCH_MAX_PACKET_THREADS];
+    uint64_t  calls[MOLOCH_MAX_PACKET_THREADS];
+    uint64_t  usecs[MOLOCH_MAX_PACKET_THREADS];
+} MoluaCallback_t;
+
+MoluaCallback_t *molua_callback_register(const char *name);
+void molua_callback_resolve(lua_State *L, int thread);
+int molua_callback_pcall(lua_State *L, MoluaCallback_t *cb, int thread, int nargs, int nresults);
+
 MD_t *molua_pushMolochData (lua_State *L, const char *str, int len);
 void *molua_pushMolochSession (lua_State *L, const MolochSession_t *session);
 
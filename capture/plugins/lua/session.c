@@ -19,6 +19,8 @@
 
 extern lua_State *Ls[MOLOCH_MAX_PACKET_THREADS];
 
+static MoluaCallback_t *bodyCallbacks[MOLUA_REF_SIZE][MOLUA_REF_MAX_CNT];
+static int              bodyCallbacksCnt[MOLUA_REF_SIZE];
 
 /******************************************************************************/
 static void *checkMolochSession (lua_State *L, int index)
@@ -36,25 +38,45 @@ static void *checkMolochSession (lua_State *L, int index)
     return ms;
 }
 /******************************************************************************/
+/* The userdata is created once per session and kept in the registry until the
+ * session is saved, so callbacks don't allocate each time
+ */
 void *molua_pushMolochSession (lua_State *L, const MolochSession_t *ms)
 {
+    MolochSession_t *session = (MolochSession_t *)ms;
+    MoluaPlugin_t   *mp = session->pluginData[molua_pluginIndex];
+
+    if (!mp) {
+        mp = session->pluginData[molua_pluginIndex] = MOLOCH_TYPE_ALLOC0(MoluaPlugin_t);
+    }
+
+    if (mp->session) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mp->session);
+        return lua_touserdata(L, -1);
+    }
+
     void **pms = (void **)lua_newuserdata(L, sizeof(void *));
     *pms = (void*)ms;
     luaL_getmetatable(L, "MolochSession");
     lua_setmetatable(L, -2);
+
+    lua_pushvalue(L, -1);
+    mp->session = luaL_ref(L, LUA_REGISTRYINDEX);
     return pms;
 }
 
 /******************************************************************************/
 void molua_classify_cb(MolochSession_t *session, const unsigned char *data, int len, int which, void *uw)
 {
+    MoluaCallback_t *cb = uw;
     lua_State *L = Ls[session->thread];
-    lua_getglobal(L, uw);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cb->ref[session->thread]);
     molua_pushMolochSession(L, session);
-    lua_pushlstring(L, (char *)data, len);
+    // Only copied into a lua string if the script calls data:get()
+    molua_pushMolochData(L, (const char *)data, len);
     lua_pushnumber(L, which);
-    if (lua_pcall(L, 3, 0, 0) != 0) {
-       LOG("error running function %s: %s", (char *)uw, lua_tostring(L, -1));
+    if (molua_callback_pcall(L, cb, session->thread, 3, 0) != 0) {
+       LOG("error running function %s: %s", cb->name, lua_tostring(L, -1));
        exit(0);
     }
 }
@@ -101,9 +123,9 @@ static int MS_register_tcp_classifier(lua_State *L)
     char  offset    = lua_tonumber(L, 2);
     int   match_len = lua_rawlen(L, 3);
     guchar *match     = g_memdup(lua_tostring(L, 3), match_len);
-    char *function  = g_strdup(lua_tostring(L, 4));
+    MoluaCallback_t *cb = molua_callback_register(lua_tostring(L, 4));
 
-    moloch_parsers_classifier_register_tcp(name, function, offset, match, match_len, molua_classify_cb);
+    moloch_parsers_classifier_register_tcp(name, cb, offset, match, match_len, molua_classify_cb);
     return 0;
 }
 /******************************************************************************/
@@ -120,38 +142,37 @@ static int MS_register_udp_classifier(lua_State *L)
     char  offset    = lua_tonumber(L, 2);
     int   match_len = lua_rawlen(L, 3);
     guchar *match     = g_memdup(lua_tostring(L, 3), match_len);
-    char *function  = g_strdup(lua_tostring(L, 4));
+    MoluaCallback_t *cb = molua_callback_register(lua_tostring(L, 4));
 
-    moloch_parsers_classifier_register_udp(name, function, offset, match, match_len, molua_classify_cb);
+    moloch_parsers_classifier_register_udp(name, cb, offset, match, match_len, molua_classify_cb);
     return 0;
 }
-static char *callbackRefs[MOLUA_REF_SIZE][MOLUA_REF_MAX_CNT];
-static int   callbackRefsCnt[MOLUA_REF_SIZE];
 /******************************************************************************/
 void molua_http_on_body_cb (MolochSession_t *session, http_parser *UNUSED(hp), const char *at, size_t length)
 {
     MoluaPlugin_t *mp = session->pluginData[molua_pluginIndex];
     lua_State *L = Ls[session->thread];
     int i;
-    for (i = 0; i < callbackRefsCnt[MOLUA_REF_HTTP]; i++) {
+    for (i = 0; i < bodyCallbacksCnt[MOLUA_REF_HTTP]; i++) {
         if (mp && mp->callbackOff[MOLUA_REF_HTTP] & (1 << i))
             continue;
 
-        lua_getglobal(L, callbackRefs[MOLUA_REF_HTTP][i]);
+        MoluaCallback_t *cb = bodyCallbacks[MOLUA_REF_HTTP][i];
+        lua_rawgeti(L, LUA_REGISTRYINDEX, cb->ref[session->thread]);
         molua_pushMolochSession(L, session);
         molua_pushMolochData(L, at, length);
 
-        if (lua_pcall(L, 2, 1, 0) != 0) {
+        if (molua_callback_pcall(L, cb, session->thread, 2, 1) != 0) {
             molua_stackDump(L);
-            LOG("error running http callback function %s", lua_tostring(L, -1));
+            LOG("error running http callback function %s: %s", cb->name, lua_tostring(L, -1));
             exit(0);
         }
 
+        // molua_pushMolochSession may have just allocated it
+        mp = session->pluginData[molua_pluginIndex];
+
         int num = lua_tointeger(L, -1);
         if (num == -1) {
-            if (!mp) {
-                mp = session->pluginData[molua_pluginIndex] = MOLOCH_TYPE_ALLOC0(MoluaPlugin_t);
-            }
             mp->callbackOff[MOLUA_REF_HTTP] |= (1 << i);
         }
         lua_pop(L, 1);
@@ -171,8 +192,8 @@ static int MS_register_body_feed(lua_State *L)
 
     if (strcmp(type, "http") == 0) {
         moloch_plugins_set_http_cb("lua", NULL, NULL, NULL, NULL, NULL, molua_http_on_body_cb, NULL);
-        if (callbackRefsCnt[MOLUA_REF_HTTP] < MOLUA_REF_MAX_CNT) {
-            callbackRefs[MOLUA_REF_HTTP][callbackRefsCnt[MOLUA_REF_HTTP]++] = g_strdup(lua_tostring(L, 2));
+        if (bodyCallbacksCnt[MOLUA_REF_HTTP] < MOLUA_REF_MAX_CNT) {
+            bodyCallbacks[MOLUA_REF_HTTP][bodyCallbacksCnt[MOLUA_REF_HTTP]++] = molua_callback_register(lua_tostring(L, 2));
         } else {
             return luaL_error(L, "Can't have more then %d %s callbacks", MOLUA_REF_MAX_CNT, type);
         }
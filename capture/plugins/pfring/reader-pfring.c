@@ -129,7 +129,7 @@ void reader_pfring_start() {
     for (i = 0; i < MAX_INTERFACES && config.interface[i]; i++) {
         char name[100];
         snprintf(name, sizeof(name), "moloch-pfring%d", i);
-        g_thread_new(name, &reader_pfring_thread, rings[i]);
+        moloch_threads_new(MOLOCH_THREAD_READER, i, name, &reader_pfring_thread, rings[i]);
     }
 }
 /******************************************************************************/
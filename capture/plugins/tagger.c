@@ -1,8 +1,8 @@
 /* tagger.c  -- Simple plugin that tags sessions by using ip, hosts, md5s
  *              lists fetched from the ES database.  taggerUpdate.pl is
  *              used to upload files to the database.  tagger checks
- *              once a minute to see if the files in the database have
- *              changed.
+ *              once a minute, or on SIGHUP, to see if the files in the
+ *              database have changed.
  *
  * Copyright 2012-2016 AOL Inc. All rights reserved.
  *
@@ -77,6 +77,7 @@ typedef struct tagger_file {
     char                 *type;
     char                **tags;
     char                **elements;
+    GPtrArray            *infos;
     uint32_t              s_hash;
     uint16_t              s_bucket;
 } TaggerFile_t;
@@ -102,20 +103,32 @@ typedef struct {
 
 typedef struct tagger_info {
     TaggerOpHead_t ops;
-    TaggerFile_t  *file;
+    char          *key;
+    char         **tags;
 } TaggerInfo_t;
 
 /******************************************************************************/
 typedef HASH_VAR(s_, TaggerStringHash_t, TaggerStringHead_t, 37277);
 
-TaggerStringHash_t allDomains;
-TaggerStringHash_t allMD5s;
-TaggerStringHash_t allEmails;
-TaggerStringHash_t allURIs;
-
 HASH_VAR(s_, allFiles, TaggerFileHead_t, 101);
 
-static patricia_tree_t *allIps;
+/* The packet threads only ever look at the published tables.  When files
+ * change new tables are built on the main thread from allFiles and swapped in,
+ * the old tables and the file data they point at are freed once no packet
+ * thread can still be using them.
+ */
+typedef struct {
+    TaggerStringHash_t    domains;
+    TaggerStringHash_t    md5s;
+    TaggerStringHash_t    emails;
+    TaggerStringHash_t    uris;
+    patricia_tree_t      *ips;
+    GPtrArray            *retired;
+} TaggerTables_t;
+
+static TaggerTables_t    *tables;
+static GPtrArray         *retiredFiles;
+static guint              publishTimer;
 
 /******************************************************************************/
 void tagger_process_match(MolochSession_t *session, GPtrArray *infos)
@@ -123,9 +136,8 @@ void tagger_process_match(MolochSession_t *session, GPtrArray *infos)
     uint32_t f, t;
     for (f = 0; f < infos->len; f++) {
         TaggerInfo_t *info = g_ptr_array_index(infos, f);
-        TaggerFile_t *file = info->file;
-        for (t = 0; file->tags[t]; t++) {
-            moloch_session_add_tag(session, file->tags[t]);
+        for (t = 0; info->tags[t]; t++) {
+            moloch_session_add_tag(session, info->tags[t]);
         }
         TaggerOp_t *op;
         DLL_FOREACH(o_, &info->ops, op) {
@@ -158,6 +170,7 @@ void tagger_process_match(MolochSession_t *session, GPtrArray *infos)
  */
 void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
 {
+    TaggerTables_t *tt = tables;
     TaggerString_t *tstring;
 
     patricia_node_t *nodes[PATRICIA_MAXBITS+1];
@@ -176,7 +189,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
         memcpy(&prefix.add.sin6.s6_addr, &session->addr1, 16);
     }
 
-    cnt = patricia_search_all(allIps, &prefix, 1, nodes);
+    cnt = patricia_search_all(tt->ips, &prefix, 1, nodes);
     for (i = 0; i < cnt; i++) {
         tagger_process_match(session, ((TaggerIP_t *)(nodes[i]->data))->infos);
     }
@@ -191,7 +204,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
         memcpy(&prefix.add.sin6.s6_addr, &session->addr2, 16);
     }
 
-    cnt = patricia_search_all(allIps, &prefix, 1, nodes);
+    cnt = patricia_search_all(tt->ips, &prefix, 1, nodes);
     for (i = 0; i < cnt; i++) {
         tagger_process_match(session, ((TaggerIP_t *)(nodes[i]->data))->infos);
     }
@@ -206,21 +219,19 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
 
             HASH_FORALL(i_, *ihash, xff,
                 prefix.add.sin.s_addr = xff->i_hash;
-                cnt = patricia_search_all(allIps, &prefix, 1, nodes);
+                cnt = patricia_search_all(tt->ips, &prefix, 1, nodes);
                 for (i = 0; i < cnt; i++) {
                     tagger_process_match(session, ((TaggerIP_t *)(nodes[i]->data))->infos);
                 }
             );
         } else {
-            GHashTable            *ghash;
-            GHashTableIter         iter;
+            MolochFieldIntsIter_t  iter;
             gpointer               ikey;
 
-            ghash = session->fields[httpXffField]->ghash;
-            g_hash_table_iter_init (&iter, ghash);
-            while (g_hash_table_iter_next (&iter, &ikey, NULL)) {
+            moloch_field_ints_iter_init(&iter, session->fields[httpXffField]);
+            while (moloch_field_ints_iter_next(&iter, &ikey)) {
                 prefix.add.sin.s_addr = (int)(long)ikey;
-                cnt = patricia_search_all(allIps, &prefix, 1, nodes);
+                cnt = patricia_search_all(tt->ips, &prefix, 1, nodes);
                 for (i = 0; i < cnt; i++) {
                     tagger_process_match(session, ((TaggerIP_t *)(nodes[i]->data))->infos);
                 }
@@ -232,12 +243,12 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (httpHostField != -1 && session->fields[httpHostField]) {
         MolochStringHashStd_t *shash = session->fields[httpHostField]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allDomains, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->domains, hstring->s_hash, hstring->str, tstring);
             if (tstring)
                 tagger_process_match(session, tstring->infos);
             char *dot = strchr(hstring->str, '.');
             if (dot && *(dot+1)) {
-                HASH_FIND(s_, allDomains, dot+1, tstring);
+                HASH_FIND(s_, tt->domains, dot+1, tstring);
                 if (tstring)
                     tagger_process_match(session, tstring->infos);
             }
@@ -246,12 +257,12 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (dnsHostField != -1 && session->fields[dnsHostField]) {
         MolochStringHashStd_t *shash = session->fields[dnsHostField]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allDomains, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->domains, hstring->s_hash, hstring->str, tstring);
             if (tstring)
                 tagger_process_match(session, tstring->infos);
             char *dot = strchr(hstring->str, '.');
             if (dot && *(dot+1)) {
-                HASH_FIND(s_, allDomains, dot+1, tstring);
+                HASH_FIND(s_, tt->domains, dot+1, tstring);
                 if (tstring)
                     tagger_process_match(session, tstring->infos);
             }
@@ -261,7 +272,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (httpMd5Field != -1 && session->fields[httpMd5Field]) {
         MolochStringHashStd_t *shash = session->fields[httpMd5Field]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allMD5s, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->md5s, hstring->s_hash, hstring->str, tstring);
             if (tstring)
                 tagger_process_match(session, tstring->infos);
         );
@@ -270,7 +281,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (httpPathField != -1 && session->fields[httpPathField]) {
         MolochStringHashStd_t *shash = session->fields[httpPathField]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allURIs, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->uris, hstring->s_hash, hstring->str, tstring);
             if (tstring) {
                 tagger_process_match(session, tstring->infos);
             }
@@ -280,7 +291,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (emailMd5Field != -1 && session->fields[emailMd5Field]) {
         MolochStringHashStd_t *shash = session->fields[emailMd5Field]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allMD5s, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->md5s, hstring->s_hash, hstring->str, tstring);
             if (tstring)
                 tagger_process_match(session, tstring->infos);
         );
@@ -289,7 +300,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (emailSrcField != -1 && session->fields[emailSrcField]) {
         MolochStringHashStd_t *shash = session->fields[emailSrcField]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allEmails, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->emails, hstring->s_hash, hstring->str, tstring);
             if (tstring)
                 tagger_process_match(session, tstring->infos);
         );
@@ -298,7 +309,7 @@ void tagger_plugin_save(MolochSession_t *session, int UNUSED(final))
     if (emailDstField != -1 && session->fields[emailDstField]) {
         MolochStringHashStd_t *shash = session->fields[emailDstField]->shash;
         HASH_FORALL(s_, *shash, hstring,
-            HASH_FIND_HASH(s_, allEmails, hstring->s_hash, hstring->str, tstring);
+            HASH_FIND_HASH(s_, tt->emails, hstring->s_hash, hstring->str, tstring);
             if (tstring)
                 tagger_process_match(session, tstring->infos);
         );
@@ -312,120 +323,196 @@ void tagger_free_ip (TaggerIP_t *tip)
     MOLOCH_TYPE_FREE(TaggerIP_t, tip);
 }
 /******************************************************************************/
+void tagger_file_free(gpointer data)
+{
+    TaggerFile_t *file = data;
+
+    if (file->infos)
+        g_ptr_array_free(file->infos, TRUE);
+    free(file->str);
+    g_free(file->md5);
+    g_free(file->type);
+    g_strfreev(file->tags);
+    g_strfreev(file->elements);
+    MOLOCH_TYPE_FREE(TaggerFile_t, file);
+}
+/******************************************************************************/
+TaggerTables_t *tagger_tables_new()
+{
+    TaggerTables_t *tt = MOLOCH_TYPE_ALLOC0(TaggerTables_t);
+
+    HASH_INIT(s_, tt->domains, moloch_string_hash, moloch_string_cmp);
+    HASH_INIT(s_, tt->md5s, moloch_string_hash, moloch_string_cmp);
+    HASH_INIT(s_, tt->emails, moloch_string_hash, moloch_string_cmp);
+    HASH_INIT(s_, tt->uris, moloch_string_hash, moloch_string_cmp);
+    tt->ips = New_Patricia(128);
+    return tt;
+}
+/******************************************************************************/
 /*
- * Called by moloch when moloch is quiting
+ * The strings and infos belong to the files, so only the lookup structures
+ * and any retired files are freed here
  */
-void tagger_plugin_exit()
+void tagger_tables_free(gpointer data)
 {
+    TaggerTables_t *tt = data;
     TaggerString_t *tstring;
-    HASH_FORALL_POP_HEAD(s_, allDomains, tstring,
-        free(tstring->str);
+
+    HASH_FORALL_POP_HEAD(s_, tt->domains, tstring,
         g_ptr_array_free(tstring->infos, TRUE);
         MOLOCH_TYPE_FREE(TaggerString_t, tstring);
     );
 
-    HASH_FORALL_POP_HEAD(s_, allMD5s, tstring,
-        free(tstring->str);
+    HASH_FORALL_POP_HEAD(s_, tt->md5s, tstring,
         g_ptr_array_free(tstring->infos, TRUE);
         MOLOCH_TYPE_FREE(TaggerString_t, tstring);
     );
 
-    HASH_FORALL_POP_HEAD(s_, allEmails, tstring,
-        free(tstring->str);
+    HASH_FORALL_POP_HEAD(s_, tt->emails, tstring,
         g_ptr_array_free(tstring->infos, TRUE);
         MOLOCH_TYPE_FREE(TaggerString_t, tstring);
     );
 
-    HASH_FORALL_POP_HEAD(s_, allURIs, tstring,
-        free(tstring->str);
+    HASH_FORALL_POP_HEAD(s_, tt->uris, tstring,
         g_ptr_array_free(tstring->infos, TRUE);
         MOLOCH_TYPE_FREE(TaggerString_t, tstring);
     );
 
-    TaggerFile_t *file;
-    HASH_FORALL_POP_HEAD(s_, allFiles, file,
-        free(file->str);
-        g_free(file->md5);
-        g_free(file->type);
-        g_strfreev(file->tags);
-        g_strfreev(file->elements);
-        MOLOCH_TYPE_FREE(TaggerFile_t, file);
-    );
-
-    Destroy_Patricia(allIps, tagger_free_ip);
-}
+    Destroy_Patricia(tt->ips, tagger_free_ip);
 
-void tagger_remove_file(GPtrArray *infos, TaggerFile_t *file)
-{
-    int f;
-    for (f = 0; f < (int)infos->len; f++) {
-        if (file == ((TaggerInfo_t *)g_ptr_array_index(infos, f))->file) {
-            g_ptr_array_remove_index_fast(infos, f);
-            return;
-        }
-    }
+    if (tt->retired)
+        g_ptr_array_free(tt->retired, TRUE);
+    MOLOCH_TYPE_FREE(TaggerTables_t, tt);
 }
 /******************************************************************************/
-/*
- * Free most of the memory used by a file
- */
-void tagger_unload_file(TaggerFile_t *file) {
-    int i;
-    if (file->type[0] == 'i') {
-        prefix_t prefix;
-
-        for (i = 0; file->elements[i]; i++) {
-            if (!ascii2prefix2(AF_INET, file->elements[i], &prefix)) {
-                LOG("Couldn't unload %s", file->elements[i]);
-                continue;
-            }
-
-            patricia_node_t *node = patricia_search_exact(allIps, &prefix);
-            if (!node || !(node->data)) {
-                LOG("Couldn't unload %s", file->elements[i]);
-                continue;
-            }
-
-            tagger_remove_file(((TaggerIP_t *)(node->data))->infos, file);
-        }
-        return;
-    }
-
+void tagger_tables_add_file(TaggerTables_t *tt, TaggerFile_t *file)
+{
     TaggerStringHash_t *hash = 0;
+    TaggerString_t     *tstring;
+    patricia_node_t    *node;
+    TaggerIP_t         *tip;
+    uint32_t            i;
+
     switch (file->type[0]) {
+    case 'i':
+        break;
     case 'h':
-        hash = (TaggerStringHash_t *)&allDomains;
+        hash = &tt->domains;
         break;
     case 'm':
-        hash = (TaggerStringHash_t *)&allMD5s;
+        hash = &tt->md5s;
         break;
     case 'e':
-        hash = (TaggerStringHash_t *)&allEmails;
+        hash = &tt->emails;
         break;
     case 'u':
-        hash = (TaggerStringHash_t *)&allURIs;
+        hash = &tt->uris;
         break;
     default:
-        LOG("ERROR - Unknown tagger type %s for %s", file->type, file->str);
+        return;
     }
 
-    TaggerString_t *tstring;
-    if (hash) {
-        for (i = 0; file->elements[i]; i++) {
-            HASH_FIND(s_, *hash, file->elements[i], tstring);
-            if (tstring) {
-                tagger_remove_file(tstring->infos, file);
-                // We could check if files is now empty and remove the node, but the
-                // theory is most of the time it will be just readded in the load_file
+    for (i = 0; i < file->infos->len; i++) {
+        TaggerInfo_t *info = g_ptr_array_index(file->infos, i);
+
+        if (!hash) {
+            node = make_and_lookup(tt->ips, info->key);
+            if (!node) {
+                LOG("Couldn't create node for %s", info->key);
+                continue;
+            }
+            if (!node->data) {
+                tip = MOLOCH_TYPE_ALLOC(TaggerIP_t);
+                tip->infos = g_ptr_array_new();
+                node->data = tip;
+            } else {
+                tip = node->data;
             }
+            g_ptr_array_add(tip->infos, info);
+            continue;
+        }
+
+        HASH_FIND(s_, *hash, info->key, tstring);
+        if (!tstring) {
+            tstring = MOLOCH_TYPE_ALLOC(TaggerString_t);
+            tstring->str = info->key; // Owned by the file, which outlives these tables
+            tstring->infos = g_ptr_array_new();
+            HASH_ADD(s_, *hash, tstring->str, tstring);
         }
+        g_ptr_array_add(tstring->infos, info);
     }
+}
+/******************************************************************************/
+/*
+ * Build new tables from all the loaded files and publish them
+ */
+gboolean tagger_publish(gpointer UNUSED(uw))
+{
+    TaggerTables_t *tt = tagger_tables_new();
+    TaggerFile_t   *file;
 
-    g_free(file->md5);
-    g_free(file->type);
-    g_strfreev(file->tags);
-    g_strfreev(file->elements);
-    file->md5 = NULL;
+    HASH_FORALL(s_, allFiles, file,
+        if (file->infos)
+            tagger_tables_add_file(tt, file);
+    );
+
+    TaggerTables_t *old = __sync_lock_test_and_set(&tables, tt);
+    old->retired = retiredFiles;
+    retiredFiles = g_ptr_array_new_with_free_func(tagger_file_free);
+    moloch_packet_defer_free(tagger_tables_free, old);
+
+    publishTimer = 0;
+    return FALSE;
+}
+/******************************************************************************/
+/*
+ * Files load one at a time, so wait a little and publish them all at once
+ */
+void tagger_publish_later()
+{
+    if (!publishTimer)
+        publishTimer = g_timeout_add(100, tagger_publish, 0);
+}
+/******************************************************************************/
+/*
+ * Called by moloch when moloch is quiting
+ */
+void tagger_plugin_exit()
+{
+    TaggerFile_t *file;
+
+    if (publishTimer)
+        g_source_remove(publishTimer);
+
+    HASH_FORALL_POP_HEAD(s_, allFiles, file,
+        tagger_file_free(file);
+    );
+
+    tables->retired = retiredFiles;
+    tagger_tables_free(tables);
+    tables = NULL;
+}
+/******************************************************************************/
+/*
+ * The current tables may still point at the data of a file that is being
+ * reloaded, so move it to the retired list to be freed with those tables
+ */
+void tagger_retire_file(TaggerFile_t *file) {
+    TaggerFile_t *old = MOLOCH_TYPE_ALLOC0(TaggerFile_t);
+
+    old->md5      = file->md5;
+    old->type     = file->type;
+    old->tags     = file->tags;
+    old->elements = file->elements;
+    old->infos    = file->infos;
+
+    file->md5      = NULL;
+    file->type     = NULL;
+    file->tags     = NULL;
+    file->elements = NULL;
+    file->infos    = NULL;
+
+    g_ptr_array_add(retiredFiles, old);
 }
 /******************************************************************************/
 void tagger_info_free(gpointer data)
@@ -447,14 +534,15 @@ void tagger_load_file_cb(int UNUSED(code), unsigned char *data, int data_len, gp
     TaggerFile_t *file = uw;
     uint32_t out[4*100];
 
-    if (file->md5)
-        tagger_unload_file(file);
+    if (file->infos) {
+        tagger_retire_file(file);
+        tagger_publish_later();
+    }
 
     memset(out, 0, sizeof(out));
     if (!data_len || !data) {
         HASH_REMOVE(s_, allFiles, file);
-        free(file->str);
-        MOLOCH_TYPE_FREE(TaggerFile_t, file);
+        tagger_file_free(file);
         return;
     }
 
@@ -462,8 +550,7 @@ void tagger_load_file_cb(int UNUSED(code), unsigned char *data, int data_len, gp
     if ((rc = js0n(data, data_len, out)) != 0) {
         LOG("ERROR: Parse error %d in >%.*s<\n", rc, data_len, data);
         HASH_REMOVE(s_, allFiles, file);
-        free(file->str);
-        MOLOCH_TYPE_FREE(TaggerFile_t, file);
+        tagger_file_free(file);
         return;
     }
 
@@ -501,8 +588,11 @@ void tagger_load_file_cb(int UNUSED(code), unsigned char *data, int data_len, gp
         moloch_db_get_tag(NULL, tagsField, file->tags[tag], NULL);
     }
 
-    patricia_node_t *node;
-    TaggerIP_t *tip;
+    if (!strchr("ihmeu", file->type[0])) {
+        LOG("ERROR - Unknown tagger type %s for %s", file->type, file->str);
+    }
+
+    file->infos = g_ptr_array_new_with_free_func(tagger_info_free);
 
     for (i = 0; file->elements[i]; i++) {
 
@@ -524,7 +614,8 @@ void tagger_load_file_cb(int UNUSED(code), unsigned char *data, int data_len, gp
         }
 
         TaggerInfo_t *info = MOLOCH_TYPE_ALLOC(TaggerInfo_t);
-        info->file = file;
+        info->key  = parts[0];
+        info->tags = file->tags;
         DLL_INIT(o_, &info->ops);
 
         int j;
@@ -577,51 +668,10 @@ void tagger_load_file_cb(int UNUSED(code), unsigned char *data, int data_len, gp
 
         }
 
-        TaggerStringHash_t *hash = 0;
-        switch (file->type[0]) {
-        case 'i':
-            node = make_and_lookup(allIps, parts[0]);
-            if (!node) {
-                LOG("Couldn't create node for %s", parts[0]);
-                continue;
-            }
-            if (!node->data) {
-                tip = MOLOCH_TYPE_ALLOC(TaggerIP_t);
-                tip->infos = g_ptr_array_new_with_free_func(tagger_info_free);
-                node->data = tip;
-            } else {
-                tip = node->data;
-            }
-            g_ptr_array_add(tip->infos, info);
-            continue;
-        case 'h':
-            hash = (TaggerStringHash_t *)&allDomains;
-            break;
-        case 'm':
-            hash = (TaggerStringHash_t *)&allMD5s;
-            break;
-        case 'e':
-            hash = (TaggerStringHash_t *)&allEmails;
-            break;
-        case 'u':
-            hash = (TaggerStringHash_t *)&allURIs;
-            break;
-        default:
-            LOG("ERROR - Unknown tagger type %s for %s", file->type, file->str);
-            continue;
-        } 
-
-        TaggerString_t *tstring;
-
-        HASH_FIND(s_, *hash, parts[0], tstring);
-        if (!tstring) {
-            tstring = MOLOCH_TYPE_ALLOC(TaggerString_t);
-            tstring->str = strdup(parts[0]); // Need to strdup since file might be unloaded
-            tstring->infos = g_ptr_array_new_with_free_func(tagger_info_free);
-            HASH_ADD(s_, *hash, tstring->str, tstring);
-        }
-        g_ptr_array_add(tstring->infos, info);
+        g_ptr_array_add(file->infos, info);
     } /* for elements */
+
+    tagger_publish_later();
 }
 /******************************************************************************/
 /*
@@ -718,6 +768,14 @@ gboolean tagger_fetch_files (gpointer sync)
     return TRUE;
 }
 /******************************************************************************/
+/*
+ * Called by moloch on SIGHUP, check for changed files right away
+ */
+void tagger_plugin_reload()
+{
+    tagger_fetch_files(0);
+}
+/******************************************************************************/
 /*
  * Called by moloch when the plugin is loaded
  */
@@ -729,11 +787,8 @@ void moloch_plugin_init()
     }
 
     HASH_INIT(s_, allFiles, moloch_string_hash, moloch_string_cmp);
-    HASH_INIT(s_, allDomains, moloch_string_hash, moloch_string_cmp);
-    HASH_INIT(s_, allMD5s, moloch_string_hash, moloch_string_cmp);
-    HASH_INIT(s_, allEmails, moloch_string_hash, moloch_string_cmp);
-    HASH_INIT(s_, allURIs, moloch_string_hash, moloch_string_cmp);
-    allIps = New_Patricia(128);
+    tables = tagger_tables_new();
+    retiredFiles = g_ptr_array_new_with_free_func(tagger_file_free);
 
     moloch_plugins_register("tagger", FALSE);
 
@@ -745,7 +800,7 @@ void moloch_plugin_init()
       tagger_plugin_save,
       NULL,
       tagger_plugin_exit,
-      NULL
+      tagger_plugin_reload
     );
 
     tagsField      = moloch_field_by_db("ta");
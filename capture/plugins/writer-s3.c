@@ -428,7 +428,7 @@ writer_s3_write(const MolochSession_t *const UNUSED(session), MolochPacket_t * c
 
     hdr.ts.tv_sec  = packet->ts.tv_sec;
     hdr.ts.tv_usec = packet->ts.tv_usec;
-    hdr.caplen     = packet->pktlen;
+    hdr.caplen     = packet->writerCapLen?packet->writerCapLen:packet->pktlen;
     hdr.len        = packet->pktlen;
 
     MOLOCH_LOCK(output);
@@ -439,8 +439,8 @@ writer_s3_write(const MolochSession_t *const UNUSED(session), MolochPacket_t * c
     memcpy(outputBuffer + outputPos, (char *)&hdr, sizeof(hdr));
     outputPos += sizeof(hdr);
 
-    memcpy(outputBuffer + outputPos, packet->pkt, packet->pktlen);
-    outputPos += packet->pktlen;
+    memcpy(outputBuffer + outputPos, packet->pkt, hdr.caplen);
+    outputPos += hdr.caplen;
 
     if(outputPos > config.pcapWriteSize) {
         writer_s3_flush(FALSE);
@@ -448,7 +448,7 @@ writer_s3_write(const MolochSession_t *const UNUSED(session), MolochPacket_t * c
 
     packet->writerFileNum = outputId;
     packet->writerFilePos = outputFilePos;
-    outputFilePos += 16 + packet->pktlen;
+    outputFilePos += 16 + hdr.caplen;
 
     if (outputFilePos >= config.maxFileSizeB) {
         writer_s3_flush(TRUE);
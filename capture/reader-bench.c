@@ -0,0 +1,192 @@
+/******************************************************************************/
+/* reader-bench.c  -- Replays pcap files from memory for moloch-bench
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+#include "pcap.h"
+
+extern MolochPcapFileHdr_t   pcapFileHeader;
+
+extern MolochConfig_t        config;
+
+/* All the files are read into one buffer up front so the replay never
+ * touches the disk, each record is a pcap_pkthdr followed by the packet,
+ * padded so the next header is aligned.
+ */
+#define REPLAY_RECORD_LEN(caplen) ((sizeof(struct pcap_pkthdr) + (caplen) + 7) & ~7)
+
+LOCAL  u_char               *replayBuf;
+LOCAL  uint64_t              replayLen;
+LOCAL  uint64_t              replaySize;
+LOCAL  uint64_t              replayPackets;
+LOCAL  int                   replayLinktype = -1;
+LOCAL  int                   replaySnaplen;
+LOCAL  struct timeval        replayFirst;
+LOCAL  struct timeval        replayLast;
+
+/******************************************************************************/
+LOCAL void reader_bench_load(char *filename)
+{
+    int dlt_to_linktype(int dlt);
+
+    char                errbuf[1024];
+    struct pcap_pkthdr *h;
+    const u_char       *bytes;
+
+    errbuf[0] = 0;
+    pcap_t *pcap = pcap_open_offline(filename, errbuf);
+    if (!pcap) {
+        printf("ERROR - Couldn't load '%s' error '%s'\n", filename, errbuf);
+        exit(1);
+    }
+
+    int linktype = dlt_to_linktype(pcap_datalink(pcap)) | pcap_datalink_ext(pcap);
+    if (replayLinktype == -1) {
+        replayLinktype = linktype;
+        replaySnaplen = pcap_snapshot(pcap);
+    } else if (replayLinktype != linktype) {
+        printf("ERROR - %s link type %d doesn't match %d of first file\n", filename, linktype, replayLinktype);
+        exit(1);
+    }
+
+    if (config.bpf) {
+        struct bpf_program   bpf;
+
+        if (pcap_compile(pcap, &bpf, config.bpf, 1, PCAP_NETMASK_UNKNOWN) == -1 ||
+            pcap_setfilter(pcap, &bpf) == -1) {
+            printf("ERROR - Couldn't set filter: '%s' with %s\n", config.bpf, pcap_geterr(pcap));
+            exit(1);
+        }
+        pcap_freecode(&bpf);
+    }
+
+    while (pcap_next_ex(pcap, &h, &bytes) == 1) {
+        if (replayLen + REPLAY_RECORD_LEN(h->caplen) > replaySize) {
+            replaySize = MAX(replaySize * 2, 1024*1024 + REPLAY_RECORD_LEN(h->caplen));
+            replayBuf = realloc(replayBuf, replaySize);
+        }
+
+        memcpy(replayBuf + replayLen, h, sizeof(*h));
+        memcpy(replayBuf + replayLen + sizeof(*h), bytes, h->caplen);
+        replayLen += REPLAY_RECORD_LEN(h->caplen);
+
+        if (replayPackets == 0)
+            replayFirst = h->ts;
+        replayLast = h->ts;
+        replayPackets++;
+    }
+
+    pcap_close(pcap);
+}
+/******************************************************************************/
+LOCAL gboolean reader_bench_quit_gfunc (gpointer UNUSED(user_data))
+{
+    moloch_quit();
+    return FALSE;
+}
+/******************************************************************************/
+/* Each loop is shifted forward in time by the length of the capture so
+ * sessions time out the same way they would reading the files back to back.
+ */
+LOCAL void *reader_bench_thread(gpointer UNUSED(uw))
+{
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    int      loop;
+
+    long span = replayLast.tv_sec - replayFirst.tv_sec + 1;
+
+    moloch_bench_replay_start();
+    uint64_t start = moloch_bench_now();
+
+    for (loop = 0; loop < config.benchLoops && !config.quitting; loop++) {
+        uint64_t pos = 0;
+
+        while (pos < replayLen) {
+            const struct pcap_pkthdr *h = (struct pcap_pkthdr *)(replayBuf + pos);
+
+            // pause reading if the packet threads are behind
+            if (moloch_packet_outstanding() > (int32_t)(config.maxPacketsInQueue/2)) {
+                usleep(100);
+                continue;
+            }
+
+            // pause if ahead of the target rate
+            if (config.benchPps && (packets & 0xff) == 0) {
+                int64_t ahead = (int64_t)(packets * 1000000000ULL / config.benchPps) - (int64_t)(moloch_bench_now() - start);
+                if (ahead > 1000) {
+                    usleep(ahead/1000);
+                }
+            }
+
+            MolochPacket_t *packet = MOLOCH_TYPE_ALLOC0(MolochPacket_t);
+            packet->pktlen        = h->caplen;
+            packet->pkt           = replayBuf + pos + sizeof(*h);
+            packet->ts            = h->ts;
+            packet->ts.tv_sec    += span * loop;
+            packet->readerFilePos = pos;
+            packet->readerName    = "bench";
+
+            MOLOCH_BENCH_START(decodeStart);
+            moloch_packet(packet);
+            MOLOCH_BENCH_STOP(MOLOCH_BENCH_READER_THREAD, MOLOCH_BENCH_DECODE, decodeStart);
+
+            packets++;
+            bytes += h->caplen;
+            pos += REPLAY_RECORD_LEN(h->caplen);
+        }
+    }
+
+    while (moloch_packet_outstanding() > 0) {
+        usleep(1000);
+    }
+
+    moloch_bench_replay_done(packets, bytes);
+    g_idle_add(reader_bench_quit_gfunc, NULL);
+    return NULL;
+}
+/******************************************************************************/
+int reader_bench_stats(MolochReaderStats_t *stats)
+{
+    stats->dropped = 0;
+    stats->total = 0;
+    return 0;
+}
+/******************************************************************************/
+void reader_bench_start() {
+    pcapFileHeader.linktype = replayLinktype;
+    pcapFileHeader.snaplen = replaySnaplen;
+
+    LOG("Replaying %" PRIu64 " packets (%" PRIu64 "MB) %d times", replayPackets, replayLen/(1024*1024), config.benchLoops);
+    moloch_threads_new(MOLOCH_THREAD_READER, 0, "moloch-bench", &reader_bench_thread, NULL);
+}
+/******************************************************************************/
+void reader_bench_init(char *UNUSED(name))
+{
+    int i;
+
+    moloch_reader_start         = reader_bench_start;
+    moloch_reader_stats         = reader_bench_stats;
+
+    for (i = 0; config.pcapReadFiles[i]; i++) {
+        reader_bench_load(config.pcapReadFiles[i]);
+    }
+
+    if (replayPackets == 0) {
+        printf("ERROR - No packets to replay\n");
+        exit(1);
+    }
+}
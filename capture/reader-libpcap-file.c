@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <gio/gio.h>
+#include <sched.h>
 #include "pcap.h"
 
 extern MolochPcapFileHdr_t   pcapFileHeader;
@@ -39,6 +40,27 @@ void reader_libpcapfile_opened();
 
 static struct bpf_program   *bpf_programs[MOLOCH_FILTER_MAX];
 
+/* With pcapReadThreads > 1 each reader thread processes its own file */
+typedef struct {
+    pcap_t          *pcap;
+    FILE            *file;
+    char            *name;
+    MolochString_t  *done;
+    uint64_t         packets;
+    int              reader;
+} MolochPcapFileInfo_t;
+
+LOCAL  MOLOCH_LOCK_DEFINE(files);
+LOCAL  MolochStringHead_t    completedQ;
+LOCAL  int                   readerThreadsRunning;
+LOCAL  int                   readerThreadsLinktype = -1;
+
+/* Timestamp in usecs of the packet each reader thread wants to hand off next,
+ * 0 until it has one and all ones once it has no more files.  pcapReadThreads
+ * is at most 32.
+ */
+LOCAL  volatile uint64_t     readerNextTs[32];
+
 /******************************************************************************/
 void reader_libpcapfile_monitor_dir(char *dirname);
 static void
@@ -322,8 +344,41 @@ int reader_libpcapfile_stats(MolochReaderStats_t *stats)
     return 0;
 }
 /******************************************************************************/
-void reader_libpcapfile_pcap_cb(u_char *UNUSED(user), const struct pcap_pkthdr *h, const u_char *bytes)
+/* Files from one capture are consecutive in time, so the reader threads merge
+ * their packets by timestamp: a reader waits while another reader still has an
+ * older packet to hand off.  Sessions that cross a file rotation keep their
+ * packet order and the packet thread clocks don't jump between files, so idle
+ * timeouts stay right.  Files that overlap in time, like one per interface, are
+ * still read at the same time, consecutive files mostly one after the other.
+ * The reader with the oldest packet never waits, ties go through together.
+ */
+LOCAL void reader_libpcapfile_wait(MolochPcapFileInfo_t *info, const struct timeval *ts)
+{
+    const uint64_t t = (uint64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+    int            r, spins = 0;
+
+    readerNextTs[info->reader] = t;
+    __sync_synchronize();
+
+    while (1) {
+        for (r = 0; r < (int)config.pcapReadThreads; r++) {
+            if (r != info->reader && readerNextTs[r] < t)
+                break;
+        }
+        if (r == (int)config.pcapReadThreads)
+            return;
+
+        if (spins++ < 1000)
+            sched_yield();
+        else
+            usleep(100);
+    }
+}
+/******************************************************************************/
+void reader_libpcapfile_pcap_cb(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 {
+    MolochPcapFileInfo_t *info = (MolochPcapFileInfo_t *)user;
+
     MolochPacket_t *packet = MOLOCH_TYPE_ALLOC0(MolochPacket_t);
 
     if (unlikely(h->caplen != h->len)) {
@@ -340,8 +395,15 @@ void reader_libpcapfile_pcap_cb(u_char *UNUSED(user), const struct pcap_pkthdr *
 
     packet->pkt           = (u_char *)bytes;
     packet->ts            = h->ts;
-    packet->readerFilePos = ftell(offlineFile) - 16 - h->len;
-    packet->readerName    = offlinePcapName;
+    if (info) {
+        reader_libpcapfile_wait(info, &h->ts);
+        info->packets++;
+        packet->readerFilePos = ftell(info->file) - 16 - h->len;
+        packet->readerName    = info->name;
+    } else {
+        packet->readerFilePos = ftell(offlineFile) - 16 - h->len;
+        packet->readerName    = offlinePcapName;
+    }
     moloch_packet(packet);
 }
 /******************************************************************************/
@@ -388,6 +450,103 @@ gboolean reader_libpcapfile_read()
     return TRUE;
 }
 /******************************************************************************/
+LOCAL gboolean reader_libpcapfile_quit_gfunc (gpointer UNUSED(user_data))
+{
+    moloch_quit();
+    return FALSE;
+}
+/******************************************************************************/
+/* Files can finish in any order, but are retired in the order they were opened,
+ * so --delete only ever removes a prefix of the processed files.
+ * Called with the files lock held.
+ */
+LOCAL void reader_libpcapfile_retire()
+{
+    MolochString_t *string;
+
+    while (DLL_COUNT(s_, &completedQ) > 0 && completedQ.s_next->uw) {
+        DLL_POP_HEAD(s_, &completedQ, string);
+
+        if (config.pcapDelete && string->uw == (gpointer)1) {
+            if (config.debug)
+                LOG("Deleting %s", string->str);
+            int rc = unlink(string->str);
+            if (rc != 0)
+                LOG("Failed to delete file %s %s (%d)", string->str, strerror(errno), errno);
+        }
+        g_free(string->str);
+        MOLOCH_TYPE_FREE(MolochString_t, string);
+    }
+}
+/******************************************************************************/
+LOCAL void *reader_libpcapfile_thread(gpointer uw)
+{
+    MolochPcapFileInfo_t info;
+    int                  reader = (long)uw;
+
+    while (1) {
+        MOLOCH_LOCK(files);
+        if (!reader_libpcapfile_next()) {
+            // Nothing left to read, don't hold up the other readers
+            readerNextTs[reader] = UINT64_MAX;
+            __sync_synchronize();
+            readerThreadsRunning--;
+            if (readerThreadsRunning == 0)
+                g_idle_add(reader_libpcapfile_quit_gfunc, NULL);
+            MOLOCH_UNLOCK(files);
+            break;
+        }
+
+        // Skipped because of a link type mismatch
+        if (!pcap) {
+            MOLOCH_UNLOCK(files);
+            continue;
+        }
+
+        memset(&info, 0, sizeof(info));
+        info.pcap = pcap;
+        info.file = offlineFile;
+        info.name = offlinePcapName;
+        info.reader = reader;
+        info.done = MOLOCH_TYPE_ALLOC0(MolochString_t);
+        info.done->str = g_strdup(offlinePcapFilename);
+        DLL_PUSH_TAIL(s_, &completedQ, info.done);
+        pcap = 0;
+        MOLOCH_UNLOCK(files);
+
+        struct timeval startTime;
+        gettimeofday(&startTime, NULL);
+
+        int r;
+        while (1) {
+            // pause reading if the writer, ES or packet threads are behind
+            if (moloch_writer_queue_length() > 10 ||
+                moloch_http_queue_length(esServer) > 100 ||
+                moloch_packet_outstanding() > (int32_t)(config.maxPacketsInQueue/2)) {
+                usleep(10000);
+                continue;
+            }
+
+            r = pcap_dispatch(info.pcap, 10000, reader_libpcapfile_pcap_cb, (u_char *)&info);
+            if (r <= 0)
+                break;
+        }
+
+        struct timeval endTime;
+        gettimeofday(&endTime, NULL);
+        double secs = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec)/1000000.0;
+        LOG("Finished %s %" PRIu64 " packets in %.2fs, %.0f packets/s", info.name, info.packets, secs, secs > 0?info.packets/secs:0);
+
+        MOLOCH_LOCK(files);
+        pcap_close(info.pcap);
+        info.done->uw = (gpointer)(long)(r == 0?1:2);
+        reader_libpcapfile_retire();
+        MOLOCH_UNLOCK(files);
+    }
+
+    return NULL;
+}
+/******************************************************************************/
 int reader_libpcapfile_should_filter(const MolochPacket_t *packet, enum MolochFilterType *type, int *index)
 {
     int t, i;
@@ -407,7 +566,21 @@ void reader_libpcapfile_opened()
 {
     int dlt_to_linktype(int dlt);
 
-    pcapFileHeader.linktype = dlt_to_linktype(pcap_datalink(pcap)) | pcap_datalink_ext(pcap);
+    int linktype = dlt_to_linktype(pcap_datalink(pcap)) | pcap_datalink_ext(pcap);
+
+    // All the reader threads share the packet decoding, so the link types must match
+    if (config.pcapReadThreads > 1) {
+        if (readerThreadsLinktype == -1) {
+            readerThreadsLinktype = linktype;
+        } else if (readerThreadsLinktype != linktype) {
+            LOG("ERROR - Skipping %s, link type %d doesn't match %d of first file", offlinePcapFilename, linktype, readerThreadsLinktype);
+            pcap_close(pcap);
+            pcap = 0;
+            return;
+        }
+    }
+
+    pcapFileHeader.linktype = linktype;
     pcapFileHeader.snaplen = pcap_snapshot(pcap);
 
     offlineFile = pcap_file(pcap);
@@ -430,6 +603,9 @@ void reader_libpcapfile_opened()
     for (t = 0; t < MOLOCH_FILTER_MAX; t++) {
         if (config.bpfsNum[t]) {
             int i;
+            // Packet threads may be using the programs from another reader thread's file
+            if (bpf_programs[t] && config.pcapReadThreads > 1)
+                continue;
             if (bpf_programs[t]) {
                 for (i = 0; i < config.bpfsNum[t]; i++) {
                     pcap_freecode(&bpf_programs[t][i]);
@@ -447,11 +623,15 @@ void reader_libpcapfile_opened()
         }
     }
 
+    offlinePcapName = strdup(offlinePcapFilename);
+
+    // The reader thread takes it from here
+    if (config.pcapReadThreads > 1)
+        return;
+
     if (config.flushBetween)
         moloch_session_flush();
 
-    offlinePcapName = strdup(offlinePcapFilename);
-
     int fd = pcap_fileno(pcap);
     if (fd == -1) {
         g_timeout_add(0, reader_libpcapfile_read, NULL);
@@ -462,6 +642,17 @@ void reader_libpcapfile_opened()
 
 /******************************************************************************/
 void reader_libpcapfile_start() {
+    if (config.pcapReadThreads > 1) {
+        int t;
+        readerThreadsRunning = config.pcapReadThreads;
+        for (t = 0; t < (int)config.pcapReadThreads; t++) {
+            char name[100];
+            snprintf(name, sizeof(name), "moloch-pcap%d", t);
+            moloch_threads_new(MOLOCH_THREAD_READER, t, name, &reader_libpcapfile_thread, (gpointer)(long)t);
+        }
+        return;
+    }
+
     reader_libpcapfile_next();
     if (!pcap) {
         if (config.pcapMonitor) {
@@ -477,8 +668,14 @@ void reader_libpcapfile_init(char *UNUSED(name))
     moloch_reader_start         = reader_libpcapfile_start;
     moloch_reader_stats         = reader_libpcapfile_stats;
 
+    if (config.pcapReadThreads > 1 && (config.pcapMonitor || config.flushBetween)) {
+        LOG("WARNING - pcapReadThreads isn't supported with --monitor or --flush, using 1 reader");
+        config.pcapReadThreads = 1;
+    }
+
     if (config.pcapMonitor)
         reader_libpcapfile_init_monitor();
 
     DLL_INIT(s_, &monitorQ);
+    DLL_INIT(s_, &completedQ);
 }
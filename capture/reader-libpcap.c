@@ -151,7 +151,7 @@ void reader_libpcap_start() {
 
         char name[100];
         snprintf(name, sizeof(name), "moloch-pcap%d", i);
-        g_thread_new(name, &reader_libpcap_thread, (gpointer)pcaps[i]);
+        moloch_threads_new(MOLOCH_THREAD_READER, i, name, &reader_libpcap_thread, (gpointer)pcaps[i]);
     }
 }
 /******************************************************************************/
@@ -117,17 +117,85 @@ char *moloch_session_id_string (char *sessionId, char *buf)
     return moloch_sprint_hex_string(buf, (uint8_t *)sessionId, sessionId[0]);
 }
 /******************************************************************************/
-/* Must match moloch_session_cmp and moloch_session_id
- * a1 0-3
- * p1 4-5
- * a2 6-9
- * p2 10-11
+/* Mix one 32 bit word into a flow hash, murmur3 style */
+LOCAL uint32_t moloch_session_flow_mix(uint32_t h, uint32_t k)
+{
+    k *= 0xcc9e2d51;
+    k = (k << 15) | (k >> 17);
+    k *= 0x1b873593;
+
+    h ^= k;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xe6546b64;
+}
+/******************************************************************************/
+LOCAL uint32_t moloch_session_flow_final(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+/******************************************************************************/
+/* Hash of an already sorted tuple, the same order moloch_session_id uses */
+LOCAL uint32_t moloch_session_flow_hash_sorted(const uint8_t *addr1, uint16_t port1, const uint8_t *addr2, uint16_t port2, int alen)
+{
+    uint32_t h = alen;
+    uint32_t w;
+    int      i;
+
+    for (i = 0; i < alen; i += 4) {
+        memcpy(&w, addr1 + i, 4);
+        h = moloch_session_flow_mix(h, w);
+    }
+    for (i = 0; i < alen; i += 4) {
+        memcpy(&w, addr2 + i, 4);
+        h = moloch_session_flow_mix(h, w);
+    }
+    h = moloch_session_flow_mix(h, (uint32_t)port1 << 16 | port2);
+    return moloch_session_flow_final(h);
+}
+/******************************************************************************/
+/* Symmetric flow hash computed straight from the header fields, both
+ * directions of a flow hash the same.  Must match moloch_session_hash.
+ */
+uint32_t moloch_session_flow_hash(uint32_t addr1, uint16_t port1, uint32_t addr2, uint16_t port2)
+{
+    if (addr1 < addr2 || (addr1 == addr2 && ntohs(port1) < ntohs(port2)))
+        return moloch_session_flow_hash_sorted((uint8_t *)&addr1, port1, (uint8_t *)&addr2, port2, 4);
+
+    return moloch_session_flow_hash_sorted((uint8_t *)&addr2, port2, (uint8_t *)&addr1, port1, 4);
+}
+/******************************************************************************/
+uint32_t moloch_session_flow_hash6(uint8_t *addr1, uint16_t port1, uint8_t *addr2, uint16_t port2)
+{
+    int cmp = memcmp(addr1, addr2, 16);
+    if (cmp < 0 || (cmp == 0 && ntohs(port1) < ntohs(port2)))
+        return moloch_session_flow_hash_sorted(addr1, port1, addr2, port2, 16);
+
+    return moloch_session_flow_hash_sorted(addr2, port2, addr1, port1, 16);
+}
+/******************************************************************************/
+/* Must match moloch_session_cmp, moloch_session_id and moloch_session_flow_hash
+ * v4: len 0, a1 1-4, p1 5-6, a2 7-10, p2 11-12
+ * v6: len 0, a1 1-16, p1 17-18, a2 19-34, p2 35-36
  */
 uint32_t moloch_session_hash(const void *key)
 {
-    unsigned char *p = (unsigned char *)key;
-    //return ((p[2] << 16 | p[3] << 8 | p[4]) * 59) ^ (p[8] << 16 | p[9] << 8 |  p[10]);
-    return (((p[1]<<24) ^ (p[2]<<18) ^ (p[3]<<12) ^ (p[4]<<6) ^ p[5]) * 13) ^ (p[8]<<24|p[9]<<16 | p[10]<<8 | p[11]);
+    const uint8_t *p = (const uint8_t *)key;
+    uint16_t       port1, port2;
+
+    if (p[0] == 37) {
+        memcpy(&port1, p+17, 2);
+        memcpy(&port2, p+35, 2);
+        return moloch_session_flow_hash_sorted(p+1, port1, p+19, port2, 16);
+    }
+
+    memcpy(&port1, p+5, 2);
+    memcpy(&port2, p+11, 2);
+    return moloch_session_flow_hash_sorted(p+1, port1, p+7, port2, 4);
 }
 
 /******************************************************************************/
@@ -152,13 +220,21 @@ void moloch_session_add_cmd(MolochSession_t *session, MolochSesCmd icmd, gpointe
     MOLOCH_UNLOCK(sessionCmds[session->thread].lock);
 }
 /******************************************************************************/
+LOCAL void moloch_session_decr_outstanding_cmd(MolochSession_t *session, gpointer UNUSED(uw1), gpointer UNUSED(uw2))
+{
+    moloch_session_decr_outstanding(session);
+}
+/******************************************************************************/
+/* Failed lookups are answered on the main thread, the session can only be
+ * saved and freed on its own packet thread.
+ */
 void moloch_session_get_tag_cb(void *sessionV, int tagType, const char *tagName, uint32_t tag, gboolean async)
 {
     MolochSession_t *session = sessionV;
 
     if (tag == 0) {
         LOG("ERROR - Not adding tag %s type %d couldn't get tag num", tagName, tagType);
-        moloch_session_decr_outstanding(session);
+        moloch_session_add_cmd(session, MOLOCH_SES_CMD_FUNC, NULL, NULL, moloch_session_decr_outstanding_cmd);
     } else if (async) {
         moloch_session_add_cmd(session, MOLOCH_SES_CMD_ADD_TAG, (gpointer)(long)tagType, (gpointer)(long)tag, NULL);
     } else {
@@ -186,6 +262,16 @@ gboolean moloch_session_has_tag(MolochSession_t *session, const char *tagName)
 void moloch_session_add_protocol(MolochSession_t *session, const char *protocol)
 {
     moloch_field_string_add(protocolField, session, protocol, -1, TRUE);
+
+    if (!session->elephant && HASH_COUNT(s_, config.elephantProtocols)) {
+        MolochString_t *tstring;
+
+        HASH_FIND(s_, config.elephantProtocols, protocol, tstring);
+        if (tstring) {
+            session->elephant = 1;
+            session->elephantBytes = (long)tstring->uw;
+        }
+    }
 }
 /******************************************************************************/
 gboolean moloch_session_has_protocol(MolochSession_t *session, const char *protocol)
@@ -211,6 +297,15 @@ void moloch_session_add_tag(MolochSession_t *session, const char *tag) {
             session->stopSaving = (int)(long)tstring->uw;
         }
     }
+    if (!session->elephant && HASH_COUNT(s_, config.elephantTags)) {
+        MolochString_t *tstring;
+
+        HASH_FIND(s_, config.elephantTags, tag, tstring);
+        if (tstring) {
+            session->elephant = 1;
+            session->elephantBytes = (long)tstring->uw;
+        }
+    }
 }
 
 /******************************************************************************/
@@ -226,6 +321,41 @@ void moloch_session_add_tag_type(MolochSession_t *session, int tagtype, const ch
             session->stopSaving = (long)tstring->uw;
         }
     }
+    if (!session->elephant && HASH_COUNT(s_, config.elephantTags)) {
+        MolochString_t *tstring;
+
+        HASH_FIND(s_, config.elephantTags, tag, tstring);
+        if (tstring) {
+            session->elephant = 1;
+            session->elephantBytes = (long)tstring->uw;
+        }
+    }
+}
+/******************************************************************************/
+/* Called once the ports are known, applies the elephant flow policy to sessions
+ * that match by port, or to every session if no match lists are configured.
+ */
+void moloch_session_elephant_ports(MolochSession_t *session)
+{
+    if (session->elephant)
+        return;
+
+    if (config.elephantAll) {
+        session->elephant = 1;
+        session->elephantBytes = config.elephantKeepBytes;
+        return;
+    }
+
+    if (!config.elephantPorts || session->protocol == IPPROTO_ICMP)
+        return;
+
+    if (config.elephantPorts[session->port2] >= 0) {
+        session->elephant = 1;
+        session->elephantBytes = config.elephantPorts[session->port2];
+    } else if (config.elephantPorts[session->port1] >= 0) {
+        session->elephant = 1;
+        session->elephantBytes = config.elephantPorts[session->port1];
+    }
 }
 /******************************************************************************/
 void moloch_session_mark_for_close (MolochSession_t *session, int ses)
@@ -268,13 +398,30 @@ void moloch_session_free (MolochSession_t *session)
 
     moloch_packet_tcp_free(session);
 
+    if (session->yara)
+        moloch_yara_session_free(session);
+
     MOLOCH_TYPE_FREE(MolochSession_t, session);
 }
 /******************************************************************************/
+/* Write out any packets still grouped by pcapSessionOrder so the positions
+ * are final before the save, only on the session's packet thread.
+ */
+LOCAL void moloch_session_flush_run(MolochSession_t *session)
+{
+    if (!session->writerRun)
+        return;
+
+    MOLOCH_BENCH_START(runStart);
+    moloch_writer_ordered_flush(session);
+    MOLOCH_BENCH_STOP(session->thread, MOLOCH_BENCH_WRITE, runStart);
+}
+/******************************************************************************/
 LOCAL void moloch_session_save(MolochSession_t *session)
 {
     if (session->h_next) {
         HASH_REMOVE(h_, sessions[session->thread][session->ses], session);
+        moloch_packet_hash_unref(session->h_hash);
     }
 
     if (session->closingQ) {
@@ -284,6 +431,11 @@ LOCAL void moloch_session_save(MolochSession_t *session)
 
     moloch_packet_tcp_free(session);
 
+    if (session->yara) {
+        moloch_yara_session_finish(session);
+        moloch_yara_session_free(session);
+    }
+
     if (session->parserInfo) {
         int i;
         for (i = 0; i < session->parserNum; i++) {
@@ -299,6 +451,8 @@ LOCAL void moloch_session_save(MolochSession_t *session)
         DLL_REMOVE(tcp_, &tcpWriteQ[session->thread], session);
     }
 
+    moloch_session_flush_run(session);
+
     if (session->outstandingQueries > 0) {
         session->needSave = 1;
         needSave[session->thread]++;
@@ -333,6 +487,7 @@ void moloch_session_mid_save(MolochSession_t *session, uint32_t tv_sec)
         session->rootId = "ROOT";
     }
 
+    moloch_session_flush_run(session);
     moloch_db_save_session(session, FALSE);
     g_array_set_size(session->filePosArray, 0);
     g_array_set_size(session->fileLenArray, 0);
@@ -355,6 +510,9 @@ void moloch_session_mid_save(MolochSession_t *session, uint32_t tv_sec)
     session->packets[0] = 0;
     session->packets[1] = 0;
     session->midSave = 0;
+    session->truncatedPackets = 0;
+    session->skippedPackets = 0;
+    session->unsavedBytes = 0;
 }
 /******************************************************************************/
 gboolean moloch_session_decr_outstanding(MolochSession_t *session)
@@ -413,19 +571,19 @@ MolochSession_t *moloch_session_find(int ses, char *sessionId)
     MolochSession_t *session;
 
     uint32_t hash = moloch_session_hash(sessionId);
-    int      thread = hash % config.packetThreads;
+    int      thread = moloch_packet_hash_thread(hash);
 
     HASH_FIND_HASH(h_, sessions[thread][ses], hash, sessionId, session);
     return session;
 }
 /******************************************************************************/
 // Should only be used by packet, lots of side effects
-MolochSession_t *moloch_session_find_or_create(int ses, char *sessionId, int *isNew)
+// hash must be moloch_session_hash(sessionId), usually packet->hash
+MolochSession_t *moloch_session_find_or_create(int ses, uint32_t hash, char *sessionId, int *isNew)
 {
     MolochSession_t *session;
 
-    uint32_t hash = moloch_session_hash(sessionId);
-    int      thread = hash % config.packetThreads;
+    int      thread = moloch_packet_hash_thread(hash);
 
     HASH_FIND_HASH(h_, sessions[thread][ses], hash, sessionId, session);
 
@@ -445,6 +603,7 @@ MolochSession_t *moloch_session_find_or_create(int ses, char *sessionId, int *is
 
     HASH_ADD_HASH(h_, sessions[thread][ses], hash, sessionId, session);
     DLL_PUSH_TAIL(q_, &sessionsQ[thread][ses], session);
+    moloch_packet_hash_ref(hash);
 
     session->filePosArray = g_array_sized_new(FALSE, FALSE, sizeof(uint64_t), 100);
     session->fileLenArray = g_array_sized_new(FALSE, FALSE, sizeof(uint16_t), 100);
@@ -583,7 +742,7 @@ void moloch_session_init()
     protocolField = moloch_field_define("general", "termfield",
         "protocols", "Protocols", "prot-term",
         "Protocols set for session",
-        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_LINKED_SESSIONS,
+        MOLOCH_FIELD_TYPE_STR_HASH,  MOLOCH_FIELD_FLAG_COUNT | MOLOCH_FIELD_FLAG_LINKED_SESSIONS | MOLOCH_FIELD_FLAG_INTERN,
         NULL);
 
     tagsStringField = moloch_field_define("general", "notreal",
@@ -597,9 +756,11 @@ void moloch_session_init()
 
     int t;
     for (t = 0; t < config.packetThreads; t++) {
-        HASHP_INIT(h_, sessions[t][SESSION_UDP], primes[p], moloch_session_hash, moloch_session_cmp);
-        HASHP_INIT(h_, sessions[t][SESSION_TCP], primes[p], moloch_session_hash, moloch_session_cmp);
-        HASHP_INIT(h_, sessions[t][SESSION_ICMP], primes[p], moloch_session_hash, moloch_session_cmp);
+        // On the numa node of the packet thread that owns them
+        const size_t size = primes[p] * sizeof(sessions[t][0].buckets[0]);
+        HASHP_INIT_MEM(h_, sessions[t][SESSION_UDP], primes[p], moloch_session_hash, moloch_session_cmp, moloch_threads_alloc(MOLOCH_THREAD_PACKET, t, size));
+        HASHP_INIT_MEM(h_, sessions[t][SESSION_TCP], primes[p], moloch_session_hash, moloch_session_cmp, moloch_threads_alloc(MOLOCH_THREAD_PACKET, t, size));
+        HASHP_INIT_MEM(h_, sessions[t][SESSION_ICMP], primes[p], moloch_session_hash, moloch_session_cmp, moloch_threads_alloc(MOLOCH_THREAD_PACKET, t, size));
         DLL_INIT(q_, &sessionsQ[t][SESSION_UDP]);
         DLL_INIT(q_, &sessionsQ[t][SESSION_TCP]);
         DLL_INIT(q_, &sessionsQ[t][SESSION_ICMP]);
@@ -620,7 +781,9 @@ static void moloch_session_flush_close(MolochSession_t *session, gpointer UNUSED
     int i;
 
     for (i = 0; i < SESSION_MAX; i++) {
+        // The pop clears h_next so save won't release the flow ref
         HASH_FORALL_POP_HEAD(h_, sessions[thread][i], session,
+            moloch_packet_hash_unref(session->h_hash);
             moloch_session_save(session);
         );
     }
@@ -0,0 +1,240 @@
+/******************************************************************************/
+/* threads.c  -- Thread creation with per role cpu pinning and numa placement
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+extern MolochConfig_t        config;
+
+/******************************************************************************/
+/* We don't link libnuma, mbind is called directly, from linux/mempolicy.h */
+#define MOLOCH_MPOL_PREFERRED  1
+#define MOLOCH_MAX_CPUS        1024
+#define MOLOCH_MAX_NODES       64
+
+typedef struct {
+    char              *setting;
+    char              *name;
+    int               *cpus;
+    int                cpusNum;
+    uint64_t           nodes;
+} MolochThreadRole_t;
+
+LOCAL MolochThreadRole_t roles[MOLOCH_THREAD_ROLE_NUM] = {
+    {"packetThreadCpus", "packet", NULL, 0, 0},
+    {"readerThreadCpus", "reader", NULL, 0, 0},
+    {"writerThreadCpus", "writer", NULL, 0, 0},
+    {"esThreadCpus",     "es",     NULL, 0, 0},
+    {NULL,               "other",  NULL, 0, 0}
+};
+
+typedef struct {
+    int                role;
+    int                index;
+    char              *name;
+    GThreadFunc        func;
+    gpointer           data;
+} MolochThreadStart_t;
+
+LOCAL short              cpuNode[MOLOCH_MAX_CPUS];
+
+/******************************************************************************/
+/* Linux puts a nodeN entry in each cpu's sysfs directory */
+LOCAL int moloch_threads_cpu_node(int cpu)
+{
+    char  path[100];
+    int   node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (!dir)
+        return -1;
+
+    const gchar *filename;
+    while ((filename = g_dir_read_name(dir))) {
+        if (strncmp(filename, "node", 4) == 0 && isdigit(filename[4])) {
+            node = atoi(filename + 4);
+            break;
+        }
+    }
+    g_dir_close(dir);
+    return node;
+}
+/******************************************************************************/
+/* Parse a list like 2-9,12,14-15 */
+LOCAL void moloch_threads_parse_cpus(MolochThreadRole_t *role, char *str)
+{
+    char **parts = g_strsplit(str, ",", 0);
+    int    p;
+
+    role->cpus = malloc(MOLOCH_MAX_CPUS * sizeof(int));
+    for (p = 0; parts[p]; p++) {
+        int first, last;
+        char *dash = strchr(parts[p], '-');
+
+        first = atoi(parts[p]);
+        last = dash?atoi(dash+1):first;
+        if (!isdigit(parts[p][0]) || first < 0 || last < first || last >= MOLOCH_MAX_CPUS) {
+            LOG("ERROR - %s has a bad cpu range '%s'", role->setting, parts[p]);
+            exit(1);
+        }
+
+        for (; first <= last && role->cpusNum < MOLOCH_MAX_CPUS; first++) {
+            role->cpus[role->cpusNum++] = first;
+            if (cpuNode[first] >= 0 && cpuNode[first] < MOLOCH_MAX_NODES)
+                role->nodes |= (1ULL << cpuNode[first]);
+        }
+    }
+    g_strfreev(parts);
+}
+/******************************************************************************/
+/* Threads of a role are given the role's cpus in order, wrapping around */
+LOCAL int moloch_threads_cpu(int role, int index)
+{
+    if (roles[role].cpusNum == 0)
+        return -1;
+    return roles[role].cpus[index % roles[role].cpusNum];
+}
+/******************************************************************************/
+int moloch_threads_node(int role, int index)
+{
+    int cpu = moloch_threads_cpu(role, index);
+    return cpu == -1?-1:cpuNode[cpu];
+}
+/******************************************************************************/
+LOCAL gpointer moloch_threads_start(gpointer startv)
+{
+    MolochThreadStart_t *start = startv;
+    int                  cpu = moloch_threads_cpu(start->role, start->index);
+
+    if (cpu != -1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc) {
+            LOG("WARNING - Couldn't pin %s to cpu %d - %s", start->name, cpu, strerror(rc));
+        } else {
+            LOG("Thread %s (%s) on cpu %d node %d", start->name, roles[start->role].name, cpu, cpuNode[cpu]);
+        }
+    }
+
+    GThreadFunc func = start->func;
+    gpointer    data = start->data;
+    g_free(start->name);
+    MOLOCH_TYPE_FREE(MolochThreadStart_t, start);
+
+    return func(data);
+}
+/******************************************************************************/
+GThread *moloch_threads_new(int role, int index, const char *name, GThreadFunc func, gpointer data)
+{
+    MolochThreadStart_t *start = MOLOCH_TYPE_ALLOC(MolochThreadStart_t);
+    start->role  = role;
+    start->index = index;
+    start->name  = g_strdup(name);
+    start->func  = func;
+    start->data  = data;
+
+    return g_thread_new(name, moloch_threads_start, start);
+}
+/******************************************************************************/
+/* Memory for a thread's tables, placed on the node of the thread's cpu when
+ * it is pinned.  The policy is set before the pages are touched so it doesn't
+ * matter which thread initializes it.  Never freed.
+ */
+void *moloch_threads_alloc(int role, int index, size_t size)
+{
+    int node = moloch_threads_node(role, index);
+    if (node < 0 || node >= MOLOCH_MAX_NODES)
+        return malloc(size);
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        LOG("ERROR - Couldn't mmap %zu bytes - %s", size, strerror(errno));
+        exit(1);
+    }
+
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, mem, size, MOLOCH_MPOL_PREFERRED, &mask, sizeof(mask)*8, 0) != 0 && config.debug) {
+        LOG("mbind to node %d failed - %s", node, strerror(errno));
+    }
+    return mem;
+}
+/******************************************************************************/
+LOCAL void moloch_threads_nodes_str(uint64_t nodes, char *buf, int size)
+{
+    int n, len = 0;
+
+    buf[0] = 0;
+    for (n = 0; n < MOLOCH_MAX_NODES; n++) {
+        if (nodes & (1ULL << n))
+            len += snprintf(buf + len, size - len, "%s%d", len?",":"", n);
+    }
+    if (!len)
+        g_strlcpy(buf, "?", size);
+}
+/******************************************************************************/
+void moloch_threads_init()
+{
+    int i;
+
+    for (i = 0; i < MOLOCH_MAX_CPUS; i++) {
+        cpuNode[i] = -1;
+    }
+    int cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (i = 0; i < cpus && i < MOLOCH_MAX_CPUS; i++) {
+        cpuNode[i] = moloch_threads_cpu_node(i);
+    }
+
+    for (i = 0; i < MOLOCH_THREAD_ROLE_NUM; i++) {
+        if (!roles[i].setting)
+            continue;
+
+        char *str = moloch_config_str(NULL, roles[i].setting, NULL);
+        if (!str)
+            continue;
+
+        moloch_threads_parse_cpus(&roles[i], str);
+        g_free(str);
+
+        char nodes[200];
+        moloch_threads_nodes_str(roles[i].nodes, nodes, sizeof(nodes));
+        LOG("%s threads on %d cpus, numa nodes %s", roles[i].name, roles[i].cpusNum, nodes);
+
+        if (config.debug) {
+            int t;
+            for (t = 0; t < roles[i].cpusNum; t++) {
+                LOG("%s thread %d -> cpu %d node %d", roles[i].name, t, roles[i].cpus[t], cpuNode[roles[i].cpus[t]]);
+            }
+        }
+    }
+
+    // Readers copy each packet, the packet threads then read it
+    uint64_t packetNodes = roles[MOLOCH_THREAD_PACKET].nodes;
+    uint64_t readerNodes = roles[MOLOCH_THREAD_READER].nodes;
+    if (packetNodes && readerNodes && (packetNodes | readerNodes) != packetNodes) {
+        LOG("WARNING - readerThreadCpus are on numa nodes that packetThreadCpus aren't, packets will cross nodes");
+    }
+    if (roles[MOLOCH_THREAD_PACKET].cpusNum && roles[MOLOCH_THREAD_PACKET].cpusNum < config.packetThreads) {
+        LOG("WARNING - packetThreadCpus has %d cpus for %d packetThreads, some will share", roles[MOLOCH_THREAD_PACKET].cpusNum, config.packetThreads);
+    }
+}
@@ -41,6 +41,7 @@ typedef struct moloch_output {
     uint64_t   max;
     uint64_t   pos;
     char       close;
+    MolochWriterIndex_t *index;
 } MolochDiskOutput_t;
 
 
@@ -56,6 +57,7 @@ static MOLOCH_LOCK_DEFINE(freeOutputBufs);
 
 static uint32_t              outputId;
 static char                 *outputFileName;
+static MolochWriterIndex_t  *outputIndex;
 static uint64_t              outputFilePos = 0;
 static struct timeval        outputFileTime;
 
@@ -144,6 +146,7 @@ gboolean writer_disk_output_cb(gint fd, GIOCondition UNUSED(cond), gpointer UNUS
     }
 
     int len;
+    MOLOCH_METRICS_START(writeStart);
     if (writeMethod == MOLOCH_WRITE_NORMAL) {
         len = write(outputFd, out->buf+out->pos, (out->max - out->pos));
         if (len < 0) {
@@ -166,6 +169,7 @@ gboolean writer_disk_output_cb(gint fd, GIOCondition UNUSED(cond), gpointer UNUS
             (void)ftruncate(outputFd, filelen);
         }
     }
+    MOLOCH_METRICS_OBSERVE(MOLOCH_METRICS_OTHER_THREAD, MOLOCH_METRICS_DISK_WRITE, writeStart);
 
     out->pos += len;
 
@@ -178,6 +182,8 @@ gboolean writer_disk_output_cb(gint fd, GIOCondition UNUSED(cond), gpointer UNUS
     if (out->close) {
         close(outputFd);
         outputFd = 0;
+        if (out->index)
+            moloch_writer_index_write(out->index, out->name);
         free(out->name);
     }
 
@@ -233,7 +239,9 @@ void *writer_disk_output_thread(void *UNUSED(arg))
                 wlen = (wlen - (wlen % pageSize) + pageSize);
             }
 
+            MOLOCH_METRICS_START(writeStart);
             int len = write(outputFd, out->buf+out->pos, wlen);
+            MOLOCH_METRICS_OBSERVE(MOLOCH_METRICS_OTHER_THREAD, MOLOCH_METRICS_DISK_WRITE, writeStart);
             out->pos += len;
             if (len < 0) {
                 LOG("ERROR - Write %d failed with %d %d\n", outputFd, len, errno);
@@ -247,6 +255,8 @@ void *writer_disk_output_thread(void *UNUSED(arg))
             }
             close(outputFd);
             outputFd = 0;
+            if (out->index)
+                moloch_writer_index_write(out->index, out->name);
             free(out->name);
         }
         writer_disk_free_buf(out);
@@ -262,6 +272,10 @@ void writer_disk_flush(gboolean all)
 
     output->close = all;
     output->name  = outputFileName;
+    if (all) {
+        output->index = outputIndex;
+        outputIndex = NULL;
+    }
 
     MolochDiskOutput_t *noutput = MOLOCH_TYPE_ALLOC0(MolochDiskOutput_t);
     noutput->max = config.pcapWriteSize;
@@ -322,6 +336,8 @@ void writer_disk_create(MolochPacket_t * const packet)
 {
     outputFileName = moloch_db_create_file(packet->ts.tv_sec, NULL, 0, 0, &outputId);
     outputFilePos = 24;
+    if (config.pcapIndex)
+        outputIndex = moloch_writer_index_new();
 
     output = MOLOCH_TYPE_ALLOC0(MolochDiskOutput_t);
     output->max = config.pcapWriteSize;
@@ -341,17 +357,17 @@ struct pcap_sf_pkthdr {
     uint32_t caplen;		/* length of portion present */
     uint32_t pktlen;		/* length this packet (off wire) */
 };
-void
-writer_disk_write(const MolochSession_t * const UNUSED(session), MolochPacket_t * const packet)
+/* Caller holds the output lock */
+LOCAL void
+writer_disk_write_locked(const MolochSession_t * const session, MolochPacket_t * const packet)
 {
     struct pcap_sf_pkthdr hdr;
 
     hdr.ts.tv_sec  = packet->ts.tv_sec;
     hdr.ts.tv_usec = packet->ts.tv_usec;
-    hdr.caplen     = packet->pktlen;
+    hdr.caplen     = packet->writerCapLen?packet->writerCapLen:packet->pktlen;
     hdr.pktlen     = packet->pktlen;
 
-    MOLOCH_LOCK(output);
     if (!outputFileName) {
         writer_disk_create(packet);
     }
@@ -359,20 +375,44 @@ writer_disk_write(const MolochSession_t * const UNUSED(session), MolochPacket_t
     memcpy(output->buf + output->pos, (char *)&hdr, sizeof(hdr));
     output->pos += sizeof(hdr);
 
-    memcpy(output->buf + output->pos, packet->pkt, packet->pktlen);
-    output->pos += packet->pktlen;
+    memcpy(output->buf + output->pos, packet->pkt, hdr.caplen);
+    output->pos += hdr.caplen;
 
     if(output->pos > output->max) {
         writer_disk_flush(FALSE);
     }
     packet->writerFileNum = outputId;
     packet->writerFilePos = outputFilePos;
-    outputFilePos += 16 + packet->pktlen;
+    if (outputIndex)
+        moloch_writer_index_add(outputIndex, session, outputFilePos, 16 + hdr.caplen);
+    outputFilePos += 16 + hdr.caplen;
 
     if (outputFilePos >= config.maxFileSizeB) {
         writer_disk_flush(TRUE);
         outputFileName = 0;
     }
+}
+/******************************************************************************/
+void
+writer_disk_write(const MolochSession_t * const session, MolochPacket_t * const packet)
+{
+    MOLOCH_LOCK(output);
+    writer_disk_write_locked(session, packet);
+    MOLOCH_UNLOCK(output);
+}
+/******************************************************************************/
+/* The whole run is written under one lock so other packet threads can't
+ * split it up.
+ */
+void
+writer_disk_write_run(const MolochSession_t * const session, MolochPacket_t * const packets, int num)
+{
+    int i;
+
+    MOLOCH_LOCK(output);
+    for (i = 0; i < num; i++) {
+        writer_disk_write_locked(session, &packets[i]);
+    }
     MOLOCH_UNLOCK(output);
 }
 /******************************************************************************/
@@ -414,7 +454,7 @@ void writer_disk_init(char *name)
 #endif
 
     if (writeMethod & MOLOCH_WRITE_THREAD) {
-        g_thread_new("moloch-output", &writer_disk_output_thread, NULL);
+        moloch_threads_new(MOLOCH_THREAD_WRITER, 0, "moloch-output", &writer_disk_output_thread, NULL);
     }
 
     if ((writeMethod & MOLOCH_WRITE_DIRECT) && sizeof(off_t) == 4 && config.maxFileSizeG > 2)
@@ -437,6 +477,7 @@ void writer_disk_init(char *name)
 
     moloch_writer_exit         = writer_disk_exit;
     moloch_writer_write        = writer_disk_write;
+    moloch_writer_write_run    = writer_disk_write_run;
 
     if (config.maxFileTimeM > 0) {
         g_timeout_add_seconds( 30, writer_disk_file_time_gfunc, 0);
@@ -0,0 +1,173 @@
+/******************************************************************************/
+/* writer-index.c  -- Sidecar index for the pcap files the writers create
+ *
+ * With pcapIndex=true each pcap file gets a <file>.idx written next to it once
+ * the file is closed, so readers can find a session's packets without a read
+ * per packet.  Everything is in host byte order like the pcap header:
+ *
+ *   header   magic "MPIX", version, blockSize, sessions, blocks, 0, fileSize
+ *   sessions {first, end, packets, 0} per session sorted by first, where first
+ *            is the offset of the session's first packet in the file, which is
+ *            also the first entry the viewer has in ps for the file, and end is
+ *            just past the session's last packet
+ *   blocks   offset of the first packet that starts at or after each
+ *            blockSize boundary, for reading from the middle of a file
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define _FILE_OFFSET_BITS 64
+#include "moloch.h"
+#include <errno.h>
+
+extern MolochConfig_t        config;
+
+#define MOLOCH_WRITER_INDEX_VERSION 1
+#define MOLOCH_WRITER_INDEX_BLOCK   (1024*1024)
+
+typedef struct {
+    char               magic[4];
+    uint32_t           version;
+    uint32_t           blockSize;
+    uint32_t           sessions;
+    uint32_t           blocks;
+    uint32_t           pad;
+    uint64_t           fileSize;
+} MolochWriterIndexHdr_t;
+
+typedef struct {
+    uint64_t           first;
+    uint64_t           end;
+    uint32_t           packets;
+    uint32_t           pad;
+} MolochWriterIndexEntry_t;
+
+/* The session pointer and first packet time tell a session apart from a
+ * later one that reused the same addresses and ports in the same file.
+ */
+typedef struct {
+    MolochWriterIndexEntry_t  entry;
+    const MolochSession_t    *session;
+    time_t                    firstPacket;
+    char                      sessionId[MOLOCH_SESSIONID_LEN];
+} MolochWriterIndexSession_t;
+
+struct moloch_writer_index {
+    GHashTable        *sessions;
+    GPtrArray         *all;
+    GArray            *blocks;
+    uint64_t           fileSize;
+};
+
+/******************************************************************************/
+LOCAL guint moloch_writer_index_hash(gconstpointer key)
+{
+    const char *sessionId = key;
+    return moloch_string_hash_len(sessionId, sessionId[0]);
+}
+/******************************************************************************/
+LOCAL gboolean moloch_writer_index_equal(gconstpointer a, gconstpointer b)
+{
+    const char *ida = a, *idb = b;
+    return ida[0] == idb[0] && memcmp(ida, idb, ida[0]) == 0;
+}
+/******************************************************************************/
+MolochWriterIndex_t *moloch_writer_index_new()
+{
+    MolochWriterIndex_t *index = MOLOCH_TYPE_ALLOC0(MolochWriterIndex_t);
+
+    index->sessions = g_hash_table_new(moloch_writer_index_hash, moloch_writer_index_equal);
+    index->all = g_ptr_array_new();
+    index->blocks = g_array_new(FALSE, TRUE, sizeof(uint64_t));
+    return index;
+}
+/******************************************************************************/
+/* Called by the writer for each packet, with whatever lock the writer already
+ * holds for the file.
+ */
+void moloch_writer_index_add(MolochWriterIndex_t *index, const MolochSession_t *session, uint64_t pos, uint32_t len)
+{
+    MolochWriterIndexSession_t *is = g_hash_table_lookup(index->sessions, session->sessionId);
+
+    if (!is || is->session != session || is->firstPacket != session->firstPacket.tv_sec) {
+        is = MOLOCH_TYPE_ALLOC0(MolochWriterIndexSession_t);
+        is->session = session;
+        is->firstPacket = session->firstPacket.tv_sec;
+        memcpy(is->sessionId, session->sessionId, session->sessionId[0]);
+        is->entry.first = pos;
+        g_hash_table_insert(index->sessions, is->sessionId, is);
+        g_ptr_array_add(index->all, is);
+    }
+    is->entry.end = pos + len;
+    is->entry.packets++;
+
+    while (index->blocks->len <= pos / MOLOCH_WRITER_INDEX_BLOCK) {
+        g_array_append_val(index->blocks, pos);
+    }
+    index->fileSize = pos + len;
+}
+/******************************************************************************/
+LOCAL int moloch_writer_index_cmp(const void *a, const void *b)
+{
+    const MolochWriterIndexSession_t *isa = *(MolochWriterIndexSession_t **)a;
+    const MolochWriterIndexSession_t *isb = *(MolochWriterIndexSession_t **)b;
+
+    if (isa->entry.first < isb->entry.first)
+        return -1;
+    return isa->entry.first > isb->entry.first;
+}
+/******************************************************************************/
+/* Called once the pcap file is complete, writes the index and frees it */
+void moloch_writer_index_write(MolochWriterIndex_t *index, const char *pcapName)
+{
+    MolochWriterIndexHdr_t hdr;
+    guint                  i;
+
+    qsort(index->all->pdata, index->all->len, sizeof(gpointer), moloch_writer_index_cmp);
+
+    memcpy(hdr.magic, "MPIX", 4);
+    hdr.version   = MOLOCH_WRITER_INDEX_VERSION;
+    hdr.blockSize = MOLOCH_WRITER_INDEX_BLOCK;
+    hdr.sessions  = index->all->len;
+    hdr.blocks    = index->blocks->len;
+    hdr.pad       = 0;
+    hdr.fileSize  = index->fileSize;
+
+    char *name = g_strdup_printf("%s.idx", pcapName);
+    FILE *fp = fopen(name, "w");
+    if (!fp) {
+        LOG("ERROR - Couldn't open index file '%s' - %s", name, strerror(errno));
+    } else {
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        for (i = 0; i < index->all->len; i++) {
+            MolochWriterIndexSession_t *is = g_ptr_array_index(index->all, i);
+            fwrite(&is->entry, sizeof(is->entry), 1, fp);
+        }
+        fwrite(index->blocks->data, sizeof(uint64_t), index->blocks->len, fp);
+        if (fclose(fp) != 0) {
+            LOG("ERROR - Couldn't write index file '%s' - %s", name, strerror(errno));
+        } else if (config.debug) {
+            LOG("Wrote %s with %u sessions", name, hdr.sessions);
+        }
+    }
+    g_free(name);
+
+    for (i = 0; i < index->all->len; i++) {
+        MOLOCH_TYPE_FREE(MolochWriterIndexSession_t, g_ptr_array_index(index->all, i));
+    }
+    g_hash_table_destroy(index->sessions);
+    g_ptr_array_free(index->all, TRUE);
+    g_array_free(index->blocks, TRUE);
+    MOLOCH_TYPE_FREE(MolochWriterIndex_t, index);
+}
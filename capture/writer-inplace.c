@@ -69,6 +69,7 @@ void writer_inplace_write(const MolochSession_t * const UNUSED(session), MolochP
 
     packet->writerFileNum = outputId;
     packet->writerFilePos = packet->readerFilePos;
+    packet->writerCapLen  = 0; // The original file always has the full packet
 }
 /******************************************************************************/
 void writer_inplace_write_dryrun(const MolochSession_t * const UNUSED(session), MolochPacket_t * const packet)
@@ -46,7 +46,7 @@ void writer_null_write(const MolochSession_t * const UNUSED(session), MolochPack
 {
     packet->writerFileNum = 0;
     packet->writerFilePos = outputFilePos;
-    outputFilePos += 16 + packet->pktlen;
+    outputFilePos += 16 + (packet->writerCapLen?packet->writerCapLen:packet->pktlen);
 }
 /******************************************************************************/
 void writer_null_init(char *UNUSED(name))
@@ -54,4 +54,5 @@ void writer_null_init(char *UNUSED(name))
     moloch_writer_queue_length = writer_null_queue_length;
     moloch_writer_exit         = writer_null_exit;
     moloch_writer_write        = writer_null_write;
+    moloch_writer_write_run    = moloch_writer_write_run_each;
 }
@@ -0,0 +1,203 @@
+/******************************************************************************/
+/* writer-ordered.c  -- Groups each session's packets before they are written
+ *
+ * With pcapSessionOrder=true the packet threads copy a session's packets into
+ * a run instead of handing them to the writer one at a time.  The run is
+ * given to the writer in one go, so the session's packets are next to each
+ * other in the pcap file and the viewer can load them with a few large reads.
+ * A run is written when
+ *   - it reaches pcapSessionOrderRunSize bytes
+ *   - its first packet has waited pcapSessionOrderDelay seconds
+ *   - the thread has more than its share of pcapSessionOrderMemory buffered,
+ *     oldest runs first
+ *   - the session is saved, session.c flushes the run before every save
+ * The file positions are only added to the session once the run is written,
+ * so saves always have the final ones.  Everything is per packet thread and
+ * must only be called from the session's own packet thread, no locking.
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "moloch.h"
+#include <time.h>
+
+extern MolochConfig_t        config;
+
+/* Each packet is stored as a header followed by the bytes the writer should
+ * save, padded so the next header is aligned.
+ */
+typedef struct {
+    struct timeval     ts;
+    uint16_t           pktlen;
+    uint16_t           writerCapLen;
+    uint32_t           pad;
+} MolochWriterRunPacket_t;
+
+#define MOLOCH_RUN_PACKET_LEN(caplen) ((sizeof(MolochWriterRunPacket_t) + (caplen) + 7) & ~7)
+#define MOLOCH_RUN_MIN_SIZE           2048
+
+typedef struct moloch_writer_run {
+    struct moloch_writer_run *run_next, *run_prev;
+    MolochSession_t          *session;
+    char                     *buf;
+    uint32_t                  len;
+    uint32_t                  size;
+    uint32_t                  packets;
+    time_t                    created;
+} MolochWriterRun_t;
+
+/* Runs are kept oldest first */
+typedef struct {
+    struct moloch_writer_run *run_next, *run_prev;
+    int                       run_count;
+    uint64_t                  bytes;
+    MolochPacket_t           *packets;
+    uint32_t                  packetsSize;
+    uint64_t                  written;
+    uint64_t                  writtenBytes;
+} MolochWriterRunHead_t;
+
+LOCAL MolochWriterRunHead_t  runs[MOLOCH_MAX_PACKET_THREADS];
+LOCAL uint64_t               threadMemory;
+
+/******************************************************************************/
+void moloch_writer_ordered_flush(MolochSession_t *session)
+{
+    MolochWriterRun_t     *run = session->writerRun;
+    MolochWriterRunHead_t *head = &runs[session->thread];
+    uint32_t               i, pos = 0;
+
+    if (!run)
+        return;
+
+    if (head->packetsSize < run->packets) {
+        head->packetsSize = MAX(head->packetsSize*2, run->packets);
+        head->packets = realloc(head->packets, head->packetsSize * sizeof(MolochPacket_t));
+    }
+
+    for (i = 0; i < run->packets; i++) {
+        MolochWriterRunPacket_t *rp = (MolochWriterRunPacket_t *)(run->buf + pos);
+        MolochPacket_t          *packet = &head->packets[i];
+        uint16_t                 caplen = rp->writerCapLen?rp->writerCapLen:rp->pktlen;
+
+        memset(packet, 0, sizeof(*packet));
+        packet->ts           = rp->ts;
+        packet->pkt          = (uint8_t *)(rp + 1);
+        packet->pktlen       = rp->pktlen;
+        packet->writerCapLen = rp->writerCapLen;
+        pos += MOLOCH_RUN_PACKET_LEN(caplen);
+    }
+
+    moloch_writer_write_run(session, head->packets, run->packets);
+
+    for (i = 0; i < run->packets; i++) {
+        moloch_packet_add_file_pos(session, &head->packets[i]);
+    }
+
+    head->written++;
+    head->writtenBytes += run->len;
+    head->bytes -= run->size;
+    DLL_REMOVE(run_, head, run);
+    session->writerRun = NULL;
+    free(run->buf);
+    MOLOCH_TYPE_FREE(MolochWriterRun_t, run);
+}
+/******************************************************************************/
+void moloch_writer_ordered_add(MolochSession_t *session, MolochPacket_t *packet)
+{
+    MolochWriterRun_t     *run = session->writerRun;
+    MolochWriterRunHead_t *head = &runs[session->thread];
+    uint16_t               caplen = packet->writerCapLen?packet->writerCapLen:packet->pktlen;
+    uint32_t               len = MOLOCH_RUN_PACKET_LEN(caplen);
+
+    if (!run) {
+        run = MOLOCH_TYPE_ALLOC0(MolochWriterRun_t);
+        run->session = session;
+        run->created = time(NULL);
+        session->writerRun = run;
+        DLL_PUSH_TAIL(run_, head, run);
+    }
+
+    if (run->len + len > run->size) {
+        uint32_t size = MAX(run->size*2, MOLOCH_RUN_MIN_SIZE);
+        while (size < run->len + len)
+            size *= 2;
+        run->buf = realloc(run->buf, size);
+        head->bytes += size - run->size;
+        run->size = size;
+    }
+
+    MolochWriterRunPacket_t *rp = (MolochWriterRunPacket_t *)(run->buf + run->len);
+    rp->ts           = packet->ts;
+    rp->pktlen       = packet->pktlen;
+    rp->writerCapLen = packet->writerCapLen;
+    rp->pad          = 0;
+    memcpy(rp + 1, packet->pkt, caplen);
+    run->len += len;
+    run->packets++;
+
+    if (run->len >= config.pcapSessionOrderRunSize)
+        moloch_writer_ordered_flush(session);
+
+    while (head->bytes > threadMemory) {
+        run = DLL_PEEK_HEAD(run_, head);
+        moloch_writer_ordered_flush(run->session);
+    }
+}
+/******************************************************************************/
+/* Called by the packet threads at least once a second when idle and every
+ * few thousand packets when busy.
+ */
+void moloch_writer_ordered_check(int thread)
+{
+    MolochWriterRunHead_t *head = &runs[thread];
+    MolochWriterRun_t     *run = DLL_PEEK_HEAD(run_, head);
+
+    if (!run)
+        return;
+
+    time_t now = time(NULL);
+    if (run->created + config.pcapSessionOrderDelay > now)
+        return;
+
+    MOLOCH_BENCH_START(writeStart);
+    while ((run = DLL_PEEK_HEAD(run_, head)) && run->created + config.pcapSessionOrderDelay <= now) {
+        moloch_writer_ordered_flush(run->session);
+    }
+    MOLOCH_BENCH_STOP(thread, MOLOCH_BENCH_WRITE, writeStart);
+}
+/******************************************************************************/
+void moloch_writer_ordered_stats(uint64_t *written, uint64_t *writtenBytes)
+{
+    int t;
+
+    *written = *writtenBytes = 0;
+    for (t = 0; t < config.packetThreads; t++) {
+        *written += runs[t].written;
+        *writtenBytes += runs[t].writtenBytes;
+    }
+}
+/******************************************************************************/
+void moloch_writer_ordered_init()
+{
+    int t;
+
+    for (t = 0; t < config.packetThreads; t++) {
+        DLL_INIT(run_, &runs[t]);
+    }
+
+    threadMemory = (uint64_t)config.pcapSessionOrderMemory * 1024 * 1024 / config.packetThreads;
+    LOG("Session ordered pcap, runs up to %u bytes, %" PRIu64 " bytes buffered per packet thread, %u second delay",
+        config.pcapSessionOrderRunSize, threadMemory, config.pcapSessionOrderDelay);
+}
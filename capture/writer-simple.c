@@ -40,6 +40,8 @@ typedef struct molochsimple {
     int                  fd;
     uint32_t             bufpos;
     int                  closing;
+    char                *name;
+    MolochWriterIndex_t *index;
 } MolochSimple_t;
 
 static MolochSimple_t    simpleQ;
@@ -65,6 +67,8 @@ MolochSimple_t *writer_simple_alloc(MolochSimple_t *previous)
         info->fd = previous->fd;
         info->pos = previous->pos;
         info->id = previous->id;
+        info->name = previous->name;
+        info->index = previous->index;
     }
     return info;
 }
@@ -125,7 +129,9 @@ void writer_simple_write(const MolochSession_t * const session, MolochPacket_t *
         memcpy(currentInfo[thread]->buf, &pcapFileHeader, 24);
         if (config.debug)
             LOG("opened %d %s %d", thread, name, currentInfo[thread]->fd);
-        g_free(name);
+        currentInfo[thread]->name = name;
+        if (config.pcapIndex)
+            currentInfo[thread]->index = moloch_writer_index_new();
     }
 
     packet->writerFileNum = currentInfo[thread]->id;
@@ -135,14 +141,17 @@ void writer_simple_write(const MolochSession_t * const session, MolochPacket_t *
 
     hdr.ts.tv_sec  = packet->ts.tv_sec;
     hdr.ts.tv_usec = packet->ts.tv_usec;
-    hdr.caplen     = packet->pktlen;
+    hdr.caplen     = packet->writerCapLen?packet->writerCapLen:packet->pktlen;
     hdr.pktlen     = packet->pktlen;
 
+    if (currentInfo[thread]->index)
+        moloch_writer_index_add(currentInfo[thread]->index, session, currentInfo[thread]->pos, 16 + hdr.caplen);
+
     memcpy(currentInfo[thread]->buf+currentInfo[thread]->bufpos, &hdr, 16);
     currentInfo[thread]->bufpos += 16;
-    memcpy(currentInfo[thread]->buf+currentInfo[thread]->bufpos, packet->pkt, packet->pktlen);
-    currentInfo[thread]->bufpos += packet->pktlen;
-    currentInfo[thread]->pos += 16 + packet->pktlen;
+    memcpy(currentInfo[thread]->buf+currentInfo[thread]->bufpos, packet->pkt, hdr.caplen);
+    currentInfo[thread]->bufpos += hdr.caplen;
+    currentInfo[thread]->pos += 16 + hdr.caplen;
 
     if (currentInfo[thread]->bufpos > config.pcapWriteSize) {
         writer_simple_process_buf(thread, 0);
@@ -176,7 +185,9 @@ void *writer_simple_thread(void *UNUSED(arg))
         }
 
         while (pos < total) {
+            MOLOCH_METRICS_START(writeStart);
             int len = write(info->fd, info->buf + pos, total - pos);
+            MOLOCH_METRICS_OBSERVE(MOLOCH_METRICS_OTHER_THREAD, MOLOCH_METRICS_DISK_WRITE, writeStart);
             if (len >= 0) {
                 pos += len;
             } else {
@@ -187,6 +198,9 @@ void *writer_simple_thread(void *UNUSED(arg))
         if (info->closing) {
             ftruncate(info->fd, info->pos);
             close(info->fd);
+            if (info->index)
+                moloch_writer_index_write(info->index, info->name);
+            g_free(info->name);
         }
 
         writer_simple_free(info);
@@ -215,6 +229,7 @@ void writer_simple_init(char *UNUSED(name))
     moloch_writer_queue_length = writer_simple_queue_length;
     moloch_writer_exit         = writer_simple_exit;
     moloch_writer_write        = writer_simple_write;
+    moloch_writer_write_run    = moloch_writer_write_run_each;
 
     pageSize = getpagesize();
     if (config.pcapWriteSize % pageSize != 0) {
@@ -223,5 +238,5 @@ void writer_simple_init(char *UNUSED(name))
     }
 
     DLL_INIT(simple_, &simpleQ);
-    g_thread_new("moloch-simple", &writer_simple_thread, NULL);
+    moloch_threads_new(MOLOCH_THREAD_WRITER, 0, "moloch-simple", &writer_simple_thread, NULL);
 }
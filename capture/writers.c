@@ -22,6 +22,7 @@
 MolochWriterQueueLength moloch_writer_queue_length;
 MolochWriterWrite moloch_writer_write;
 MolochWriterExit moloch_writer_exit;
+MolochWriterWriteRun moloch_writer_write_run;
 
 /******************************************************************************/
 extern MolochConfig_t        config;
@@ -43,6 +44,27 @@ void moloch_writers_start(char *name) {
     MolochWriterInit func = str->uw;
     func(name);
     moloch_add_can_quit((MolochCanQuitFunc)moloch_writer_queue_length, "writer queue length");
+
+    if (config.pcapSessionOrder) {
+        if (moloch_writer_write_run) {
+            moloch_writer_ordered_init();
+        } else {
+            LOG("WARNING - pcapSessionOrder isn't supported by pcapWriteMethod %s, ignoring", name);
+            config.pcapSessionOrder = FALSE;
+        }
+    }
+}
+/******************************************************************************/
+/* For writers where consecutive writes from one packet thread are already
+ * next to each other in the file.
+ */
+void moloch_writer_write_run_each(const MolochSession_t * const session, MolochPacket_t * const packets, int num)
+{
+    int i;
+
+    for (i = 0; i < num; i++) {
+        moloch_writer_write(session, &packets[i]);
+    }
 }
 /******************************************************************************/
 void moloch_writers_add(char *name, MolochWriterInit func) {
@@ -21,9 +21,10 @@ extern MolochConfig_t config;
 
 #if YR_MAJOR_VERSION == 3 && YR_MINOR_VERSION == 4
 // Yara 3
-static YR_COMPILER *yCompiler = 0;
+#define MOLOCH_YARA_COMPILER 1
+static YR_COMPILER *yCompiler[MOLOCH_MAX_PACKET_THREADS];
 static YR_COMPILER *yEmailCompiler = 0;
-static YR_RULES *yRules = 0;
+static YR_RULES *yRules[MOLOCH_MAX_PACKET_THREADS];
 static YR_RULES *yEmailRules = 0;
 
 
@@ -33,7 +34,8 @@ void moloch_yara_report_error(int error_level, const char* file_name, int line_n
     LOG("%d %s:%d: %s\n", error_level, file_name, line_number, error_message);
 }
 /******************************************************************************/
-void moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
+/* Returns the number of errors, the caller decides if they are fatal */
+int moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
 {
     yr_compiler_create(compiler);
     (*compiler)->callback = moloch_yara_report_error;
@@ -49,22 +51,29 @@ void moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
             fclose(rule_file);
 
             if (errors) {
-                exit (0);
+                return errors;
             }
             yr_compiler_get_rules(*compiler, rules);
         } else {
-            printf("yara could not open file: %s\n", filename);
-            exit(1);
+            LOG("yara could not open file: %s", filename);
+            return 1;
         }
     }
+    return 0;
 }
 /******************************************************************************/
 void moloch_yara_init()
 {
     yr_initialize();
 
-    moloch_yara_open(config.yara, &yCompiler, &yRules);
-    moloch_yara_open(config.emailYara, &yEmailCompiler, &yEmailRules);
+    /* Each packet thread gets its own compiled rules so scans never share state */
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        if (moloch_yara_open(config.yara, &yCompiler[t], &yRules[t]))
+            exit(1);
+    }
+    if (moloch_yara_open(config.emailYara, &yEmailCompiler, &yEmailRules))
+        exit(1);
 }
 
 /******************************************************************************/
@@ -89,7 +98,7 @@ int moloch_yara_callback(int message, YR_RULE* rule, MolochSession_t* session)
 /******************************************************************************/
 void  moloch_yara_execute(MolochSession_t *session, const uint8_t *data, int len, int UNUSED(first))
 {
-    yr_rules_scan_mem(yRules, (uint8_t *)data, len, 0, (YR_CALLBACK_FUNC)moloch_yara_callback, session, 0);
+    yr_rules_scan_mem(yRules[session->thread], (uint8_t *)data, len, 0, (YR_CALLBACK_FUNC)moloch_yara_callback, session, 0);
     return;
 }
 /******************************************************************************/
@@ -101,22 +110,26 @@ void  moloch_yara_email_execute(MolochSession_t *session, const uint8_t *data, i
 /******************************************************************************/
 void moloch_yara_exit()
 {
-    if (yRules)
-        yr_rules_destroy(yRules);
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        if (yRules[t])
+            yr_rules_destroy(yRules[t]);
+        if (yCompiler[t])
+            yr_compiler_destroy(yCompiler[t]);
+    }
+
     if (yEmailRules)
         yr_rules_destroy(yEmailRules);
-
-    if (yCompiler)
-        yr_compiler_destroy(yCompiler);
     if (yEmailCompiler)
         yr_compiler_destroy(yEmailCompiler);
     yr_finalize();
 }
 #elif defined(YR_COMPILER_H)
 // Yara 3
-static YR_COMPILER *yCompiler = 0;
+#define MOLOCH_YARA_COMPILER 1
+static YR_COMPILER *yCompiler[MOLOCH_MAX_PACKET_THREADS];
 static YR_COMPILER *yEmailCompiler = 0;
-static YR_RULES *yRules = 0;
+static YR_RULES *yRules[MOLOCH_MAX_PACKET_THREADS];
 static YR_RULES *yEmailRules = 0;
 
 
@@ -126,7 +139,8 @@ void moloch_yara_report_error(int error_level, const char* file_name, int line_n
     LOG("%d %s:%d: %s\n", error_level, file_name, line_number, error_message);
 }
 /******************************************************************************/
-void moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
+/* Returns the number of errors, the caller decides if they are fatal */
+int moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
 {
     yr_compiler_create(compiler);
     (*compiler)->callback = moloch_yara_report_error;
@@ -142,22 +156,29 @@ void moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
             fclose(rule_file);
 
             if (errors) {
-                exit (0);
+                return errors;
             }
             yr_compiler_get_rules(*compiler, rules);
         } else {
-            printf("yara could not open file: %s\n", filename);
-            exit(1);
+            LOG("yara could not open file: %s", filename);
+            return 1;
         }
     }
+    return 0;
 }
 /******************************************************************************/
 void moloch_yara_init()
 {
     yr_initialize();
 
-    moloch_yara_open(config.yara, &yCompiler, &yRules);
-    moloch_yara_open(config.emailYara, &yEmailCompiler, &yEmailRules);
+    /* Each packet thread gets its own compiled rules so scans never share state */
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        if (moloch_yara_open(config.yara, &yCompiler[t], &yRules[t]))
+            exit(1);
+    }
+    if (moloch_yara_open(config.emailYara, &yEmailCompiler, &yEmailRules))
+        exit(1);
 }
 
 /******************************************************************************/
@@ -182,7 +203,7 @@ int moloch_yara_callback(int message, YR_RULE* rule, MolochSession_t* session)
 /******************************************************************************/
 void  moloch_yara_execute(MolochSession_t *session, const uint8_t *data, int len, int UNUSED(first))
 {
-    yr_rules_scan_mem(yRules, (uint8_t *)data, len, 0, (YR_CALLBACK_FUNC)moloch_yara_callback, session, 0);
+    yr_rules_scan_mem(yRules[session->thread], (uint8_t *)data, len, 0, (YR_CALLBACK_FUNC)moloch_yara_callback, session, 0);
     return;
 }
 /******************************************************************************/
@@ -194,22 +215,26 @@ void  moloch_yara_email_execute(MolochSession_t *session, const uint8_t *data, i
 /******************************************************************************/
 void moloch_yara_exit()
 {
-    if (yRules)
-        yr_rules_destroy(yRules);
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        if (yRules[t])
+            yr_rules_destroy(yRules[t]);
+        if (yCompiler[t])
+            yr_compiler_destroy(yCompiler[t]);
+    }
+
     if (yEmailRules)
         yr_rules_destroy(yEmailRules);
-
-    if (yCompiler)
-        yr_compiler_destroy(yCompiler);
     if (yEmailCompiler)
         yr_compiler_destroy(yEmailCompiler);
     yr_finalize();
 }
 #elif defined(STRING_IS_HEX)
 // Yara 2.x
-static YR_COMPILER *yCompiler = 0;
+#define MOLOCH_YARA_COMPILER 1
+static YR_COMPILER *yCompiler[MOLOCH_MAX_PACKET_THREADS];
 static YR_COMPILER *yEmailCompiler = 0;
-static YR_RULES *yRules = 0;
+static YR_RULES *yRules[MOLOCH_MAX_PACKET_THREADS];
 static YR_RULES *yEmailRules = 0;
 
 
@@ -219,7 +244,8 @@ void moloch_yara_report_error(int error_level, const char* file_name, int line_n
     LOG("%d %s:%d: %s\n", error_level, file_name, line_number, error_message);
 }
 /******************************************************************************/
-void moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
+/* Returns the number of errors, the caller decides if they are fatal */
+int moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
 {
     yr_compiler_create(compiler);
     (*compiler)->error_report_function = moloch_yara_report_error;
@@ -235,22 +261,29 @@ void moloch_yara_open(char *filename, YR_COMPILER **compiler, YR_RULES **rules)
             fclose(rule_file);
 
             if (errors) {
-                exit (0);
+                return errors;
             }
             yr_compiler_get_rules(*compiler, rules);
         } else {
-            printf("yara could not open file: %s\n", filename);
-            exit(1);
+            LOG("yara could not open file: %s", filename);
+            return 1;
         }
     }
+    return 0;
 }
 /******************************************************************************/
 void moloch_yara_init()
 {
     yr_initialize();
 
-    moloch_yara_open(config.yara, &yCompiler, &yRules);
-    moloch_yara_open(config.emailYara, &yEmailCompiler, &yEmailRules);
+    /* Each packet thread gets its own compiled rules so scans never share state */
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        if (moloch_yara_open(config.yara, &yCompiler[t], &yRules[t]))
+            exit(1);
+    }
+    if (moloch_yara_open(config.emailYara, &yEmailCompiler, &yEmailRules))
+        exit(1);
 }
 
 /******************************************************************************/
@@ -275,7 +308,7 @@ int moloch_yara_callback(int message, YR_RULE* rule, MolochSession_t* session)
 /******************************************************************************/
 void  moloch_yara_execute(MolochSession_t *session, const uint8_t *data, int len, int UNUSED(first))
 {
-    yr_rules_scan_mem(yRules, (uint8_t *)data, len, (YR_CALLBACK_FUNC)moloch_yara_callback, session, FALSE, 0);
+    yr_rules_scan_mem(yRules[session->thread], (uint8_t *)data, len, (YR_CALLBACK_FUNC)moloch_yara_callback, session, FALSE, 0);
     return;
 }
 /******************************************************************************/
@@ -287,13 +320,16 @@ void  moloch_yara_email_execute(MolochSession_t *session, const uint8_t *data, i
 /******************************************************************************/
 void moloch_yara_exit()
 {
-    if (yRules)
-        yr_rules_destroy(yRules);
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        if (yRules[t])
+            yr_rules_destroy(yRules[t]);
+        if (yCompiler[t])
+            yr_compiler_destroy(yCompiler[t]);
+    }
+
     if (yEmailRules)
         yr_rules_destroy(yEmailRules);
-
-    if (yCompiler)
-        yr_compiler_destroy(yCompiler);
     if (yEmailCompiler)
         yr_compiler_destroy(yEmailCompiler);
     yr_finalize();
@@ -301,7 +337,7 @@ void moloch_yara_exit()
 #else
 // Yara 1.x
 
-static YARA_CONTEXT *yContext = 0;
+static YARA_CONTEXT *yContext[MOLOCH_MAX_PACKET_THREADS];
 static YARA_CONTEXT *yEmailContext = 0;
 
 
@@ -345,7 +381,10 @@ void moloch_yara_init()
 {
     yr_init();
 
-    yContext = moloch_yara_open(config.yara);
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        yContext[t] = moloch_yara_open(config.yara);
+    }
     yEmailContext = moloch_yara_open(config.emailYara);
 }
 
@@ -392,7 +431,7 @@ void  moloch_yara_execute(MolochSession_t *session, const uint8_t *data, int len
     }
     block.next = NULL;
 
-    yr_scan_mem_blocks(&block, yContext, (YARACALLBACK)moloch_yara_callback, session);
+    yr_scan_mem_blocks(&block, yContext[session->thread], (YARACALLBACK)moloch_yara_callback, session);
     return;
 }
 /******************************************************************************/
@@ -424,6 +463,215 @@ void moloch_yara_email_execute(MolochSession_t *session, const uint8_t *data, in
 /******************************************************************************/
 void moloch_yara_exit()
 {
-    yr_destroy_context(yContext);
+    int t;
+    for (t = 0; t < config.packetThreads; t++) {
+        yr_destroy_context(yContext[t]);
+    }
 }
 #endif
+/******************************************************************************/
+/* Hot reload on SIGHUP.  The new rules are compiled on their own thread so the
+ * packet threads never wait, then each rules pointer is swapped atomically and
+ * the old rules are destroyed once every packet thread has passed a quiescent
+ * point.  A rules file that doesn't compile leaves the current rules in place.
+ */
+#ifdef MOLOCH_YARA_COMPILER
+typedef struct {
+    YR_COMPILER       *compiler;
+    YR_RULES          *rules;
+} MolochYaraRules_t;
+
+static int             yaraReloading;
+
+/******************************************************************************/
+static void moloch_yara_rules_free(gpointer data)
+{
+    MolochYaraRules_t *yr = data;
+
+    if (yr->rules)
+        yr_rules_destroy(yr->rules);
+    if (yr->compiler)
+        yr_compiler_destroy(yr->compiler);
+    MOLOCH_TYPE_FREE(MolochYaraRules_t, yr);
+}
+/******************************************************************************/
+static void moloch_yara_swap(YR_COMPILER **compiler, YR_RULES **rules, YR_COMPILER *newCompiler, YR_RULES *newRules)
+{
+    MolochYaraRules_t *old = MOLOCH_TYPE_ALLOC(MolochYaraRules_t);
+
+    old->rules    = __sync_lock_test_and_set(rules, newRules);
+    old->compiler = *compiler;
+    *compiler     = newCompiler;
+    moloch_packet_defer_free(moloch_yara_rules_free, old);
+}
+/******************************************************************************/
+static gpointer moloch_yara_reload_thread(gpointer UNUSED(uw))
+{
+    // The extra slot is the email rules
+    YR_COMPILER *compilers[MOLOCH_MAX_PACKET_THREADS+1];
+    YR_RULES    *rules[MOLOCH_MAX_PACKET_THREADS+1];
+    int          t, errors = 0;
+
+    memset(compilers, 0, sizeof(compilers));
+    memset(rules, 0, sizeof(rules));
+
+    for (t = 0; t < config.packetThreads && !errors; t++) {
+        errors = moloch_yara_open(config.yara, &compilers[t], &rules[t]);
+    }
+    if (!errors)
+        errors = moloch_yara_open(config.emailYara, &compilers[config.packetThreads], &rules[config.packetThreads]);
+
+    if (errors) {
+        LOG("ERROR - yara rules didn't compile, keeping the current rules");
+        for (t = 0; t <= config.packetThreads; t++) {
+            if (rules[t])
+                yr_rules_destroy(rules[t]);
+            if (compilers[t])
+                yr_compiler_destroy(compilers[t]);
+        }
+    } else {
+        for (t = 0; t < config.packetThreads; t++) {
+            moloch_yara_swap(&yCompiler[t], &yRules[t], compilers[t], rules[t]);
+        }
+        moloch_yara_swap(&yEmailCompiler, &yEmailRules, compilers[config.packetThreads], rules[config.packetThreads]);
+        LOG("yara rules reloaded");
+    }
+
+    __sync_lock_release(&yaraReloading);
+    return NULL;
+}
+/******************************************************************************/
+void moloch_yara_reload()
+{
+    if (!config.yara && !config.emailYara)
+        return;
+
+    if (__sync_lock_test_and_set(&yaraReloading, 1)) {
+        LOG("yara reload already running");
+        return;
+    }
+
+    moloch_threads_new(MOLOCH_THREAD_OTHER, 0, "moloch-yara", moloch_yara_reload_thread, NULL);
+}
+#else
+void moloch_yara_reload()
+{
+    if (config.yara || config.emailYara)
+        LOG("Reloading isn't supported with yara 1.x");
+}
+#endif
+/******************************************************************************/
+/* Streaming scans, the same for every yara version.  Each direction keeps the
+ * last yaraWindow bytes already scanned plus anything new, and is scanned once
+ * yaraScanBytes new bytes have built up or the session is saved.  The overlap
+ * lets rules match across segment boundaries.  Buffers start small and double
+ * as needed up to yaraWindow + yaraScanBytes, since most sessions are short.
+ */
+#define MOLOCH_YARA_MIN_BUF 1024
+
+typedef struct moloch_yara_session {
+    uint8_t           *buf[2];
+    uint32_t           size[2];
+    uint32_t           len[2];
+    uint32_t           pending[2];
+    uint32_t           scanned;
+} MolochYaraSession_t;
+
+static uint64_t        yaraBytes[MOLOCH_MAX_PACKET_THREADS];
+static uint64_t        yaraUsecs[MOLOCH_MAX_PACKET_THREADS];
+
+/******************************************************************************/
+static void moloch_yara_session_scan(MolochSession_t *session, MolochYaraSession_t *ys, int which)
+{
+    struct timeval startTime, endTime;
+
+    gettimeofday(&startTime, NULL);
+    moloch_yara_execute(session, ys->buf[which], ys->len[which], 1);
+    gettimeofday(&endTime, NULL);
+
+    yaraUsecs[session->thread] += (endTime.tv_sec - startTime.tv_sec)*1000000 + (endTime.tv_usec - startTime.tv_usec);
+    yaraBytes[session->thread] += ys->len[which];
+    ys->scanned += ys->pending[which];
+    ys->pending[which] = 0;
+
+    /* Keep just the overlap for the next scan */
+    if (ys->len[which] > config.yaraWindow) {
+        memmove(ys->buf[which], ys->buf[which] + ys->len[which] - config.yaraWindow, config.yaraWindow);
+        ys->len[which] = config.yaraWindow;
+    }
+}
+/******************************************************************************/
+void moloch_yara_session_add(MolochSession_t *session, const uint8_t *data, int len, int which)
+{
+    MolochYaraSession_t *ys = session->yara;
+
+    if (!ys) {
+        ys = session->yara = MOLOCH_TYPE_ALLOC0(MolochYaraSession_t);
+    }
+
+    while (len > 0) {
+        if (config.yaraMaxBytes && ys->scanned + ys->pending[0] + ys->pending[1] >= config.yaraMaxBytes)
+            return;
+
+        uint32_t copy = MIN((uint32_t)len, config.yaraScanBytes - ys->pending[which]);
+        if (config.yaraMaxBytes)
+            copy = MIN(copy, config.yaraMaxBytes - ys->scanned - ys->pending[0] - ys->pending[1]);
+
+        if (ys->len[which] + copy > ys->size[which]) {
+            uint32_t size = ys->size[which]?ys->size[which]:MOLOCH_YARA_MIN_BUF;
+            while (size < ys->len[which] + copy)
+                size *= 2;
+            size = MIN(size, config.yaraWindow + config.yaraScanBytes);
+            ys->buf[which] = realloc(ys->buf[which], size);
+            MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_YARA, (int64_t)size - ys->size[which]);
+            ys->size[which] = size;
+        }
+        memcpy(ys->buf[which] + ys->len[which], data, copy);
+        ys->len[which]     += copy;
+        ys->pending[which] += copy;
+        data += copy;
+        len  -= copy;
+
+        if (ys->pending[which] >= config.yaraScanBytes)
+            moloch_yara_session_scan(session, ys, which);
+    }
+}
+/******************************************************************************/
+/* Scan whatever hasn't been scanned yet, called before the session is saved */
+void moloch_yara_session_finish(MolochSession_t *session)
+{
+    MolochYaraSession_t *ys = session->yara;
+    int which;
+
+    if (!ys)
+        return;
+
+    for (which = 0; which < 2; which++) {
+        if (ys->pending[which])
+            moloch_yara_session_scan(session, ys, which);
+    }
+}
+/******************************************************************************/
+void moloch_yara_session_free(MolochSession_t *session)
+{
+    MolochYaraSession_t *ys = session->yara;
+
+    if (!ys)
+        return;
+
+    int which;
+    for (which = 0; which < 2; which++) {
+        if (ys->buf[which]) {
+            free(ys->buf[which]);
+            MOLOCH_MEMORY_ADD(session->thread, MOLOCH_MEMORY_YARA, -(int64_t)ys->size[which]);
+        }
+    }
+    MOLOCH_TYPE_FREE(MolochYaraSession_t, ys);
+    session->yara = NULL;
+}
+/******************************************************************************/
+void moloch_yara_thread_stats(int thread, uint64_t *bytes, uint64_t *usecs)
+{
+    *bytes = yaraBytes[thread];
+    *usecs = yaraUsecs[thread];
+}
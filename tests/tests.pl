@@ -10,6 +10,8 @@ use Test::Differences;
 use Cwd;
 use URI::Escape;
 use TAP::Harness;
+use Time::HiRes qw(time);
+use POSIX ":sys_wait_h";
 use MolochTest;
 
 $main::userAgent = LWP::UserAgent->new(timeout => 20);
@@ -57,14 +59,40 @@ sub sortJson {
     return $json;
 }
 ################################################################################
+# A pcap/<name> test is read by the test-<name> node when config.test.ini has one
+sub captureNode {
+my ($filename, $node) = @_;
+
+    my ($name) = $filename =~ /([^\/]+)$/;
+    open my $fh, '<', "config.test.ini" or die "error opening config.test.ini: $!";
+    my $found = grep {/^\[test-\Q$name\E\]/} <$fh>;
+    close $fh;
+    return $found?"test-$name":$node;
+}
+################################################################################
+# A pcap/<name> directory holds rotated files that are read together, in name
+# order, by the parallel readers of the test-readers node
+sub captureCmd {
+my ($filename) = @_;
+
+    if (-d $filename) {
+        my $node = captureNode($filename, "test-readers");
+        my $files = join(" ", map {"-r $_"} sort glob("$filename/*.pcap"));
+        return "../capture/moloch-capture --tests -c config.test.ini -n $node $files 2>&1 1>/dev/null | ./tests.pl --fix";
+    }
+    my $node = captureNode($filename, "test");
+    return "../capture/moloch-capture --tests -c config.test.ini -n $node -r $filename.pcap 2>&1 1>/dev/null | ./tests.pl --fix";
+}
+################################################################################
 sub doTests {
     my @files = @ARGV;
-    @files = glob ("pcap/*.pcap") if ($#files == -1);
+    @files = (glob ("pcap/*.pcap"), grep {-d $_} glob ("pcap/*")) if ($#files == -1);
 
     plan tests => scalar @files;
 
     foreach my $filename (@files) {
         $filename = substr($filename, 0, -5) if ($filename =~ /\.pcap$/);
+        $filename =~ s/\/$//;
         die "Missing $filename.test" if (! -f "$filename.test");
 
         open my $fh, '<', "$filename.test" or die "error opening $filename.test: $!";
@@ -72,7 +100,7 @@ sub doTests {
         my $savedJson = sortJson(from_json($savedData, {relaxed => 1}));
 
 
-        my $cmd = "../capture/moloch-capture --tests -c config.test.ini -n test -r $filename.pcap 2>&1 1>/dev/null | ./tests.pl --fix";
+        my $cmd = captureCmd($filename);
 
         if ($main::valgrind) {
             $cmd = "G_SLICE=always-malloc valgrind --leak-check=full --log-file=$filename.val " . $cmd;
@@ -154,11 +182,88 @@ sub fixIp {
 sub doMake {
     foreach my $filename (@ARGV) {
         $filename = substr($filename, 0, -5) if ($filename =~ /\.pcap$/);
+        $filename =~ s/\/$//;
+        my $cmd = captureCmd($filename);
         if ($main::debug) {
-          print("../capture/moloch-capture --tests -c config.test.ini -n test -r $filename.pcap 2>&1 1>/dev/null | ./tests.pl --fix > $filename.test\n");
+          print("$cmd > $filename.test\n");
+        }
+        system("$cmd > $filename.test");
+    }
+}
+################################################################################
+# Time how long capture takes to parse the pcap files, each file is read
+# $main::benchLoops times in a single capture run so startup doesn't dominate
+sub doBench {
+    my @files = @ARGV;
+    @files = ("http") if ($#files == -1);
+    # A bare name like smtp means all of pcap/smtp-*.pcap
+    @files = map { /\.pcap$/ ? $_ : glob ("pcap/$_-*.pcap") } @files;
+
+    my $cmd = "../capture/moloch-capture --dryrun -q -c config.test.ini -n test";
+    for (my $i = 0; $i < $main::benchLoops; $i++) {
+        foreach my $filename (@files) {
+            $cmd .= " -r $filename";
+        }
+    }
+
+    if ($main::debug) {
+        print "$cmd\n";
+    }
+
+    my $start = time();
+    system("$cmd > /dev/null 2>&1") == 0 or die "capture failed: $?";
+    my $total = time() - $start;
+
+    my $bytes = 0;
+    foreach my $filename (@files) {
+        $bytes += (stat($filename))[7];
+    }
+    $bytes *= $main::benchLoops;
+
+    printf("%d files x %d loops: %.3fs, %.3fms per loop, %.1f MB/s\n",
+           scalar @files, $main::benchLoops, $total, $total*1000/$main::benchLoops, $bytes/$total/1000000);
+}
+################################################################################
+# Replay the pcap files while sending capture SIGHUP every 250ms, each one
+# recompiles and swaps in the yara rules.  Capture must finish cleanly.
+sub doReloadStress {
+    my @files = @ARGV;
+    @files = glob ("pcap/http-*.pcap") if ($#files == -1);
+
+    my @cmd = ("../capture/moloch-capture", "--dryrun", "-q", "-c", "config.test.ini", "-n", "test");
+    for (my $i = 0; $i < $main::benchLoops; $i++) {
+        foreach my $filename (@files) {
+            push(@cmd, "-r", $filename);
         }
-        system("../capture/moloch-capture --tests -c config.test.ini -n test -r $filename.pcap 2>&1 1>/dev/null | ./tests.pl --fix > $filename.test");
     }
+
+    if ($main::debug) {
+        print join(" ", @cmd), "\n";
+    }
+
+    my $pid = fork();
+    die "fork failed: $!" if (!defined $pid);
+    if ($pid == 0) {
+        open(STDOUT, ">", "/dev/null");
+        open(STDERR, ">&STDOUT");
+        exec(@cmd);
+        exit(1);
+    }
+
+    # Give capture time to install its signal handlers
+    sleep(1);
+
+    my $signals = 0;
+    while (waitpid($pid, WNOHANG) == 0) {
+        kill("HUP", $pid);
+        $signals++;
+        select(undef, undef, undef, 0.25);
+    }
+    my $status = $?;
+
+    printf("%d files x %d loops with %d SIGHUPs: capture %s\n",
+           scalar @files, $main::benchLoops, $signals, $status == 0?"ok":"FAILED ($status)");
+    exit($status == 0?0:1);
 }
 ################################################################################
 sub doViewer {
@@ -273,6 +378,7 @@ my ($cmd) = @_;
 $main::debug = 0;
 $main::valgrind = 0;
 $main::cmd = "--capture";
+$main::benchLoops = 100;
 
 while (scalar (@ARGV) > 0) {
     if ($ARGV[0] eq "--debug") {
@@ -281,7 +387,10 @@ while (scalar (@ARGV) > 0) {
     } elsif ($ARGV[0] eq "--valgrind") {
         $main::valgrind = 1;
         shift @ARGV;
-    } elsif ($ARGV[0] =~ /^--(viewer|fix|make|capture|viewernostart|viewerstart|viewerhang|help)$/) {
+    } elsif ($ARGV[0] eq "--loops") {
+        shift @ARGV;
+        $main::benchLoops = int(shift @ARGV);
+    } elsif ($ARGV[0] =~ /^--(viewer|fix|make|capture|bench|reloadstress|viewernostart|viewerstart|viewerhang|help)$/) {
         $main::cmd = $ARGV[0];
         shift @ARGV;
     } elsif ($ARGV[0] =~ /^-/) {
@@ -297,18 +406,27 @@ if ($main::cmd eq "--fix") {
     doFix();
 } elsif ($main::cmd eq "--make") {
     doMake();
+} elsif ($main::cmd eq "--bench") {
+    doBench();
+} elsif ($main::cmd eq "--reloadstress") {
+    doReloadStress();
 } elsif ($main::cmd eq "--help") {
     print "$ARGV[0] [OPTIONS] [COMMAND] <pcap> files\n";
     print "Options:\n";
     print "  --debug       Turn on debuggin\n";
     print "  --valgrind    Use valgrind on capture\n";
+    print "  --loops <num> Number of times --bench and --reloadstress read each pcap file, default 100\n";
     print "\n";
     print "Commands:\n";
     print "  --help        This help\n";
-    print "  --make        Create a .test file for each .pcap file on command line\n";
+    print "  --make        Create a .test file for each .pcap file or directory on command line\n";
+    print "  --bench       Time capture parsing the pcap files, default is pcap/http-*.pcap,\n";
+    print "                a name like smtp uses pcap/smtp-*.pcap\n";
+    print "  --reloadstress Parse the pcap files while sending capture SIGHUP to reload rules\n";
     print "  --viewer      viewer tests\n";
     print "                This will init local ES, import data, start a viewer, run tests\n";
-    print " [default]      Run each .pcap file thru ../capture/moloch-capture and compare to .test file\n";
+    print " [default]      Run each .pcap file and pcap/<name> directory of rotated files thru\n";
+    print "                ../capture/moloch-capture and compare to .test file\n";
 } elsif ($main::cmd =~ "^--viewer") {
     doGeo();
     setpgrp $$, 0;
@@ -185,6 +185,147 @@ Pcap.prototype.readPacket = function(pos, cb) {
   }
 };
 
+//////////////////////////////////////////////////////////////////////////////////
+//// Coalesced reads
+//////////////////////////////////////////////////////////////////////////////////
+// Packets closer together than READ_GAP are read with one fs.read, up to
+// READ_MAX bytes at a time, instead of one read per packet.
+internals.READ_GAP = 128*1024;
+internals.READ_MAX = 4*1024*1024;
+
+// Loads the <file>.idx written by capture with pcapIndex=true, see
+// capture/writer-index.c for the layout.  Only the session table is used here.
+Pcap.prototype.readIndex = function() {
+  if (this.index !== undefined) {
+    return this.index;
+  }
+
+  this.index = null;
+  try {
+    var buffer = fs.readFileSync(this.filename + ".idx");
+    if (buffer.length >= 32 && buffer.toString("ascii", 0, 4) === "MPIX" && buffer.readUInt32LE(4) === 1) {
+      var sessions = buffer.readUInt32LE(12);
+      if (buffer.length >= 32 + sessions*24) {
+        this.index = {buffer: buffer, sessions: sessions};
+      }
+    }
+  } catch (e) {
+  }
+  return this.index;
+};
+
+// Returns the offset just past the last packet of the session whose first
+// packet in this file is at pos, or undefined if it isn't in the index.
+Pcap.prototype.indexSessionEnd = function(pos) {
+  var index = this.readIndex();
+  if (!index) {
+    return undefined;
+  }
+
+  var buffer = index.buffer;
+  var low = 0, high = index.sessions - 1;
+  while (low <= high) {
+    var mid = (low + high) >>> 1;
+    var off = 32 + mid*24;
+    var first = buffer.readUInt32LE(off) + buffer.readUInt32LE(off+4) * 0x100000000;
+    if (first === pos) {
+      return buffer.readUInt32LE(off+8) + buffer.readUInt32LE(off+12) * 0x100000000;
+    }
+    if (first < pos) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return undefined;
+};
+
+// Reads the packets at positions, lens are the matching psl entries if known.
+// cb(err, packets) with packets in the same order as positions, packets that
+// can't be read are left out like readPacket does.
+Pcap.prototype.readPackets = function(positions, lens, cb) {
+  var self = this;
+  var packets = [];
+  var sessionEnd = lens ? undefined : self.indexSessionEnd(positions[0]);
+
+  function packetEnd(i) {
+    if (lens && lens[i] > 0) {
+      return positions[i] + lens[i];
+    }
+    if (i === positions.length - 1 && sessionEnd !== undefined && sessionEnd > positions[i]) {
+      return sessionEnd;
+    }
+    return positions[i] + 1550;
+  }
+
+  function readRun(start) {
+    if (start >= positions.length) {
+      return cb(null, packets);
+    }
+
+    var end = start + 1;
+    var runStart = positions[start];
+    var runEnd = packetEnd(start);
+    while (end < positions.length &&
+           positions[end] >= positions[end-1] &&
+           positions[end] - runEnd <= internals.READ_GAP &&
+           packetEnd(end) - runStart <= internals.READ_MAX) {
+      runEnd = Math.max(runEnd, packetEnd(end));
+      end++;
+    }
+
+    var buffer = new Buffer(runEnd - runStart);
+    fs.read(self.fd, buffer, 0, buffer.length, runStart, function (err, bytesRead) {
+      if (err) {
+        return cb(err, packets);
+      }
+
+      var run = [];
+      var missing = [];
+      for (var i = start; i < end; i++) {
+        var off = positions[i] - runStart;
+        if (off + 16 > bytesRead) {
+          missing.push(i);
+          continue;
+        }
+        var len = (self.bigEndian?buffer.readUInt32BE(off+8):buffer.readUInt32LE(off+8));
+        if (len > 0xffff) {
+          continue;
+        }
+        if (off + 16 + len > bytesRead) {
+          missing.push(i);
+          continue;
+        }
+        run[i - start] = buffer.slice(off, off + 16 + len);
+      }
+
+      function runDone() {
+        for (var r = 0; r < end - start; r++) {
+          if (run[r]) {
+            packets.push(run[r]);
+          }
+        }
+        readRun(end);
+      }
+
+      // Guessed too short, fall back to reading those one at a time
+      var m = 0;
+      (function readMissing() {
+        if (m >= missing.length) {
+          return runDone();
+        }
+        var i = missing[m++];
+        self.readPacket(positions[i], function (packet) {
+          run[i - start] = packet;
+          readMissing();
+        });
+      })();
+    });
+  }
+
+  readRun(0);
+};
+
 Pcap.prototype.scrubPacket = function(packet, pos, buf, entire) {
 
   var len = packet.pcap.incl_len + 16; // 16 = pcap header length
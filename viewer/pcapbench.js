@@ -0,0 +1,154 @@
+/******************************************************************************/
+/* pcapbench.js -- Time reading sessions back out of a pcap file
+ *
+ * pcapbench.js <pcap file> [-n <rounds>] [-nolens]
+ *
+ * Splits the file into sessions by address/port pair, then reads every
+ * session back once with a read per packet like the viewer used to and once
+ * with Pcap.readPackets.  -nolens leaves out the packet lengths so
+ * readPackets has to guess them or use the <file>.idx if there is one.
+ * Drop the page cache between runs to measure the disk instead of memory.
+ *
+ * Copyright 2012-2016 AOL Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this Software except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*jshint
+  node: true, plusplus: false, curly: true, eqeqeq: true, immed: true, latedef: true, newcap: true, nonew: true, undef: true, strict: true, trailing: true
+*/
+'use strict';
+var fs = require('fs-ext');
+var async = require('async');
+var Pcap = require('./pcap.js');
+
+function help() {
+  console.log("pcapbench.js <pcap file> [-n <rounds>] [-nolens]");
+  process.exit(0);
+}
+
+var filename;
+var rounds = 1;
+var useLens = true;
+
+for (var a = 2; a < process.argv.length; a++) {
+  if (process.argv[a] === "-n") {
+    rounds = +process.argv[++a];
+  } else if (process.argv[a] === "-nolens") {
+    useLens = false;
+  } else if (process.argv[a] === "-h" || process.argv[a] === "--help") {
+    help();
+  } else {
+    filename = process.argv[a];
+  }
+}
+
+if (!filename || !(rounds > 0)) {
+  help();
+}
+
+// Count the reads pcap.js does
+var reads = 0;
+var realRead = fs.read;
+fs.read = function () {
+  reads++;
+  return realRead.apply(fs, arguments);
+};
+
+var pcap = Pcap.get("bench");
+pcap.open(filename);
+
+// Walk the file, grouping packet positions by the sorted address/port pair
+var sessions = {};
+var data = fs.readFileSync(filename);
+var pos = 24;
+var packets = 0;
+while (pos + 16 <= data.length) {
+  var len = pcap.bigEndian?data.readUInt32BE(pos+8):data.readUInt32LE(pos+8);
+  if (pos + 16 + len > data.length) {
+    break;
+  }
+
+  var obj = {};
+  var key = "other";
+  try {
+    pcap.decode(data.slice(pos, pos + 16 + len), obj);
+    if (obj.ip) {
+      var l4 = obj.tcp || obj.udp || {};
+      var a1 = obj.ip.addr1 + ":" + l4.sport;
+      var a2 = obj.ip.addr2 + ":" + l4.dport;
+      key = obj.ip.p + (a1 < a2?a1 + "," + a2:a2 + "," + a1);
+    }
+  } catch (e) {
+  }
+
+  if (!sessions[key]) {
+    sessions[key] = {positions: [], lens: []};
+  }
+  sessions[key].positions.push(pos);
+  sessions[key].lens.push(16 + len);
+  packets++;
+  pos += 16 + len;
+}
+data = null;
+
+var list = Object.keys(sessions).map(function (key) {return sessions[key];});
+console.log(filename, packets, "packets", list.length, "sessions", pcap.readIndex()?"with index":"without index");
+
+function perPacket(session, cb) {
+  var got = 0;
+  async.eachSeries(session.positions, function (pos, nextCb) {
+    pcap.readPacket(pos, function (packet) {
+      if (packet) {
+        got++;
+      }
+      nextCb();
+    });
+  }, function () {
+    cb(got);
+  });
+}
+
+function coalesced(session, cb) {
+  pcap.readPackets(session.positions, useLens?session.lens:undefined, function (err, packets) {
+    cb(packets.length);
+  });
+}
+
+function run(name, method, cb) {
+  reads = 0;
+  var got = 0;
+  var start = process.hrtime();
+  var r = 0;
+  async.whilst(function () {return r < rounds;}, function (roundCb) {
+    r++;
+    async.eachSeries(list, function (session, nextCb) {
+      method(session, function (n) {
+        got += n;
+        nextCb();
+      });
+    }, roundCb);
+  }, function () {
+    var diff = process.hrtime(start);
+    var ms = diff[0]*1000 + diff[1]/1000000;
+    console.log(name, "packets", got, "reads", reads, "ms", ms.toFixed(1),
+                "ms/session", (ms/(list.length*rounds)).toFixed(3));
+    cb();
+  });
+}
+
+run("perPacket", perPacket, function () {
+  run("readPackets", coalesced, function () {
+    process.exit(0);
+  });
+});
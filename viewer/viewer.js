@@ -2672,20 +2672,16 @@ app.get('/unique.txt', function(req, res) {
 });
 
 function processSessionIdDisk(session, headerCb, packetCb, endCb, limit) {
-  function processFile(pcap, pos, i, nextCb) {
+  function processFile(pcap, file, nextCb) {
     pcap.ref();
-    pcap.readPacket(pos, function(packet) {
-      switch(packet) {
-      case null:
-        endCb("Error loading data for session " + session._id, null);
-        break;
-      case undefined:
-        break;
-      default:
-        packetCb(pcap, packet, nextCb, i);
-        break;
-      }
+    pcap.readPackets(file.positions, file.lens, function(err, packets) {
       pcap.unref();
+      if (err) {
+        return endCb("Error loading data for session " + session._id, null);
+      }
+      async.eachLimit(packets, limit || 1, function(packet, packetNextCb) {
+        packetCb(pcap, packet, packetNextCb, itemPos++);
+      }, nextCb);
     });
   }
 
@@ -2693,28 +2689,41 @@ function processSessionIdDisk(session, headerCb, packetCb, endCb, limit) {
 
   fields = session._source || session.fields;
 
-  var fileNum;
+  // Group the positions by file so each file's packets can be read together
+  var files = [];
+  var file;
+  for (var i = 0, ilen = fields.ps.length; i < ilen; i++) {
+    if (fields.ps[i] < 0) {
+      file = {num: fields.ps[i] * -1, positions: [], lens: fields.psl && fields.psl.length === ilen ? [] : undefined};
+      files.push(file);
+    } else if (file) {
+      file.positions.push(fields.ps[i]);
+      if (file.lens) {
+        file.lens.push(fields.psl[i]);
+      }
+    }
+  }
+
   var itemPos = 0;
-  async.eachLimit(fields.ps, limit || 1, function(pos, nextCb) {
-    if (pos < 0) {
-      fileNum = pos * -1;
+  async.eachSeries(files, function(file, nextCb) {
+    if (file.positions.length === 0) {
       return nextCb(null);
     }
 
     // Get the pcap file for this node a filenum, if it isn't opened then do the filename lookup and open it
-    var opcap = Pcap.get(fields.no + ":" + fileNum);
+    var opcap = Pcap.get(fields.no + ":" + file.num);
     if (!opcap.isOpen()) {
-      Db.fileIdToFile(fields.no, fileNum, function(file) {
+      Db.fileIdToFile(fields.no, file.num, function(info) {
 
-        if (!file) {
-          console.log("WARNING - Only have SPI data, PCAP file no longer available", fields.no + '-' + fileNum);
-          return nextCb("Only have SPI data, PCAP file no longer available for " + fields.no + '-' + fileNum);
+        if (!info) {
+          console.log("WARNING - Only have SPI data, PCAP file no longer available", fields.no + '-' + file.num);
+          return nextCb("Only have SPI data, PCAP file no longer available for " + fields.no + '-' + file.num);
         }
 
-        var ipcap = Pcap.get(fields.no + ":" + file.num);
+        var ipcap = Pcap.get(fields.no + ":" + info.num);
 
         try {
-          ipcap.open(file.name);
+          ipcap.open(info.name);
         } catch (err) {
           console.log("ERROR - Couldn't open file ", err);
           return nextCb("Couldn't open file " + err);
@@ -2724,14 +2733,14 @@ function processSessionIdDisk(session, headerCb, packetCb, endCb, limit) {
           headerCb(ipcap, ipcap.readHeader());
           headerCb = null;
         }
-        processFile(ipcap, pos, itemPos++, nextCb);
+        processFile(ipcap, file, nextCb);
       });
     } else {
       if (headerCb) {
         headerCb(opcap, opcap.readHeader());
         headerCb = null;
       }
-      processFile(opcap, pos, itemPos++, nextCb);
+      processFile(opcap, file, nextCb);
     }
   },
   function (pcapErr, results) {
@@ -2755,6 +2764,9 @@ function processSessionId(id, fullSession, headerCb, packetCb, endCb, maxPackets
 
     if (maxPackets && fields.ps.length > maxPackets) {
       fields.ps.length = maxPackets;
+      if (fields.psl && fields.psl.length > maxPackets) {
+        fields.psl.length = maxPackets;
+      }
     }
 
     /* Go through the list of prefetch the id to file name if we are running in parallel to